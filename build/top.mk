@@ -166,6 +166,7 @@ LTHREAD_LIBS = @LTHREAD_LIBS@
 
 SLAPD_NDB_LIBS = @SLAPD_NDB_LIBS@
 WT_LIBS = @WT_LIBS@
+MDB_LIBS = @MDB_LIBS@
 
 LEVENT_LIBS = @LEVENT_LIBS@
 
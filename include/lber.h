@@ -147,8 +147,12 @@ typedef struct lber_memory_fns {
 /* Only meaningful ifdef LDAP_PF_LOCAL_SENDMSG */
 #define LBER_SB_OPT_UNGET_BUF	15
 
+/* Only meaningful with ber_sockbuf_io_readahead */
+#define LBER_SB_OPT_SET_READAHEAD_MAX	16
+#define LBER_SB_OPT_GET_READAHEAD	17
+
 /* Largest option used by the library */
-#define LBER_SB_OPT_OPT_MAX		15
+#define LBER_SB_OPT_OPT_MAX		17
 
 /* LBER IO operations stacking levels */
 #define LBER_SBIOD_LEVEL_PROVIDER	10
@@ -173,6 +177,17 @@ typedef struct sockbuf Sockbuf;
 
 typedef struct sockbuf_io Sockbuf_IO;
 
+/* Filled in by LBER_SB_OPT_GET_READAHEAD */
+typedef struct sockbuf_readahead_info {
+	ber_len_t	sri_size;	/* current buffer, 0 while released */
+	ber_len_t	sri_next;	/* size of the next buffer */
+	ber_len_t	sri_max;	/* adaptive limit, 0 if fixed */
+	ber_len_t	sri_pending;	/* buffered, not yet consumed */
+	unsigned long	sri_reads;	/* reads from the layer above */
+	unsigned long	sri_hits;	/* ...served from the buffer alone */
+	unsigned long	sri_fills;	/* reads from the layer below */
+} Sockbuf_Readahead_Info;
+
 /* Structure for LBER IO operation descriptor */
 typedef struct sockbuf_io_desc {
 	int			sbiod_level;
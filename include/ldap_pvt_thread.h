@@ -218,6 +218,14 @@ ldap_pvt_thread_pool_submit2 LDAP_P((
 	void *arg,
 	void **cookie ));
 
+LDAP_F( int )
+ldap_pvt_thread_pool_submit_q LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	ldap_pvt_thread_start_t *start,
+	void *arg,
+	void **cookie,
+	int queue ));
+
 LDAP_F( int )
 ldap_pvt_thread_pool_retract LDAP_P((
 	void *cookie ));
@@ -239,6 +247,16 @@ ldap_pvt_thread_pool_queues LDAP_P((
 	ldap_pvt_thread_pool_t *pool,
 	int numqs ));
 
+LDAP_F( int )
+ldap_pvt_thread_pool_affinity LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	char **cpulists ));
+
+LDAP_F( int )
+ldap_pvt_thread_pool_bind LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	int queue ));
+
 #ifndef LDAP_PVT_THREAD_H_DONE
 typedef enum {
 	LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN = -1,
@@ -254,7 +272,9 @@ typedef enum {
 	LDAP_PVT_THREAD_POOL_PARAM_PENDING_MAX,
 	LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD_MAX,
 	LDAP_PVT_THREAD_POOL_PARAM_STATE,
-	LDAP_PVT_THREAD_POOL_PARAM_PAUSED
+	LDAP_PVT_THREAD_POOL_PARAM_PAUSED,
+	LDAP_PVT_THREAD_POOL_PARAM_STEALS,
+	LDAP_PVT_THREAD_POOL_PARAM_WAIT
 } ldap_pvt_thread_pool_param_t;
 #endif /* !LDAP_PVT_THREAD_H_DONE */
 
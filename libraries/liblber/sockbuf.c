@@ -575,51 +575,87 @@ Sockbuf_IO ber_sockbuf_io_tcp = {
 
 /*
  * Support for readahead (UDP needs it)
+ *
+ * Stream connections can also switch it to adaptive mode with
+ * LBER_SB_OPT_SET_READAHEAD_MAX: the buffer then follows the sizes
+ * actually being read, between LBER_MIN_BUFF_SIZE and the configured
+ * maximum, and is released whenever it runs dry so that idle
+ * connections do not hold on to one.
  */
 
+#ifndef LBER_READAHEAD_SHRINK
+#define LBER_READAHEAD_SHRINK	8	/* short fills before halving */
+#endif
+
+typedef struct sb_rdahead {
+	Sockbuf_Buf		ra_buf;
+	ber_len_t		ra_size;	/* size of the next buffer */
+	ber_len_t		ra_max;		/* zero unless adaptive */
+	int				ra_short;	/* consecutive short fills */
+	unsigned long	ra_reads;
+	unsigned long	ra_hits;
+	unsigned long	ra_fills;
+} sb_rdahead;
+
 static int
 sb_rdahead_setup( Sockbuf_IO_Desc *sbiod, void *arg )
 {
-	Sockbuf_Buf		*p;
+	sb_rdahead		*ra;
 
 	assert( sbiod != NULL );
 
-	p = LBER_MALLOC( sizeof( *p ) );
-	if ( p == NULL ) return -1;
+	ra = LBER_CALLOC( 1, sizeof( *ra ) );
+	if ( ra == NULL ) return -1;
 
-	ber_pvt_sb_buf_init( p );
+	ber_pvt_sb_buf_init( &ra->ra_buf );
 
 	if ( arg == NULL ) {
-		ber_pvt_sb_grow_buffer( p, LBER_DEFAULT_READAHEAD );
+		ber_pvt_sb_grow_buffer( &ra->ra_buf, LBER_DEFAULT_READAHEAD );
 	} else {
-		ber_pvt_sb_grow_buffer( p, *((int *)arg) );
+		ber_pvt_sb_grow_buffer( &ra->ra_buf, *((int *)arg) );
 	}
+	ra->ra_size = ra->ra_buf.buf_size;
 
-	sbiod->sbiod_pvt = p;
+	sbiod->sbiod_pvt = ra;
 	return 0;
 }
 
 static int
 sb_rdahead_remove( Sockbuf_IO_Desc *sbiod )
 {
-	Sockbuf_Buf		*p;
+	sb_rdahead		*ra;
 
 	assert( sbiod != NULL );
 
-	p = (Sockbuf_Buf *)sbiod->sbiod_pvt;
+	ra = (sb_rdahead *)sbiod->sbiod_pvt;
 
-	if ( p->buf_ptr != p->buf_end ) return -1;
+	if ( ra->ra_buf.buf_ptr != ra->ra_buf.buf_end ) return -1;
 
-	ber_pvt_sb_buf_destroy( (Sockbuf_Buf *)(sbiod->sbiod_pvt) );
+	ber_pvt_sb_buf_destroy( &ra->ra_buf );
 	LBER_FREE( sbiod->sbiod_pvt );
 	sbiod->sbiod_pvt = NULL;
 
 	return 0;
 }
 
+static ber_slen_t
+sb_rdahead_fill( Sockbuf_IO_Desc *sbiod, char *buf, ber_len_t len )
+{
+	ber_slen_t		ret;
+
+	for (;;) {
+		ret = LBER_SBIOD_READ_NEXT( sbiod, buf, len );
+#ifdef EINTR	
+		if ( ( ret < 0 ) && ( errno == EINTR ) ) continue;
+#endif
+		return ret;
+	}
+}
+
 static ber_slen_t
 sb_rdahead_read( Sockbuf_IO_Desc *sbiod, void *buf, ber_len_t len )
 {
+	sb_rdahead		*ra;
 	Sockbuf_Buf		*p;
 	ber_slen_t		bufptr = 0, ret, max;
 
@@ -627,32 +663,74 @@ sb_rdahead_read( Sockbuf_IO_Desc *sbiod, void *buf, ber_len_t len )
 	assert( SOCKBUF_VALID( sbiod->sbiod_sb ) );
 	assert( sbiod->sbiod_next != NULL );
 
-	p = (Sockbuf_Buf *)sbiod->sbiod_pvt;
+	ra = (sb_rdahead *)sbiod->sbiod_pvt;
+	p = &ra->ra_buf;
+
+	assert( p->buf_size > 0 || ra->ra_max );
 
-	assert( p->buf_size > 0 );
+	ra->ra_reads++;
 
 	/* Are there anything left in the buffer? */
 	ret = ber_pvt_sb_copy_out( p, buf, len );
 	bufptr += ret;
 	len -= ret;
 
-	if ( len == 0 ) return bufptr;
+	if ( len == 0 ) {
+		ra->ra_hits++;
+		return bufptr;
+	}
 
-	max = p->buf_size - p->buf_end;
-	ret = 0;
-	while ( max > 0 ) {
-		ret = LBER_SBIOD_READ_NEXT( sbiod, p->buf_base + p->buf_end,
-			max );
-#ifdef EINTR	
-		if ( ( ret < 0 ) && ( errno == EINTR ) ) continue;
-#endif
-		break;
+	/* The buffer is empty from here on */
+	if ( ra->ra_max ) {
+		if ( len >= ra->ra_size ) {
+			/* Not worth buffering, read straight into the caller's */
+			ra->ra_fills++;
+			ret = sb_rdahead_fill( sbiod, (char *)buf + bufptr, len );
+			if ( ret < 0 ) {
+				return ( bufptr ? bufptr : ret );
+			}
+			return bufptr + ret;
+		}
+
+		if ( p->buf_size != ra->ra_size ) {
+			ber_pvt_sb_buf_destroy( p );
+			if ( ber_pvt_sb_grow_buffer( p, ra->ra_size ) ) {
+				return ( bufptr ? bufptr : -1 );
+			}
+		}
 	}
 
+	max = p->buf_size - p->buf_end;
+	ra->ra_fills++;
+	ret = sb_rdahead_fill( sbiod, p->buf_base + p->buf_end, max );
+
 	if ( ret < 0 ) {
+		if ( ra->ra_max ) {
+			/* Nothing buffered and nothing to read, we are idle */
+			int err = errno;
+			ber_pvt_sb_buf_destroy( p );
+			errno = err;
+		}
 		return ( bufptr ? bufptr : ret );
 	}
 
+	if ( ra->ra_max ) {
+		if ( ret == max ) {
+			/* There may well be more where that came from */
+			ra->ra_short = 0;
+			if ( ra->ra_size < ra->ra_max ) {
+				ra->ra_size <<= 1;
+			}
+		} else if ( ret < max / 4 && ra->ra_size > LBER_MIN_BUFF_SIZE ) {
+			if ( ++ra->ra_short >= LBER_READAHEAD_SHRINK ) {
+				ra->ra_short = 0;
+				ra->ra_size >>= 1;
+			}
+		} else {
+			ra->ra_short = 0;
+		}
+	}
+
 	p->buf_end += ret;
 	bufptr += ber_pvt_sb_copy_out( p, (char *) buf + bufptr, len );
 	return bufptr;
@@ -673,16 +751,18 @@ sb_rdahead_close( Sockbuf_IO_Desc *sbiod )
 	assert( sbiod != NULL );
 
 	/* Just erase the buffer */
-	ber_pvt_sb_buf_destroy((Sockbuf_Buf *)sbiod->sbiod_pvt);
+	ber_pvt_sb_buf_destroy( &((sb_rdahead *)sbiod->sbiod_pvt)->ra_buf );
 	return 0;
 }
 
 static int
 sb_rdahead_ctrl( Sockbuf_IO_Desc *sbiod, int opt, void *arg )
 {
+	sb_rdahead		*ra;
 	Sockbuf_Buf		*p;
 
-	p = (Sockbuf_Buf *)sbiod->sbiod_pvt;
+	ra = (sb_rdahead *)sbiod->sbiod_pvt;
+	p = &ra->ra_buf;
 
 	if ( opt == LBER_SB_OPT_DATA_READY ) {
 		if ( p->buf_ptr != p->buf_end ) {
@@ -693,8 +773,47 @@ sb_rdahead_ctrl( Sockbuf_IO_Desc *sbiod, int opt, void *arg )
 		if ( p->buf_size >= *((ber_len_t *)arg) ) {
 			return 0;
 		}
-		return ( ber_pvt_sb_grow_buffer( p, *((int *)arg) ) ?
-			-1 : 1 );
+		if ( ber_pvt_sb_grow_buffer( p, *((int *)arg) ) ) {
+			return -1;
+		}
+		if ( ra->ra_size < p->buf_size ) {
+			ra->ra_size = p->buf_size;
+		}
+		return 1;
+
+	} else if ( opt == LBER_SB_OPT_SET_READAHEAD_MAX ) {
+		ber_len_t		pw, max = *((ber_len_t *)arg);
+
+		if ( max == 0 ) {
+			/* Back to a fixed buffer */
+			ra->ra_max = 0;
+			return ( ber_pvt_sb_grow_buffer( p, ra->ra_size ) ? -1 : 1 );
+		}
+
+		for ( pw = LBER_MIN_BUFF_SIZE; pw < max; pw <<= 1 ) {
+			if ( pw > LBER_MAX_BUFF_SIZE ) return -1;
+		}
+		ra->ra_max = pw;
+		if ( ra->ra_size > pw ) {
+			ra->ra_size = pw;
+		}
+		if ( p->buf_ptr == p->buf_end ) {
+			/* Allocate on demand from now on */
+			ber_pvt_sb_buf_destroy( p );
+		}
+		return 1;
+
+	} else if ( opt == LBER_SB_OPT_GET_READAHEAD ) {
+		Sockbuf_Readahead_Info	*info = (Sockbuf_Readahead_Info *)arg;
+
+		info->sri_size = p->buf_size;
+		info->sri_next = ra->ra_size;
+		info->sri_max = ra->ra_max;
+		info->sri_pending = p->buf_end - p->buf_ptr;
+		info->sri_reads = ra->ra_reads;
+		info->sri_hits = ra->ra_hits;
+		info->sri_fills = ra->ra_fills;
+		return 1;
 	}
 
 	return LBER_SBIOD_CTRL_NEXT( sbiod, opt, arg );
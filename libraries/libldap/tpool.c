@@ -13,6 +13,10 @@
  * <http://www.OpenLDAP.org/license.html>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1			/* Needed for glibc cpu_set_t */
+#endif
+
 #include "portable.h"
 
 #include <stdio.h>
@@ -30,6 +34,9 @@
 
 #include "ldap_pvt_thread.h" /* Get the thread interface */
 #include "ldap_queue.h"
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
 #define LDAP_THREAD_POOL_IMPLEMENTATION
 #include "ldap_thr_debug.h"  /* May rename symbols defined below */
 
@@ -94,6 +101,7 @@ typedef struct ldap_int_thread_task_s {
 	ldap_pvt_thread_start_t *ltt_start_routine;
 	void *ltt_arg;
 	struct ldap_int_thread_poolq_s *ltt_queue;
+	unsigned long ltt_queued;	/* tpool_usec() at submit */
 } ldap_int_thread_task_t;
 
 typedef LDAP_STAILQ_HEAD(tcq, ldap_int_thread_task_s) ldap_int_tpool_plist_t;
@@ -132,6 +140,17 @@ struct ldap_int_thread_poolq_s {
 	int ltp_active_count;		/* Active, not paused/idle tasks */
 	int ltp_open_count;			/* Number of threads */
 	int ltp_starting;			/* Currently starting threads */
+
+	unsigned long ltp_steals;	/* Tasks taken from sibling queues */
+	unsigned long ltp_wait;		/* Decaying average queue wait, usec << 4 */
+
+	/* CPUs the threads of this queue run on, and its version.
+	 * Threads compare ltp_cpugen with the version they applied.
+	 */
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t ltp_cpus;
+#endif
+	int ltp_cpugen;
 };
 
 struct ldap_int_thread_pool_s {
@@ -176,6 +195,12 @@ struct ldap_int_thread_pool_s {
 
 	/* Max pending + paused + idle tasks, negated when ltp_finishing */
 	int ltp_max_pending;
+
+	/* CPU binding of the queues, see pool_affinity() */
+	char **ltp_cpulists;
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t ltp_cpus;			/* CPUs of the process at init */
+#endif
 };
 
 static ldap_int_tpool_plist_t empty_pending_list =
@@ -189,12 +214,29 @@ static LDAP_STAILQ_HEAD(tpq, ldap_int_thread_pool_s)
 static ldap_pvt_thread_mutex_t ldap_pvt_thread_pool_mutex;
 
 static void *ldap_int_thread_pool_wrapper( void *pool );
+static void tpool_split_cpus( struct ldap_int_thread_pool_s *pool );
+static int tpool_bind_cpus( struct ldap_int_thread_poolq_s *pq );
 
 static ldap_pvt_thread_key_t	ldap_tpool_key;
 
 /* Context of the main thread */
 static ldap_int_thread_userctx_t ldap_int_main_thrctx;
 
+/* Monotonic clock in microseconds, only used for differences */
+static unsigned long
+tpool_usec( void )
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+#else
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+#endif
+}
+
 int
 ldap_int_thread_pool_startup ( void )
 {
@@ -285,11 +327,23 @@ fail:
 	if (rc != 0)
 		goto fail;
 
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (sched_getaffinity(0, sizeof(pool->ltp_cpus), &pool->ltp_cpus) != 0) {
+		int n = sysconf(_SC_NPROCESSORS_CONF);
+		CPU_ZERO(&pool->ltp_cpus);
+		for (i=0; i<n && i<CPU_SETSIZE; i++)
+			CPU_SET(i, &pool->ltp_cpus);
+	}
+#endif
+
 	rem_thr = max_threads % numqs;
 	rem_pend = max_pending % numqs;
 	for ( i=0; i<numqs; i++ ) {
 		pq = pool->ltp_wqs[i];
 		pq->ltp_pool = pool;
+#ifdef HAVE_SCHED_SETAFFINITY
+		pq->ltp_cpus = pool->ltp_cpus;
+#endif
 		rc = ldap_pvt_thread_mutex_init(&pq->ltp_mutex);
 		if (rc != 0)
 			return(rc);
@@ -350,18 +404,134 @@ ldap_pvt_thread_pool_submit (
 	return ldap_pvt_thread_pool_submit2( tpool, start_routine, arg, NULL );
 }
 
+/* Whether threads of sq may run tasks queued on pq.  With CPU
+ * affinity configured, tasks only move between queues bound to
+ * the same CPUs.  The sets are read without locking like the
+ * counters below; they only change on reconfiguration.
+ */
+static int
+tpool_may_steal( struct ldap_int_thread_pool_s *pool,
+	struct ldap_int_thread_poolq_s *pq,
+	struct ldap_int_thread_poolq_s *sq )
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (pool->ltp_cpulists && !CPU_EQUAL(&pq->ltp_cpus, &sq->ltp_cpus))
+		return 0;
+#endif
+	return 1;
+}
+
+/* Wake up an idle thread of some queue other than wqs[x], if any,
+ * so it can steal the task just queued there.  The counters are
+ * read without locking; a missed or spurious wakeup is harmless.
+ */
+static void
+tpool_wake_sibling( struct ldap_int_thread_pool_s *pool, int x )
+{
+	struct ldap_int_thread_poolq_s *sq;
+	int i;
+
+	for (i = x+1; i % pool->ltp_numqs != x; i++) {
+		sq = pool->ltp_wqs[i % pool->ltp_numqs];
+		if (!tpool_may_steal(pool, pool->ltp_wqs[x], sq))
+			continue;
+		if (sq->ltp_open_count - sq->ltp_starting > sq->ltp_active_count) {
+			ldap_pvt_thread_mutex_lock(&sq->ltp_mutex);
+			ldap_pvt_thread_cond_signal(&sq->ltp_cond);
+			ldap_pvt_thread_mutex_unlock(&sq->ltp_mutex);
+			break;
+		}
+	}
+}
+
+/* Take a pending task off the busiest sibling of pq.
+ * Called with pq->ltp_mutex held; sibling mutexes are only
+ * tried so two queues stealing from each other cannot deadlock.
+ * Nothing is stolen once a pause was requested: the pauser may
+ * already have counted pq as idle.
+ */
+static ldap_int_thread_task_t *
+tpool_steal( struct ldap_int_thread_pool_s *pool,
+	struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_poolq_s *sq, *busiest = NULL;
+	ldap_int_thread_task_t *task = NULL;
+	int i, max = 0;
+
+	if (pool->ltp_pause)
+		return NULL;
+
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		sq = pool->ltp_wqs[i];
+		if (sq != pq && sq->ltp_pending_count > max &&
+			tpool_may_steal(pool, sq, pq)) {
+			max = sq->ltp_pending_count;
+			busiest = sq;
+		}
+	}
+	if (busiest == NULL)
+		return NULL;
+
+	if (ldap_pvt_thread_mutex_trylock(&busiest->ltp_mutex) == 0) {
+		task = LDAP_STAILQ_FIRST(busiest->ltp_work_list);
+		if (task) {
+			LDAP_STAILQ_REMOVE_HEAD(busiest->ltp_work_list, ltt_next.q);
+			busiest->ltp_pending_count--;
+			pq->ltp_steals++;
+		}
+		ldap_pvt_thread_mutex_unlock(&busiest->ltp_mutex);
+	}
+	return task;
+}
+
+/* Dequeue the next task for a thread of pq, from pq itself or
+ * else from a sibling queue.  Called with pq->ltp_mutex held.
+ */
+static ldap_int_thread_task_t *
+tpool_next_task( struct ldap_int_thread_pool_s *pool,
+	struct ldap_int_thread_poolq_s *pq )
+{
+	ldap_int_thread_task_t *task;
+
+	task = LDAP_STAILQ_FIRST(pq->ltp_work_list);
+	if (task) {
+		LDAP_STAILQ_REMOVE_HEAD(pq->ltp_work_list, ltt_next.q);
+		pq->ltp_pending_count--;
+	} else if (pool->ltp_numqs > 1) {
+		task = tpool_steal(pool, pq);
+	}
+	if (task) {
+		pq->ltp_wait += tpool_usec() - task->ltt_queued - (pq->ltp_wait >> 4);
+	}
+	return task;
+}
+
 /* Submit a task to be performed by the thread pool */
 int
 ldap_pvt_thread_pool_submit2 (
 	ldap_pvt_thread_pool_t *tpool,
 	ldap_pvt_thread_start_t *start_routine, void *arg,
 	void **cookie )
+{
+	return ldap_pvt_thread_pool_submit_q( tpool, start_routine, arg,
+		cookie, -1 );
+}
+
+/* Submit a task to the given queue of the thread pool, or to the
+ * least loaded one if queue < 0.  Another queue is used if the
+ * requested one has too many pending tasks.
+ */
+int
+ldap_pvt_thread_pool_submit_q (
+	ldap_pvt_thread_pool_t *tpool,
+	ldap_pvt_thread_start_t *start_routine, void *arg,
+	void **cookie, int queue )
 {
 	struct ldap_int_thread_pool_s *pool;
 	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
 	ldap_pvt_thread_t thr;
-	int i, j;
+	int i, j, steal = 0;
 
 	if (tpool == NULL)
 		return(-1);
@@ -371,7 +541,9 @@ ldap_pvt_thread_pool_submit2 (
 	if (pool == NULL)
 		return(-1);
 
-	if ( pool->ltp_numqs > 1 ) {
+	if ( queue >= 0 ) {
+		i = queue % pool->ltp_numqs;
+	} else if ( pool->ltp_numqs > 1 ) {
 		int min = pool->ltp_wqs[0]->ltp_max_pending + pool->ltp_wqs[0]->ltp_max_count;
 		int min_x = 0, cnt;
 		for ( i = 0; i < pool->ltp_numqs; i++ ) {
@@ -416,6 +588,7 @@ ldap_pvt_thread_pool_submit2 (
 	task->ltt_start_routine = start_routine;
 	task->ltt_arg = arg;
 	task->ltt_queue = pq;
+	task->ltt_queued = tpool_usec();
 	if ( cookie )
 		*cookie = task;
 
@@ -468,11 +641,20 @@ ldap_pvt_thread_pool_submit2 (
 			 * task will be handled eventually.
 			 */
 		}
+	} else if (pool->ltp_numqs > 1 &&
+		pq->ltp_open_count - pq->ltp_starting <= pq->ltp_active_count)
+	{
+		/* every thread of this queue is busy, let an idle
+		 * thread of another queue come and take the task.
+		 */
+		steal = 1;
 	}
 	ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
  done:
 	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	if (steal)
+		tpool_wake_sibling(pool, i);
 	return(0);
 
  failed:
@@ -607,6 +789,9 @@ ldap_pvt_thread_pool_queues(
 			LDAP_STAILQ_INIT(&pq->ltp_pending_list);
 			pq->ltp_work_list = &pq->ltp_pending_list;
 			LDAP_SLIST_INIT(&pq->ltp_free_list);
+#ifdef HAVE_SCHED_SETAFFINITY
+			pq->ltp_cpus = pool->ltp_cpus;
+#endif
 		}
 	}
 	rem_thr = pool->ltp_max_count % numqs;
@@ -625,7 +810,174 @@ ldap_pvt_thread_pool_queues(
 		}
 	}
 	pool->ltp_numqs = numqs;
+	if (pool->ltp_cpulists)
+		tpool_split_cpus(pool);
+	return 0;
+}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/* Parse a CPU list like "0-3,8,10-11" */
+static int
+tpool_parse_cpus( const char *str, cpu_set_t *set )
+{
+	char *next;
+	long lo, hi;
+
+	CPU_ZERO(set);
+	do {
+		lo = strtol(str, &next, 10);
+		if (next == str || lo < 0)
+			return -1;
+		hi = lo;
+		if (*next == '-') {
+			str = next + 1;
+			hi = strtol(str, &next, 10);
+			if (next == str || hi < lo)
+				return -1;
+		}
+		if (hi >= CPU_SETSIZE)
+			return -1;
+		for (; lo <= hi; lo++)
+			CPU_SET(lo, set);
+		str = next;
+	} while (*str++ == ',');
+
+	return str[-1] == '\0' ? 0 : -1;
+}
+#endif
+
+/* Recompute the CPUs of each queue from ltp_cpulists and
+ * let their threads pick up the change.
+ */
+static void
+tpool_split_cpus( struct ldap_int_thread_pool_s *pool )
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	struct ldap_int_thread_poolq_s *pq;
+	cpu_set_t set;
+	int i, j, n, ncpus = CPU_COUNT(&pool->ltp_cpus);
+	int cpus[CPU_SETSIZE];
+
+	for (i=0, n=0; n<ncpus && i<CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &pool->ltp_cpus))
+			cpus[n++] = i;
+
+	for (i=0; i<pool->ltp_numqs; i++) {
+		if (pool->ltp_cpulists == NULL) {
+			set = pool->ltp_cpus;
+		} else if (pool->ltp_cpulists[0] == NULL) {
+			/* an even share of consecutive CPUs for each queue */
+			CPU_ZERO(&set);
+			if (n <= pool->ltp_numqs) {
+				CPU_SET(cpus[i % n], &set);
+			} else {
+				for (j = i * n / pool->ltp_numqs;
+					j < (i+1) * n / pool->ltp_numqs; j++)
+					CPU_SET(cpus[j], &set);
+			}
+		} else {
+			for (j=0; pool->ltp_cpulists[j]; j++) ;
+			tpool_parse_cpus(pool->ltp_cpulists[i % j], &set);
+		}
+		pq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		pq->ltp_cpus = set;
+		pq->ltp_cpugen++;
+		ldap_pvt_thread_cond_broadcast(&pq->ltp_cond);
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
+#endif
+}
+
+/* Apply the CPUs of pq to the calling thread */
+static int
+tpool_bind_cpus( struct ldap_int_thread_poolq_s *pq )
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	return sched_setaffinity(0, sizeof(pq->ltp_cpus), &pq->ltp_cpus);
+#else
 	return 0;
+#endif
+}
+
+/* Bind the threads of each queue to a set of CPUs.  cpulists is NULL
+ * to unbind them, an empty list to give each queue an even share of
+ * consecutive CPUs, or CPU lists like "0-3,8" used by successive
+ * queues, round robin.  Fails if the platform cannot bind threads.
+ */
+int
+ldap_pvt_thread_pool_affinity(
+	ldap_pvt_thread_pool_t *tpool,
+	char **cpulists )
+{
+	struct ldap_int_thread_pool_s *pool;
+	char **old;
+	int i;
+
+	if (tpool == NULL)
+		return(-1);
+
+	pool = *tpool;
+
+	if (pool == NULL)
+		return(-1);
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (cpulists) {
+		cpu_set_t set;
+		for (i=0; cpulists[i]; i++)
+			if (tpool_parse_cpus(cpulists[i], &set) != 0 || !CPU_COUNT(&set))
+				return(-1);
+	}
+#else
+	if (cpulists)
+		return(-1);
+#endif
+
+	old = pool->ltp_cpulists;
+	pool->ltp_cpulists = NULL;
+	if (cpulists) {
+		for (i=0; cpulists[i]; i++) ;
+		pool->ltp_cpulists = LDAP_CALLOC(i+1, sizeof(char *));
+		if (pool->ltp_cpulists == NULL) {
+			pool->ltp_cpulists = old;
+			return(-1);
+		}
+		for (i=0; cpulists[i]; i++)
+			pool->ltp_cpulists[i] = LDAP_STRDUP(cpulists[i]);
+	}
+	if (old)
+		LDAP_VFREE(old);
+
+	tpool_split_cpus(pool);
+	return(0);
+}
+
+/* Bind the calling thread, which need not belong to the pool,
+ * to the CPUs of the given queue.
+ */
+int
+ldap_pvt_thread_pool_bind(
+	ldap_pvt_thread_pool_t *tpool,
+	int queue )
+{
+	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq;
+	int rc;
+
+	if (tpool == NULL || queue < 0)
+		return(-1);
+
+	pool = *tpool;
+
+	if (pool == NULL)
+		return(-1);
+
+	pq = pool->ltp_wqs[queue % pool->ltp_numqs];
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+	rc = tpool_bind_cpus(pq);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	return rc;
 }
 
 /* Set max #threads.  value <= 0 means max supported #threads (LDAP_MAXTHR) */
@@ -775,6 +1127,26 @@ ldap_pvt_thread_pool_query(
 		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
 		break;
 
+	case LDAP_PVT_THREAD_POOL_PARAM_STEALS:
+	case LDAP_PVT_THREAD_POOL_PARAM_WAIT:
+		{
+			unsigned long sum = 0;
+			int i;
+			for (i=0; i<pool->ltp_numqs; i++) {
+				struct ldap_int_thread_poolq_s *pq = pool->ltp_wqs[i];
+				ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+				if (param == LDAP_PVT_THREAD_POOL_PARAM_STEALS)
+					sum += pq->ltp_steals;
+				else
+					sum += pq->ltp_wait >> 4;
+				ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+			}
+			if (param == LDAP_PVT_THREAD_POOL_PARAM_WAIT)
+				sum /= pool->ltp_numqs;
+			count = sum & INT_MAX;
+		}
+		break;
+
 	case LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN:
 		break;
 	}
@@ -939,6 +1311,8 @@ ldap_pvt_thread_pool_free ( ldap_pvt_thread_pool_t *tpool )
 			LDAP_FREE(pq->ltp_free);
 		}
 	}
+	if (pool->ltp_cpulists)
+		LDAP_VFREE(pool->ltp_cpulists);
 	LDAP_FREE(pool->ltp_wqs);
 	LDAP_FREE(pool);
 	*tpool = NULL;
@@ -954,10 +1328,9 @@ ldap_int_thread_pool_wrapper (
 	struct ldap_int_thread_poolq_s *pq = xpool;
 	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
 	ldap_int_thread_task_t *task;
-	ldap_int_tpool_plist_t *work_list;
 	ldap_int_thread_userctx_t ctx, *kctx;
 	unsigned i, keyslot, hash;
-	int pool_lock = 0, freeme = 0;
+	int pool_lock = 0, freeme = 0, cpugen = 0;
 
 	assert(pool != NULL);
 
@@ -995,8 +1368,11 @@ ldap_int_thread_pool_wrapper (
 	pq->ltp_active_count++;
 
 	for (;;) {
-		work_list = pq->ltp_work_list; /* help the compiler a bit */
-		task = LDAP_STAILQ_FIRST(work_list);
+		if (cpugen != pq->ltp_cpugen) {
+			cpugen = pq->ltp_cpugen;
+			tpool_bind_cpus(pq);
+		}
+		task = tpool_next_task(pool, pq);
 		if (task == NULL) {	/* paused or no pending tasks */
 			if (--(pq->ltp_active_count) < 1) {
 				if (pool->ltp_pause) {
@@ -1040,8 +1416,8 @@ ldap_int_thread_pool_wrapper (
 				} else
 					ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 
-				work_list = pq->ltp_work_list;
-				task = LDAP_STAILQ_FIRST(work_list);
+				/* the pool lock is only held while paused */
+				task = pool_lock ? NULL : tpool_next_task(pool, pq);
 			} while (task == NULL);
 
 			if (pool_lock) {
@@ -1052,8 +1428,6 @@ ldap_int_thread_pool_wrapper (
 			pq->ltp_active_count++;
 		}
 
-		LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
-		pq->ltp_pending_count--;
 		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
 		task->ltt_start_routine(&ctx, task->ltt_arg);
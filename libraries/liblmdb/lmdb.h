@@ -356,6 +356,10 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
  * pages sequentially.
  */
 #define MDB_CP_COMPACT	0x01
+/** Applying an incremental copy: check all pages of the resulting copy
+ * against the digest it carries.
+ */
+#define MDB_CP_VERIFY	0x02
 /*	@} */
 
 /** @brief Cursor Get operations.
@@ -705,6 +709,109 @@ int  mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags);
 	 */
 int  mdb_env_copyfd2(MDB_env *env, mdb_filehandle_t fd, unsigned int flags);
 
+	/** @brief A callback function reporting the progress of a copy.
+	 *
+	 * It is called after each chunk written by #mdb_env_copy() and its
+	 * variants. In a copy using several threads it may be called from
+	 * any of them, but never concurrently. For #mdb_env_copyincr() it
+	 * counts the bytes of the environment examined instead, and the
+	 * rate limit of #mdb_env_set_copyopts() applies to those too.
+	 * @param[in] env The environment being copied.
+	 * @param[in] done The number of bytes written so far.
+	 * @param[in] total The number of bytes the copy will have.
+	 * @param[in] ctx The context given to #mdb_env_set_copyfunc().
+	 * @return 0 to go on, or a non-zero error value to fail the copy
+	 * with it.
+	 */
+typedef int (MDB_copy_func)(MDB_env *env, size_t done, size_t total, void *ctx);
+
+	/** @brief Set how later copies of the environment are made.
+	 *
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] threads The number of threads walking the environment in
+	 * a copy with #MDB_CP_COMPACT. With more than one, the named databases,
+	 * and the subtrees of the large ones, are copied in parallel. This
+	 * needs an output that is seekable and not in append mode, it falls
+	 * back to a single walker otherwise, and on Windows.
+	 * @param[in] rate The maximum average number of bytes per second to
+	 * write, or 0 for no limit.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_set_copyopts(MDB_env *env, unsigned int threads, size_t rate);
+
+	/** @brief Set a callback reporting the progress of later copies.
+	 *
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] func An #MDB_copy_func function, or 0.
+	 * @param[in] ctx An arbitrary context pointer for the callback.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_set_copyfunc(MDB_env *env, MDB_copy_func *func, void *ctx);
+
+	/** @brief Make an incremental copy of an LMDB environment.
+	 *
+	 * The copy holds only the pages which differ from a previous copy of
+	 * the environment, and the meta pages. The previous copy is described
+	 * by a file of page digests, written by the call that made it. Pages
+	 * are compared by content, since pages do not record which
+	 * transaction wrote them. The whole environment is read, but only the
+	 * pages changed since the previous copy are written.
+	 * Use #mdb_incr_apply() to bring a copy up to date with it.
+	 * @note This call can trigger significant file size growth if run in
+	 * parallel with write transactions, because it employs a read-only
+	 * transaction. See long-lived transactions under @ref caveats_sec.
+	 * Not supported on Windows.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] fd The filedescriptor to write the copy to. It must
+	 * have already been opened for Write access.
+	 * @param[in] osums A filedescriptor to read the digests of the previous
+	 * copy from, or INVALID_HANDLE_VALUE (-1 on POSIX) to copy all pages,
+	 * making a copy that applies to an empty file.
+	 * @param[in] nsums The filedescriptor to write the digests of this copy
+	 * to. If this call fails, the file must be discarded.
+	 * @return A non-zero error value on failure and 0 on success. Some
+	 * possible errors are:
+	 * <ul>
+	 *	<li>#MDB_INVALID - \b osums is not a digests file of this environment.
+	 * </ul>
+	 */
+int  mdb_env_copyincr(MDB_env *env, mdb_filehandle_t fd,
+	mdb_filehandle_t osums, mdb_filehandle_t nsums);
+
+	/** @brief Apply an incremental copy to a copy of an LMDB environment.
+	 *
+	 * The incremental copy must have been made against the digests of
+	 * the snapshot that \b dst holds now, or against none if \b dst is
+	 * empty. \b dst is patched in place: the meta pages are wiped before
+	 * the first data page is written, and the new ones are written last,
+	 * after the other pages have been synced.
+	 * @warning If this call fails or is interrupted after it has begun
+	 * writing pages, \b dst is destroyed and can no longer be opened or
+	 * patched. To keep the previous snapshot, apply the incremental copy
+	 * to a duplicate of \b dst and rename that into place afterwards, as
+	 * mdb_patch does. The environment must not be open.
+	 * Not supported on Windows.
+	 * @param[in] fd The filedescriptor to read the incremental copy from.
+	 * @param[in] dst The filedescriptor of the data file of the copy. It
+	 * must have already been opened for Read and Write access.
+	 * @param[in] flags Special options for this operation. This parameter
+	 * must be set to 0 or by bitwise OR'ing together one or more of the
+	 * values described here.
+	 * <ul>
+	 *	<li>#MDB_CP_VERIFY - Read back all pages of the resulting copy and
+	 *		check them against the digest of the environment they came from.
+	 * </ul>
+	 * @return A non-zero error value on failure and 0 on success. Some
+	 * possible errors are:
+	 * <ul>
+	 *	<li>#MDB_INVALID - \b fd is not an incremental copy, or is truncated.
+	 *	<li>#MDB_INCOMPATIBLE - \b fd does not follow the snapshot \b dst holds.
+	 *	<li>#MDB_CORRUPTED - verification found a mismatch.
+	 * </ul>
+	 */
+int  mdb_incr_apply(mdb_filehandle_t fd, mdb_filehandle_t dst, unsigned int flags);
+
 	/** @brief Return statistics about the LMDB environment.
 	 *
 	 * @param[in] env An environment handle returned by #mdb_env_create()
@@ -1290,6 +1290,17 @@ typedef struct MDB_pgstate {
 	txnid_t		mf_pglast;	/**< ID of last used record, or 0 if !mf_pghead */
 } MDB_pgstate;
 
+	/** A run of two or more consecutive pages in me_pghead.
+	 *	The runs index keeps every run twice: as (length, first page)
+	 *	in me_runs[0] and as (first page, length) in me_runs[1], each
+	 *	array sorted by both fields. me_runs[0] gives the best fit for
+	 *	a multi-page request, me_runs[1] the run holding a given page.
+	 */
+typedef struct MDB_pgrun {
+	pgno_t		mr_k1;
+	pgno_t		mr_k2;
+} MDB_pgrun;
+
 	/** The database environment. */
 struct MDB_env {
 	HANDLE		me_fd;		/**< The main data file */
@@ -1330,6 +1341,13 @@ struct MDB_env {
 	MDB_pgstate	me_pgstate;		/**< state of old pages from freeDB */
 #	define		me_pglast	me_pgstate.mf_pglast
 #	define		me_pghead	me_pgstate.mf_pghead
+	MDB_pgrun	*me_runs[2];	/**< runs index of me_pghead, see #MDB_pgrun */
+	unsigned int	me_nruns;	/**< number of runs in the index */
+	unsigned int	me_maxruns;	/**< allocated size of each me_runs[] */
+	/** The runs index matches me_pghead. Code which modifies me_pghead
+	 *	without updating the index must clear this.
+	 */
+	int			me_runs_ok;
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
 	MDB_IDL		me_free_pgs;
@@ -1355,6 +1373,10 @@ struct MDB_env {
 #endif
 	void		*me_userctx;	 /**< User-settable context */
 	MDB_assert_func *me_assert_func; /**< Callback for assertion failures */
+	unsigned int	me_cpthreads;	/**< walker threads for compacting copy */
+	size_t		me_cprate;		/**< max bytes per second written by copy */
+	MDB_copy_func	*me_cpfunc;	/**< Callback for copy progress */
+	void		*me_cpctx;		/**< context for #me_cpfunc */
 };
 
 	/** Nested transaction */
@@ -2167,6 +2189,193 @@ mdb_find_oldest(MDB_txn *txn)
 	return oldest;
 }
 
+/** Find the first run in \b runs[0..n-1] not less than (\b k1, \b k2) */
+static unsigned
+mdb_run_search(MDB_pgrun *runs, unsigned n, pgno_t k1, pgno_t k2)
+{
+	unsigned base = 0, pivot;
+
+	while (n) {
+		pivot = n >> 1;
+		if (runs[base+pivot].mr_k1 < k1 ||
+			(runs[base+pivot].mr_k1 == k1 && runs[base+pivot].mr_k2 < k2)) {
+			base += pivot + 1;
+			n -= pivot + 1;
+		} else {
+			n = pivot;
+		}
+	}
+	return base;
+}
+
+static int
+mdb_run_cmp(const void *a, const void *b)
+{
+	const MDB_pgrun *ra = a, *rb = b;
+
+	if (ra->mr_k1 != rb->mr_k1)
+		return ra->mr_k1 < rb->mr_k1 ? -1 : 1;
+	return ra->mr_k2 < rb->mr_k2 ? -1 : ra->mr_k2 > rb->mr_k2;
+}
+
+/** Make room for one more run in the runs index */
+static int
+mdb_runs_grow(MDB_env *env)
+{
+	MDB_pgrun *r;
+	unsigned x, max = env->me_maxruns ? env->me_maxruns * 2 : 64;
+
+	for (x = 0; x < 2; x++) {
+		if (!(r = realloc(env->me_runs[x], max * sizeof(MDB_pgrun))))
+			return ENOMEM;
+		env->me_runs[x] = r;
+	}
+	env->me_maxruns = max;
+	return MDB_SUCCESS;
+}
+
+/** Rebuild the runs index from me_pghead.
+ * @return 0 on success, ENOMEM if the index could not be allocated.
+ */
+static int
+mdb_runs_build(MDB_env *env)
+{
+	pgno_t *mop = env->me_pghead;
+	unsigned i, j, n = 0;
+
+	for (i = mop ? mop[0] : 0; i; i = j) {
+		for (j = i-1; j && mop[j] == mop[j+1]+1; j--)
+			;
+		if (i - j < 2)
+			continue;
+		if (n == env->me_maxruns && mdb_runs_grow(env))
+			return ENOMEM;
+		env->me_runs[0][n].mr_k1 = i - j;
+		env->me_runs[0][n].mr_k2 = mop[i];
+		env->me_runs[1][n].mr_k1 = mop[i];
+		env->me_runs[1][n].mr_k2 = i - j;
+		n++;
+	}
+	/* me_runs[1] is already in page order */
+	qsort(env->me_runs[0], n, sizeof(MDB_pgrun), mdb_run_cmp);
+	env->me_nruns = n;
+	env->me_runs_ok = 1;
+	return MDB_SUCCESS;
+}
+
+/** Add the run of \b len pages at \b pgno to the runs index.
+ * Single pages are not indexed. If memory runs out the index
+ * is dropped, to be rebuilt by the next multi-page allocation.
+ */
+static void
+mdb_runs_add(MDB_env *env, pgno_t pgno, pgno_t len)
+{
+	MDB_pgrun *r;
+	unsigned x, n = env->me_nruns;
+
+	if (len < 2 || !env->me_runs_ok)
+		return;
+	if (n == env->me_maxruns && mdb_runs_grow(env)) {
+		env->me_runs_ok = 0;
+		return;
+	}
+	r = env->me_runs[0];
+	x = mdb_run_search(r, n, len, pgno);
+	memmove(r+x+1, r+x, (n-x) * sizeof(MDB_pgrun));
+	r[x].mr_k1 = len;
+	r[x].mr_k2 = pgno;
+	r = env->me_runs[1];
+	x = mdb_run_search(r, n, pgno, 0);
+	memmove(r+x+1, r+x, (n-x) * sizeof(MDB_pgrun));
+	r[x].mr_k1 = pgno;
+	r[x].mr_k2 = len;
+	env->me_nruns = n+1;
+}
+
+/** Remove the run of \b len pages at \b pgno from the runs index.
+ * The run must be present.
+ */
+static void
+mdb_runs_del(MDB_env *env, pgno_t pgno, pgno_t len)
+{
+	MDB_pgrun *r;
+	unsigned x, n = env->me_nruns--;
+
+	r = env->me_runs[0];
+	x = mdb_run_search(r, n, len, pgno);
+	memmove(r+x, r+x+1, (n-x-1) * sizeof(MDB_pgrun));
+	r = env->me_runs[1];
+	x = mdb_run_search(r, n, pgno, 0);
+	memmove(r+x, r+x+1, (n-x-1) * sizeof(MDB_pgrun));
+}
+
+/** Find the indexed run holding page \b pgno.
+ * @return (first page, length) of the run, or NULL.
+ */
+static MDB_pgrun *
+mdb_runs_find(MDB_env *env, pgno_t pgno)
+{
+	MDB_pgrun *r = env->me_runs[1];
+	unsigned x = mdb_run_search(r, env->me_nruns, pgno+1, 0);
+
+	if (x && r[x-1].mr_k1 + r[x-1].mr_k2 > pgno)
+		return &r[x-1];
+	return NULL;
+}
+
+/** Update the runs index for pages [\b pgno, \b pgno + \b num),
+ * none of which are in me_pghead yet, before merging them in.
+ */
+static void
+mdb_runs_merge(MDB_env *env, pgno_t pgno, pgno_t num)
+{
+	pgno_t *mop = env->me_pghead, start = pgno, end = pgno + num;
+	MDB_pgrun *r;
+	unsigned x;
+
+	if (!env->me_runs_ok)
+		return;
+	/* Join whatever run or single page ends just below */
+	x = mdb_midl_search(mop, pgno-1);
+	if (x <= mop[0] && mop[x] == pgno-1) {
+		start = pgno-1;
+		if ((r = mdb_runs_find(env, start)) != NULL) {
+			start = r->mr_k1;
+			mdb_runs_del(env, start, r->mr_k2);
+		}
+	}
+	/* and whatever starts just above */
+	x = mdb_midl_search(mop, end);
+	if (x <= mop[0] && mop[x] == end) {
+		if ((r = mdb_runs_find(env, end)) != NULL) {
+			num = r->mr_k2;
+			mdb_runs_del(env, end, num);
+			end += num;
+		} else {
+			end++;
+		}
+	}
+	mdb_runs_add(env, start, end - start);
+}
+
+/** Update the runs index for pages [\b pgno, \b pgno + \b num)
+ * being taken out of me_pghead.
+ */
+static void
+mdb_runs_take(MDB_env *env, pgno_t pgno, pgno_t num)
+{
+	MDB_pgrun *r;
+	pgno_t start, len;
+
+	if (!env->me_runs_ok || !(r = mdb_runs_find(env, pgno)))
+		return;
+	start = r->mr_k1;
+	len = r->mr_k2;
+	mdb_runs_del(env, start, len);
+	mdb_runs_add(env, start, pgno - start);
+	mdb_runs_add(env, pgno + num, start + len - pgno - num);
+}
+
 /** Add a page to the txn's dirty list */
 static void
 mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
@@ -2219,7 +2428,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 	MDB_txn *txn = mc->mc_txn;
 	MDB_env *env = txn->mt_env;
 	pgno_t pgno, *mop = env->me_pghead;
-	unsigned i, j, mop_len = mop ? mop[0] : 0, n2 = num-1;
+	unsigned i, j, k, mop_len = mop ? mop[0] : 0, n2 = num-1;
 	MDB_page *np;
 	txnid_t oldest = 0, last;
 	MDB_cursor_op op;
@@ -2250,16 +2459,29 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		MDB_node *leaf;
 		pgno_t *idl;
 
-		/* Seek a big enough contiguous page range. Prefer
-		 * pages at the tail, just truncating the list.
+		/* Seek a big enough contiguous page range. Single pages
+		 * come from the tail, just truncating the list. Ranges
+		 * are the best fit from the runs index. Don't build the
+		 * index while saving the freelist, it is not maintained
+		 * there; fall back to scanning from the tail.
 		 */
 		if (mop_len > n2) {
-			i = mop_len;
-			do {
-				pgno = mop[i];
-				if (mop[i-n2] == pgno+n2)
+			if (n2 && (env->me_runs_ok ||
+				(mc->mc_dbi != FREE_DBI && !mdb_runs_build(env)))) {
+				j = mdb_run_search(env->me_runs[0], env->me_nruns, num, 0);
+				if (j < env->me_nruns) {
+					pgno = env->me_runs[0][j].mr_k2;
+					i = mdb_midl_search(mop, pgno);
 					goto search_done;
-			} while (--i > n2);
+				}
+			} else {
+				i = mop_len;
+				do {
+					pgno = mop[i];
+					if (mop[i-n2] == pgno+n2)
+						goto search_done;
+				} while (--i > n2);
+			}
 			if (--retry < 0)
 				break;
 		}
@@ -2331,7 +2553,12 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		for (j = i; j; j--)
 			DPRINTF(("IDL %"Z"u", idl[j]));
 #endif
-		/* Merge in descending sorted order */
+		/* Index the new ranges, then merge in descending sorted order */
+		for (j = i; j; j = k) {
+			for (k = j-1; k && idl[k] == idl[k+1]+1; k--)
+				;
+			mdb_runs_merge(env, idl[j], j - k);
+		}
 		mdb_midl_xmerge(mop, idl);
 		mop_len = mop[0];
 	}
@@ -2355,6 +2582,7 @@ search_done:
 		}
 	}
 	if (i) {
+		mdb_runs_take(env, pgno, num);
 		mop[0] = mop_len -= num;
 		/* Move any stragglers down */
 		for (j = i-num; j < mop_len; )
@@ -3079,6 +3307,8 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 			/* me_pgstate: */
 			env->me_pghead = NULL;
 			env->me_pglast = 0;
+			env->me_nruns = 0;
+			env->me_runs_ok = 1;
 
 			env->me_txn = NULL;
 			mode = 0;	/* txn == env->me_txn0, do not free() it */
@@ -3090,6 +3320,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 			txn->mt_parent->mt_child = NULL;
 			txn->mt_parent->mt_flags &= ~MDB_TXN_HAS_CHILD;
 			env->me_pgstate = ((MDB_ntxn *)txn)->mnt_pgstate;
+			env->me_runs_ok = 0;
 			mdb_midl_free(txn->mt_free_pgs);
 			free(txn->mt_u.dirty_list);
 		}
@@ -3153,6 +3384,9 @@ mdb_freelist_save(MDB_txn *txn)
 
 	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
 
+	/* me_pghead is edited directly below */
+	env->me_runs_ok = 0;
+
 	if (env->me_pghead) {
 		/* Make sure first page of freeDB is touched and on freelist */
 		rc = mdb_page_search(&mc, NULL, MDB_PS_FIRST|MDB_PS_MODIFY);
@@ -4717,7 +4951,6 @@ mdb_env_excl_lock(MDB_env *env, int *excl)
 	return rc;
 }
 
-#ifdef MDB_USE_HASH
 /*
  * hash_64 - 64 bit Fowler/Noll/Vo-0 FNV-1a hash code
  *
@@ -4777,6 +5010,7 @@ mdb_hash_val(MDB_val *val, mdb_hash_t hval)
 	return hval;
 }
 
+#ifdef MDB_USE_HASH
 /** Hash the string and output the encoded hash.
  * This uses modified RFC1924 Ascii85 encoding to accommodate systems with
  * very short name limits. We don't care about the encoding being reversible,
@@ -5160,6 +5394,8 @@ mdb_env_close0(MDB_env *env, int excl)
 	free(env->me_dirty_list);
 	free(env->me_txn0);
 	mdb_midl_free(env->me_free_pgs);
+	free(env->me_runs[0]);
+	free(env->me_runs[1]);
 
 	if (env->me_flags & MDB_ENV_TXKEY) {
 		pthread_key_delete(env->me_txkey);
@@ -5813,6 +6049,7 @@ mdb_ovpage_free(MDB_cursor *mc, MDB_page *mp)
 			mdb_dpage_free(env, mp);
 release:
 		/* Insert in me_pghead */
+		mdb_runs_merge(env, pg, ovpages);
 		mop = env->me_pghead;
 		j = mop[0] + ovpages;
 		for (i = mop[0]; i && mop[i] < pg; i--)
@@ -9162,6 +9399,15 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
 #endif
 #define MDB_EOF		0x10	/**< #mdb_env_copyfd1() is done reading */
 
+	/** Progress and rate limit of a copy, shared by its threads. */
+typedef struct mdb_copy_pace {
+	MDB_env *cp_env;
+	pthread_mutex_t *cp_mutex;	/**< Lock for a copy with several writers */
+	size_t cp_done;			/**< bytes written so far */
+	size_t cp_total;		/**< bytes the copy will have */
+	unsigned long cp_start;	/**< #mdb_env_cclock() when the copy began */
+} mdb_copy_pace;
+
 	/** State needed for a double-buffering compacting copy. */
 typedef struct mdb_copy {
 	MDB_env *mc_env;
@@ -9180,8 +9426,68 @@ typedef struct mdb_copy {
 	 *	to fail the copy.  Not mutex-protected, LMDB expects atomic int.
 	 */
 	volatile int mc_error;
+	mdb_copy_pace *mc_pace;
+	/** Parallel copy this walker belongs to. It writes its own buffer
+	 *	at the pages it numbered, instead of handing it to a writer thread.
+	 */
+	struct mdb_copy_par *mc_par;
+	pgno_t mc_wpgno;		/**< First page in the buffer, for #mc_par */
+	/** Named DBs already copied by the walkers of #mc_par, in the order
+	 *	the main DB lists them.
+	 */
+	struct mdb_copy_sub *mc_subs;
+	unsigned mc_nsubs;		/**< Next entry of #mc_subs */
 } mdb_copy;
 
+	/** Milliseconds since an arbitrary start, for pacing a copy. */
+static unsigned long ESECT
+mdb_env_cclock(void)
+{
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+#endif
+}
+
+	/** Account for \b len more bytes written by a copy: report the
+	 *	progress, and sleep as long as the copy is ahead of #me_cprate.
+	 * @return the result of the progress callback.
+	 */
+static int ESECT
+mdb_env_cpace(mdb_copy_pace *cp, size_t len)
+{
+	MDB_env *env = cp->cp_env;
+	long ms = 0;
+	int rc = MDB_SUCCESS;
+
+	if (!env->me_cpfunc && !env->me_cprate)
+		return MDB_SUCCESS;
+	if (cp->cp_mutex)
+		pthread_mutex_lock(cp->cp_mutex);
+	cp->cp_done += len;
+	if (env->me_cpfunc)
+		rc = env->me_cpfunc(env, cp->cp_done, cp->cp_total, env->me_cpctx);
+	if (env->me_cprate)
+		ms = (long)((double)cp->cp_done * 1000 / env->me_cprate) -
+			(long)(mdb_env_cclock() - cp->cp_start);
+	if (cp->cp_mutex)
+		pthread_mutex_unlock(cp->cp_mutex);
+	if (ms > 0 && !rc) {
+#ifdef _WIN32
+		Sleep(ms);
+#else
+		struct timespec ts;
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (ms % 1000) * 1000000;
+		nanosleep(&ts, NULL);
+#endif
+	}
+	return rc;
+}
+
 	/** Dedicated writer thread for compacting copy. */
 static THREAD_RET ESECT CALL_CONV
 mdb_env_copythr(void *arg)
@@ -9229,9 +9535,11 @@ again:
 #endif
 				break;
 			} else if (len > 0) {
-				rc = MDB_SUCCESS;
 				ptr += len;
 				wsize -= len;
+				rc = mdb_env_cpace(my->mc_pace, len);
+				if (rc)
+					break;
 				continue;
 			} else {
 				rc = EIO;
@@ -9259,6 +9567,75 @@ again:
 #undef DO_WRITE
 }
 
+	/** A tree, or a subtree under the root of a large named DB, which
+	 *	one walker of a parallel compacting copy copies on its own into
+	 *	a range of pages reserved for it.
+	 */
+typedef struct mdb_copy_unit {
+	pgno_t cu_root;			/**< Its root, then its root in the copy */
+	pgno_t cu_pgno;			/**< First page of its range in the copy */
+	pgno_t cu_count;		/**< Pages in the range, 0 until counted */
+} mdb_copy_unit;
+
+	/** A named DB in a parallel compacting copy. */
+typedef struct mdb_copy_sub {
+	pgno_t cs_root;			/**< Its root, then its root in the copy */
+	unsigned cs_unit;		/**< Its first unit */
+	unsigned cs_nunits;		/**< 0 if empty, 1, or the children of its root */
+} mdb_copy_sub;
+
+	/** State shared by the walker threads of a parallel compacting copy. */
+typedef struct mdb_copy_par {
+	mdb_copy *cp_my;		/**< The calling thread's copy */
+	off_t cp_off;			/**< Offset of page 0 in the output */
+	mdb_copy_unit **cp_order;	/**< Units to take, in this order */
+	unsigned cp_nunits;
+	unsigned cp_next;		/**< Next unit to take */
+	int cp_count;			/**< Count the units instead of copying them */
+	volatile int cp_error;	/**< Like #mdb_copy.mc_error */
+} mdb_copy_par;
+
+#ifndef _WIN32
+	/** Write the buffer of a walker of a parallel copy, and the overflow
+	 *	page tail following it, at the pages they were numbered for.
+	 */
+static int ESECT
+mdb_env_cpwrite(mdb_copy *my)
+{
+	int toggle = my->mc_toggle, rc = my->mc_par->cp_error;
+	char *ptr = my->mc_wbuf[toggle];
+	size_t wsize = my->mc_wlen[toggle];
+	off_t off = my->mc_par->cp_off + (off_t)my->mc_wpgno * my->mc_env->me_psize;
+	ssize_t len;
+
+again:
+	while (wsize > 0 && !rc) {
+		len = pwrite(my->mc_fd, ptr, wsize > MAX_WRITE ? MAX_WRITE : wsize, off);
+		if (len > 0) {
+			ptr += len;
+			off += len;
+			wsize -= len;
+			rc = mdb_env_cpace(my->mc_pace, len);
+		} else if (len < 0) {
+			rc = ErrCode();
+			if (rc == EINTR)
+				rc = MDB_SUCCESS;
+		} else {
+			rc = EIO;
+		}
+	}
+	if (my->mc_olen[toggle]) {
+		wsize = my->mc_olen[toggle];
+		ptr = my->mc_over[toggle];
+		my->mc_olen[toggle] = 0;
+		goto again;
+	}
+	my->mc_wlen[toggle] = 0;
+	my->mc_wpgno = my->mc_next_pgno;
+	return rc;
+}
+#endif
+
 	/** Give buffer and/or #MDB_EOF to writer thread, await unused buffer.
 	 *
 	 * @param[in] my control structure.
@@ -9267,6 +9644,10 @@ again:
 static int ESECT
 mdb_env_cthr_toggle(mdb_copy *my, int adjust)
 {
+#ifndef _WIN32
+	if (my->mc_par)
+		return mdb_env_cpwrite(my);
+#endif
 	pthread_mutex_lock(&my->mc_mutex);
 	my->mc_new += adjust;
 	pthread_cond_signal(&my->mc_cond);
@@ -9381,11 +9762,15 @@ mdb_env_cwalk(mdb_copy *my, pgno_t *pg, int flags)
 						}
 
 						memcpy(&db, NODEDATA(ni), sizeof(db));
-						my->mc_toggle = toggle;
-						rc = mdb_env_cwalk(my, &db.md_root, ni->mn_flags & F_DUPDATA);
-						if (rc)
-							goto done;
-						toggle = my->mc_toggle;
+						if (my->mc_subs) {
+							db.md_root = my->mc_subs[my->mc_nsubs++].cs_root;
+						} else {
+							my->mc_toggle = toggle;
+							rc = mdb_env_cwalk(my, &db.md_root, ni->mn_flags & F_DUPDATA);
+							if (rc)
+								goto done;
+							toggle = my->mc_toggle;
+						}
 						memcpy(NODEDATA(ni), &db, sizeof(db));
 					}
 				}
@@ -9440,64 +9825,21 @@ done:
 	return rc;
 }
 
-	/** Copy environment with compaction. */
+	/** Set up the meta pages of a compacting copy.
+	 * @param[in] txn the read-only txn being copied.
+	 * @param[out] buf space for #NUM_METAS pages.
+	 * @param[out] new_root the root of the main DB in the copy.
+	 */
 static int ESECT
-mdb_env_copyfd1(MDB_env *env, HANDLE fd)
+mdb_env_cmeta(MDB_txn *txn, char *buf, pgno_t *new_root)
 {
+	MDB_env *env = txn->mt_env;
 	MDB_meta *mm;
 	MDB_page *mp;
-	mdb_copy my = {0};
-	MDB_txn *txn = NULL;
-	pthread_t thr;
-	pgno_t root, new_root;
+	pgno_t root;
 	int rc = MDB_SUCCESS;
 
-#ifdef _WIN32
-	if (!(my.mc_mutex = CreateMutex(NULL, FALSE, NULL)) ||
-		!(my.mc_cond = CreateEvent(NULL, FALSE, FALSE, NULL))) {
-		rc = ErrCode();
-		goto done;
-	}
-	my.mc_wbuf[0] = _aligned_malloc(MDB_WBUF*2, env->me_os_psize);
-	if (my.mc_wbuf[0] == NULL) {
-		/* _aligned_malloc() sets errno, but we use Windows error codes */
-		rc = ERROR_NOT_ENOUGH_MEMORY;
-		goto done;
-	}
-#else
-	if ((rc = pthread_mutex_init(&my.mc_mutex, NULL)) != 0)
-		return rc;
-	if ((rc = pthread_cond_init(&my.mc_cond, NULL)) != 0)
-		goto done2;
-#ifdef HAVE_MEMALIGN
-	my.mc_wbuf[0] = memalign(env->me_os_psize, MDB_WBUF*2);
-	if (my.mc_wbuf[0] == NULL) {
-		rc = errno;
-		goto done;
-	}
-#else
-	{
-		void *p;
-		if ((rc = posix_memalign(&p, env->me_os_psize, MDB_WBUF*2)) != 0)
-			goto done;
-		my.mc_wbuf[0] = p;
-	}
-#endif
-#endif
-	memset(my.mc_wbuf[0], 0, MDB_WBUF*2);
-	my.mc_wbuf[1] = my.mc_wbuf[0] + MDB_WBUF;
-	my.mc_next_pgno = NUM_METAS;
-	my.mc_env = env;
-	my.mc_fd = fd;
-	rc = THREAD_CREATE(thr, mdb_env_copythr, &my);
-	if (rc)
-		goto done;
-
-	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
-	if (rc)
-		goto finish;
-
-	mp = (MDB_page *)my.mc_wbuf[0];
+	mp = (MDB_page *)buf;
 	memset(mp, 0, NUM_METAS * env->me_psize);
 	mp->mp_pgno = 0;
 	mp->mp_flags = P_META;
@@ -9505,14 +9847,14 @@ mdb_env_copyfd1(MDB_env *env, HANDLE fd)
 	mdb_env_init_meta0(env, mm);
 	mm->mm_address = env->me_metas[0]->mm_address;
 
-	mp = (MDB_page *)(my.mc_wbuf[0] + env->me_psize);
+	mp = (MDB_page *)(buf + env->me_psize);
 	mp->mp_pgno = 1;
 	mp->mp_flags = P_META;
 	*(MDB_meta *)METADATA(mp) = *mm;
 	mm = (MDB_meta *)METADATA(mp);
 
 	/* Set metapage 1 with current main DB */
-	root = new_root = txn->mt_dbs[MAIN_DBI].md_root;
+	root = *new_root = txn->mt_dbs[MAIN_DBI].md_root;
 	if (root != P_INVALID) {
 		/* Count free pages + freeDB pages.  Subtract from last_pg
 		 * to find the new last_pg, which also becomes the new root.
@@ -9524,15 +9866,16 @@ mdb_env_copyfd1(MDB_env *env, HANDLE fd)
 		while ((rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) == 0)
 			freecount += *(MDB_ID *)data.mv_data;
 		if (rc != MDB_NOTFOUND)
-			goto finish;
+			return rc;
+		rc = MDB_SUCCESS;
 		freecount += txn->mt_dbs[FREE_DBI].md_branch_pages +
 			txn->mt_dbs[FREE_DBI].md_leaf_pages +
 			txn->mt_dbs[FREE_DBI].md_overflow_pages;
 
-		new_root = txn->mt_next_pgno - 1 - freecount;
-		mm->mm_last_pg = new_root;
+		*new_root = txn->mt_next_pgno - 1 - freecount;
+		mm->mm_last_pg = *new_root;
 		mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
-		mm->mm_dbs[MAIN_DBI].md_root = new_root;
+		mm->mm_dbs[MAIN_DBI].md_root = *new_root;
 	} else {
 		/* When the DB is empty, handle it specially to
 		 * fix any breakage like page leaks from ITS#8174.
@@ -9542,52 +9885,461 @@ mdb_env_copyfd1(MDB_env *env, HANDLE fd)
 	if (root != P_INVALID || mm->mm_dbs[MAIN_DBI].md_flags) {
 		mm->mm_txnid = 1;		/* use metapage 1 */
 	}
+	return rc;
+}
 
-	my.mc_wlen[0] = env->me_psize * NUM_METAS;
-	my.mc_txn = txn;
-	rc = mdb_env_cwalk(&my, &root, 0);
-	if (rc == MDB_SUCCESS && root != new_root) {
-		rc = MDB_INCOMPATIBLE;	/* page leak or corrupt DB */
-	}
+#ifndef _WIN32
+	/** Count the pages a compacting copy writes for a tree.
+	 * @param[in] txn the read-only txn being copied.
+	 * @param[in] pg root of the tree.
+	 * @param[in,out] count incremented by the number of pages.
+	 */
+static int ESECT
+mdb_env_ccount(MDB_txn *txn, pgno_t pg, pgno_t *count)
+{
+	MDB_cursor mc = {0};
+	MDB_node *ni;
+	MDB_page *mp, *omp;
+	MDB_db db;
+	unsigned i, n;
+	int rc;
 
-finish:
+	mc.mc_txn = txn;
+	rc = mdb_page_get(&mc, pg, &mp, NULL);
 	if (rc)
-		my.mc_error = rc;
-	mdb_env_cthr_toggle(&my, 1 | MDB_EOF);
-	rc = THREAD_FINISH(thr);
-	_mdb_txn_abort(txn);
+		return rc;
+	(*count)++;
+	if (IS_LEAF2(mp))
+		return MDB_SUCCESS;
+	n = NUMKEYS(mp);
+	for (i=0; i<n && !rc; i++) {
+		ni = NODEPTR(mp, i);
+		if (IS_BRANCH(mp)) {
+			rc = mdb_env_ccount(txn, NODEPGNO(ni), count);
+		} else if (ni->mn_flags & F_BIGDATA) {
+			/* Not OVPAGES(), the value may have shrunk in place */
+			memcpy(&pg, NODEDATA(ni), sizeof(pg));
+			rc = mdb_page_get(&mc, pg, &omp, NULL);
+			if (rc == MDB_SUCCESS)
+				*count += omp->mp_pages;
+		} else if (ni->mn_flags & F_SUBDATA) {
+			memcpy(&db, NODEDATA(ni), sizeof(db));
+			*count += db.md_branch_pages + db.md_leaf_pages +
+				db.md_overflow_pages;
+		}
+	}
+	return rc;
+}
 
-done:
-#ifdef _WIN32
-	if (my.mc_wbuf[0]) _aligned_free(my.mc_wbuf[0]);
-	if (my.mc_cond)  CloseHandle(my.mc_cond);
-	if (my.mc_mutex) CloseHandle(my.mc_mutex);
+	/** Walker thread of a parallel compacting copy. */
+static THREAD_RET ESECT CALL_CONV
+mdb_env_copywalk(void *arg)
+{
+	mdb_copy_par *cp = arg;
+	mdb_copy my = {0};
+	mdb_copy_unit *cu;
+	void *buf = NULL;
+	int rc = MDB_SUCCESS;
+
+	my.mc_env = cp->cp_my->mc_env;
+	my.mc_txn = cp->cp_my->mc_txn;
+	my.mc_fd = cp->cp_my->mc_fd;
+	my.mc_pace = cp->cp_my->mc_pace;
+	my.mc_par = cp;
+	if (!cp->cp_count) {
+#ifdef HAVE_MEMALIGN
+		buf = memalign(my.mc_env->me_os_psize, MDB_WBUF);
+		if (buf == NULL)
+			rc = errno;
 #else
-	free(my.mc_wbuf[0]);
-	pthread_cond_destroy(&my.mc_cond);
-done2:
-	pthread_mutex_destroy(&my.mc_mutex);
+		rc = posix_memalign(&buf, my.mc_env->me_os_psize, MDB_WBUF);
 #endif
-	return rc ? rc : my.mc_error;
+		if (rc == MDB_SUCCESS)
+			memset(buf, 0, MDB_WBUF);
+		my.mc_wbuf[0] = my.mc_wbuf[1] = buf;
+	}
+
+	while (rc == MDB_SUCCESS) {
+		pthread_mutex_lock(&cp->cp_my->mc_mutex);
+		cu = NULL;
+		if (cp->cp_next < cp->cp_nunits && !cp->cp_error)
+			cu = cp->cp_order[cp->cp_next++];
+		pthread_mutex_unlock(&cp->cp_my->mc_mutex);
+		if (!cu)
+			break;
+		if (cp->cp_count) {
+			rc = mdb_env_ccount(my.mc_txn, cu->cu_root, &cu->cu_count);
+			continue;
+		}
+		my.mc_next_pgno = my.mc_wpgno = cu->cu_pgno;
+		rc = mdb_env_cwalk(&my, &cu->cu_root, 0);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_env_cpwrite(&my);
+		if (rc == MDB_SUCCESS && my.mc_next_pgno != cu->cu_pgno + cu->cu_count)
+			rc = MDB_INCOMPATIBLE;	/* page leak or corrupt DB */
+	}
+	if (rc)
+		cp->cp_error = rc;
+	free(buf);
+	return (THREAD_RET)0;
 }
 
-	/** Copy environment as-is. */
+	/** Run walker threads over the units of a parallel compacting copy. */
 static int ESECT
-mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+mdb_env_cprun(mdb_copy_par *cp, pthread_t *thr, unsigned nthr)
 {
-	MDB_txn *txn = NULL;
-	mdb_mutexref_t wmutex = NULL;
+	unsigned i;
 	int rc;
-	size_t wsize, w3;
-	char *ptr;
-#ifdef _WIN32
-	DWORD len, w2;
-#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
-#else
-	ssize_t len;
-	size_t w2;
-#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
-#endif
+
+	cp->cp_next = 0;
+	if (nthr > cp->cp_nunits)
+		nthr = cp->cp_nunits;
+	for (i=0; i<nthr; i++) {
+		rc = THREAD_CREATE(thr[i], mdb_env_copywalk, cp);
+		if (rc) {
+			cp->cp_error = rc;
+			break;
+		}
+	}
+	while (i)
+		THREAD_FINISH(thr[--i]);
+	return cp->cp_error;
+}
+
+static int
+mdb_env_cucmp(const void *a, const void *b)
+{
+	pgno_t ca = (*(mdb_copy_unit **)a)->cu_count;
+	pgno_t cb = (*(mdb_copy_unit **)b)->cu_count;
+	return (ca < cb) - (ca > cb);
+}
+
+	/** Compacting copy with several walker threads.
+	 *
+	 * Each named DB is a unit that one walker copies into a range of
+	 * pages reserved for it. A named DB holding more than its share of
+	 * the pages is split into a unit for each child of its root, and
+	 * its root is copied once they are done. The main DB goes last, so
+	 * the pages end up numbered the same way as in a single-threaded
+	 * copy, except for their order.
+	 *
+	 * The size of a range is known from the DB record of a plain named
+	 * DB. A split DB, or one with sorted duplicates, has its units
+	 * counted by the walkers first.
+	 * @param[in] my control structure of the calling thread.
+	 * @param[in] off offset of the copy in the output file.
+	 * @param[in] new_root the root of the main DB in the copy.
+	 */
+static int ESECT
+mdb_env_copypar(mdb_copy *my, off_t off, pgno_t new_root)
+{
+	MDB_env *env = my->mc_env;
+	MDB_txn *txn = my->mc_txn;
+	MDB_db *mdb = &txn->mt_dbs[MAIN_DBI];
+	mdb_copy_par cp = {0};
+	mdb_copy_sub *subs = NULL, *cs;
+	mdb_copy_unit *units = NULL, *cu;
+	unsigned i, j, n, nsubs = 0, maxsubs = 0, nunits = 0, maxunits = 0;
+	unsigned nthr = env->me_cpthreads;
+	pthread_t *thr = NULL;
+	MDB_cursor mc;
+	MDB_node *ni;
+	MDB_page *mp, *rp;
+	MDB_db db;
+	pgno_t pgno, limit, root;
+	int rc;
+
+	cp.cp_my = my;
+	cp.cp_off = off;
+	my->mc_par = &cp;
+
+	/* The meta pages */
+	my->mc_wpgno = 0;
+	my->mc_wlen[0] = NUM_METAS * env->me_psize;
+	rc = mdb_env_cpwrite(my);
+	if (rc)
+		goto done;
+
+	/* Find the named DBs, and the units to copy them in */
+	limit = (new_root - NUM_METAS) / nthr;
+	mdb_cursor_init(&mc, txn, MAIN_DBI, NULL);
+	rc = mdb_page_search(&mc, NULL, MDB_PS_FIRST);
+	for (; rc == MDB_SUCCESS; rc = mdb_cursor_sibling(&mc, 1)) {
+		mp = mc.mc_pg[mc.mc_top];
+		for (i=0; i<NUMKEYS(mp); i++) {
+			ni = NODEPTR(mp, i);
+			if (!(ni->mn_flags & F_SUBDATA))
+				continue;
+			if (nsubs == maxsubs) {
+				maxsubs = maxsubs ? maxsubs * 2 : 16;
+				cs = realloc(subs, maxsubs * sizeof(*subs));
+				if (!cs) {
+					rc = ENOMEM;
+					goto done;
+				}
+				subs = cs;
+			}
+			memcpy(&db, NODEDATA(ni), sizeof(db));
+			cs = &subs[nsubs++];
+			cs->cs_root = db.md_root;
+			cs->cs_unit = nunits;
+			cs->cs_nunits = 0;
+			if (db.md_root == P_INVALID)
+				continue;
+			rp = NULL;
+			n = 1;
+			if (db.md_depth > 1 && db.md_branch_pages + db.md_leaf_pages +
+				db.md_overflow_pages > limit) {
+				rc = mdb_page_get(&mc, db.md_root, &rp, NULL);
+				if (rc)
+					goto done;
+				n = NUMKEYS(rp);
+			}
+			if (nunits + n > maxunits) {
+				maxunits = maxunits * 2 + n;
+				cu = realloc(units, maxunits * sizeof(*units));
+				if (!cu) {
+					rc = ENOMEM;
+					goto done;
+				}
+				units = cu;
+			}
+			for (j=0; j<n; j++) {
+				cu = &units[nunits++];
+				cu->cu_root = rp ? NODEPGNO(NODEPTR(rp, j)) : db.md_root;
+				cu->cu_count = (rp || (db.md_flags & MDB_DUPSORT)) ? 0 :
+					db.md_branch_pages + db.md_leaf_pages + db.md_overflow_pages;
+			}
+			cs->cs_nunits = n;
+		}
+	}
+	if (rc != MDB_NOTFOUND)
+		goto done;
+	rc = MDB_SUCCESS;
+
+	cp.cp_order = malloc((nunits + 1) * sizeof(*cp.cp_order));
+	thr = malloc(nthr * sizeof(*thr));
+	if (!cp.cp_order || !thr) {
+		rc = ENOMEM;
+		goto done;
+	}
+
+	/* Count the units whose size is not known */
+	for (i=n=0; i<nunits; i++)
+		if (!units[i].cu_count)
+			cp.cp_order[n++] = &units[i];
+	if (n) {
+		cp.cp_count = 1;
+		cp.cp_nunits = n;
+		rc = mdb_env_cprun(&cp, thr, nthr);
+		if (rc)
+			goto done;
+	}
+
+	/* Reserve their ranges, the main DB comes after them */
+	pgno = NUM_METAS;
+	for (i=0; i<nsubs; i++) {
+		cs = &subs[i];
+		for (j=0; j<cs->cs_nunits; j++) {
+			cu = &units[cs->cs_unit + j];
+			cu->cu_pgno = pgno;
+			pgno += cu->cu_count;
+		}
+		if (cs->cs_nunits > 1)
+			pgno++;
+	}
+	if (pgno + mdb->md_branch_pages + mdb->md_leaf_pages +
+		mdb->md_overflow_pages != new_root + 1) {
+		rc = MDB_INCOMPATIBLE;	/* page leak or corrupt DB */
+		goto done;
+	}
+
+	/* Copy them, largest first */
+	for (i=0; i<nunits; i++)
+		cp.cp_order[i] = &units[i];
+	qsort(cp.cp_order, nunits, sizeof(*cp.cp_order), mdb_env_cucmp);
+	cp.cp_count = 0;
+	cp.cp_nunits = nunits;
+	rc = mdb_env_cprun(&cp, thr, nthr);
+	if (rc)
+		goto done;
+
+	/* Copy the roots of the split DBs */
+	for (i=0; i<nsubs; i++) {
+		cs = &subs[i];
+		cu = &units[cs->cs_unit];
+		if (cs->cs_nunits == 1) {
+			cs->cs_root = cu->cu_root;
+		} else if (cs->cs_nunits) {
+			rc = mdb_page_get(&mc, cs->cs_root, &rp, NULL);
+			if (rc)
+				goto done;
+			mp = (MDB_page *)my->mc_wbuf[0];
+			mdb_page_copy(mp, rp, env->me_psize);
+			for (j=0; j<cs->cs_nunits; j++)
+				SETPGNO(NODEPTR(mp, j), cu[j].cu_root);
+			cu += cs->cs_nunits - 1;
+			cs->cs_root = mp->mp_pgno = cu->cu_pgno + cu->cu_count;
+			my->mc_wpgno = mp->mp_pgno;
+			my->mc_next_pgno = mp->mp_pgno + 1;
+			my->mc_wlen[0] = env->me_psize;
+			rc = mdb_env_cpwrite(my);
+			if (rc)
+				goto done;
+		}
+	}
+
+	/* And the main DB, with the new roots of the named DBs */
+	my->mc_subs = subs;
+	my->mc_next_pgno = my->mc_wpgno = pgno;
+	root = mdb->md_root;
+	rc = mdb_env_cwalk(my, &root, 0);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_env_cpwrite(my);
+	if (rc == MDB_SUCCESS && (root != new_root || my->mc_nsubs != nsubs))
+		rc = MDB_INCOMPATIBLE;
+
+done:
+	free(thr);
+	free(cp.cp_order);
+	free(units);
+	free(subs);
+	return rc;
+}
+#endif
+
+	/** Copy environment with compaction. */
+static int ESECT
+mdb_env_copyfd1(MDB_env *env, HANDLE fd)
+{
+	mdb_copy my = {0};
+	mdb_copy_pace pace = {0};
+	MDB_txn *txn = NULL;
+	pthread_t thr;
+	pgno_t root, new_root;
+	int rc = MDB_SUCCESS;
+#ifndef _WIN32
+	off_t off;
+	int fl;
+#endif
+
+#ifdef _WIN32
+	if (!(my.mc_mutex = CreateMutex(NULL, FALSE, NULL)) ||
+		!(my.mc_cond = CreateEvent(NULL, FALSE, FALSE, NULL))) {
+		rc = ErrCode();
+		goto done;
+	}
+	my.mc_wbuf[0] = _aligned_malloc(MDB_WBUF*2, env->me_os_psize);
+	if (my.mc_wbuf[0] == NULL) {
+		/* _aligned_malloc() sets errno, but we use Windows error codes */
+		rc = ERROR_NOT_ENOUGH_MEMORY;
+		goto done;
+	}
+#else
+	if ((rc = pthread_mutex_init(&my.mc_mutex, NULL)) != 0)
+		return rc;
+	if ((rc = pthread_cond_init(&my.mc_cond, NULL)) != 0)
+		goto done2;
+#ifdef HAVE_MEMALIGN
+	my.mc_wbuf[0] = memalign(env->me_os_psize, MDB_WBUF*2);
+	if (my.mc_wbuf[0] == NULL) {
+		rc = errno;
+		goto done;
+	}
+#else
+	{
+		void *p;
+		if ((rc = posix_memalign(&p, env->me_os_psize, MDB_WBUF*2)) != 0)
+			goto done;
+		my.mc_wbuf[0] = p;
+	}
+#endif
+#endif
+	memset(my.mc_wbuf[0], 0, MDB_WBUF*2);
+	my.mc_wbuf[1] = my.mc_wbuf[0] + MDB_WBUF;
+	my.mc_next_pgno = NUM_METAS;
+	my.mc_env = env;
+	my.mc_fd = fd;
+	pace.cp_env = env;
+	pace.cp_mutex = &my.mc_mutex;
+	pace.cp_start = mdb_env_cclock();
+	my.mc_pace = &pace;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		goto done;
+	rc = mdb_env_cmeta(txn, my.mc_wbuf[0], &new_root);
+	if (rc)
+		goto done;
+	root = txn->mt_dbs[MAIN_DBI].md_root;
+	pace.cp_total = (size_t)(root == P_INVALID ? NUM_METAS : new_root + 1) *
+		env->me_psize;
+	my.mc_txn = txn;
+
+#ifndef _WIN32
+	/* Walkers write their pages in place, so the output must
+	 * be seekable, and not append everything at its end.
+	 */
+	if (env->me_cpthreads > 1 && root != P_INVALID &&
+		!(txn->mt_dbs[MAIN_DBI].md_flags & MDB_DUPSORT) &&
+		(off = lseek(fd, 0, SEEK_CUR)) != -1 &&
+		(fl = fcntl(fd, F_GETFL)) != -1 && !(fl & O_APPEND)) {
+		rc = mdb_env_copypar(&my, off, new_root);
+		if (rc == MDB_SUCCESS &&
+			lseek(fd, off + (off_t)pace.cp_total, SEEK_SET) == -1)
+			rc = ErrCode();
+		goto done;
+	}
+#endif
+
+	rc = THREAD_CREATE(thr, mdb_env_copythr, &my);
+	if (rc)
+		goto done;
+
+	my.mc_wlen[0] = env->me_psize * NUM_METAS;
+	rc = mdb_env_cwalk(&my, &root, 0);
+	if (rc == MDB_SUCCESS && root != new_root) {
+		rc = MDB_INCOMPATIBLE;	/* page leak or corrupt DB */
+	}
+
+	if (rc)
+		my.mc_error = rc;
+	mdb_env_cthr_toggle(&my, 1 | MDB_EOF);
+	rc = THREAD_FINISH(thr);
+
+done:
+	_mdb_txn_abort(txn);
+#ifdef _WIN32
+	if (my.mc_wbuf[0]) _aligned_free(my.mc_wbuf[0]);
+	if (my.mc_cond)  CloseHandle(my.mc_cond);
+	if (my.mc_mutex) CloseHandle(my.mc_mutex);
+#else
+	free(my.mc_wbuf[0]);
+	pthread_cond_destroy(&my.mc_cond);
+done2:
+	pthread_mutex_destroy(&my.mc_mutex);
+#endif
+	return rc ? rc : my.mc_error;
+}
+
+	/** Copy environment as-is. */
+static int ESECT
+mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+{
+	MDB_txn *txn = NULL;
+	mdb_mutexref_t wmutex = NULL;
+	mdb_copy_pace pace = {0};
+	int rc;
+	size_t wsize, w3, wmax = MAX_WRITE;
+	char *ptr;
+#ifdef _WIN32
+	DWORD len, w2;
+#define DO_WRITE(rc, fd, ptr, w2, len)	rc = WriteFile(fd, ptr, w2, &len, NULL)
+#else
+	ssize_t len;
+	size_t w2;
+#define DO_WRITE(rc, fd, ptr, w2, len)	len = write(fd, ptr, w2); rc = (len >= 0)
+#endif
 
 	/* Do the lock/unlock of the reader mutex before starting the
 	 * write txn.  Otherwise other read txns could block writers.
@@ -9645,10 +10397,18 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 		if (w3 > fsize)
 			w3 = fsize;
 	}
+	pace.cp_env = env;
+	pace.cp_total = w3;
+	pace.cp_start = mdb_env_cclock();
+	if (env->me_cpfunc || env->me_cprate)
+		wmax = MDB_WBUF;	/* report and pace it in small steps */
+	rc = mdb_env_cpace(&pace, wsize);
+	if (rc)
+		goto leave;
 	wsize = w3 - wsize;
 	while (wsize > 0) {
-		if (wsize > MAX_WRITE)
-			w2 = MAX_WRITE;
+		if (wsize > wmax)
+			w2 = wmax;
 		else
 			w2 = wsize;
 		DO_WRITE(rc, fd, ptr, w2, len);
@@ -9656,9 +10416,11 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 			rc = ErrCode();
 			break;
 		} else if (len > 0) {
-			rc = MDB_SUCCESS;
 			ptr += len;
 			wsize -= len;
+			rc = mdb_env_cpace(&pace, len);
+			if (rc)
+				break;
 			continue;
 		} else {
 			rc = EIO;
@@ -9712,6 +10474,380 @@ mdb_env_copy(MDB_env *env, const char *path)
 	return mdb_env_copy2(env, path, 0);
 }
 
+int ESECT
+mdb_env_set_copyopts(MDB_env *env, unsigned int threads, size_t rate)
+{
+	if (!env)
+		return EINVAL;
+	env->me_cpthreads = threads;
+	env->me_cprate = rate;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_set_copyfunc(MDB_env *env, MDB_copy_func *func, void *ctx)
+{
+	if (!env)
+		return EINVAL;
+	env->me_cpfunc = func;
+	env->me_cpctx = ctx;
+	return MDB_SUCCESS;
+}
+
+	/** Header of an incremental copy, or of a page digests file.
+	 *
+	 * An incremental copy continues with the pages which differ from the
+	 * copy a digests file describes, each preceded by its page number,
+	 * and always with the meta pages. A #P_INVALID page number ends it,
+	 * followed by a digest of all the pages of the copy it brings about.
+	 *
+	 * A digests file continues with the #mdb_hash_val() of each page of
+	 * the copy made in \b mi_txnid.
+	 */
+typedef struct MDB_incr {
+	uint32_t	mi_magic;	/**< #MDB_INCR_MAGIC or #MDB_SUMS_MAGIC */
+	uint32_t	mi_psize;	/**< page size of the environment */
+	txnid_t		mi_base;	/**< txn of the copy it applies to, 0 if empty */
+	txnid_t		mi_txnid;	/**< txn of the snapshot it holds */
+	pgno_t		mi_npages;	/**< size of the copy, in pages */
+} MDB_incr;
+
+#define MDB_INCR_MAGIC	0xBEEFC0DF	/**< an incremental copy */
+#define MDB_SUMS_MAGIC	0xBEEFC0E0	/**< page digests of a copy */
+
+#ifndef _WIN32
+	/** Read \b len bytes at \b off, or sequentially if it is -1.
+	 * @return #MDB_INVALID if the file ends first.
+	 */
+static int ESECT
+mdb_incr_read(HANDLE fd, void *buf, size_t len, off_t off)
+{
+	char *ptr = buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = off == -1 ? read(fd, ptr, len) : pread(fd, ptr, len, off);
+		if (rc > 0) {
+			ptr += rc;
+			len -= rc;
+			if (off != -1)
+				off += rc;
+		} else if (rc == 0) {
+			return MDB_INVALID;
+		} else if (ErrCode() != EINTR) {
+			return ErrCode();
+		}
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Write \b len bytes at \b off, or sequentially if it is -1. */
+static int ESECT
+mdb_incr_write(HANDLE fd, const void *buf, size_t len, off_t off)
+{
+	const char *ptr = buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = off == -1 ? write(fd, ptr, len) : pwrite(fd, ptr, len, off);
+		if (rc > 0) {
+			ptr += rc;
+			len -= rc;
+			if (off != -1)
+				off += rc;
+		} else if (rc == 0) {
+			return EIO;
+		} else if (ErrCode() != EINTR) {
+			return ErrCode();
+		}
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Add the digest of a page to the digest of a whole copy. */
+static mdb_hash_t
+mdb_incr_sum(void *page, size_t psize, mdb_hash_t *total)
+{
+	MDB_val val;
+	mdb_hash_t h;
+
+	val.mv_data = page;
+	val.mv_size = psize;
+	h = mdb_hash_val(&val, MDB_HASH_INIT);
+	val.mv_data = &h;
+	val.mv_size = sizeof(h);
+	*total = mdb_hash_val(&val, *total);
+	return h;
+}
+#endif
+
+int ESECT
+mdb_env_copyincr(MDB_env *env, HANDLE fd, HANDLE osums, HANDLE nsums)
+{
+#ifdef _WIN32
+	return ERROR_NOT_SUPPORTED;
+#else
+	MDB_txn *txn = NULL;
+	mdb_mutexref_t wmutex = NULL;
+	mdb_copy_pace pace = {0};
+	MDB_incr hdr, ohdr;
+	mdb_hash_t total = MDB_HASH_INIT, *osum, *nsum;
+	size_t psize = env->me_psize, wlen = 0, fsize;
+	pgno_t pgno, pg, i, n, k, chunk = MDB_WBUF / sizeof(mdb_hash_t);
+	char *buf, *metas, *page;
+	int rc;
+
+	buf = malloc(MDB_WBUF * 3 + NUM_METAS * psize);
+	if (!buf)
+		return ENOMEM;
+	osum = (mdb_hash_t *)(buf + MDB_WBUF);
+	nsum = (mdb_hash_t *)(buf + MDB_WBUF * 2);
+	metas = buf + MDB_WBUF * 3;
+
+	/* Take the meta pages along with the snapshot, like mdb_env_copyfd0() */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		goto leave;
+	if (env->me_txns) {
+		mdb_txn_end(txn, MDB_END_RESET_TMP);
+		wmutex = env->me_wmutex;
+		if (LOCK_MUTEX(rc, env, wmutex))
+			goto leave;
+		rc = mdb_txn_renew0(txn);
+		if (rc == MDB_SUCCESS)
+			memcpy(metas, env->me_map, NUM_METAS * psize);
+		UNLOCK_MUTEX(wmutex);
+		if (rc)
+			goto leave;
+	} else {
+		memcpy(metas, env->me_map, NUM_METAS * psize);
+	}
+
+	memset(&ohdr, 0, sizeof(ohdr));
+	if (osums != INVALID_HANDLE_VALUE) {
+		rc = mdb_incr_read(osums, &ohdr, sizeof(ohdr), -1);
+		if (rc)
+			goto leave;
+		if (ohdr.mi_magic != MDB_SUMS_MAGIC || ohdr.mi_psize != psize ||
+			ohdr.mi_txnid > txn->mt_txnid) {
+			rc = MDB_INVALID;
+			goto leave;
+		}
+	}
+
+	if ((rc = mdb_fsize(env->me_fd, &fsize)))
+		goto leave;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.mi_psize = psize;
+	hdr.mi_txnid = txn->mt_txnid;
+	hdr.mi_npages = txn->mt_next_pgno;
+	if (hdr.mi_npages > fsize / psize)
+		hdr.mi_npages = fsize / psize;
+	hdr.mi_magic = MDB_SUMS_MAGIC;
+	rc = mdb_incr_write(nsums, &hdr, sizeof(hdr), -1);
+	if (rc)
+		goto leave;
+	hdr.mi_magic = MDB_INCR_MAGIC;
+	hdr.mi_base = ohdr.mi_txnid;
+	memcpy(buf, &hdr, sizeof(hdr));
+	wlen = sizeof(hdr);
+
+	pace.cp_env = env;
+	pace.cp_total = hdr.mi_npages * psize;
+	pace.cp_start = mdb_env_cclock();
+
+	for (pgno = 0; pgno < hdr.mi_npages; pgno += n) {
+		n = hdr.mi_npages - pgno;
+		if (n > chunk)
+			n = chunk;
+		/* Digests of these pages in the previous copy */
+		k = 0;
+		if (pgno < ohdr.mi_npages) {
+			k = ohdr.mi_npages - pgno;
+			if (k > n)
+				k = n;
+			rc = mdb_incr_read(osums, osum, k * sizeof(mdb_hash_t), -1);
+			if (rc)
+				goto leave;
+		}
+		for (i = 0; i < n; i++) {
+			pg = pgno + i;
+			if (wlen + sizeof(pg) + psize > MDB_WBUF) {
+				rc = mdb_incr_write(fd, buf, wlen, -1);
+				if (rc)
+					goto leave;
+				wlen = 0;
+			}
+			/* Digest the copy taken, not the map: a page which is free
+			 * in this snapshot may be rewritten meanwhile.
+			 */
+			page = buf + wlen + sizeof(pg);
+			memcpy(page, pg < NUM_METAS ? metas + pg * psize :
+				env->me_map + pg * psize, psize);
+			nsum[i] = mdb_incr_sum(page, psize, &total);
+			if (pg >= NUM_METAS && i < k && osum[i] == nsum[i])
+				continue;
+			memcpy(buf + wlen, &pg, sizeof(pg));
+			wlen += sizeof(pg) + psize;
+		}
+		rc = mdb_incr_write(nsums, nsum, n * sizeof(mdb_hash_t), -1);
+		if (rc)
+			goto leave;
+		/* Pace the scan, the pages written are only a fraction of it */
+		rc = mdb_env_cpace(&pace, n * psize);
+		if (rc)
+			goto leave;
+	}
+
+	if (wlen + sizeof(pg) + sizeof(total) > MDB_WBUF) {
+		rc = mdb_incr_write(fd, buf, wlen, -1);
+		if (rc)
+			goto leave;
+		wlen = 0;
+	}
+	pg = P_INVALID;
+	memcpy(buf + wlen, &pg, sizeof(pg));
+	memcpy(buf + wlen + sizeof(pg), &total, sizeof(total));
+	rc = mdb_incr_write(fd, buf, wlen + sizeof(pg) + sizeof(total), -1);
+
+leave:
+	_mdb_txn_abort(txn);
+	free(buf);
+	return rc;
+#endif
+}
+
+int ESECT
+mdb_incr_apply(HANDLE fd, HANDLE dst, unsigned int flags)
+{
+#ifdef _WIN32
+	return ERROR_NOT_SUPPORTED;
+#else
+	MDB_incr hdr;
+	MDB_page *mp;
+	MDB_meta *m;
+	mdb_hash_t digest, total = MDB_HASH_INIT;
+	txnid_t txnid = 0;
+	size_t psize, fsize;
+	pgno_t pgno, i, n, chunk;
+	unsigned metas = 0;
+	char *buf, *mbuf;
+	int rc, wiped = 0;
+
+	rc = mdb_incr_read(fd, &hdr, sizeof(hdr), -1);
+	if (rc)
+		return rc;
+	psize = hdr.mi_psize;
+	if (hdr.mi_magic != MDB_INCR_MAGIC || psize < sizeof(MDB_page) * 2 ||
+		psize > MAX_PAGESIZE || hdr.mi_npages < NUM_METAS)
+		return MDB_INVALID;
+	chunk = MDB_WBUF / psize;
+	buf = malloc(MDB_WBUF + NUM_METAS * psize);
+	if (!buf)
+		return ENOMEM;
+	mbuf = buf + MDB_WBUF;
+
+	/* It must continue from the snapshot the copy holds now */
+	if ((rc = mdb_fsize(dst, &fsize)))
+		goto leave;
+	if (fsize) {
+		rc = mdb_incr_read(dst, mbuf, NUM_METAS * psize, 0);
+		if (rc)
+			goto leave;
+		for (i = 0; i < NUM_METAS; i++) {
+			mp = (MDB_page *)(mbuf + i * psize);
+			m = METADATA(mp);
+			if (!F_ISSET(mp->mp_flags, P_META) || m->mm_magic != MDB_MAGIC ||
+				m->mm_psize != psize) {
+				rc = MDB_INVALID;
+				goto leave;
+			}
+			if (m->mm_txnid > txnid)
+				txnid = m->mm_txnid;
+		}
+	}
+	if (txnid != hdr.mi_base) {
+		rc = MDB_INCOMPATIBLE;
+		goto leave;
+	}
+
+	/* Data pages go in place, the meta pages last. The copy holds
+	 * neither snapshot in between, so its meta pages are wiped before
+	 * the first data page is written: if this is interrupted, the copy
+	 * fails to open instead of presenting a mix of both.
+	 */
+	for (;;) {
+		rc = mdb_incr_read(fd, &pgno, sizeof(pgno), -1);
+		if (rc)
+			goto leave;
+		if (pgno == P_INVALID)
+			break;
+		if (pgno >= hdr.mi_npages) {
+			rc = MDB_INVALID;
+			goto leave;
+		}
+		if (pgno < NUM_METAS) {
+			rc = mdb_incr_read(fd, mbuf + pgno * psize, psize, -1);
+			metas |= 1U << pgno;
+		} else {
+			if (fsize && !wiped) {
+				memset(buf, 0, NUM_METAS * psize);
+				rc = mdb_incr_write(dst, buf, NUM_METAS * psize, 0);
+				if (rc)
+					goto leave;
+				if (MDB_FDATASYNC(dst)) {
+					rc = ErrCode();
+					goto leave;
+				}
+				wiped = 1;
+			}
+			rc = mdb_incr_read(fd, buf, psize, -1);
+			if (rc == MDB_SUCCESS)
+				rc = mdb_incr_write(dst, buf, psize, (off_t)pgno * psize);
+		}
+		if (rc)
+			goto leave;
+	}
+	rc = mdb_incr_read(fd, &digest, sizeof(digest), -1);
+	if (rc)
+		goto leave;
+	if (metas != (1U << NUM_METAS) - 1) {
+		rc = MDB_INVALID;
+		goto leave;
+	}
+	if (ftruncate(dst, (off_t)hdr.mi_npages * psize) || MDB_FDATASYNC(dst)) {
+		rc = ErrCode();
+		goto leave;
+	}
+	rc = mdb_incr_write(dst, mbuf, NUM_METAS * psize, 0);
+	if (rc)
+		goto leave;
+	if (MDB_FDATASYNC(dst)) {
+		rc = ErrCode();
+		goto leave;
+	}
+
+	if (flags & MDB_CP_VERIFY) {
+		for (pgno = 0; pgno < hdr.mi_npages; pgno += n) {
+			n = hdr.mi_npages - pgno;
+			if (n > chunk)
+				n = chunk;
+			rc = mdb_incr_read(dst, buf, n * psize, (off_t)pgno * psize);
+			if (rc)
+				goto leave;
+			for (i = 0; i < n; i++)
+				mdb_incr_sum(buf + i * psize, psize, &total);
+		}
+		if (total != digest)
+			rc = MDB_CORRUPTED;
+	}
+
+leave:
+	free(buf);
+	return rc;
+#endif
+}
+
 int ESECT
 mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
 {
@@ -20,6 +20,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 #include "lmdb.h"
 
 static void
@@ -27,28 +32,120 @@ sighandle(int sig)
 {
 }
 
+static int
+progress(MDB_env *env, size_t done, size_t total, void *ctx)
+{
+	int *last = ctx, pct = total ? (int)((double)done * 100 / total) : 100;
+
+	if (pct != *last) {
+		*last = pct;
+		fprintf(stderr, "\r%3d%% of %luMB", pct, (unsigned long)(total >> 20));
+		if (done >= total)
+			fputc('\n', stderr);
+	}
+	return 0;
+}
+
+/* Parse a number of bytes, with an optional k, m or g suffix */
+static int
+getsize(const char *str, size_t *res)
+{
+	char *end;
+	unsigned long val = strtoul(str, &end, 10);
+
+	switch (*end) {
+	case 'g': case 'G':
+		val <<= 10;
+		/* FALLTHRU */
+	case 'm': case 'M':
+		val <<= 10;
+		/* FALLTHRU */
+	case 'k': case 'K':
+		val <<= 10;
+		end++;
+	}
+	*res = val;
+	return end == str || *end;
+}
+
+/* Write an incremental copy to dstpath or stdout, and the digests
+ * of its pages to nsums. Remove them if it fails.
+ */
+static int
+incrcopy(MDB_env *env, const char *dstpath, const char *osums, const char *nsums)
+{
+#ifdef _WIN32
+	return ERROR_NOT_SUPPORTED;
+#else
+	int rc = MDB_SUCCESS, fd = MDB_STDOUT, ofd = -1, nfd = -1;
+
+	if (dstpath && (fd = open(dstpath, O_WRONLY|O_CREAT|O_EXCL, 0600)) < 0)
+		return errno;
+	if (osums && (ofd = open(osums, O_RDONLY)) < 0)
+		rc = errno;
+	if (!rc && (nfd = open(nsums, O_WRONLY|O_CREAT|O_EXCL, 0600)) < 0)
+		rc = errno;
+	if (!rc)
+		rc = mdb_env_copyincr(env, fd, ofd, nfd);
+	if (nfd >= 0 && close(nfd) < 0 && !rc)
+		rc = errno;
+	if (fd != MDB_STDOUT && close(fd) < 0 && !rc)
+		rc = errno;
+	if (ofd >= 0)
+		close(ofd);
+	if (rc) {
+		if (nfd >= 0)
+			unlink(nsums);
+		if (dstpath)
+			unlink(dstpath);
+	}
+	return rc;
+#endif
+}
+
 int main(int argc,char * argv[])
 {
 	int rc;
 	MDB_env *env;
 	const char *progname = argv[0], *act;
 	unsigned flags = MDB_RDONLY;
-	unsigned cpflags = 0;
+	unsigned cpflags = 0, threads = 0;
+	size_t rate = 0;
+	int verbose = 0, last = -1;
+	char *end, *osums = NULL, *nsums = NULL;
 
 	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
 		if (argv[1][1] == 'n' && argv[1][2] == '\0')
 			flags |= MDB_NOSUBDIR;
 		else if (argv[1][1] == 'c' && argv[1][2] == '\0')
 			cpflags |= MDB_CP_COMPACT;
-		else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
+		else if (argv[1][1] == 'v' && argv[1][2] == '\0')
+			verbose = 1;
+		else if (argv[1][1] == 'j' && argv[1][2] == '\0' && argc > 2) {
+			threads = strtoul(argv[2], &end, 10);
+			if (end == argv[2] || *end)
+				argc = 0;
+			argc--, argv++;
+		} else if (argv[1][1] == 'r' && argv[1][2] == '\0' && argc > 2) {
+			if (getsize(argv[2], &rate))
+				argc = 0;
+			argc--, argv++;
+		} else if (argv[1][1] == 'i' && argv[1][2] == '\0' && argc > 2) {
+			osums = argv[2];
+			argc--, argv++;
+		} else if (argv[1][1] == 's' && argv[1][2] == '\0' && argc > 2) {
+			nsums = argv[2];
+			argc--, argv++;
+		} else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
 			printf("%s\n", MDB_VERSION_STRING);
 			exit(0);
 		} else
 			argc = 0;
 	}
 
-	if (argc<2 || argc>3) {
-		fprintf(stderr, "usage: %s [-V] [-c] [-n] srcpath [dstpath]\n", progname);
+	if (argc<2 || argc>3 || (osums && !nsums) ||
+		(nsums && (cpflags & MDB_CP_COMPACT))) {
+		fprintf(stderr, "usage: %s [-V] [-c] [-n] [-v] [-j threads] [-r rate] [-i oldsums] [-s sums] srcpath [dstpath]\n", progname);
 		exit(EXIT_FAILURE);
 	}
 
@@ -66,9 +163,16 @@ int main(int argc,char * argv[])
 	if (rc == MDB_SUCCESS) {
 		rc = mdb_env_open(env, argv[1], flags, 0600);
 	}
+	if (rc == MDB_SUCCESS) {
+		mdb_env_set_copyopts(env, threads, rate);
+		if (verbose)
+			mdb_env_set_copyfunc(env, progress, &last);
+	}
 	if (rc == MDB_SUCCESS) {
 		act = "copying";
-		if (argc == 2)
+		if (nsums)
+			rc = incrcopy(env, argc == 3 ? argv[2] : NULL, osums, nsums);
+		else if (argc == 2)
 			rc = mdb_env_copyfd2(env, MDB_STDOUT, cpflags);
 		else
 			rc = mdb_env_copy2(env, argv[2], cpflags);
@@ -0,0 +1,171 @@
+/* mdb_patch.c - memory-mapped database incremental restore tool */
+/*
+ * Copyright 2012-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include "lmdb.h"
+
+#ifndef _WIN32
+	/* Copy the file at path, if any, to dst */
+static int stage(const char *path, int dst)
+{
+	char buf[65536], *ptr;
+	ssize_t len, wlen;
+	int src, rc = MDB_SUCCESS;
+
+	if ((src = open(path, O_RDONLY)) < 0)
+		return errno == ENOENT ? MDB_SUCCESS : errno;
+	while ((len = read(src, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			rc = errno;
+			break;
+		}
+		for (ptr = buf; len; ptr += wlen, len -= wlen) {
+			if ((wlen = write(dst, ptr, len)) < 0) {
+				if (errno == EINTR) {
+					wlen = 0;
+					continue;
+				}
+				rc = errno;
+				break;
+			}
+		}
+		if (rc)
+			break;
+	}
+	close(src);
+	return rc;
+}
+
+	/* Sync the directory holding path, so a rename into it sticks */
+static int sync_dir(const char *path)
+{
+	char *dir, *slash;
+	int fd, rc = MDB_SUCCESS;
+
+	dir = strdup(path);
+	if (!dir)
+		return ENOMEM;
+	slash = strrchr(dir, '/');
+	if (slash == dir)
+		slash[1] = '\0';
+	else if (slash)
+		*slash = '\0';
+	else
+		strcpy(dir, ".");
+	if ((fd = open(dir, O_RDONLY)) < 0 || fsync(fd) < 0)
+		rc = errno;
+	if (fd >= 0)
+		close(fd);
+	free(dir);
+	return rc;
+}
+#endif
+
+int main(int argc,char * argv[])
+{
+	int rc;
+	const char *progname = argv[0], *act;
+	unsigned flags = 0;
+	int subdir = 1;
+	char *path;
+
+	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+		if (argv[1][1] == 'n' && argv[1][2] == '\0')
+			subdir = 0;
+		else if (argv[1][1] == 'v' && argv[1][2] == '\0')
+			flags |= MDB_CP_VERIFY;
+		else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
+			printf("%s\n", MDB_VERSION_STRING);
+			exit(0);
+		} else
+			argc = 0;
+	}
+
+	if (argc<2 || argc>3) {
+		fprintf(stderr, "usage: %s [-V] [-n] [-v] dstpath [incrpath]\n", progname);
+		exit(EXIT_FAILURE);
+	}
+
+#ifdef _WIN32
+	act = "patching";
+	rc = ERROR_NOT_SUPPORTED;
+	path = NULL;
+#else
+	{
+	int fd = 0, dst = -1;
+	char *tmp;
+
+	path = argv[1];
+	if (subdir) {
+		path = malloc(strlen(argv[1]) + sizeof("/data.mdb"));
+		if (!path) {
+			fprintf(stderr, "%s: out of memory\n", progname);
+			exit(EXIT_FAILURE);
+		}
+		sprintf(path, "%s/data.mdb", argv[1]);
+	}
+	/* Patch a duplicate, the copy is only replaced once that worked */
+	tmp = malloc(strlen(path) + sizeof(".patch"));
+	if (!tmp) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmp, "%s.patch", path);
+	act = "opening incremental copy";
+	rc = MDB_SUCCESS;
+	if (argc == 3 && (fd = open(argv[2], O_RDONLY)) < 0)
+		rc = errno;
+	if (rc == MDB_SUCCESS) {
+		act = "duplicating copy";
+		if ((dst = open(tmp, O_RDWR|O_CREAT|O_TRUNC, 0600)) < 0)
+			rc = errno;
+		else
+			rc = stage(path, dst);
+	}
+	if (rc == MDB_SUCCESS) {
+		act = "patching";
+		rc = mdb_incr_apply(fd, dst, flags);
+	}
+	if (dst >= 0 && close(dst) < 0 && !rc)
+		rc = errno;
+	if (rc == MDB_SUCCESS) {
+		act = "replacing copy";
+		if (rename(tmp, path) < 0)
+			rc = errno;
+		else
+			rc = sync_dir(path);
+	} else if (dst >= 0) {
+		unlink(tmp);
+	}
+	if (fd > 0)
+		close(fd);
+	free(tmp);
+	if (subdir)
+		free(path);
+	}
+#endif
+	if (rc)
+		fprintf(stderr, "%s: %s failed, error %d (%s)\n",
+			progname, act, rc, mdb_strerror(rc));
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+/* mtest7.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for overflow page allocation in a fragmented freelist */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	4000
+#define PGSIZE	4000	/* a bit less than a page, so N chunks need N pages */
+#define ROUNDS	8
+
+static int sizes[NKEYS], gens[NKEYS], saved[2][NKEYS];
+static char buf[32*PGSIZE];
+
+static void put(MDB_txn *txn, MDB_dbi dbi, int i, int size, int gen)
+{
+	int rc;
+	MDB_val key, data;
+
+	key.mv_size = sizeof(i);
+	key.mv_data = &i;
+	data.mv_size = size;
+	data.mv_data = buf;
+	memset(buf, (i + gen) & 0xff, size);
+	E(mdb_put(txn, dbi, &key, &data, 0));
+	sizes[i] = size;
+	gens[i] = gen;
+}
+
+static void del(MDB_txn *txn, MDB_dbi dbi, int i)
+{
+	int rc;
+	MDB_val key;
+
+	key.mv_size = sizeof(i);
+	key.mv_data = &i;
+	E(mdb_del(txn, dbi, &key, NULL));
+	sizes[i] = 0;
+}
+
+static void verify(MDB_env *env, MDB_dbi dbi)
+{
+	int i, j, rc, n = 0;
+	MDB_val key, data;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	unsigned char *p;
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_cursor_open(txn, dbi, &cursor));
+	while ((rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
+		i = *(int *)key.mv_data;
+		CHECK(i >= 0 && i < NKEYS && sizes[i], "unexpected key");
+		CHECK(data.mv_size == (size_t)sizes[i], "wrong size");
+		for (p = data.mv_data, j = 0; j < sizes[i]; j++)
+			CHECK(p[j] == ((i + gens[i]) & 0xff), "corrupted data");
+		n++;
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	for (i = 0; i < NKEYS; i++)
+		if (sizes[i])
+			n--;
+	CHECK(n == 0, "missing keys");
+}
+
+int main(int argc,char * argv[])
+{
+	int i, r, rc;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn, *child;
+	MDB_envinfo info;
+	size_t lastpg = 0;
+	clock_t start;
+
+	srand(time(NULL));
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 1024*1024*1024));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	/* Fill with overflow values of 1 to 13 pages */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, MDB_INTEGERKEY, &dbi));
+	for (i = 0; i < NKEYS; i++)
+		put(txn, dbi, i, (1 + i % 13) * PGSIZE, 0);
+	E(mdb_txn_commit(txn));
+
+	/* Punch holes of every size */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	for (i = 1; i < NKEYS; i += 2)
+		del(txn, dbi, i);
+	E(mdb_txn_commit(txn));
+	verify(env, dbi);
+	E(mdb_env_info(env, &info));
+	printf("Fragmented %zu pages\n", info.me_last_pgno);
+
+	for (r = 1; r <= ROUNDS; r++) {
+		start = clock();
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		/* Refill the holes with differently sized values */
+		for (i = 1; i < NKEYS; i += 2)
+			put(txn, dbi, i, (1 + rand() % 17) * PGSIZE, r);
+		/* Overwrite some of them again, returning dirty pages */
+		for (i = 1; i < NKEYS; i += 14)
+			put(txn, dbi, i, (1 + rand() % 17) * PGSIZE, r + ROUNDS);
+		/* A child allocates and is discarded */
+		memcpy(saved[0], sizes, sizeof(sizes));
+		memcpy(saved[1], gens, sizeof(gens));
+		E(mdb_txn_begin(env, txn, 0, &child));
+		for (i = 3; i < NKEYS; i += 10)
+			put(child, dbi, i, (1 + rand() % 29) * PGSIZE, r + 2 * ROUNDS);
+		mdb_txn_abort(child);
+		memcpy(sizes, saved[0], sizeof(sizes));
+		memcpy(gens, saved[1], sizeof(gens));
+		/* A child allocates and is kept */
+		E(mdb_txn_begin(env, txn, 0, &child));
+		for (i = 5; i < NKEYS; i += 10)
+			put(child, dbi, i, (1 + rand() % 29) * PGSIZE, r + 3 * ROUNDS);
+		E(mdb_txn_commit(child));
+		E(mdb_txn_commit(txn));
+		verify(env, dbi);
+
+		/* And punch new holes */
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		for (i = 1; i < NKEYS; i += 2)
+			del(txn, dbi, i);
+		E(mdb_txn_commit(txn));
+		E(mdb_env_info(env, &info));
+		printf("Round %d: %zu pages, %ld ms\n", r, info.me_last_pgno,
+			(long)((clock() - start) * 1000 / CLOCKS_PER_SEC));
+		if (r == ROUNDS/2)
+			lastpg = info.me_last_pgno;
+	}
+	verify(env, dbi);
+	/* Once settled, holes should be reused rather than growing the file */
+	CHECK(info.me_last_pgno <= lastpg + lastpg/10, "freelist not reused");
+
+	mdb_dbi_close(env, dbi);
+	mdb_env_close(env);
+
+	return 0;
+}
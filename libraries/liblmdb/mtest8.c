@@ -0,0 +1,197 @@
+/* mtest8.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for compacting copy with several walker threads */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	20000
+
+static const char *names[] = { "plain", "big", "dups", "empty", NULL };
+static char buf[5*4096];
+static size_t lastdone, lasttotal;
+
+static int progress(MDB_env *env, size_t done, size_t total, void *ctx)
+{
+	int rc = 0;
+
+	CHECK(done > lastdone && done <= total, "progress");
+	lastdone = done;
+	lasttotal = total;
+	return 0;
+}
+
+/* Check that every DB of the copy in path has the same data as in env */
+static void compare(MDB_env *env, const char *path)
+{
+	int i, j, rc;
+	MDB_env *env2;
+	MDB_txn *txn, *txn2;
+	MDB_dbi dbi, dbi2;
+	MDB_cursor *cur, *cur2;
+	MDB_val key, data, key2, data2;
+	MDB_stat st, st2;
+
+	E(mdb_env_create(&env2));
+	E(mdb_env_set_maxdbs(env2, 8));
+	E(mdb_env_open(env2, path, MDB_RDONLY, 0664));
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_txn_begin(env2, NULL, MDB_RDONLY, &txn2));
+	for (i = -1; names[i+1] || i < 0; i++) {
+		const char *name = i < 0 ? NULL : names[i];
+		E(mdb_dbi_open(txn, name, 0, &dbi));
+		E(mdb_dbi_open(txn2, name, 0, &dbi2));
+		E(mdb_stat(txn, dbi, &st));
+		E(mdb_stat(txn2, dbi2, &st2));
+		CHECK(st.ms_entries == st2.ms_entries, "entries differ");
+		CHECK(st.ms_leaf_pages == st2.ms_leaf_pages, "leaf pages differ");
+		E(mdb_cursor_open(txn, dbi, &cur));
+		E(mdb_cursor_open(txn2, dbi2, &cur2));
+		while ((rc = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) == 0) {
+			E(mdb_cursor_get(cur2, &key2, &data2, MDB_NEXT));
+			CHECK(key.mv_size == key2.mv_size &&
+				!memcmp(key.mv_data, key2.mv_data, key.mv_size), "key differs");
+			/* Records of named DBs hold their roots, which differ */
+			for (j = 0; !name && names[j]; j++)
+				if (key.mv_size == strlen(names[j]) &&
+					!memcmp(key.mv_data, names[j], key.mv_size))
+					break;
+			if (name || !names[j])
+				CHECK(data.mv_size == data2.mv_size &&
+					!memcmp(data.mv_data, data2.mv_data, data.mv_size), "data differs");
+		}
+		CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+		CHECK(mdb_cursor_get(cur2, &key2, &data2, MDB_NEXT) == MDB_NOTFOUND, "extra data");
+		mdb_cursor_close(cur);
+		mdb_cursor_close(cur2);
+	}
+	mdb_txn_abort(txn2);
+	mdb_txn_abort(txn);
+	mdb_env_close(env2);
+}
+
+int main(int argc,char * argv[])
+{
+	int i, j, rc, fd;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	MDB_val key, data;
+	MDB_envinfo info, info2;
+	char kbuf[32];
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 8));
+	E(mdb_env_set_mapsize(env, 1024*1024*1024));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	memset(buf, 'x', sizeof(buf));
+	key.mv_data = kbuf;
+	data.mv_data = buf;
+	/* A plain DB, large enough to be split among the walkers */
+	E(mdb_dbi_open(txn, "plain", MDB_CREATE, &dbi));
+	for (i = 0; i < NKEYS * 5; i++) {
+		key.mv_size = sprintf(kbuf, "%08x", i);
+		data.mv_size = 32 + i % 100;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	/* Overflow values */
+	E(mdb_dbi_open(txn, "big", MDB_CREATE, &dbi));
+	for (i = 0; i < NKEYS / 10; i++) {
+		key.mv_size = sprintf(kbuf, "%08x", i);
+		data.mv_size = 4000 + (i % 5) * 4000;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	/* Sorted duplicates, some in subtrees of their own */
+	E(mdb_dbi_open(txn, "dups", MDB_CREATE|MDB_DUPSORT, &dbi));
+	for (i = 0; i < NKEYS / 100; i++) {
+		key.mv_size = sprintf(kbuf, "%08x", i);
+		for (j = 0; j < (i % 10 ? 3 : 1000); j++) {
+			data.mv_size = sprintf(buf + 100, "%08x", j);
+			data.mv_data = buf + 100;
+			E(mdb_put(txn, dbi, &key, &data, 0));
+		}
+	}
+	data.mv_data = buf;
+	E(mdb_dbi_open(txn, "empty", MDB_CREATE, &dbi));
+	/* And plain records in the main DB */
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	for (i = 0; i < 100; i++) {
+		key.mv_size = sprintf(kbuf, "main%04d", i);
+		data.mv_size = i * 100;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	E(mdb_txn_commit(txn));
+
+	/* Leave some free pages behind */
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "plain", 0, &dbi));
+	for (i = 0; i < NKEYS * 5; i += 3) {
+		key.mv_size = sprintf(kbuf, "%08x", i);
+		E(mdb_del(txn, dbi, &key, NULL));
+	}
+	E(mdb_dbi_open(txn, "big", 0, &dbi));
+	for (i = 0; i < NKEYS / 10; i += 2) {
+		key.mv_size = sprintf(kbuf, "%08x", i);
+		E(mdb_del(txn, dbi, &key, NULL));
+	}
+	E(mdb_txn_commit(txn));
+
+	mkdir("./testdb/copy1", 0775);
+	mkdir("./testdb/copy2", 0775);
+	mkdir("./testdb/copy3", 0775);
+	E(mdb_env_copy2(env, "./testdb/copy1", MDB_CP_COMPACT));
+	compare(env, "./testdb/copy1");
+
+	E(mdb_env_set_copyopts(env, 4, 0));
+	E(mdb_env_copy2(env, "./testdb/copy2", MDB_CP_COMPACT));
+	compare(env, "./testdb/copy2");
+
+	/* A file descriptor is left at the end of the copy */
+	E(mdb_env_set_copyfunc(env, progress, NULL));
+	fd = open("./testdb/copy3/data.mdb", O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	CHECK(fd >= 0, "open");
+	E(mdb_env_copyfd2(env, fd, MDB_CP_COMPACT));
+	CHECK(lseek(fd, 0, SEEK_CUR) == (off_t)lasttotal, "file offset");
+	close(fd);
+	CHECK(lastdone == lasttotal, "progress incomplete");
+	compare(env, "./testdb/copy3");
+
+	/* The copies have all the pages in use and nothing else */
+	for (i = 1; i <= 3; i++) {
+		MDB_env *env2;
+		sprintf(kbuf, "./testdb/copy%d", i);
+		E(mdb_env_create(&env2));
+		E(mdb_env_open(env2, kbuf, MDB_RDONLY, 0664));
+		E(mdb_env_info(env2, i == 1 ? &info : &info2));
+		mdb_env_close(env2);
+		CHECK(info.me_last_pgno == info2.me_last_pgno || i == 1, "copies differ in size");
+	}
+	printf("Compacted to %zu pages\n", info.me_last_pgno + 1);
+
+	mdb_env_close(env);
+
+	return 0;
+}
@@ -0,0 +1,186 @@
+/* mtest9.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for incremental copies */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	20000
+
+static char buf[4096];
+
+/* Write records first..last-1 of DB, or delete them */
+static void put(MDB_env *env, int first, int last, int del)
+{
+	int i, rc;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	char kbuf[32];
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	key.mv_data = kbuf;
+	data.mv_data = buf;
+	for (i = first; i < last; i++) {
+		key.mv_size = sprintf(kbuf, "%08x", i);
+		data.mv_size = 32 + i % 200;
+		if (del)
+			E(mdb_del(txn, dbi, &key, NULL));
+		else
+			E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	E(mdb_txn_commit(txn));
+}
+
+/* Make an incremental copy of env into path, return its size */
+static off_t incr(MDB_env *env, const char *path, const char *osums,
+	const char *nsums)
+{
+	int rc = 0, fd, ofd = -1, nfd;
+	struct stat st;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	CHECK(fd >= 0, "open");
+	if (osums) {
+		ofd = open(osums, O_RDONLY);
+		CHECK(ofd >= 0, "open");
+	}
+	nfd = open(nsums, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	CHECK(nfd >= 0, "open");
+	E(mdb_env_copyincr(env, fd, ofd, nfd));
+	CHECK(fstat(fd, &st) == 0, "fstat");
+	close(nfd);
+	if (ofd >= 0)
+		close(ofd);
+	close(fd);
+	return st.st_size;
+}
+
+/* Apply the incremental copy in path to the copy in testdb/copy */
+static int apply(const char *path)
+{
+	int rc = 0, fd, dst;
+
+	fd = open(path, O_RDONLY);
+	CHECK(fd >= 0, "open");
+	dst = open("./testdb/copy/data.mdb", O_RDWR|O_CREAT, 0664);
+	CHECK(dst >= 0, "open");
+	rc = mdb_incr_apply(fd, dst, MDB_CP_VERIFY);
+	close(dst);
+	close(fd);
+	return rc;
+}
+
+/* Check that the copy has the same data as env */
+static void compare(MDB_env *env)
+{
+	int rc;
+	MDB_env *env2;
+	MDB_txn *txn, *txn2;
+	MDB_dbi dbi;
+	MDB_cursor *cur, *cur2;
+	MDB_val key, data, key2, data2;
+	MDB_envinfo info, info2;
+
+	E(mdb_env_create(&env2));
+	E(mdb_env_open(env2, "./testdb/copy", MDB_RDONLY, 0664));
+	E(mdb_env_info(env, &info));
+	E(mdb_env_info(env2, &info2));
+	CHECK(info.me_last_txnid == info2.me_last_txnid, "txnids differ");
+	CHECK(info.me_last_pgno == info2.me_last_pgno, "sizes differ");
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_txn_begin(env2, NULL, MDB_RDONLY, &txn2));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	E(mdb_cursor_open(txn, dbi, &cur));
+	E(mdb_cursor_open(txn2, dbi, &cur2));
+	while ((rc = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) == 0) {
+		E(mdb_cursor_get(cur2, &key2, &data2, MDB_NEXT));
+		CHECK(key.mv_size == key2.mv_size &&
+			!memcmp(key.mv_data, key2.mv_data, key.mv_size), "key differs");
+		CHECK(data.mv_size == data2.mv_size &&
+			!memcmp(data.mv_data, data2.mv_data, data.mv_size), "data differs");
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	CHECK(mdb_cursor_get(cur2, &key2, &data2, MDB_NEXT) == MDB_NOTFOUND, "extra data");
+	mdb_cursor_close(cur);
+	mdb_cursor_close(cur2);
+	mdb_txn_abort(txn2);
+	mdb_txn_abort(txn);
+	mdb_env_close(env2);
+}
+
+int main(int argc,char * argv[])
+{
+	int rc, fd, nfd;
+	MDB_env *env;
+	off_t full, part;
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 1024*1024*1024));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+	memset(buf, 'x', sizeof(buf));
+	put(env, 0, NKEYS, 0);
+	mkdir("./testdb/copy", 0775);
+
+	/* Without digests every page is copied, onto an empty file */
+	full = incr(env, "./testdb/incr1", NULL, "./testdb/sums1");
+	E(apply("./testdb/incr1"));
+	compare(env);
+
+	/* A few changes only copy a few pages */
+	buf[0] = 'y';
+	put(env, NKEYS / 2, NKEYS / 2 + 10, 0);
+	put(env, NKEYS, NKEYS + 50, 0);
+	put(env, 0, 20, 1);
+	part = incr(env, "./testdb/incr2", "./testdb/sums1", "./testdb/sums2");
+	CHECK(part * 10 < full, "increment too large");
+	E(apply("./testdb/incr2"));
+	compare(env);
+
+	/* Increments must be applied in order */
+	put(env, NKEYS * 2, NKEYS * 3, 0);
+	incr(env, "./testdb/incr3", "./testdb/sums2", "./testdb/sums3");
+	put(env, NKEYS * 2, NKEYS * 2 + 100, 1);
+	incr(env, "./testdb/incr4", "./testdb/sums3", "./testdb/sums4");
+	CHECK(RES(MDB_INCOMPATIBLE, apply("./testdb/incr2")), "reapplied");
+	CHECK(RES(MDB_INCOMPATIBLE, apply("./testdb/incr4")), "skipped");
+	E(apply("./testdb/incr3"));
+	E(apply("./testdb/incr4"));
+	compare(env);
+
+	/* Anything else than digests is refused */
+	fd = open("./testdb/incr1", O_RDONLY);
+	CHECK(fd >= 0, "open");
+	nfd = open("./testdb/sums5", O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	CHECK(nfd >= 0, "open");
+	CHECK(RES(MDB_INVALID, mdb_env_copyincr(env, nfd, fd, nfd)), "bad digests");
+	close(nfd);
+	close(fd);
+
+	printf("Full copy %ld bytes, increment %ld bytes\n", (long)full, (long)part);
+	mdb_env_close(env);
+
+	return 0;
+}
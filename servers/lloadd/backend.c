@@ -345,7 +345,10 @@ try_upstream(
         } else {
             b->b_counters[LLOAD_STATS_OPS_OTHER].lc_ops_received++;
         }
-        c->c_n_ops_executing++;
+        if ( !c->c_n_ops_executing++ ) {
+            /* Latency is measured from here while nothing comes back */
+            gettimeofday( &c->c_last_activity, NULL );
+        }
         c->c_counters.lc_ops_received++;
 
         *res = LDAP_SUCCESS;
@@ -379,6 +382,13 @@ backend_select(
         return 1;
     }
 
+    if ( op->o_csn && !backend_csn_covered( b, op->o_csn ) ) {
+        Debug( LDAP_DEBUG_CONNS, "backend_select: "
+                "backend %s has not caught up with the client's writes\n",
+                b->b_uri.bv_val );
+        return 0;
+    }
+
     if ( op->o_tag == LDAP_REQ_BIND
 #ifdef LDAP_API_FEATURE_VERIFY_CREDENTIALS
             && !(lload_features & LLOAD_FEATURE_VC)
@@ -428,6 +438,223 @@ upstream_select(
     return finished;
 }
 
+/*
+ * Extract the SID, the third field of a CSN.
+ */
+static int
+csn_sid( struct berval *csn, struct berval *sid )
+{
+    char *p = csn->bv_val, *end = csn->bv_val + csn->bv_len;
+    int i;
+
+    for ( i = 0; i < 2; i++ ) {
+        if ( !(p = memchr( p, '#', end - p )) ) {
+            return -1;
+        }
+        p++;
+    }
+    sid->bv_val = p;
+    if ( !(p = memchr( p, '#', end - p )) ) {
+        return -1;
+    }
+    sid->bv_len = p - sid->bv_val;
+    return 0;
+}
+
+/*
+ * Has b seen everything in csn? Each of its values has to be matched by a
+ * value from the same SID that is at least as recent.
+ */
+int
+backend_csn_covered( LloadBackend *b, BerVarray csn )
+{
+    struct berval sid, have_sid;
+    int i, j;
+
+    assert_locked( &b->b_mutex );
+
+    for ( i = 0; !BER_BVISNULL( &csn[i] ); i++ ) {
+        if ( csn_sid( &csn[i], &sid ) ) {
+            continue;
+        }
+        for ( j = 0; b->b_csn && !BER_BVISNULL( &b->b_csn[j] ); j++ ) {
+            if ( !csn_sid( &b->b_csn[j], &have_sid ) &&
+                    !ber_bvcmp( &sid, &have_sid ) ) {
+                break;
+            }
+        }
+        if ( !b->b_csn || BER_BVISNULL( &b->b_csn[j] ) ||
+                ber_bvcmp( &b->b_csn[j], &csn[i] ) < 0 ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+backend_csn_response(
+        LloadConnection *upstream,
+        LloadOperation *op,
+        BerElement *ber )
+{
+    LloadBackend *b = upstream->c_backend;
+    struct berval type;
+    BerVarray vals = NULL, csn = NULL;
+    ber_tag_t tag;
+    ber_len_t len;
+
+    tag = ber_peek_tag( ber, &len );
+    if ( tag == LDAP_RES_SEARCH_ENTRY ) {
+        if ( ber_scanf( ber, "{x{" /* "}}" */ ) != LBER_ERROR ) {
+            while ( ber_peek_tag( ber, &len ) == LBER_SEQUENCE ) {
+                if ( ber_scanf( ber, "{mW}", &type, &vals ) == LBER_ERROR ) {
+                    break;
+                }
+                if ( !csn && type.bv_len == STRLENOF("contextCSN") &&
+                        !strncasecmp( type.bv_val, "contextCSN",
+                                type.bv_len ) ) {
+                    csn = vals;
+                } else {
+                    ber_bvarray_free( vals );
+                }
+                vals = NULL;
+            }
+        }
+
+        /* Only installed once the search is known to have succeeded */
+        if ( csn ) {
+            ber_bvarray_free( op->o_csn );
+            op->o_csn = csn;
+        }
+    } else if ( tag == LDAP_RES_SEARCH_RESULT ) {
+        ber_int_t result;
+
+        if ( ber_scanf( ber, "{e" /* "}" */, &result ) == LBER_ERROR ) {
+            result = LDAP_OTHER;
+        }
+        Debug( LDAP_DEBUG_TRACE, "backend_csn_response: "
+                "backend %s contextCSN poll finished, result=%d%s\n",
+                b->b_uri.bv_val, result, op->o_csn ? "" : ", no contextCSN" );
+
+        checked_lock( &b->b_mutex );
+        if ( result == LDAP_SUCCESS && op->o_csn ) {
+            ber_bvarray_free( b->b_csn );
+            b->b_csn = op->o_csn;
+            op->o_csn = NULL;
+            b->b_csn_time = op->o_start;
+        } else if ( timercmp( &b->b_csn_poll, &op->o_start, == ) ) {
+            /* Nothing learnt, let the next update poll again */
+            b->b_csn_poll = b->b_csn_time;
+        }
+        checked_unlock( &b->b_mutex );
+
+        op->o_res = LLOAD_OP_COMPLETED;
+        OPERATION_UNLINK(op);
+    }
+
+    ber_free( ber, 1 );
+    return LDAP_SUCCESS;
+}
+
+/*
+ * Read the contextCSN of lload_write_coherence_csn off one of b's
+ * connections. Clients that have written to b can then be served by any
+ * backend that has caught up with the values seen after their write.
+ */
+void
+backend_csn_poll( LloadBackend *b )
+{
+    LloadOperation *op;
+    LloadConnection *upstream = NULL;
+    BerElement *output;
+    struct timeval now;
+    ber_int_t msgid;
+    epoch_t epoch;
+    char *message;
+    int res, rc;
+
+    if ( BER_BVISNULL( &lload_write_coherence_csn ) ) {
+        return;
+    }
+
+    gettimeofday( &now, NULL );
+
+    checked_lock( &b->b_mutex );
+    if ( timercmp( &b->b_csn_time, &b->b_csn_poll, != ) &&
+            now.tv_sec < b->b_csn_poll.tv_sec + LLOAD_CSN_POLL_TIMEOUT ) {
+        /* Previous one still running */
+        checked_unlock( &b->b_mutex );
+        return;
+    }
+    epoch = epoch_join();
+
+    op = ch_calloc( 1, sizeof(LloadOperation) );
+    op->o_tag = LDAP_REQ_SEARCH;
+    op->o_start = now;
+    op->o_response_cb = backend_csn_response;
+    ldap_pvt_thread_mutex_init( &op->o_link_mutex );
+    op->o_refcnt = 1;
+
+    backend_select( b, op, &upstream, &res, &message );
+    if ( !upstream ) {
+        checked_unlock( &b->b_mutex );
+        epoch_leave( epoch );
+        ldap_pvt_thread_mutex_destroy( &op->o_link_mutex );
+        ch_free( op );
+        return;
+    }
+    b->b_csn_poll = now;
+    checked_unlock( &b->b_mutex );
+
+    CONNECTION_ASSERT_LOCKED(upstream);
+    assert_locked( &upstream->c_io_mutex );
+    op->o_upstream = upstream;
+    op->o_upstream_connid = upstream->c_connid;
+    op->o_res = LLOAD_OP_FAILED;
+
+    if ( (output = ber_alloc()) == NULL ) {
+        upstream->c_n_ops_executing--;
+        CONNECTION_UNLOCK(upstream);
+        checked_unlock( &upstream->c_io_mutex );
+
+        checked_lock( &b->b_mutex );
+        b->b_n_ops_executing--;
+        operation_update_backend_counters( op, b );
+        checked_unlock( &b->b_mutex );
+
+        Debug( LDAP_DEBUG_ANY, "backend_csn_poll: "
+                "ber_alloc failed\n" );
+
+        epoch_leave( epoch );
+        ldap_pvt_thread_mutex_destroy( &op->o_link_mutex );
+        ch_free( op );
+        return;
+    }
+    upstream->c_pendingber = output;
+
+    op->o_upstream_msgid = msgid = upstream->c_next_msgid++;
+    rc = ldap_tavl_insert(
+            &upstream->c_ops, op, operation_upstream_cmp, ldap_avl_dup_error );
+    assert( rc == LDAP_SUCCESS );
+    CONNECTION_UNLOCK(upstream);
+
+    Debug( LDAP_DEBUG_TRACE, "backend_csn_poll: "
+            "reading contextCSN from backend %s on upstream connid=%lu as "
+            "msgid=%d\n",
+            b->b_uri.bv_val, op->o_upstream_connid, msgid );
+
+    ber_printf( output, "t{tit{Oeeiibts{s}}}", LDAP_TAG_MESSAGE,
+            LDAP_TAG_MSGID, msgid,
+            LDAP_REQ_SEARCH, &lload_write_coherence_csn,
+            LDAP_SCOPE_BASE, LDAP_DEREF_NEVER, 0, 0, 0,
+            LDAP_FILTER_PRESENT, "objectClass",
+            "contextCSN" );
+    checked_unlock( &upstream->c_io_mutex );
+
+    connection_write_cb( -1, 0, upstream );
+    epoch_leave( epoch );
+}
+
 /*
  * Will schedule a connection attempt if there is a need for it. Need exclusive
  * access to backend, its b_mutex is not touched here, though.
@@ -785,6 +1012,7 @@ lload_backend_destroy( LloadBackend *b )
         b->b_retry_event = NULL;
     }
 
+    ber_bvarray_free( b->b_csn );
     ch_free( b->b_host );
     ch_free( b->b_uri.bv_val );
     ch_free( b->b_name.bv_val );
@@ -228,6 +228,7 @@ request_bind( LloadConnection *client, LloadOperation *op )
 
             pinned_op->o_request = op->o_request;
             pinned_op->o_ctrls = op->o_ctrls;
+            pinned_op->o_pdu = op->o_pdu;
 
             /* No one has seen this operation yet, plant the pin back in its stead */
             client->c_n_ops_executing--;
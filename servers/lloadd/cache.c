@@ -0,0 +1,592 @@
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2024 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "lutil.h"
+#include "lload.h"
+
+/*
+ * Response cache for base scope searches.
+ *
+ * The first request for a given key (client identity, request and controls)
+ * is forwarded as usual and becomes the entry's leader, the responses it
+ * gets are recorded as they pass through forward_response(). Identical
+ * requests arriving in the meantime wait on the entry and are sent the same
+ * responses when the leader finishes. Successful results are then kept for
+ * lload_cache_ttl milliseconds, up to lload_cache_size entries.
+ *
+ * Writes passing through bump lload_cache_gen, entries from an older
+ * generation are never handed out again.
+ */
+
+LDAP_TAILQ_HEAD(lload_cache_waiters, LloadOperation);
+
+enum lload_cache_state {
+    LLOAD_CACHE_PENDING = 0,
+    LLOAD_CACHE_READY,
+};
+
+struct LloadCacheEntry {
+    struct berval ce_key;
+    unsigned long ce_gen;
+    enum lload_cache_state ce_state;
+    int ce_linked; /* still in lload_cache */
+    struct timeval ce_expires;
+
+    BerVarray ce_pdus; /* protocolOp and controls of each response */
+    ber_len_t ce_size;
+
+    LloadOperation *ce_leader;
+    struct lload_cache_waiters ce_waiters;
+
+    LDAP_TAILQ_ENTRY(LloadCacheEntry) ce_lru;
+};
+
+static TAvlnode *lload_cache;
+static LDAP_TAILQ_HEAD(lload_cache_lru, LloadCacheEntry) lload_cache_lru;
+static unsigned long lload_cache_gen, lload_cache_count;
+static ldap_pvt_thread_mutex_t lload_cache_mutex;
+
+/* These change what the response looks like or keep it going */
+static struct berval lload_cache_uncacheable[] = {
+    BER_BVC(LDAP_CONTROL_SYNC),
+    BER_BVC(LDAP_CONTROL_PERSIST_REQUEST),
+    BER_BVC(LDAP_CONTROL_PAGEDRESULTS),
+    BER_BVNULL
+};
+
+static int
+cache_entry_cmp( const void *left, const void *right )
+{
+    const LloadCacheEntry *l = left, *r = right;
+
+    return ber_bvcmp( &l->ce_key, &r->ce_key );
+}
+
+static void
+cache_entry_free( LloadCacheEntry *ce )
+{
+    assert( !ce->ce_linked && !ce->ce_leader );
+    assert( LDAP_TAILQ_EMPTY( &ce->ce_waiters ) );
+
+    ber_bvarray_free( ce->ce_pdus );
+    ch_free( ce->ce_key.bv_val );
+    ch_free( ce );
+}
+
+static void
+cache_entry_unlink( LloadCacheEntry *ce )
+{
+    LloadCacheEntry *removed;
+
+    assert_locked( &lload_cache_mutex );
+    assert( ce->ce_linked );
+
+    removed = ldap_tavl_delete( &lload_cache, ce, cache_entry_cmp );
+    assert( removed == ce );
+
+    if ( ce->ce_state == LLOAD_CACHE_READY ) {
+        LDAP_TAILQ_REMOVE( &lload_cache_lru, ce, ce_lru );
+    }
+    ce->ce_linked = 0;
+    lload_cache_count--;
+}
+
+static void
+cache_waiters_take( LloadCacheEntry *ce, struct lload_cache_waiters *waiters )
+{
+    LloadOperation *op;
+
+    assert_locked( &lload_cache_mutex );
+
+    LDAP_TAILQ_INIT( waiters );
+    while ( (op = LDAP_TAILQ_FIRST( &ce->ce_waiters )) ) {
+        LDAP_TAILQ_REMOVE( &ce->ce_waiters, op, o_cache_next );
+        LDAP_TAILQ_INSERT_TAIL( waiters, op, o_cache_next );
+        op->o_cache = NULL;
+    }
+}
+
+static int
+cache_result( BerVarray pdus )
+{
+    BerElementBuffer berbuf;
+    BerElement *ber = (BerElement *)&berbuf;
+    ber_int_t result;
+    int i;
+
+    if ( !pdus ) return -1;
+
+    for ( i = 0; !BER_BVISNULL( &pdus[i + 1] ); i++ )
+        /* last one is the result */;
+
+    ber_init2( ber, &pdus[i], 0 );
+    if ( ber_scanf( ber, "{e" /* "}" */, &result ) == LBER_ERROR ) {
+        return -1;
+    }
+    return result;
+}
+
+static int
+cache_cacheable( LloadOperation *op )
+{
+    BerElementBuffer copy_berbuf;
+    BerElement *copy = (BerElement *)&copy_berbuf;
+    struct berval base, control;
+    ber_int_t scope;
+
+    if ( op->o_tag != LDAP_REQ_SEARCH ) {
+        return 0;
+    }
+
+    ber_init2( copy, &op->o_request, 0 );
+    if ( ber_scanf( copy, "me", &base, &scope ) == LBER_ERROR ||
+            scope != LDAP_SCOPE_BASE ) {
+        return 0;
+    }
+
+    if ( BER_BVISNULL( &op->o_ctrls ) ) {
+        return 1;
+    }
+
+    ber_init2( copy, &op->o_ctrls, 0 );
+    while ( ber_skip_element( copy, &control ) == LBER_SEQUENCE ) {
+        BerElementBuffer control_berbuf;
+        BerElement *control_ber = (BerElement *)&control_berbuf;
+        struct berval oid;
+        int i;
+
+        ber_init2( control_ber, &control, 0 );
+        if ( ber_skip_element( control_ber, &oid ) == LBER_ERROR ) {
+            return 0;
+        }
+        for ( i = 0; !BER_BVISNULL( &lload_cache_uncacheable[i] ); i++ ) {
+            if ( ber_bvcmp( &oid, &lload_cache_uncacheable[i] ) == 0 ) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * Send pdus to op's client and finish the operation.
+ */
+static void
+cache_deliver( LloadOperation *op, BerVarray pdus )
+{
+    LloadConnection *client;
+    BerElement *output;
+    int i;
+
+    checked_lock( &op->o_link_mutex );
+    client = op->o_client;
+    checked_unlock( &op->o_link_mutex );
+
+    if ( pdus && client && IS_ALIVE( client, c_live ) ) {
+        checked_lock( &client->c_io_mutex );
+        output = client->c_pendingber;
+        if ( output != NULL || (output = ber_alloc()) != NULL ) {
+            client->c_pendingber = output;
+            for ( i = 0; !BER_BVISNULL( &pdus[i] ); i++ ) {
+                lload_pdu_splice( output, op->o_client_msgid, &pdus[i] );
+            }
+        }
+        checked_unlock( &client->c_io_mutex );
+
+        connection_write_cb( -1, 0, client );
+    }
+
+    op->o_res = LLOAD_OP_COMPLETED;
+    OPERATION_UNLINK(op);
+}
+
+/*
+ * Returns non-zero if op has been taken care of, either answered from the
+ * cache or queued behind an identical request in progress. Otherwise op
+ * might have been made the leader of a new entry and should be forwarded.
+ */
+int
+lload_cache_request( LloadConnection *client, LloadOperation *op )
+{
+    LloadCacheEntry *ce, needle = {};
+    BerVarray pdus = NULL;
+    struct timeval now;
+    char *ptr;
+    int rc = 0;
+
+    if ( !lload_cache_size || !cache_cacheable( op ) ) {
+        return rc;
+    }
+
+    CONNECTION_LOCK(client);
+    needle.ce_key.bv_len = client->c_auth.bv_len + 1 + op->o_request.bv_len +
+            op->o_ctrls.bv_len;
+    ptr = needle.ce_key.bv_val = ch_malloc( needle.ce_key.bv_len );
+    if ( client->c_auth.bv_len ) {
+        ptr = lutil_memcopy( ptr, client->c_auth.bv_val, client->c_auth.bv_len );
+    }
+    CONNECTION_UNLOCK(client);
+    /* The identity never contains a NUL, the rest is self-delimiting BER */
+    *ptr++ = '\0';
+    ptr = lutil_memcopy( ptr, op->o_request.bv_val, op->o_request.bv_len );
+    if ( op->o_ctrls.bv_len ) {
+        lutil_memcopy( ptr, op->o_ctrls.bv_val, op->o_ctrls.bv_len );
+    }
+
+    gettimeofday( &now, NULL );
+
+    checked_lock( &lload_cache_mutex );
+    ce = ldap_tavl_find( lload_cache, &needle, cache_entry_cmp );
+    if ( ce &&
+            ( ce->ce_gen != lload_cache_gen ||
+                    ( ce->ce_state == LLOAD_CACHE_READY &&
+                            timercmp( &ce->ce_expires, &now, < ) ) ) ) {
+        /* Stale, a pending one is left to its leader to dispose of */
+        cache_entry_unlink( ce );
+        if ( ce->ce_state == LLOAD_CACHE_READY ) {
+            cache_entry_free( ce );
+        }
+        ce = NULL;
+    }
+
+    if ( !IS_ALIVE( op, o_refcnt ) ) {
+        /* Abandoned already, nothing to do */
+    } else if ( ce && ce->ce_state == LLOAD_CACHE_PENDING ) {
+        Debug( LDAP_DEBUG_TRACE, "lload_cache_request: "
+                "client connid=%lu msgid=%d waiting on client connid=%lu "
+                "msgid=%d\n",
+                op->o_client_connid, op->o_client_msgid,
+                ce->ce_leader->o_client_connid,
+                ce->ce_leader->o_client_msgid );
+        op->o_cache = ce;
+        LDAP_TAILQ_INSERT_TAIL( &ce->ce_waiters, op, o_cache_next );
+        rc = 1;
+    } else if ( ce ) {
+        Debug( LDAP_DEBUG_TRACE, "lload_cache_request: "
+                "answering client connid=%lu msgid=%d from cache\n",
+                op->o_client_connid, op->o_client_msgid );
+        LDAP_TAILQ_REMOVE( &lload_cache_lru, ce, ce_lru );
+        LDAP_TAILQ_INSERT_TAIL( &lload_cache_lru, ce, ce_lru );
+        ber_bvarray_dup_x( &pdus, ce->ce_pdus, NULL );
+        rc = 1;
+    } else {
+        LloadCacheEntry *old;
+
+        while ( lload_cache_count >= lload_cache_size &&
+                (old = LDAP_TAILQ_FIRST( &lload_cache_lru )) ) {
+            cache_entry_unlink( old );
+            cache_entry_free( old );
+        }
+
+        /* Only pending ones left, forward without caching */
+        if ( lload_cache_count < lload_cache_size ) {
+            ce = ch_calloc( 1, sizeof(LloadCacheEntry) );
+            ce->ce_key = needle.ce_key;
+            BER_BVZERO( &needle.ce_key );
+            ce->ce_gen = lload_cache_gen;
+            ce->ce_leader = op;
+            LDAP_TAILQ_INIT( &ce->ce_waiters );
+
+            rc = ldap_tavl_insert( &lload_cache, ce, cache_entry_cmp,
+                    ldap_avl_dup_error );
+            assert( rc == LDAP_SUCCESS );
+            ce->ce_linked = 1;
+            lload_cache_count++;
+
+            op->o_cache = ce;
+        }
+    }
+    checked_unlock( &lload_cache_mutex );
+
+    ch_free( needle.ce_key.bv_val );
+
+    if ( pdus ) {
+        cache_deliver( op, pdus );
+        ber_bvarray_free( pdus );
+    }
+    return rc;
+}
+
+/*
+ * Record a response as it is forwarded to the leader's client.
+ */
+void
+lload_cache_response( LloadOperation *op, BerValue *pdu )
+{
+    LloadCacheEntry *ce;
+    struct berval copy;
+
+    checked_lock( &lload_cache_mutex );
+    ce = op->o_cache;
+    if ( ce && ce->ce_leader == op ) {
+        ber_dupbv( &copy, pdu );
+        ber_bvarray_add( &ce->ce_pdus, &copy );
+        ce->ce_size += pdu->bv_len;
+    }
+    checked_unlock( &lload_cache_mutex );
+}
+
+/*
+ * The leader has received its result, pass it on to everyone waiting and
+ * keep it around if it can be reused.
+ */
+void
+lload_cache_finish( LloadOperation *op )
+{
+    LloadCacheEntry *ce;
+    LloadOperation *waiter;
+    struct lload_cache_waiters waiters;
+    BerVarray pdus = NULL;
+    struct timeval now;
+    epoch_t epoch;
+    int result;
+
+    epoch = epoch_join();
+
+    checked_lock( &lload_cache_mutex );
+    if ( !(ce = op->o_cache) ) {
+        checked_unlock( &lload_cache_mutex );
+        epoch_leave( epoch );
+        return;
+    }
+    assert( ce->ce_leader == op && ce->ce_state == LLOAD_CACHE_PENDING );
+    op->o_cache = NULL;
+    ce->ce_leader = NULL;
+
+    cache_waiters_take( ce, &waiters );
+
+    result = cache_result( ce->ce_pdus );
+    if ( ce->ce_linked && ce->ce_gen == lload_cache_gen &&
+            ( result == LDAP_SUCCESS || result == LDAP_NO_SUCH_OBJECT ) &&
+            ce->ce_size <= LLOAD_CACHE_MAX_RESPONSE ) {
+        gettimeofday( &now, NULL );
+        ce->ce_expires.tv_sec = now.tv_sec + lload_cache_ttl / 1000;
+        ce->ce_expires.tv_usec = now.tv_usec + ( lload_cache_ttl % 1000 ) * 1000;
+        if ( ce->ce_expires.tv_usec >= 1000000 ) {
+            ce->ce_expires.tv_sec++;
+            ce->ce_expires.tv_usec -= 1000000;
+        }
+        ce->ce_state = LLOAD_CACHE_READY;
+        LDAP_TAILQ_INSERT_TAIL( &lload_cache_lru, ce, ce_lru );
+
+        if ( !LDAP_TAILQ_EMPTY( &waiters ) ) {
+            ber_bvarray_dup_x( &pdus, ce->ce_pdus, NULL );
+        }
+    } else {
+        if ( ce->ce_linked ) {
+            cache_entry_unlink( ce );
+        }
+        pdus = ce->ce_pdus;
+        ce->ce_pdus = NULL;
+        cache_entry_free( ce );
+    }
+    checked_unlock( &lload_cache_mutex );
+
+    while ( (waiter = LDAP_TAILQ_FIRST( &waiters )) ) {
+        LDAP_TAILQ_REMOVE( &waiters, waiter, o_cache_next );
+        if ( IS_ALIVE( waiter, o_refcnt ) ) {
+            cache_deliver( waiter, pdus );
+        }
+    }
+    ber_bvarray_free( pdus );
+
+    epoch_leave( epoch );
+}
+
+/*
+ * Detach the waiters from the entry op leads, dropping the entry. Returns
+ * non-zero if there were any.
+ */
+static int
+cache_leader_drop( LloadOperation *op, struct lload_cache_waiters *waiters )
+{
+    LloadCacheEntry *ce;
+
+    LDAP_TAILQ_INIT( waiters );
+
+    checked_lock( &lload_cache_mutex );
+    if ( !(ce = op->o_cache) || ce->ce_leader != op ) {
+        checked_unlock( &lload_cache_mutex );
+        return 0;
+    }
+    op->o_cache = NULL;
+    ce->ce_leader = NULL;
+
+    cache_waiters_take( ce, waiters );
+    if ( ce->ce_linked ) {
+        cache_entry_unlink( ce );
+    }
+    cache_entry_free( ce );
+    checked_unlock( &lload_cache_mutex );
+
+    return !LDAP_TAILQ_EMPTY( waiters );
+}
+
+struct lload_cache_requeue {
+    struct lload_cache_waiters waiters;
+    epoch_t epoch; /* keeps the waiters around until we get to them */
+};
+
+static void *
+cache_requeue_task( void *ctx, void *arg )
+{
+    struct lload_cache_requeue *requeue = arg;
+    LloadOperation *waiter;
+
+    while ( (waiter = LDAP_TAILQ_FIRST( &requeue->waiters )) ) {
+        LloadConnection *client;
+
+        LDAP_TAILQ_REMOVE( &requeue->waiters, waiter, o_cache_next );
+
+        checked_lock( &waiter->o_link_mutex );
+        client = waiter->o_client;
+        checked_unlock( &waiter->o_link_mutex );
+
+        if ( client && IS_ALIVE( waiter, o_refcnt ) ) {
+            Debug( LDAP_DEBUG_TRACE, "cache_requeue_task: "
+                    "reprocessing client connid=%lu msgid=%d\n",
+                    waiter->o_client_connid, waiter->o_client_msgid );
+            request_process( client, waiter );
+        }
+    }
+
+    epoch_leave( requeue->epoch );
+    ch_free( requeue );
+    return NULL;
+}
+
+/*
+ * op could not be forwarded. If it was leading an entry, everyone waiting on
+ * it would fail the same way, reject them with the same result.
+ */
+void
+lload_cache_reject( LloadOperation *op, int result, const char *msg )
+{
+    LloadOperation *waiter;
+    struct lload_cache_waiters waiters;
+    epoch_t epoch;
+
+    if ( !op->o_cache ) {
+        return;
+    }
+
+    epoch = epoch_join();
+    cache_leader_drop( op, &waiters );
+
+    while ( (waiter = LDAP_TAILQ_FIRST( &waiters )) ) {
+        LDAP_TAILQ_REMOVE( &waiters, waiter, o_cache_next );
+        if ( IS_ALIVE( waiter, o_refcnt ) ) {
+            operation_send_reject( waiter, result, msg, 1 );
+        }
+    }
+
+    epoch_leave( epoch );
+}
+
+/*
+ * Called as op is being unlinked. A waiter just leaves the queue, if the
+ * leader goes before its result arrives, the requests waiting on it are
+ * processed again from a pool thread, one of them taking over. Doing that
+ * here would nest another request_process() inside each unlink.
+ */
+void
+lload_cache_unlink( LloadOperation *op )
+{
+    LloadCacheEntry *ce;
+    LloadOperation *waiter;
+    struct lload_cache_requeue *requeue;
+
+    checked_lock( &lload_cache_mutex );
+    if ( (ce = op->o_cache) && ce->ce_leader != op ) {
+        op->o_cache = NULL;
+        LDAP_TAILQ_REMOVE( &ce->ce_waiters, op, o_cache_next );
+        ce = NULL;
+    }
+    checked_unlock( &lload_cache_mutex );
+    if ( !ce ) {
+        return;
+    }
+
+    requeue = ch_malloc( sizeof(struct lload_cache_requeue) );
+    requeue->epoch = epoch_join();
+    if ( !cache_leader_drop( op, &requeue->waiters ) ) {
+        epoch_leave( requeue->epoch );
+        ch_free( requeue );
+        return;
+    }
+
+    if ( !ldap_pvt_thread_pool_submit(
+                 &connection_pool, cache_requeue_task, requeue ) ) {
+        return;
+    }
+
+    Debug( LDAP_DEBUG_ANY, "lload_cache_unlink: "
+            "failed to submit a task to reprocess waiting requests\n" );
+    while ( (waiter = LDAP_TAILQ_FIRST( &requeue->waiters )) ) {
+        LDAP_TAILQ_REMOVE( &requeue->waiters, waiter, o_cache_next );
+        if ( IS_ALIVE( waiter, o_refcnt ) ) {
+            operation_send_reject( waiter, LDAP_BUSY, "too busy", 1 );
+        }
+    }
+    epoch_leave( requeue->epoch );
+    ch_free( requeue );
+}
+
+void
+lload_cache_invalidate( void )
+{
+    if ( !lload_cache_size ) {
+        return;
+    }
+
+    checked_lock( &lload_cache_mutex );
+    lload_cache_gen++;
+    checked_unlock( &lload_cache_mutex );
+}
+
+int
+lload_cache_init( void )
+{
+    ldap_pvt_thread_mutex_init( &lload_cache_mutex );
+    LDAP_TAILQ_INIT( &lload_cache_lru );
+    return 0;
+}
+
+static void
+cache_entry_destroy( void *arg )
+{
+    LloadCacheEntry *ce = arg;
+
+    ce->ce_linked = 0;
+    ce->ce_leader = NULL;
+    LDAP_TAILQ_INIT( &ce->ce_waiters );
+    cache_entry_free( ce );
+}
+
+void
+lload_cache_destroy( void )
+{
+    ldap_tavl_free( lload_cache, cache_entry_destroy );
+    lload_cache = NULL;
+    LDAP_TAILQ_INIT( &lload_cache_lru );
+    lload_cache_count = 0;
+
+    ldap_pvt_thread_mutex_destroy( &lload_cache_mutex );
+}
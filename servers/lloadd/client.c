@@ -95,6 +95,8 @@ request_process( LloadConnection *client, LloadOperation *op )
     int res = LDAP_UNAVAILABLE, rc = LDAP_SUCCESS;
     char *message = "no connections available";
     enum op_restriction client_restricted;
+    struct timeval coherence_at;
+    int coherent = 0;
 
     if ( lload_control_actions && !BER_BVISNULL( &op->o_ctrls ) ) {
         BerElementBuffer copy_berbuf;
@@ -172,11 +174,47 @@ request_process( LloadConnection *client, LloadOperation *op )
                 break;
         }
     }
-    if ( op->o_restricted < client_restricted ) {
+    if ( client_restricted == LLOAD_OP_RESTRICTED_WRITE &&
+            op->o_restricted == LLOAD_OP_NOT_RESTRICTED &&
+            ( op->o_tag == LDAP_REQ_SEARCH || op->o_tag == LDAP_REQ_COMPARE ) &&
+            client->c_restricted_inflight == 0 &&
+            !BER_BVISNULL( &lload_write_coherence_csn ) ) {
+        /* A read once all writes are done, might not need to be pinned */
+        coherent = 1;
+        coherence_at = client->c_coherence_at;
+        if ( client->c_coherence_csn ) {
+            ber_bvarray_dup_x( &op->o_csn, client->c_coherence_csn, NULL );
+        }
+    } else if ( op->o_restricted < client_restricted ) {
         op->o_restricted = client_restricted;
     }
     CONNECTION_UNLOCK(client);
 
+    if ( coherent && !op->o_csn ) {
+        /* Has b told us what it looked like after the last write yet? */
+        checked_lock( &b->b_mutex );
+        if ( b->b_csn && timercmp( &b->b_csn_time, &coherence_at, > ) ) {
+            ber_bvarray_dup_x( &op->o_csn, b->b_csn, NULL );
+        }
+        checked_unlock( &b->b_mutex );
+
+        CONNECTION_LOCK(client);
+        if ( !op->o_csn ) {
+            op->o_restricted = client_restricted;
+        } else if ( !client->c_coherence_csn &&
+                timercmp( &client->c_coherence_at, &coherence_at, == ) ) {
+            ber_bvarray_dup_x( &client->c_coherence_csn, op->o_csn, NULL );
+        }
+        CONNECTION_UNLOCK(client);
+    }
+
+    if ( op->o_tag != LDAP_REQ_SEARCH && op->o_tag != LDAP_REQ_COMPARE ) {
+        lload_cache_invalidate();
+    } else if ( !upstream && !b && op->o_restricted == LLOAD_OP_NOT_RESTRICTED &&
+            lload_cache_request( client, op ) ) {
+        return rc;
+    }
+
     if ( upstream ) {
         b = upstream->c_backend;
         checked_lock( &b->b_mutex );
@@ -185,7 +223,15 @@ request_process( LloadConnection *client, LloadOperation *op )
         }
         checked_unlock( &b->b_mutex );
     } else if ( b ) {
-        backend_select( b, op, &upstream, &res, &message );
+        if ( op->o_csn ) {
+            /* Any backend that has caught up with the writes will do */
+            upstream_select( op, &upstream, &res, &message );
+        }
+        if ( !upstream ) {
+            checked_lock( &b->b_mutex );
+            backend_select( b, op, &upstream, &res, &message );
+            checked_unlock( &b->b_mutex );
+        }
     } else {
         upstream_select( op, &upstream, &res, &message );
     }
@@ -195,6 +241,7 @@ request_process( LloadConnection *client, LloadOperation *op )
                 "connid=%lu, msgid=%d no available connection found\n",
                 op->o_client_connid, op->o_client_msgid );
 
+        lload_cache_reject( op, res, message );
         operation_send_reject( op, res, message, 1 );
         goto fail;
     }
@@ -313,10 +360,8 @@ request_process( LloadConnection *client, LloadOperation *op )
 
         ber_printf( output, /* "{{" */ "}}" );
     } else {
-        ber_printf( output, "t{titOtO}", LDAP_TAG_MESSAGE,
-                LDAP_TAG_MSGID, msgid,
-                op->o_tag, &op->o_request,
-                LDAP_TAG_CONTROLS, BER_BV_OPTIONAL( &op->o_ctrls ) );
+        /* Only the message ID changes, pass the rest through as is */
+        lload_pdu_splice( output, msgid, &op->o_pdu );
     }
     checked_unlock( &upstream->c_io_mutex );
 
@@ -499,7 +544,8 @@ client_tls_handshake_cb( evutil_socket_t s, short what, void *arg )
         event_assign( c->c_read_event, base, c->c_fd, EV_READ|EV_PERSIST,
                 connection_read_cb, c );
         if ( IS_ALIVE( c, c_live ) ) {
-            event_add( c->c_read_event, c->c_read_timeout );
+            /* The client might have sent its first request already */
+            connection_read_enable( c );
         }
 
         event_assign( c->c_write_event, base, c->c_fd, EV_WRITE,
@@ -678,6 +724,10 @@ client_reset( LloadConnection *c )
         ch_free( c->c_sasl_bind_mech.bv_val );
         BER_BVZERO( &c->c_sasl_bind_mech );
     }
+    if ( c->c_coherence_csn ) {
+        ber_bvarray_free( c->c_coherence_csn );
+        c->c_coherence_csn = NULL;
+    }
 
     if ( restricted && restricted < LLOAD_OP_RESTRICTED_ISOLATE ) {
         if ( c->c_backend ) {
@@ -79,6 +79,9 @@ static struct timeval timeout_api_tv, timeout_net_tv,
 
 lload_features_t lload_features;
 int lload_write_coherence = 0;
+struct berval lload_write_coherence_csn = BER_BVNULL;
+unsigned int lload_cache_size = 0;
+unsigned int lload_cache_ttl = 1000;
 
 ber_len_t sockbuf_max_incoming_client = LLOAD_SB_MAX_INCOMING_CLIENT;
 ber_len_t sockbuf_max_incoming_upstream = LLOAD_SB_MAX_INCOMING_UPSTREAM;
@@ -666,6 +669,41 @@ static ConfigTable config_back_cf_table[] = {
         NULL,
         { .v_int = 0 }
     },
+    { "write_coherence_csn", "DN", 2, 2, 0,
+        ARG_BERVAL,
+        &lload_write_coherence_csn,
+        "( OLcfgBkAt:13.41 "
+            "NAME 'olcBkLloadWriteCoherenceCSN' "
+            "DESC 'Entry whose contextCSN tells which backends have caught up with a write' "
+            "EQUALITY distinguishedNameMatch "
+            "SYNTAX OMsDN "
+            "SINGLE-VALUE )",
+        NULL, NULL
+    },
+    { "cache_size", "entries", 2, 2, 0,
+        ARG_UINT,
+        &lload_cache_size,
+        "( OLcfgBkAt:13.42 "
+            "NAME 'olcBkLloadCacheSize' "
+            "DESC 'Number of base scope search responses to cache' "
+            "EQUALITY integerMatch "
+            "SYNTAX OMsInteger "
+            "SINGLE-VALUE )",
+        NULL,
+        { .v_uint = 0 }
+    },
+    { "cache_ttl", "milliseconds", 2, 2, 0,
+        ARG_UINT,
+        &lload_cache_ttl,
+        "( OLcfgBkAt:13.43 "
+            "NAME 'olcBkLloadCacheTTL' "
+            "DESC 'How long a cached response can be used for' "
+            "EQUALITY integerMatch "
+            "SYNTAX OMsInteger "
+            "SINGLE-VALUE )",
+        NULL,
+        { .v_uint = 1000 }
+    },
     { "restrict_exop", "OID> <action", 3, 3, 0,
         ARG_MAGIC|CFG_RESTRICT_EXOP,
         &config_restrict_oid,
@@ -822,6 +860,9 @@ static ConfigOCs lloadocs[] = {
             "$ olcBkLloadTLSShareSlapdCTX "
             "$ olcBkLloadClientMaxPending "
             "$ olcBkLloadWriteCoherence "
+            "$ olcBkLloadWriteCoherenceCSN "
+            "$ olcBkLloadCacheSize "
+            "$ olcBkLloadCacheTTL "
             "$ olcBkLloadRestrictExop "
             "$ olcBkLloadRestrictControl "
         ") )",
@@ -146,7 +146,7 @@ handle_pdus( void *ctx, void *arg )
     checked_lock( &c->c_io_mutex );
     if ( !(lload_features & LLOAD_FEATURE_PAUSE) ||
             !(c->c_io_state & LLOAD_C_READ_PAUSE) ) {
-        event_add( c->c_read_event, c->c_read_timeout );
+        connection_read_enable( c );
         Debug( LDAP_DEBUG_CONNS, "handle_pdus: "
                 "re-enabled read event on connid=%lu\n",
                 c->c_connid );
@@ -161,6 +161,22 @@ done:
     return NULL;
 }
 
+/*
+ * Re-arm the read event. Data the Sockbuf has already pulled off the socket
+ * (readahead, TLS) will not make the socket readable again, so have it
+ * delivered straight away.
+ */
+void
+connection_read_enable( LloadConnection *c )
+{
+    int ready = ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_DATA_READY, NULL );
+
+    event_add( c->c_read_event, c->c_read_timeout );
+    if ( ready ) {
+        event_active( c->c_read_event, EV_READ, 0 );
+    }
+}
+
 /*
  * Initial read on the connection, if we get an LDAP PDU, submit the
  * processing of this and successive ones to the work queue.
@@ -273,7 +289,7 @@ connection_read_cb( evutil_socket_t s, short what, void *arg )
         if ( rc == LDAP_SUCCESS &&
                 ( !(lload_features & LLOAD_FEATURE_PAUSE) ||
                         !(c->c_io_state & LLOAD_C_READ_PAUSE) ) ) {
-            event_add( c->c_read_event, c->c_read_timeout );
+            connection_read_enable( c );
         }
         checked_unlock( &c->c_io_mutex );
         goto out;
@@ -295,6 +311,53 @@ out:
     epoch_leave( epoch );
 }
 
+/*
+ * Queue an LDAPMessage on output under a new message ID. Everything after the
+ * ID (protocolOp and controls) is copied verbatim from the PDU as received,
+ * so the payload is neither decoded nor re-encoded and moves exactly once.
+ *
+ * Caller must hold the c_io_mutex owning output.
+ */
+int
+lload_pdu_splice( BerElement *output, ber_int_t msgid, BerValue *pdu )
+{
+    unsigned char hdr[2 + sizeof(ber_len_t) + 2 + sizeof(ber_int_t)];
+    unsigned char *p = hdr + sizeof(hdr);
+    ber_uint_t id = msgid;
+    ber_len_t len;
+    int n;
+
+    /* messageID, minimal two's complement */
+    for ( n = 0; n < sizeof(ber_int_t); n++, id >>= 8 ) {
+        *--p = id & 0xffU;
+    }
+    while ( n > 1 && ( ( p[0] == 0 && !(p[1] & 0x80U) ) ||
+                            ( p[0] == 0xffU && (p[1] & 0x80U) ) ) ) {
+        p++;
+        n--;
+    }
+    *--p = n;
+    *--p = LDAP_TAG_MSGID;
+
+    /* LDAPMessage tag and length */
+    len = hdr + sizeof(hdr) - p + pdu->bv_len;
+    if ( len < 0x80 ) {
+        *--p = len;
+    } else {
+        for ( n = 0; len; n++, len >>= 8 ) {
+            *--p = len & 0xffU;
+        }
+        *--p = 0x80U | n;
+    }
+    *--p = LDAP_TAG_MESSAGE;
+
+    if ( ber_write( output, (char *)p, hdr + sizeof(hdr) - p, 0 ) < 0 ||
+            ber_write( output, pdu->bv_val, pdu->bv_len, 0 ) < 0 ) {
+        return -1;
+    }
+    return 0;
+}
+
 void
 connection_write_cb( evutil_socket_t s, short what, void *arg )
 {
@@ -368,7 +431,7 @@ connection_write_cb( evutil_socket_t s, short what, void *arg )
                     "Unpausing connection connid=%lu\n",
                     c->c_connid );
             if ( !(c->c_io_state & LLOAD_C_READ_HANDOVER) ) {
-                event_add( c->c_read_event, c->c_read_timeout );
+                connection_read_enable( c );
             }
         }
     }
@@ -633,6 +696,16 @@ lload_connection_init(
                 LBER_SBIOD_LEVEL_PROVIDER, (void *)&s );
     }
 
+    {
+        /* Most PDUs should then take a single read, idle connections do
+         * not keep the buffer around */
+        ber_len_t max = LLOAD_SB_MAX_READAHEAD;
+
+        ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_readahead,
+                LBER_SBIOD_LEVEL_PROVIDER, NULL );
+        ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_SET_READAHEAD_MAX, &max );
+    }
+
 #ifdef LDAP_DEBUG
     ber_sockbuf_add_io(
             c->c_sb, &ber_sockbuf_io_debug, INT_MAX, (void *)"lload_" );
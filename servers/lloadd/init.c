@@ -102,6 +102,9 @@ lload_global_init( void )
     if ( lload_exop_init() ) {
         return -1;
     }
+    if ( lload_cache_init() ) {
+        return -1;
+    }
     return 0;
 }
 
@@ -114,6 +117,7 @@ lload_global_destroy( void )
     }
 
     lload_exop_destroy();
+    lload_cache_destroy();
     ldap_tavl_free( lload_control_actions, (AVL_FREE)lload_restriction_free );
     ldap_tavl_free( lload_exop_actions, (AVL_FREE)lload_restriction_free );
 
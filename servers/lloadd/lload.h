@@ -79,9 +79,19 @@ LDAP_BEGIN_DECL
 
 #define LLOAD_SB_MAX_INCOMING_CLIENT ( ( 1 << 24 ) - 1 )
 #define LLOAD_SB_MAX_INCOMING_UPSTREAM ( ( 1 << 24 ) - 1 )
+#define LLOAD_SB_MAX_READAHEAD ( 1 << 16 )
 
 #define LLOAD_CONN_MAX_PDUS_PER_CYCLE_DEFAULT 10
 
+/* Decay time constant of upstream latency estimates, in seconds */
+#define LLOAD_LATENCY_DECAY 10
+
+/* How long to wait for a contextCSN poll before sending another, in seconds */
+#define LLOAD_CSN_POLL_TIMEOUT 10
+
+/* Larger responses are handed to waiting requests but not kept */
+#define LLOAD_CACHE_MAX_RESPONSE ( 1 << 16 )
+
 #define BER_BV_OPTIONAL( bv ) ( BER_BVISNULL( bv ) ? NULL : ( bv ) )
 
 #include <epoch.h>
@@ -104,6 +114,7 @@ typedef struct LloadPendingConnection LloadPendingConnection;
 typedef struct LloadConnection LloadConnection;
 typedef struct LloadOperation LloadOperation;
 typedef struct LloadChange LloadChange;
+typedef struct LloadCacheEntry LloadCacheEntry;
 /* end of forward declarations */
 
 typedef LDAP_STAILQ_HEAD(TierSt, LloadTier) lload_t_head;
@@ -318,6 +329,10 @@ struct LloadBackend {
     uintptr_t b_operation_count;
     uintptr_t b_operation_time;
 
+    /* contextCSN of lload_write_coherence_csn as of b_csn_time */
+    BerVarray b_csn;
+    struct timeval b_csn_time, b_csn_poll;
+
 #ifdef BALANCER_MODULE
     monitor_subsys_t *b_monitor;
 #endif /* BALANCER_MODULE */
@@ -490,9 +505,16 @@ struct LloadConnection {
     long c_n_ops_completed;      /* num of ops completed */
     lload_counters_t c_counters; /* per connection operation counters */
 
+    /* Upstream only, maintained by the thread reading responses */
+    double c_latency;               /* peak EWMA of first response time (us) */
+    struct timeval c_latency_time;  /* when c_latency was last updated */
+    struct timeval c_last_activity; /* last response or becoming busy */
+
     enum op_restriction c_restricted;
     uintptr_t c_restricted_inflight;
     time_t c_restricted_at;
+    struct timeval c_coherence_at; /* when the last write finished */
+    BerVarray c_coherence_csn;     /* what reads need to see since */
     LloadBackend *c_backend;
     LloadConnection *c_linked_upstream;
 
@@ -560,6 +582,15 @@ struct LloadOperation {
     enum op_result o_res;
     BerElement *o_ber;
     BerValue o_request, o_ctrls;
+    BerValue o_pdu; /* raw protocolOp and controls, points into o_ber */
+
+    BerVarray o_csn; /* upstream has to have caught up with these, on a
+                      * contextCSN poll: the values read so far */
+    LloadOperationHandler o_response_cb; /* set on our own requests */
+
+    /* Protected by the response cache mutex */
+    LloadCacheEntry *o_cache;
+    LDAP_TAILQ_ENTRY(LloadOperation) o_cache_next;
 };
 
 struct restriction_entry {
@@ -171,7 +171,7 @@ operation_init( LloadConnection *c, BerElement *ber )
         goto fail;
     }
 
-    tag = op->o_tag = ber_skip_element( ber, &op->o_request );
+    tag = op->o_tag = ber_peek_element( ber, &op->o_request );
     switch ( tag ) {
         case LBER_ERROR:
             rc = -1;
@@ -181,10 +181,15 @@ operation_init( LloadConnection *c, BerElement *ber )
         ldap_tavl_delete( &c->c_ops, op, operation_client_cmp );
         goto fail;
     }
+    ber_skip_raw( ber, &op->o_pdu );
 
     tag = ber_peek_tag( ber, &len );
     if ( tag == LDAP_TAG_CONTROLS ) {
-        ber_skip_element( ber, &op->o_ctrls );
+        BerValue ctrls;
+
+        ber_peek_element( ber, &op->o_ctrls );
+        ber_skip_raw( ber, &ctrls );
+        op->o_pdu.bv_len = ctrls.bv_val + ctrls.bv_len - op->o_pdu.bv_val;
     }
 
     switch ( op->o_tag ) {
@@ -223,6 +228,7 @@ operation_destroy( LloadOperation *op )
     assert( op->o_upstream == NULL );
 
     ber_free( op->o_ber, 1 );
+    ber_bvarray_free( op->o_csn );
     ldap_pvt_thread_mutex_destroy( &op->o_link_mutex );
     ch_free( op );
 }
@@ -236,6 +242,10 @@ operation_unlink( LloadOperation *op )
 
     assert( op->o_refcnt == 0 );
 
+    if ( op->o_cache ) {
+        lload_cache_unlink( op );
+    }
+
     Debug( LDAP_DEBUG_TRACE, "operation_unlink: "
             "unlinking operation between client connid=%lu and upstream "
             "connid=%lu "
@@ -285,15 +295,21 @@ operation_unlink_client( LloadOperation *op, LloadConnection *client )
         if ( op->o_restricted == LLOAD_OP_RESTRICTED_WRITE ) {
             if ( !--client->c_restricted_inflight &&
                     client->c_restricted_at >= 0 ) {
-                if ( lload_write_coherence < 0 ) {
-                    client->c_restricted_at = -1;
-                } else if ( timerisset( &op->o_last_response ) ) {
-                    client->c_restricted_at = op->o_last_response.tv_sec;
+                if ( timerisset( &op->o_last_response ) ) {
+                    client->c_coherence_at = op->o_last_response;
                 } else {
                     /* We have to default to o_start just in case we abandoned an
                      * operation that the backend actually processed */
-                    client->c_restricted_at = op->o_start.tv_sec;
+                    client->c_coherence_at = op->o_start;
+                }
+                if ( lload_write_coherence < 0 ) {
+                    client->c_restricted_at = -1;
+                } else {
+                    client->c_restricted_at = client->c_coherence_at.tv_sec;
                 }
+                /* Only contextCSN read after this write will do */
+                ber_bvarray_free( client->c_coherence_csn );
+                client->c_coherence_csn = NULL;
             }
         }
 
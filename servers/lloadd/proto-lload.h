@@ -44,6 +44,8 @@ LDAP_SLAPD_F (int) upstream_select( LloadOperation *op, LloadConnection **c, int
 LDAP_SLAPD_F (int) backend_select( LloadBackend *b, LloadOperation *op, LloadConnection **c, int *res, char **message );
 LDAP_SLAPD_F (int) try_upstream( LloadBackend *b, lload_c_head *head, LloadOperation *op, LloadConnection *c, int *res, char **message );
 LDAP_SLAPD_F (void) backend_reset( LloadBackend *b, int gentle );
+LDAP_SLAPD_F (int) backend_csn_covered( LloadBackend *b, BerVarray csn );
+LDAP_SLAPD_F (void) backend_csn_poll( LloadBackend *b );
 LDAP_SLAPD_F (LloadBackend *) lload_backend_new( void );
 LDAP_SLAPD_F (void) lload_backend_destroy( LloadBackend *b );
 
@@ -55,6 +57,18 @@ LDAP_SLAPD_F (int) handle_bind_response( LloadConnection *client, LloadOperation
 LDAP_SLAPD_F (int) handle_whoami_response( LloadConnection *client, LloadOperation *op, BerElement *ber );
 LDAP_SLAPD_F (int) handle_vc_bind_response( LloadConnection *client, LloadOperation *op, BerElement *ber );
 
+/*
+ * cache.c
+ */
+LDAP_SLAPD_F (int) lload_cache_init( void );
+LDAP_SLAPD_F (void) lload_cache_destroy( void );
+LDAP_SLAPD_F (int) lload_cache_request( LloadConnection *client, LloadOperation *op );
+LDAP_SLAPD_F (void) lload_cache_response( LloadOperation *op, BerValue *pdu );
+LDAP_SLAPD_F (void) lload_cache_finish( LloadOperation *op );
+LDAP_SLAPD_F (void) lload_cache_unlink( LloadOperation *op );
+LDAP_SLAPD_F (void) lload_cache_reject( LloadOperation *op, int result, const char *msg );
+LDAP_SLAPD_F (void) lload_cache_invalidate( void );
+
 /*
  * client.c
  */
@@ -97,6 +111,8 @@ LDAP_SLAPD_V (ldap_pvt_thread_mutex_t) clients_mutex;
 LDAP_SLAPD_F (void *) handle_pdus( void *ctx, void *arg );
 LDAP_SLAPD_F (void) connection_write_cb( evutil_socket_t s, short what, void *arg );
 LDAP_SLAPD_F (void) connection_read_cb( evutil_socket_t s, short what, void *arg );
+LDAP_SLAPD_F (void) connection_read_enable( LloadConnection *c );
+LDAP_SLAPD_F (int) lload_pdu_splice( BerElement *output, ber_int_t msgid, BerValue *pdu );
 LDAP_SLAPD_F (int) lload_connection_close( LloadConnection *c, void *arg );
 LDAP_SLAPD_F (LloadConnection *) lload_connection_init( ber_socket_t s,
         struct berval *localname,
@@ -238,6 +254,9 @@ LDAP_SLAPD_V (ber_len_t) sockbuf_max_incoming_upstream;
 LDAP_SLAPD_V (int) lload_conn_max_pdus_per_cycle;
 
 LDAP_SLAPD_V (int) lload_write_coherence;
+LDAP_SLAPD_V (struct berval) lload_write_coherence_csn;
+LDAP_SLAPD_V (unsigned int) lload_cache_size;
+LDAP_SLAPD_V (unsigned int) lload_cache_ttl;
 
 LDAP_SLAPD_V (lload_features_t) lload_features;
 
@@ -136,12 +136,20 @@ lload_tiers_update( evutil_socket_t s, short what, void *arg )
         if ( tier->t_type.tier_update ) {
             tier->t_type.tier_update( tier );
         }
+        if ( !BER_BVISNULL( &lload_write_coherence_csn ) ) {
+            LloadBackend *b;
+
+            LDAP_CIRCLEQ_FOREACH ( b, &tier->t_backends, b_next ) {
+                backend_csn_poll( b );
+            }
+        }
     }
 }
 
 extern struct lload_tier_type roundrobin_tier;
 extern struct lload_tier_type weighted_tier;
 extern struct lload_tier_type bestof_tier;
+extern struct lload_tier_type peakewma_tier;
 
 struct {
     char *name;
@@ -150,6 +158,7 @@ struct {
         { "roundrobin", &roundrobin_tier },
         { "weighted", &weighted_tier },
         { "bestof", &bestof_tier },
+        { "peakewma", &peakewma_tier },
 
         { NULL }
 };
@@ -0,0 +1,257 @@
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2024 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <ac/time.h>
+#include <math.h>
+
+#include "lload.h"
+
+static LloadTierInit peakewma_init;
+static LloadTierBackendCb peakewma_add_backend;
+static LloadTierBackendCb peakewma_remove_backend;
+static LloadTierSelect peakewma_select;
+
+struct lload_tier_type peakewma_tier;
+
+/*
+ * Expected cost of sending one more request down c: its recent latency
+ * times the number of requests it would then have outstanding.
+ *
+ * The latency is the peak EWMA kept by upstream_latency_update(), decayed
+ * to now. While requests are outstanding and nothing has come back for
+ * longer than that, the time since is used instead, so a server that
+ * stalls becomes expensive straight away rather than after its first slow
+ * response arrives.
+ */
+static double
+peakewma_cost( LloadConnection *c, struct timeval *now )
+{
+    struct timeval tvdiff;
+    double latency = c->c_latency, stalled;
+    long pending = c->c_n_ops_executing;
+
+    if ( timerisset( &c->c_latency_time ) ) {
+        timersub( now, &c->c_latency_time, &tvdiff );
+        latency *= exp( -( tvdiff.tv_sec + tvdiff.tv_usec / 1000000.0 ) /
+                LLOAD_LATENCY_DECAY );
+    }
+
+    if ( pending > 0 ) {
+        timersub( now, &c->c_last_activity, &tvdiff );
+        stalled = tvdiff.tv_sec * 1000000.0 + tvdiff.tv_usec;
+        if ( stalled > latency ) {
+            latency = stalled;
+        }
+    }
+
+    /* Without any samples yet this degrades to least outstanding requests */
+    return ( latency + 1 ) * ( pending + 1 );
+}
+
+/*
+ * Find the cheapest connection of b that looks usable. The values are read
+ * without locking the connections, try_upstream() makes the final call.
+ */
+static LloadConnection *
+peakewma_backend_best(
+        LloadBackend *b,
+        LloadOperation *op,
+        struct timeval *now,
+        double *costp )
+{
+    lload_c_head *head;
+    LloadConnection *c, *best = NULL;
+    double cost;
+
+    assert_locked( &b->b_mutex );
+
+    if ( b->b_max_pending && b->b_n_ops_executing >= b->b_max_pending ) {
+        return NULL;
+    }
+    if ( op->o_csn && !backend_csn_covered( b, op->o_csn ) ) {
+        return NULL;
+    }
+
+    if ( op->o_tag == LDAP_REQ_BIND
+#ifdef LDAP_API_FEATURE_VERIFY_CREDENTIALS
+            && !(lload_features & LLOAD_FEATURE_VC)
+#endif /* LDAP_API_FEATURE_VERIFY_CREDENTIALS */
+            ) {
+        head = &b->b_bindconns;
+    } else {
+        head = &b->b_conns;
+    }
+
+    LDAP_CIRCLEQ_FOREACH( c, head, c_next ) {
+        if ( c->c_state != LLOAD_C_READY ) {
+            continue;
+        }
+        if ( b->b_max_conn_pending &&
+                c->c_n_ops_executing >= b->b_max_conn_pending ) {
+            continue;
+        }
+
+        cost = peakewma_cost( c, now );
+        if ( !best || cost < *costp ) {
+            best = c;
+            *costp = cost;
+        }
+    }
+
+    return best;
+}
+
+static LloadTier *
+peakewma_init( void )
+{
+    LloadTier *tier;
+
+    tier = ch_calloc( 1, sizeof(LloadTier) );
+
+    tier->t_type = peakewma_tier;
+    ldap_pvt_thread_mutex_init( &tier->t_mutex );
+    LDAP_CIRCLEQ_INIT( &tier->t_backends );
+
+    return tier;
+}
+
+static int
+peakewma_add_backend( LloadTier *tier, LloadBackend *b )
+{
+    assert( b->b_tier == tier );
+
+    LDAP_CIRCLEQ_INSERT_TAIL( &tier->t_backends, b, b_next );
+    if ( !tier->t_private ) {
+        tier->t_private = b;
+    }
+    tier->t_nbackends++;
+    return LDAP_SUCCESS;
+}
+
+static int
+peakewma_remove_backend( LloadTier *tier, LloadBackend *b )
+{
+    LloadBackend *next = LDAP_CIRCLEQ_LOOP_NEXT( &tier->t_backends, b, b_next );
+
+    assert_locked( &tier->t_mutex );
+    assert_locked( &b->b_mutex );
+
+    assert( b->b_tier == tier );
+    assert( tier->t_private );
+
+    LDAP_CIRCLEQ_REMOVE( &tier->t_backends, b, b_next );
+    LDAP_CIRCLEQ_ENTRY_INIT( b, b_next );
+
+    if ( b == next ) {
+        tier->t_private = NULL;
+    } else {
+        tier->t_private = next;
+    }
+    tier->t_nbackends--;
+
+    return LDAP_SUCCESS;
+}
+
+static int
+peakewma_select(
+        LloadTier *tier,
+        LloadOperation *op,
+        LloadConnection **cp,
+        int *res,
+        char **message )
+{
+    LloadBackend *first, *next, *b, *best = NULL;
+    LloadConnection *c;
+    struct timeval now;
+    double cost, best_cost = 0;
+    int rc = 0;
+
+    checked_lock( &tier->t_mutex );
+    first = b = tier->t_private;
+    checked_unlock( &tier->t_mutex );
+
+    if ( !first ) return rc;
+
+    gettimeofday( &now, NULL );
+
+    do {
+        checked_lock( &b->b_mutex );
+        if ( peakewma_backend_best( b, op, &now, &cost ) &&
+                ( !best || cost < best_cost ) ) {
+            best = b;
+            best_cost = cost;
+        }
+        next = LDAP_CIRCLEQ_LOOP_NEXT( &tier->t_backends, b, b_next );
+        checked_unlock( &b->b_mutex );
+        b = next;
+    } while ( b != first );
+
+    if ( best ) {
+        checked_lock( &best->b_mutex );
+        c = peakewma_backend_best( best, op, &now, &cost );
+        if ( c && try_upstream( best, NULL, op, c, res, message ) ) {
+            *cp = c;
+            next = LDAP_CIRCLEQ_LOOP_NEXT( &tier->t_backends, best, b_next );
+            checked_unlock( &best->b_mutex );
+
+            /* Start from elsewhere next time so that ties are spread out */
+            checked_lock( &tier->t_mutex );
+            tier->t_private = next;
+            checked_unlock( &tier->t_mutex );
+            return 1;
+        }
+        checked_unlock( &best->b_mutex );
+    }
+
+    /* Lost a race or nothing looked usable, settle for a round robin */
+    b = first;
+    do {
+        checked_lock( &b->b_mutex );
+        next = LDAP_CIRCLEQ_LOOP_NEXT( &tier->t_backends, b, b_next );
+
+        rc = backend_select( b, op, cp, res, message );
+        checked_unlock( &b->b_mutex );
+
+        if ( rc && *cp ) {
+            checked_lock( &tier->t_mutex );
+            tier->t_private = next;
+            checked_unlock( &tier->t_mutex );
+            return rc;
+        }
+
+        b = next;
+    } while ( b != first );
+
+    return rc;
+}
+
+struct lload_tier_type peakewma_tier = {
+        .tier_name = "peakewma",
+
+        .tier_init = peakewma_init,
+        .tier_startup = tier_startup,
+        .tier_reset = tier_reset,
+        .tier_destroy = tier_destroy,
+
+        .tier_oc = BER_BVC("olcBkLloadTierConfig"),
+        .tier_backend_oc = BER_BVC("olcBkLloadBackendConfig"),
+
+        .tier_add_backend = peakewma_add_backend,
+        .tier_remove_backend = peakewma_remove_backend,
+
+        .tier_select = peakewma_select,
+};
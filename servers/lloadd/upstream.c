@@ -20,6 +20,7 @@
 #include <ac/string.h>
 #include <ac/time.h>
 #include <ac/unistd.h>
+#include <math.h>
 
 #include "lload.h"
 
@@ -65,7 +66,7 @@ int
 forward_response( LloadConnection *client, LloadOperation *op, BerElement *ber )
 {
     BerElement *output;
-    BerValue response, controls = BER_BVNULL;
+    BerValue response, controls;
     ber_int_t msgid;
     ber_tag_t tag, response_tag;
     ber_len_t len;
@@ -80,11 +81,17 @@ forward_response( LloadConnection *client, LloadOperation *op, BerElement *ber )
     }
     CONNECTION_UNLOCK(client);
 
-    response_tag = ber_skip_element( ber, &response );
+    /* Only the message ID changes, take the rest as it came in */
+    response_tag = ber_skip_raw( ber, &response );
 
     tag = ber_peek_tag( ber, &len );
     if ( tag == LDAP_TAG_CONTROLS ) {
-        ber_skip_element( ber, &controls );
+        ber_skip_raw( ber, &controls );
+        response.bv_len = controls.bv_val + controls.bv_len - response.bv_val;
+    }
+
+    if ( op->o_cache ) {
+        lload_cache_response( op, &response );
     }
 
     Debug( LDAP_DEBUG_TRACE, "forward_response: "
@@ -100,10 +107,7 @@ forward_response( LloadConnection *client, LloadOperation *op, BerElement *ber )
     }
     client->c_pendingber = output;
 
-    ber_printf( output, "t{titOtO}", LDAP_TAG_MESSAGE,
-            LDAP_TAG_MSGID, msgid,
-            response_tag, &response,
-            LDAP_TAG_CONTROLS, BER_BV_OPTIONAL( &controls ) );
+    lload_pdu_splice( output, msgid, &response );
 
     checked_unlock( &client->c_io_mutex );
 
@@ -127,6 +131,14 @@ forward_final_response(
 
     rc = forward_response( client, op, ber );
 
+    if ( op->o_cache ) {
+        lload_cache_finish( op );
+    } else if ( op->o_tag != LDAP_REQ_SEARCH &&
+            op->o_tag != LDAP_REQ_COMPARE && op->o_tag != LDAP_REQ_BIND ) {
+        /* Reads issued while the write was in progress could be stale too */
+        lload_cache_invalidate();
+    }
+
     op->o_res = LLOAD_OP_COMPLETED;
     if ( !op->o_pin_id ) {
         OPERATION_UNLINK(op);
@@ -135,6 +147,33 @@ forward_final_response(
     return rc;
 }
 
+/*
+ * Peak EWMA: a slower sample replaces the estimate outright, faster ones only
+ * pull it down gradually, depending on how long ago the last one arrived.
+ *
+ * Only the thread currently reading c's responses calls this, readers
+ * elsewhere tolerate a stale value.
+ */
+static void
+upstream_latency_update(
+        LloadConnection *c,
+        uintptr_t diff,
+        struct timeval *now )
+{
+    struct timeval tvdiff;
+    double w;
+
+    if ( diff >= c->c_latency || !timerisset( &c->c_latency_time ) ) {
+        c->c_latency = diff;
+    } else {
+        timersub( now, &c->c_latency_time, &tvdiff );
+        w = exp( -( tvdiff.tv_sec + tvdiff.tv_usec / 1000000.0 ) /
+                LLOAD_LATENCY_DECAY );
+        c->c_latency = c->c_latency * w + diff * ( 1 - w );
+    }
+    c->c_latency_time = *now;
+}
+
 static int
 handle_unsolicited( LloadConnection *c, BerElement *ber )
 {
@@ -266,8 +305,11 @@ handle_one_response( LloadConnection *c )
 
             __atomic_add_fetch( &b->b_operation_count, 1, __ATOMIC_RELAXED );
             __atomic_add_fetch( &b->b_operation_time, diff, __ATOMIC_RELAXED );
+
+            upstream_latency_update( c, diff, &tv );
         }
         op->o_last_response = tv;
+        c->c_last_activity = tv;
 
         Debug( LDAP_DEBUG_STATS2, "handle_one_response: "
                 "upstream connid=%lu, processing response for "
@@ -288,7 +330,10 @@ handle_one_response( LloadConnection *c )
         checked_lock( &op->o_link_mutex );
         client = op->o_client;
         checked_unlock( &op->o_link_mutex );
-        if ( client && IS_ALIVE( client, c_live ) ) {
+        if ( op->o_response_cb ) {
+            /* One of our own, nobody to forward it to */
+            rc = op->o_response_cb( c, op, ber );
+        } else if ( client && IS_ALIVE( client, c_live ) ) {
             rc = handler( client, op, ber );
         } else {
             ber_free( ber, 1 );
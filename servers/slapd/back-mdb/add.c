@@ -357,13 +357,13 @@ mdb_add(Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if ( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_batch_abort( mdb, moi );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		}
 
-		rs->sr_err = mdb_txn_commit( txn );
+		rs->sr_err = mdb_batch_commit( mdb, moi );
 		txn = NULL;
 		if ( rs->sr_err != 0 ) {
 			mdb->mi_numads = numads;
@@ -391,7 +391,7 @@ return_results:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_batch_abort( mdb, moi );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
@@ -249,6 +249,22 @@ mdb_attr_index_config(
 		}
 	}
 
+	if ( mask & SLAP_INDEX_SUBSTR_LENS ) {
+		const char *text = NULL;
+		rc = slap_index_substr_check( mask, &text );
+		if ( rc != LDAP_SUCCESS ) {
+			if ( c_reply )
+			{
+				snprintf(c_reply->msg, sizeof(c_reply->msg),
+					"%s", text );
+				fprintf( stderr, "%s: line %d: %s\n",
+					fname, lineno, c_reply->msg );
+			}
+			rc = LDAP_PARAM_ERROR;
+			goto done;
+		}
+	}
+
 	if( !mask ) {
 		if ( c_reply )
 		{
@@ -52,6 +52,12 @@ LDAP_BEGIN_DECL
 /* Most users will never see this */
 #define DEFAULT_RTXN_SIZE	10000
 
+/* Set in the attribute count of a compressed id2entry record */
+#define	MDB_ENTRY_ZIP	(1U<<(sizeof(unsigned int)*CHAR_BIT-1))
+
+/* Number of entries sampled to train a compression dictionary */
+#define MDB_ZDICT_SAMPLE	1000
+
 #ifdef LDAP_DEVEL
 #define MDB_MONITOR_IDX
 #endif
@@ -64,6 +70,9 @@ typedef struct mdb_monitor_t {
 /* From ldap_rq.h */
 struct re_s;
 
+/* From batch.c */
+struct mdb_batch;
+
 struct mdb_info {
 	MDB_env		*mi_dbenv;
 
@@ -91,6 +100,17 @@ struct mdb_info {
 	struct re_s		*mi_txn_cp_task;
 	struct re_s		*mi_index_task;
 
+	/* group commit */
+	unsigned	mi_batch_max;
+	struct mdb_batch	*mi_batch;	/* batch open for new updates */
+	ldap_pvt_thread_mutex_t	mi_batch_mutex;
+	ldap_pvt_thread_cond_t	mi_batch_cond;
+
+	/* entry compression */
+	int			mi_compress;
+	struct berval	mi_zdict;	/* preset dictionary, if trained */
+	unsigned long	mi_zdictid;	/* its Adler-32 checksum */
+
 	mdb_monitor_t	mi_monitor;
 
 #ifdef MDB_MONITOR_IDX
@@ -104,6 +124,7 @@ struct mdb_info {
 #define	MDB_DEL_INDEX	0x08
 #define	MDB_RE_OPEN		0x10
 #define	MDB_NEED_UPGRADE	0x20
+#define	MDB_ZDICT_TRAIN	0x40
 
 	int mi_numads;
 
@@ -128,12 +149,14 @@ struct mdb_info {
 typedef struct mdb_op_info {
 	OpExtra		moi_oe;
 	MDB_txn*	moi_txn;
+	struct mdb_batch	*moi_batch;	/* moi_txn is nested in a group commit */
 	int			moi_ref;
 	char		moi_flag;
 } mdb_op_info;
 #define MOI_READER	0x01
 #define MOI_FREEIT	0x02
 #define MOI_KEEPER	0x04
+#define MOI_LEADER	0x08
 
 LDAP_END_DECL
 
@@ -164,6 +187,7 @@ typedef struct mdb_attrixinfo {
 /* These flags must not clash with SLAP_INDEX flags or ops in slap.h! */
 #define	MDB_INDEX_DELETING	0x8000U	/* index is being modified */
 #define	MDB_INDEX_UPDATE_OP	0x03	/* performing an index update */
+#define	MDB_INDEX_STALE_OP	0x04	/* removing keys an index update replaces */
 
 /* For slapindex to record which attrs in an entry belong to which
  * index database 
@@ -0,0 +1,191 @@
+/* batch.c - group commit of update operations */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2024 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/*
+ * An update that finds no batch open starts one and becomes its
+ * leader. The leader begins the shared write txn, which waits for the
+ * previous batch to finish committing, and makes its changes in a
+ * nested txn of it. Updates arriving in the meantime join the batch
+ * and take turns running their own nested txns, so a failed update
+ * only discards its own changes. When the leader is done with its
+ * nested txn it closes the batch, waits for the members that already
+ * joined, and commits the shared txn once for all of them. Nobody
+ * returns a result before that commit has completed.
+ */
+struct mdb_batch {
+	MDB_txn		*mb_txn;	/* shared txn, NULL until begun */
+	int			mb_rc;		/* result of beginning or committing it */
+	int			mb_size;	/* updates that joined */
+	int			mb_nops;	/* updates still running a nested txn */
+	int			mb_refs;	/* updates still waiting for mb_rc */
+	char		mb_busy;	/* a nested txn is in progress */
+	char		mb_done;	/* mb_rc is final */
+};
+
+/* Finish our nested txn and wait for the shared commit */
+static int
+mdb_batch_end( struct mdb_info *mdb, mdb_op_info *moi, int commit )
+{
+	struct mdb_batch *mb = moi->moi_batch;
+	int rc = 0;
+
+	if ( moi->moi_txn ) {
+		if ( commit )
+			rc = mdb_txn_commit( moi->moi_txn );
+		else
+			mdb_txn_abort( moi->moi_txn );
+		moi->moi_txn = NULL;
+	}
+	moi->moi_batch = NULL;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_batch_mutex );
+	mb->mb_busy = 0;
+	mb->mb_nops--;
+	ldap_pvt_thread_cond_broadcast( &mdb->mi_batch_cond );
+
+	if ( moi->moi_flag & MOI_LEADER ) {
+		moi->moi_flag ^= MOI_LEADER;
+		if ( mdb->mi_batch == mb )
+			mdb->mi_batch = NULL;
+		while ( mb->mb_nops )
+			ldap_pvt_thread_cond_wait( &mdb->mi_batch_cond, &mdb->mi_batch_mutex );
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_batch_mutex );
+
+		/* The shared txn must be committed by the thread that began it */
+		mb->mb_rc = mdb_txn_commit( mb->mb_txn );
+		if ( mb->mb_rc ) {
+			mdb->mi_numads = 0;
+			Debug( LDAP_DEBUG_ANY, "mdb_batch_end: "
+				"commit of %d updates failed: %s (%d)\n",
+				mb->mb_size, mdb_strerror( mb->mb_rc ), mb->mb_rc );
+		} else {
+			Debug( LDAP_DEBUG_TRACE, "mdb_batch_end: "
+				"committed %d updates\n", mb->mb_size );
+		}
+
+		ldap_pvt_thread_mutex_lock( &mdb->mi_batch_mutex );
+		mb->mb_done = 1;
+		ldap_pvt_thread_cond_broadcast( &mdb->mi_batch_cond );
+	} else {
+		while ( !mb->mb_done )
+			ldap_pvt_thread_cond_wait( &mdb->mi_batch_cond, &mdb->mi_batch_mutex );
+	}
+
+	if ( !rc )
+		rc = mb->mb_rc;
+	if ( --mb->mb_refs == 0 )
+		ch_free( mb );
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_batch_mutex );
+
+	return rc;
+}
+
+/* Join the open batch or start a new one, and begin a nested
+ * txn of its shared txn for this update.
+ */
+int
+mdb_batch_begin( struct mdb_info *mdb, mdb_op_info *moi )
+{
+	struct mdb_batch *mb;
+	int rc;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_batch_mutex );
+	mb = mdb->mi_batch;
+	if ( !mb ) {
+		MDB_txn *txn;
+
+		mb = ch_calloc( 1, sizeof( struct mdb_batch ));
+		mb->mb_busy = 1;	/* the leader goes first */
+		mb->mb_size = mb->mb_nops = mb->mb_refs = 1;
+		if ( mdb->mi_batch_max > 1 )
+			mdb->mi_batch = mb;
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_batch_mutex );
+
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+
+		ldap_pvt_thread_mutex_lock( &mdb->mi_batch_mutex );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY, "mdb_batch_begin: err %s(%d)\n",
+				mdb_strerror( rc ), rc );
+			if ( mdb->mi_batch == mb )
+				mdb->mi_batch = NULL;
+			mb->mb_rc = rc;
+			mb->mb_done = 1;
+			ldap_pvt_thread_cond_broadcast( &mdb->mi_batch_cond );
+			if ( --mb->mb_refs == 0 )
+				ch_free( mb );
+			ldap_pvt_thread_mutex_unlock( &mdb->mi_batch_mutex );
+			return rc;
+		}
+		mb->mb_txn = txn;
+		moi->moi_flag |= MOI_LEADER;
+		ldap_pvt_thread_cond_broadcast( &mdb->mi_batch_cond );
+	} else {
+		mb->mb_nops++;
+		mb->mb_refs++;
+		if ( ++mb->mb_size >= mdb->mi_batch_max )
+			mdb->mi_batch = NULL;
+		while ( !mb->mb_done && ( !mb->mb_txn || mb->mb_busy ))
+			ldap_pvt_thread_cond_wait( &mdb->mi_batch_cond, &mdb->mi_batch_mutex );
+		if ( mb->mb_done ) {
+			/* The leader could not begin the shared txn */
+			rc = mb->mb_rc;
+			if ( --mb->mb_refs == 0 )
+				ch_free( mb );
+			ldap_pvt_thread_mutex_unlock( &mdb->mi_batch_mutex );
+			return rc;
+		}
+		mb->mb_busy = 1;
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_batch_mutex );
+
+	moi->moi_batch = mb;
+	rc = mdb_txn_begin( mdb->mi_dbenv, mb->mb_txn, 0, &moi->moi_txn );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "mdb_batch_begin: nested txn err %s(%d)\n",
+			mdb_strerror( rc ), rc );
+		moi->moi_txn = NULL;
+		mdb_batch_end( mdb, moi, 0 );
+	}
+	return rc;
+}
+
+/* Commit the write txn of an update. For a batched update, returns
+ * once the shared txn is committed, with the result of that commit.
+ */
+int
+mdb_batch_commit( struct mdb_info *mdb, mdb_op_info *moi )
+{
+	if ( !moi->moi_batch )
+		return mdb_txn_commit( moi->moi_txn );
+	return mdb_batch_end( mdb, moi, 1 );
+}
+
+void
+mdb_batch_abort( struct mdb_info *mdb, mdb_op_info *moi )
+{
+	if ( !moi->moi_batch )
+		mdb_txn_abort( moi->moi_txn );
+	else
+		mdb_batch_end( mdb, moi, 0 );
+}
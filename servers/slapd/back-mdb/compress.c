@@ -0,0 +1,413 @@
+/* compress.c - compression of id2entry records */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2024 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+
+/*
+ * Entries are mostly small, so on their own they compress poorly.
+ * What they do share is the values that recur across the DIT:
+ * objectClasses, creatorsName, the parts of DNs below the suffix.
+ * A preset dictionary of those values, sampled from the entries
+ * already in the database, lets each record refer back to them.
+ *
+ * The dictionary is kept in the ad2id DB under key 0, which is never
+ * used for an attribute. Once written it is never changed, since every
+ * record compressed with it depends on its exact contents; zlib records
+ * the dictionary's Adler-32 checksum in each stream, which is checked
+ * against ours before inflating.
+ */
+
+/* zlib has no prepared form of a dictionary, each record pays for
+ * loading it, so it's kept small. The window covers the dictionary
+ * and most of an entry.
+ */
+#define MDB_ZWBITS	13
+#define MDB_ZMEMLEVEL	6
+#define MDB_ZDICT_MAX	4096
+#define MDB_ZDICT_MIN	16	/* fewest entries worth training on */
+#define MDB_ZVAL_MIN	4	/* shortest value worth a back-reference */
+#define MDB_ZVAL_MAX	256
+
+static voidpf
+mdb_zalloc( voidpf opaque, uInt items, uInt size )
+{
+	Operation *op = opaque;
+	return op->o_tmpalloc( (ber_len_t)items * size, op->o_tmpmemctx );
+}
+
+static void
+mdb_zfree( voidpf opaque, voidpf ptr )
+{
+	Operation *op = opaque;
+	op->o_tmpfree( ptr, op->o_tmpmemctx );
+}
+
+/* Compress len bytes of src into dst, which has room for *dlen bytes,
+ * using the dictionary, which must already be loaded. Returns 0 and
+ * sets *dlen to the compressed size, or nonzero if the result would
+ * not fit.
+ */
+int
+mdb_entry_deflate( Operation *op, void *src, size_t len,
+	void *dst, size_t *dlen )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	z_stream zs = {0};
+	int rc;
+
+	zs.zalloc = mdb_zalloc;
+	zs.zfree = mdb_zfree;
+	zs.opaque = op;
+	if ( deflateInit2( &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MDB_ZWBITS,
+		MDB_ZMEMLEVEL, Z_DEFAULT_STRATEGY ) != Z_OK )
+		return -1;
+	deflateSetDictionary( &zs, (Bytef *)mdb->mi_zdict.bv_val,
+		mdb->mi_zdict.bv_len );
+	zs.next_in = src;
+	zs.avail_in = len;
+	zs.next_out = dst;
+	zs.avail_out = *dlen;
+	rc = deflate( &zs, Z_FINISH );
+	*dlen = zs.total_out;
+	deflateEnd( &zs );
+	return rc != Z_STREAM_END;
+}
+
+/* Decompress a record into dst, which must receive exactly len bytes */
+int
+mdb_entry_inflate( Operation *op, void *src, size_t slen,
+	void *dst, size_t len )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	z_stream zs = {0};
+	int rc;
+
+	zs.zalloc = mdb_zalloc;
+	zs.zfree = mdb_zfree;
+	zs.opaque = op;
+	zs.next_in = src;
+	zs.avail_in = slen;
+	if ( inflateInit2( &zs, MDB_ZWBITS ) != Z_OK )
+		return LDAP_OTHER;
+	zs.next_out = dst;
+	zs.avail_out = len;
+	rc = inflate( &zs, Z_FINISH );
+	if ( rc == Z_NEED_DICT ) {
+		if ( !mdb->mi_zdict.bv_len || zs.adler != mdb->mi_zdictid ) {
+			Debug( LDAP_DEBUG_ANY, "mdb_entry_inflate: "
+				"entry needs unknown dictionary %lx\n", zs.adler );
+			inflateEnd( &zs );
+			return LDAP_OTHER;
+		}
+		inflateSetDictionary( &zs, (Bytef *)mdb->mi_zdict.bv_val,
+			mdb->mi_zdict.bv_len );
+		rc = inflate( &zs, Z_FINISH );
+	}
+	if ( rc != Z_STREAM_END || zs.total_out != len ) {
+		Debug( LDAP_DEBUG_ANY, "mdb_entry_inflate: "
+			"corrupted entry: %s (%d)\n", zs.msg ? zs.msg : "", rc );
+		rc = LDAP_OTHER;
+	} else {
+		rc = 0;
+	}
+	inflateEnd( &zs );
+	return rc;
+}
+
+static void
+mdb_zdict_set( struct mdb_info *mdb, void *dict, size_t len )
+{
+	mdb_zdict_free( mdb );
+	mdb->mi_zdict.bv_val = ch_malloc( len );
+	mdb->mi_zdict.bv_len = len;
+	memcpy( mdb->mi_zdict.bv_val, dict, len );
+	mdb->mi_zdictid = adler32( adler32( 0, NULL, 0 ), dict, len );
+}
+
+/* Load the dictionary, if the database has one */
+int
+mdb_zdict_read( struct mdb_info *mdb, MDB_txn *txn )
+{
+	MDB_val key, data;
+	int rc, zero = 0;
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &zero;
+	rc = mdb_get( txn, mdb->mi_ad2id, &key, &data );
+	if ( rc == MDB_NOTFOUND ) {
+		mdb_zdict_free( mdb );
+		return 0;
+	}
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_zdict_read: mdb_get failed: %s(%d)\n",
+			mdb_strerror(rc), rc );
+		return rc;
+	}
+	mdb_zdict_set( mdb, data.mv_data, data.mv_size );
+	return 0;
+}
+
+typedef struct zval {
+	struct berval zv_bv;
+	int zv_count;
+} zval;
+
+static int
+zval_cmp( const void *v1, const void *v2 )
+{
+	const zval *z1 = v1, *z2 = v2;
+
+	if ( z1->zv_bv.bv_len != z2->zv_bv.bv_len )
+		return z1->zv_bv.bv_len < z2->zv_bv.bv_len ? -1 : 1;
+	return memcmp( z1->zv_bv.bv_val, z2->zv_bv.bv_val, z1->zv_bv.bv_len );
+}
+
+/* Most useful first: the bytes saved by referring back to the value */
+static int
+zval_score( const void *v1, const void *v2 )
+{
+	const zval *z1 = v1, *z2 = v2;
+	ber_len_t s1 = (z1->zv_count - 1) * (z1->zv_bv.bv_len + 1);
+	ber_len_t s2 = (z2->zv_count - 1) * (z2->zv_bv.bv_len + 1);
+
+	if ( s1 != s2 )
+		return s1 > s2 ? -1 : 1;
+	return zval_cmp( v1, v2 );
+}
+
+/* Build a dictionary from the values that recur in a sample of the
+ * entries in the database, and store it. Does nothing if there are
+ * too few entries to tell what recurs.
+ */
+int
+mdb_zdict_train( BackendDB *be, MDB_txn *txn )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	Operation op = {0};
+	Opheader ohdr = {0};
+	MDB_cursor *mc;
+	MDB_val key, data;
+	zval *vals = NULL;
+	char *dict, *ptr;
+	int i, j, nvals = 0, maxvals = 0, nentries = 0, zero = 0, rc;
+
+	op.o_hdr = &ohdr;
+	op.o_bd = be;
+	op.o_tmpmemctx = NULL;
+	op.o_tmpmfuncs = &ch_mfuncs;
+
+	rc = mdb_cursor_open( txn, mdb->mi_id2entry, &mc );
+	if ( rc )
+		return rc;
+	while ( nentries < MDB_ZDICT_SAMPLE &&
+		( rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT )) == 0 ) {
+		Entry *e;
+		Attribute *a;
+		ID id;
+
+		if ( !data.mv_size )
+			continue;
+		memcpy( &id, key.mv_data, sizeof(ID) );
+		rc = mdb_entry_decode( &op, txn, &data, id, &e );
+		if ( rc )
+			break;
+		e->e_name.bv_val = NULL;
+		e->e_nname.bv_val = NULL;
+		nentries++;
+		for ( a = e->e_attrs; a; a = a->a_next ) {
+			for ( i = 0; i < a->a_numvals; i++ ) {
+				for ( j = 0; j < 2; j++ ) {
+					struct berval *bv = j ? &a->a_nvals[i] : &a->a_vals[i];
+					if ( j && a->a_nvals == a->a_vals )
+						break;
+					if ( bv->bv_len < MDB_ZVAL_MIN || bv->bv_len > MDB_ZVAL_MAX )
+						continue;
+					if ( nvals == maxvals ) {
+						maxvals = maxvals ? maxvals * 2 : 1024;
+						vals = ch_realloc( vals, maxvals * sizeof(zval) );
+					}
+					ber_dupbv( &vals[nvals].zv_bv, bv );
+					vals[nvals++].zv_count = 1;
+				}
+			}
+		}
+		mdb_entry_return( &op, e );
+	}
+	mdb_cursor_close( mc );
+	if ( rc && rc != MDB_NOTFOUND )
+		goto done;
+	rc = 0;
+	if ( nentries < MDB_ZDICT_MIN )
+		goto done;
+
+	/* Count the distinct values, keeping those seen more than once */
+	qsort( vals, nvals, sizeof(zval), zval_cmp );
+	for ( i = 0, j = -1; i < nvals; i++ ) {
+		if ( j >= 0 && !zval_cmp( &vals[j], &vals[i] )) {
+			vals[j].zv_count++;
+			ch_free( vals[i].zv_bv.bv_val );
+			continue;
+		}
+		if ( j >= 0 && vals[j].zv_count < 2 )
+			ch_free( vals[j].zv_bv.bv_val );
+		else
+			j++;
+		vals[j] = vals[i];
+	}
+	if ( j >= 0 && vals[j].zv_count < 2 )
+		ch_free( vals[j].zv_bv.bv_val );
+	else
+		j++;
+	nvals = j;
+	if ( !nvals )
+		goto done;
+
+	/* Take the most useful values that fit, and put them at the end
+	 * of the dictionary, where back-references to them are shortest.
+	 * Each keeps the NUL that follows it in an encoded entry.
+	 */
+	qsort( vals, nvals, sizeof(zval), zval_score );
+	j = 0;
+	for ( i = 0; i < nvals; i++ ) {
+		if ( j + vals[i].zv_bv.bv_len + 1 > MDB_ZDICT_MAX )
+			break;
+		j += vals[i].zv_bv.bv_len + 1;
+	}
+	dict = ch_malloc( j );
+	ptr = dict + j;
+	while ( i-- > 0 ) {
+		ptr -= vals[i].zv_bv.bv_len + 1;
+		memcpy( ptr, vals[i].zv_bv.bv_val, vals[i].zv_bv.bv_len );
+		ptr[vals[i].zv_bv.bv_len] = '\0';
+	}
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &zero;
+	data.mv_size = j;
+	data.mv_data = dict;
+	rc = mdb_put( txn, mdb->mi_ad2id, &key, &data, MDB_NOOVERWRITE );
+	if ( rc == 0 ) {
+		mdb_zdict_set( mdb, dict, j );
+		Debug( LDAP_DEBUG_STATS, "mdb_zdict_train: database \"%s\": "
+			"trained a %d byte dictionary on %d entries\n",
+			be->be_suffix[0].bv_val, j, nentries );
+	} else if ( rc == MDB_KEYEXIST ) {
+		/* someone else beat us to it */
+		rc = mdb_zdict_read( mdb, txn );
+	} else {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_zdict_train: mdb_put failed: %s(%d)\n",
+			mdb_strerror(rc), rc );
+	}
+	ch_free( dict );
+
+done:
+	for ( i = 0; i < nvals; i++ )
+		ch_free( vals[i].zv_bv.bv_val );
+	ch_free( vals );
+	return rc;
+}
+
+/* Train a dictionary in a txn of its own, if we still need one */
+int
+mdb_zdict_setup( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	MDB_txn *txn;
+	int rc;
+
+	if ( !mdb->mi_compress || mdb->mi_zdict.bv_len )
+		return 0;
+
+	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+	if ( rc )
+		return rc;
+	rc = mdb_zdict_train( be, txn );
+	if ( rc ) {
+		mdb_txn_abort( txn );
+	} else {
+		rc = mdb_txn_commit( txn );
+	}
+	if ( rc ) {
+		mdb_zdict_free( mdb );
+		Debug( LDAP_DEBUG_ANY, "mdb_zdict_setup: database \"%s\": "
+			"failed: %s (%d)\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+	}
+	return rc;
+}
+
+void
+mdb_zdict_free( struct mdb_info *mdb )
+{
+	if ( mdb->mi_zdict.bv_val ) {
+		ch_free( mdb->mi_zdict.bv_val );
+		BER_BVZERO( &mdb->mi_zdict );
+		mdb->mi_zdictid = 0;
+	}
+}
+
+#else /* !HAVE_ZLIB */
+
+int
+mdb_entry_deflate( Operation *op, void *src, size_t len,
+	void *dst, size_t *dlen )
+{
+	return -1;
+}
+
+int
+mdb_entry_inflate( Operation *op, void *src, size_t slen,
+	void *dst, size_t len )
+{
+	Debug( LDAP_DEBUG_ANY, "mdb_entry_inflate: "
+		"entry is compressed but zlib support is not available\n" );
+	return LDAP_OTHER;
+}
+
+int
+mdb_zdict_read( struct mdb_info *mdb, MDB_txn *txn )
+{
+	return 0;
+}
+
+int
+mdb_zdict_train( BackendDB *be, MDB_txn *txn )
+{
+	return 0;
+}
+
+int
+mdb_zdict_setup( BackendDB *be )
+{
+	return 0;
+}
+
+void
+mdb_zdict_free( struct mdb_info *mdb )
+{
+}
+
+#endif /* HAVE_ZLIB */
@@ -35,6 +35,7 @@ static ConfigDriver mdb_bk_cfg;
 
 enum {
 	MDB_CHKPT = 1,
+	MDB_COMPRESS,
 	MDB_DIRECTORY,
 	MDB_DBNOSYNC,
 	MDB_ENVFLAGS,
@@ -45,6 +46,7 @@ enum {
 	MDB_SSTACK,
 	MDB_MULTIVAL,
 	MDB_IDLEXP,
+	MDB_IDLBITMAP,
 };
 
 static ConfigTable mdbcfg[] = {
@@ -53,6 +55,11 @@ static ConfigTable mdbcfg[] = {
 			"DESC 'Power of 2 used to set IDL size' "
 			"EQUALITY integerMatch "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "idlbitmap", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|MDB_IDLBITMAP,
+		mdb_bk_cfg, "( OLcfgBkAt:12.2 NAME 'olcBkMdbIdlBitmap' "
+			"DESC 'Use compressed bitmaps for IDLs too large for a list' "
+			"EQUALITY booleanMatch "
+			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "directory", "dir", 2, 2, 0, ARG_STRING|ARG_MAGIC|MDB_DIRECTORY,
 		mdb_cf_gen, "( OLcfgDbAt:0.1 NAME 'olcDbDirectory' "
 			"DESC 'Directory for database content' "
@@ -63,6 +70,11 @@ static ConfigTable mdbcfg[] = {
 			"DESC 'Database checkpoint interval in kbytes and minutes' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE )",NULL, NULL },
+	{ "compression", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|MDB_COMPRESS,
+		mdb_cf_gen, "( OLcfgDbAt:12.8 NAME 'olcDbCompression' "
+			"DESC 'Compress entries with a dictionary trained on the database' "
+			"EQUALITY booleanMatch "
+			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "dbnosync", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|MDB_DBNOSYNC,
 		mdb_cf_gen, "( OLcfgDbAt:1.4 NAME 'olcDbNoSync' "
 			"DESC 'Disable synchronous database writes' "
@@ -73,6 +85,12 @@ static ConfigTable mdbcfg[] = {
 			"DESC 'Database environment flags' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "groupcommit", "max", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_batch_max),
+		"( OLcfgDbAt:12.7 NAME 'olcDbGroupCommit' "
+		"DESC 'Maximum number of concurrent updates to commit together' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "index", "attr> <[pres,eq,approx,sub]", 2, 3, 0, ARG_MAGIC|MDB_INDEX,
 		mdb_cf_gen, "( OLcfgDbAt:0.2 NAME 'olcDbIndex' "
 		"DESC 'Attribute index parameters' "
@@ -127,7 +145,7 @@ static ConfigOCs mdbocs[] = {
 		"NAME 'olcMdbBkConfig' "
 		"DESC 'MDB backend configuration' "
 		"SUP olcBackendConfig "
-		"MAY olcBkMdbIdlExp )",
+		"MAY ( olcBkMdbIdlExp $ olcBkMdbIdlBitmap ) )",
 			Cft_Backend, mdbcfg },
 	{
 		"( OLcfgDbOc:12.1 "
@@ -138,8 +156,8 @@ static ConfigOCs mdbocs[] = {
 		"MAY ( olcDbCheckpoint $ olcDbEnvFlags $ "
 		"olcDbNoSync $ olcDbIndex $ olcDbMaxReaders $ olcDbMaxSize $ "
 		"olcDbMode $ olcDbSearchStack $ olcDbMaxEntrySize $ olcDbRtxnSize $ "
-		"olcDbMultival ) )",
-			Cft_Database, mdbcfg+1 },
+		"olcDbMultival $ olcDbGroupCommit $ olcDbCompression ) )",
+			Cft_Database, mdbcfg+2 },
 	{ NULL, 0, NULL }
 };
 
@@ -156,6 +174,20 @@ static int
 mdb_bk_cfg( ConfigArgs *c )
 {
 	int rc = 0;
+	if ( c->type == MDB_IDLBITMAP ) {
+		if ( c->op == SLAP_CONFIG_EMIT ) {
+			if ( MDB_idl_bitmap )
+				c->value_int = MDB_idl_bitmap;
+			else
+				rc = 1;
+		} else if ( c->op == LDAP_MOD_DELETE ) {
+			MDB_idl_bitmap = 0;
+		} else {
+			MDB_idl_bitmap = c->value_int;
+			c->bi->bi_private = (void *)8;
+		}
+		return rc;
+	}
 	if ( c->op == SLAP_CONFIG_EMIT ) {
 		if ( MDB_idl_logn != MDB_IDL_LOGN )
 			c->value_int = MDB_idl_logn;
@@ -506,6 +538,11 @@ mdb_cf_cleanup( ConfigArgs *c )
 			rc = LDAP_OTHER;
 		mdb_setup_indexer( mdb );
 	}
+
+	if ( mdb->mi_flags & MDB_ZDICT_TRAIN ) {
+		mdb->mi_flags ^= MDB_ZDICT_TRAIN;
+		mdb_zdict_setup( c->be );
+	}
 	return rc;
 }
 
@@ -555,6 +592,10 @@ mdb_cf_gen( ConfigArgs *c )
 			}
 			break;
 
+		case MDB_COMPRESS:
+			c->value_int = mdb->mi_compress;
+			break;
+
 		case MDB_DBNOSYNC:
 			if ( mdb->mi_dbenv_flags & MDB_NOSYNC )
 				c->value_int = 1;
@@ -626,6 +667,9 @@ mdb_cf_gen( ConfigArgs *c )
 			config_push_cleanup( c, mdb_cf_cleanup );
 			ldap_pvt_thread_pool_purgekey( mdb->mi_dbenv );
 			break;
+		case MDB_COMPRESS:
+			mdb->mi_compress = 0;
+			break;
 		case MDB_DBNOSYNC:
 			mdb_env_set_flags( mdb->mi_dbenv, MDB_NOSYNC, 0 );
 			mdb->mi_dbenv_flags &= ~MDB_NOSYNC;
@@ -893,6 +937,24 @@ mdb_cf_gen( ConfigArgs *c )
 		}
 		break;
 
+	case MDB_COMPRESS:
+#ifndef HAVE_ZLIB
+		if ( c->value_int ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"%s: compression requires zlib support", c->argv[0] );
+			Debug( LDAP_DEBUG_ANY, "%s %s\n", c->log, c->cr_msg );
+			return 1;
+		}
+#endif
+		mdb->mi_compress = c->value_int;
+		/* Entries added from now on should get a dictionary */
+		if ( mdb->mi_compress && ( mdb->mi_flags & MDB_IS_OPEN ) &&
+			!mdb->mi_zdict.bv_len ) {
+			mdb->mi_flags |= MDB_ZDICT_TRAIN;
+			config_push_cleanup( c, mdb_cf_cleanup );
+		}
+		break;
+
 	case MDB_DBNOSYNC:
 		if ( c->value_int )
 			mdb->mi_dbenv_flags |= MDB_NOSYNC;
@@ -31,6 +31,11 @@ static int presence_candidates(
 	AttributeDescription *desc,
 	ID *ids );
 
+static int equality_keys(
+	Operation *op,
+	AttributeAssertion *ava,
+	MDB_dbi *dbi,
+	struct berval **keys );
 static int equality_candidates(
 	Operation *op,
 	MDB_txn *rtxn,
@@ -558,6 +563,228 @@ base:
 	return 0;
 }
 
+/* Estimated candidate counts, used to order the components of an AND */
+#define	EST_ALL		NOID		/* unindexed, every entry is a candidate */
+#define	EST_UNKNOWN	(NOID-1)	/* indexed, but not cheaply estimated */
+
+/* An AND stops fetching IDLs once its candidates are this few, or
+ * once the next component's IDL is AND_COST_RATIO times larger than
+ * the candidate list; the search tests each candidate against the
+ * full filter anyway.
+ */
+#define	AND_TEST_MAX	8
+#define	AND_COST_RATIO	64
+
+static ID
+keys_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	int ftype,
+	MatchingRule *mr,
+	void *assertion )
+{
+	MDB_dbi	dbi;
+	int i;
+	int rc;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	struct berval *keys = NULL;
+	ID count, est = EST_UNKNOWN;
+
+	rc = mdb_index_param( op->o_bd, desc, ftype, &dbi, &mask, &prefix );
+	if ( rc != LDAP_SUCCESS ) {
+		return EST_ALL;
+	}
+
+	if ( ftype == LDAP_FILTER_PRESENT ) {
+		if ( prefix.bv_val == NULL )
+			return EST_ALL;
+		rc = mdb_key_count( op->o_bd, rtxn, dbi, &prefix, &count );
+		if ( rc == MDB_NOTFOUND )
+			return 0;
+		return rc ? EST_UNKNOWN : count;
+	}
+
+	if ( !mr || !mr->smr_filter ) {
+		return EST_ALL;
+	}
+
+	rc = (mr->smr_filter)( ftype, mask, desc->ad_type->sat_syntax, mr,
+		&prefix, assertion, &keys, op->o_tmpmemctx );
+	if ( rc != LDAP_SUCCESS || keys == NULL ) {
+		return EST_ALL;
+	}
+
+	/* The keys are intersected, so the smallest one bounds the result.
+	 * Positional substring alternatives start at the first empty key.
+	 */
+	for ( i = 0; keys[i].bv_len != 0; i++ ) {
+		rc = mdb_key_count( op->o_bd, rtxn, dbi, &keys[i], &count );
+		if ( rc == MDB_NOTFOUND ) {
+			est = 0;
+			break;
+		}
+		if ( rc == 0 && count < est )
+			est = count;
+	}
+
+	ber_bvarray_free_x( keys, op->o_tmpmemctx );
+	return est;
+}
+
+/* Estimate how many candidates a filter will produce, using only
+ * the key counts of the index databases.
+ */
+static ID
+filter_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *f )
+{
+	Filter *f2;
+	ID est, n;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return 0;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		if ( f->f_result == LDAP_COMPARE_TRUE ||
+			f->f_result == LDAP_SUCCESS )
+			return EST_ALL;
+		return 0;
+
+	case LDAP_FILTER_PRESENT:
+		if ( f->f_desc == slap_schema.si_ad_objectClass )
+			return EST_ALL;
+		return keys_estimate( op, rtxn, f->f_desc, LDAP_FILTER_PRESENT,
+			NULL, NULL );
+
+	case LDAP_FILTER_EQUALITY:
+		if ( f->f_av_desc == slap_schema.si_ad_entryDN )
+			return 1;
+		return keys_estimate( op, rtxn, f->f_av_desc, LDAP_FILTER_EQUALITY,
+			f->f_av_desc->ad_type->sat_equality, &f->f_av_value );
+
+	case LDAP_FILTER_SUBSTRINGS:
+		return keys_estimate( op, rtxn, f->f_sub_desc, LDAP_FILTER_SUBSTRINGS,
+			f->f_sub_desc->ad_type->sat_substr, f->f_sub );
+
+	case LDAP_FILTER_AND:
+		est = EST_ALL;
+		for ( f2 = f->f_and; f2; f2 = f2->f_next ) {
+			n = filter_estimate( op, rtxn, f2 );
+			if ( n < est )
+				est = n;
+			if ( est == 0 )
+				break;
+		}
+		return est;
+
+	case LDAP_FILTER_OR:
+		est = 0;
+		for ( f2 = f->f_or; f2; f2 = f2->f_next ) {
+			n = filter_estimate( op, rtxn, f2 );
+			if ( n >= EST_UNKNOWN )
+				return n;
+			est += n;
+			if ( est >= EST_UNKNOWN )
+				return EST_UNKNOWN;
+		}
+		return est;
+	}
+
+	return EST_UNKNOWN;
+}
+
+typedef struct and_term {
+	Filter *f;
+	ID est;
+} and_term;
+
+typedef struct or_key {
+	AttributeDescription *desc;
+	MDB_dbi dbi;
+	struct berval *keys;
+} or_key;
+
+/* Fetch the single-key equality components of an OR that share an
+ * index together, with one cursor pass and one merge per index. The
+ * components handled here are flagged in done[], and their union is
+ * left in ids.
+ */
+static int
+or_batch_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *flist,
+	char *done,
+	ID *ids,
+	ID *tmp,
+	ID *save )
+{
+	Filter *f;
+	or_key *ok;
+	struct berval *keys;
+	int i, j, k, n = 0, rc = 0;
+
+	for ( f = flist; f != NULL; f = f->f_next )
+		n++;
+	ok = op->o_tmpcalloc( n, sizeof(or_key), op->o_tmpmemctx );
+	keys = op->o_tmpalloc( ( n + 1 ) * sizeof(struct berval), op->o_tmpmemctx );
+
+	for ( i = 0, f = flist; f != NULL; f = f->f_next, i++ ) {
+		if ( f->f_choice != LDAP_FILTER_EQUALITY ||
+			f->f_ava->aa_desc == slap_schema.si_ad_entryDN )
+			continue;
+#ifdef LDAP_COMP_MATCH
+		if ( is_aliased_attribute && is_aliased_attribute( f->f_ava->aa_desc ))
+			continue;
+#endif
+		ok[i].desc = f->f_ava->aa_desc;
+		equality_keys( op, f->f_ava, &ok[i].dbi, &ok[i].keys );
+		if ( ok[i].keys && !BER_BVISNULL( &ok[i].keys[1] )) {
+			ber_bvarray_free_x( ok[i].keys, op->o_tmpmemctx );
+			ok[i].keys = NULL;
+		}
+	}
+
+	MDB_IDL_ZERO( ids );
+	for ( i = 0; i < n; i++ ) {
+		if ( ok[i].keys == NULL || done[i] )
+			continue;
+		keys[0] = ok[i].keys[0];
+		for ( j = i + 1, k = 1; j < n; j++ ) {
+			if ( ok[j].keys && ok[j].dbi == ok[i].dbi )
+				keys[k++] = ok[j].keys[0];
+		}
+		if ( k < 2 )
+			continue;
+		BER_BVZERO( &keys[k] );
+		rc = mdb_keys_read( op, rtxn, ok[i].dbi, keys, LDAP_FILTER_OR,
+			save, tmp );
+		if ( rc != 0 )
+			break;
+		mdb_idl_union( ids, save );
+		for ( j = i; j < n; j++ ) {
+			if ( ok[j].keys && ok[j].dbi == ok[i].dbi )
+				done[j] = 1;
+		}
+		Debug( LDAP_DEBUG_FILTER,
+			"<= mdb_list_candidates: %d keys of (%s) fetched together\n",
+			k, ok[i].desc->ad_cname.bv_val );
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		if ( ok[i].keys )
+			ber_bvarray_free_x( ok[i].keys, op->o_tmpmemctx );
+	}
+	op->o_tmpfree( keys, op->o_tmpmemctx );
+	op->o_tmpfree( ok, op->o_tmpmemctx );
+	return rc;
+}
+
 static int
 list_candidates(
 	Operation *op,
@@ -570,14 +797,57 @@ list_candidates(
 {
 	int rc = 0;
 	Filter	*f;
+	and_term *terms = NULL, t;
+	char *done = NULL;
+	int i, j, n = 0, first = 1;
 
 	Debug( LDAP_DEBUG_FILTER, "=> mdb_list_candidates 0x%x\n", ftype );
-	for ( f = flist; f != NULL; f = f->f_next ) {
+
+	/* Order the components of an AND by their estimated size, so
+	 * the most selective ones are fetched first.
+	 */
+	if ( ftype == LDAP_FILTER_AND ) {
+		for ( f = flist; f != NULL; f = f->f_next )
+			n++;
+		terms = op->o_tmpalloc( n * sizeof(and_term), op->o_tmpmemctx );
+		for ( i = 0, f = flist; f != NULL; f = f->f_next ) {
+			/* ignore precomputed scopes */
+			if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
+			     f->f_result == LDAP_SUCCESS ) {
+				continue;
+			}
+			t.f = f;
+			t.est = filter_estimate( op, rtxn, f );
+			for ( j = i; j > 0 && terms[j-1].est > t.est; j-- )
+				terms[j] = terms[j-1];
+			terms[j] = t;
+			i++;
+			if ( t.est == 0 )
+				break;
+		}
+		n = i;
+		f = n ? terms[0].f : NULL;
+	} else {
+		f = flist;
+		/* Batch up equality lookups on the same index */
+		if ( flist != NULL && flist->f_next != NULL ) {
+			for ( ; f != NULL; f = f->f_next )
+				n++;
+			done = op->o_tmpcalloc( n, 1, op->o_tmpmemctx );
+			rc = or_batch_candidates( op, rtxn, flist, done, ids, tmp, save );
+			first = 0;
+			f = rc ? NULL : flist;
+		}
+	}
+
+	for ( i = 0; f != NULL; ) {
 		/* ignore precomputed scopes */
 		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
 		     f->f_result == LDAP_SUCCESS ) {
-			continue;
+			goto next;
 		}
+		if ( done && done[i] )
+			goto next;
 		MDB_IDL_ZERO( save );
 		rc = mdb_filter_candidates( op, rtxn, f, save, tmp,
 			save+MDB_idl_um_size );
@@ -585,29 +855,54 @@ list_candidates(
 		if ( rc != 0 ) {
 			if ( ftype == LDAP_FILTER_AND ) {
 				rc = 0;
-				continue;
+				goto next;
 			}
 			break;
 		}
 
 		
 		if ( ftype == LDAP_FILTER_AND ) {
-			if ( f == flist ) {
+			if ( first ) {
 				MDB_IDL_CPY( ids, save );
 			} else {
 				mdb_idl_intersection( ids, save );
 			}
 			if( MDB_IDL_IS_ZERO( ids ) )
 				break;
+			/* Few enough candidates left to just test them */
+			if ( i+1 < n && !MDB_IDL_IS_RANGE( ids ) &&
+				!MDB_IDL_IS_BITMAP( ids ) &&
+				( ids[0] <= AND_TEST_MAX ||
+				( terms[i+1].est < EST_UNKNOWN &&
+				terms[i+1].est / AND_COST_RATIO > ids[0] ))) {
+				Debug( LDAP_DEBUG_FILTER,
+					"<= mdb_list_candidates: %ld candidates, "
+					"skipping %d components\n",
+					(long) ids[0], n - i - 1 );
+				break;
+			}
 		} else {
-			if ( f == flist ) {
+			if ( first ) {
 				MDB_IDL_CPY( ids, save );
 			} else {
 				mdb_idl_union( ids, save );
 			}
 		}
+		first = 0;
+next:
+		if ( ftype == LDAP_FILTER_AND ) {
+			f = ++i < n ? terms[i].f : NULL;
+		} else {
+			f = f->f_next;
+			i++;
+		}
 	}
 
+	if ( terms )
+		op->o_tmpfree( terms, op->o_tmpmemctx );
+	if ( done )
+		op->o_tmpfree( done, op->o_tmpmemctx );
+
 	if( rc == LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_FILTER,
 			"<= mdb_list_candidates: id=%ld first=%ld last=%ld\n",
@@ -694,44 +989,25 @@ done:
 	return rc;
 }
 
+/* Generate the index keys for an equality assertion. *keys is left
+ * NULL if the assertion can't be resolved through an index.
+ */
 static int
-equality_candidates(
+equality_keys(
 	Operation *op,
-	MDB_txn *rtxn,
 	AttributeAssertion *ava,
-	ID *ids,
-	ID *tmp )
+	MDB_dbi *dbi,
+	struct berval **keys )
 {
-	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
-	struct berval *keys = NULL;
 	MatchingRule *mr;
 
-	Debug( LDAP_DEBUG_TRACE, "=> mdb_equality_candidates (%s)\n",
-			ava->aa_desc->ad_cname.bv_val );
-
-	if ( ava->aa_desc == slap_schema.si_ad_entryDN ) {
-		ID id;
-		rc = mdb_dn2id( op, rtxn, NULL, &ava->aa_value, &id, NULL, NULL, NULL );
-		if ( rc == LDAP_SUCCESS ) {
-			/* exactly one ID can match */
-			ids[0] = 1;
-			ids[1] = id;
-		}
-		if ( rc == MDB_NOTFOUND ) {
-			MDB_IDL_ZERO( ids );
-			rc = 0;
-		}
-		return rc;
-	}
-
-	MDB_IDL_ALL( ids );
+	*keys = NULL;
 
 	rc = mdb_index_param( op->o_bd, ava->aa_desc, LDAP_FILTER_EQUALITY,
-		&dbi, &mask, &prefix );
+		dbi, &mask, &prefix );
 
 	if ( rc == LDAP_INAPPROPRIATE_MATCHING ) {
 		Debug( LDAP_DEBUG_FILTER,
@@ -764,7 +1040,7 @@ equality_candidates(
 		mr,
 		&prefix,
 		&ava->aa_value,
-		&keys, op->o_tmpmemctx );
+		keys, op->o_tmpmemctx );
 
 	if( rc != LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_TRACE,
@@ -774,44 +1050,59 @@ equality_candidates(
 		return 0;
 	}
 
-	if( keys == NULL ) {
+	if( *keys == NULL ) {
 		Debug( LDAP_DEBUG_TRACE,
 			"<= mdb_equality_candidates: (%s) no keys\n",
 			ava->aa_desc->ad_cname.bv_val );
 		return 0;
 	}
 
-	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
-		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
+	return 0;
+}
 
-		if( rc == MDB_NOTFOUND ) {
+static int
+equality_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeAssertion *ava,
+	ID *ids,
+	ID *tmp )
+{
+	MDB_dbi	dbi;
+	int rc;
+	struct berval *keys = NULL;
+
+	Debug( LDAP_DEBUG_TRACE, "=> mdb_equality_candidates (%s)\n",
+			ava->aa_desc->ad_cname.bv_val );
+
+	if ( ava->aa_desc == slap_schema.si_ad_entryDN ) {
+		ID id;
+		rc = mdb_dn2id( op, rtxn, NULL, &ava->aa_value, &id, NULL, NULL, NULL );
+		if ( rc == LDAP_SUCCESS ) {
+			/* exactly one ID can match */
+			ids[0] = 1;
+			ids[1] = id;
+		}
+		if ( rc == MDB_NOTFOUND ) {
 			MDB_IDL_ZERO( ids );
 			rc = 0;
-			break;
-		} else if( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_equality_candidates: (%s) "
-				"key read failed (%d)\n",
-				ava->aa_desc->ad_cname.bv_val, rc );
-			break;
 		}
+		return rc;
+	}
 
-		if( MDB_IDL_IS_ZERO( tmp ) ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_equality_candidates: (%s) NULL\n", 
-				ava->aa_desc->ad_cname.bv_val );
-			MDB_IDL_ZERO( ids );
-			break;
-		}
+	MDB_IDL_ALL( ids );
 
-		if ( i == 0 ) {
-			MDB_IDL_CPY( ids, tmp );
-		} else {
-			mdb_idl_intersection( ids, tmp );
-		}
+	equality_keys( op, ava, &dbi, &keys );
+	if( keys == NULL ) {
+		return 0;
+	}
 
-		if( MDB_IDL_IS_ZERO( ids ) )
-			break;
+	rc = mdb_keys_read( op, rtxn, dbi, keys, LDAP_FILTER_AND, ids, tmp );
+	if( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"<= mdb_equality_candidates: (%s) "
+			"key read failed (%d)\n",
+			ava->aa_desc->ad_cname.bv_val, rc );
 	}
 
 	ber_bvarray_free_x( keys, op->o_tmpmemctx );
@@ -834,7 +1125,6 @@ approx_candidates(
 	ID *tmp )
 {
 	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
@@ -902,37 +1192,12 @@ approx_candidates(
 		return 0;
 	}
 
-	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
-		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
-
-		if( rc == MDB_NOTFOUND ) {
-			MDB_IDL_ZERO( ids );
-			rc = 0;
-			break;
-		} else if( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_approx_candidates: (%s) "
-				"key read failed (%d)\n",
-				ava->aa_desc->ad_cname.bv_val, rc );
-			break;
-		}
-
-		if( MDB_IDL_IS_ZERO( tmp ) ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_approx_candidates: (%s) NULL\n",
-				ava->aa_desc->ad_cname.bv_val );
-			MDB_IDL_ZERO( ids );
-			break;
-		}
-
-		if ( i == 0 ) {
-			MDB_IDL_CPY( ids, tmp );
-		} else {
-			mdb_idl_intersection( ids, tmp );
-		}
-
-		if( MDB_IDL_IS_ZERO( ids ) )
-			break;
+	rc = mdb_keys_read( op, rtxn, dbi, keys, LDAP_FILTER_AND, ids, tmp );
+	if( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"<= mdb_approx_candidates: (%s) "
+			"key read failed (%d)\n",
+			ava->aa_desc->ad_cname.bv_val, rc );
 	}
 
 	ber_bvarray_free_x( keys, op->o_tmpmemctx );
@@ -944,6 +1209,62 @@ approx_candidates(
 	return( rc );
 }
 
+/* Read the keys of a substring assertion. Positional keys start with
+ * the ones every candidate must have, followed by the alternatives for
+ * each unanchored substring, each introduced by an empty key. A
+ * candidate must have all the keys of one of those alternatives.
+ */
+static int
+substring_keys_read(
+	Operation *op,
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	struct berval *keys,
+	ID *ids,
+	ID *tmp )
+{
+	struct berval *k, *alt, save;
+	ID *any = NULL, *res = NULL;
+	int i, rc = 0;
+
+	for ( k = keys; k->bv_len != 0; k++ );
+	if ( BER_BVISNULL( k ))
+		return mdb_keys_read( op, rtxn, dbi, keys, LDAP_FILTER_AND, ids, tmp );
+
+	if ( k != keys ) {
+		save = *k;
+		BER_BVZERO( k );
+		rc = mdb_keys_read( op, rtxn, dbi, keys, LDAP_FILTER_AND, ids, tmp );
+		*k = save;
+	}
+
+	while ( rc == 0 && !BER_BVISNULL( k ) && !MDB_IDL_IS_ZERO( ids )) {
+		if ( any == NULL ) {
+			any = op->o_tmpalloc( 2 * MDB_idl_um_size * sizeof(ID),
+				op->o_tmpmemctx );
+			res = any + MDB_idl_um_size;
+		}
+		MDB_IDL_ZERO( any );
+		for ( i = 0; i < SLAP_INDEX_SUBSTR_POS_BUCKETS && rc == 0; i++ ) {
+			alt = ++k;
+			while ( k->bv_len != 0 )
+				k++;
+			save = *k;
+			BER_BVZERO( k );
+			MDB_IDL_ALL( res );
+			rc = mdb_keys_read( op, rtxn, dbi, alt, LDAP_FILTER_AND, res, tmp );
+			*k = save;
+			mdb_idl_union( any, res );
+		}
+		if ( rc == 0 )
+			mdb_idl_intersection( ids, any );
+	}
+
+	if ( any )
+		op->o_tmpfree( any, op->o_tmpmemctx );
+	return rc;
+}
+
 static int
 substring_candidates(
 	Operation *op,
@@ -953,7 +1274,6 @@ substring_candidates(
 	ID *tmp )
 {
 	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
@@ -1017,37 +1337,12 @@ substring_candidates(
 		return 0;
 	}
 
-	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
-		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
-
-		if( rc == MDB_NOTFOUND ) {
-			MDB_IDL_ZERO( ids );
-			rc = 0;
-			break;
-		} else if( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_substring_candidates: (%s) "
-				"key read failed (%d)\n",
-				sub->sa_desc->ad_cname.bv_val, rc );
-			break;
-		}
-
-		if( MDB_IDL_IS_ZERO( tmp ) ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"<= mdb_substring_candidates: (%s) NULL\n",
-				sub->sa_desc->ad_cname.bv_val );
-			MDB_IDL_ZERO( ids );
-			break;
-		}
-
-		if ( i == 0 ) {
-			MDB_IDL_CPY( ids, tmp );
-		} else {
-			mdb_idl_intersection( ids, tmp );
-		}
-
-		if( MDB_IDL_IS_ZERO( ids ) )
-			break;
+	rc = substring_keys_read( op, rtxn, dbi, keys, ids, tmp );
+	if( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"<= mdb_substring_candidates: (%s) "
+			"key read failed (%d)\n",
+			sub->sa_desc->ad_cname.bv_val, rc );
 	}
 
 	ber_bvarray_free_x( keys, op->o_tmpmemctx );
@@ -35,7 +35,8 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 	Ecount *eh);
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
 	Ecount *ec);
-static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals );
+static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals,
+	ber_len_t extra );
 
 #define ID2VKSZ	(sizeof(ID)+2)
 
@@ -262,6 +263,45 @@ static int mdb_mval_get(Operation *op, MDB_cursor *mc, ID id, Attribute *a, int
 
 #define ADD_FLAGS	(MDB_NOOVERWRITE|MDB_APPEND)
 
+/* Smaller entries are not worth compressing */
+#define MDB_ENTRY_ZMIN	128
+
+/* Encode e and compress the result. A compressed record keeps the
+ * attribute and value counts and ocflags of the header, with
+ * MDB_ENTRY_ZIP set in the attribute count, followed by the size of
+ * the rest of the encoded entry and its zlib stream. Returns NULL if
+ * the entry doesn't shrink enough to be worth inflating on every read.
+ */
+static unsigned int *mdb_entry_zip(Operation *op, Entry *e, Ecount *ec,
+	ber_len_t *zlen)
+{
+	MDB_val raw;
+	unsigned int *lp, *zp;
+	size_t len;
+
+	raw.mv_size = ec->dlen;
+	raw.mv_data = op->o_tmpalloc( ec->dlen, op->o_tmpmemctx );
+	zp = op->o_tmpalloc( ec->dlen, op->o_tmpmemctx );
+	lp = raw.mv_data;
+	len = ec->dlen - ec->dlen/8 - 4*sizeof(int);
+	if ( mdb_entry_encode( op, e, &raw, ec ) ||
+		mdb_entry_deflate( op, lp+3, ec->dlen - 3*sizeof(int), zp+4, &len )) {
+		op->o_tmpfree( zp, op->o_tmpmemctx );
+		zp = NULL;
+	} else {
+		zp[0] = lp[0] | MDB_ENTRY_ZIP;
+		zp[1] = lp[1];
+		zp[2] = lp[2];
+		zp[3] = ec->dlen - 3*sizeof(int);
+		len += 4*sizeof(int);
+		/* padding */
+		*zlen = (len + sizeof(ID)-1) & ~(sizeof(ID)-1);
+		memset( (char *)zp + len, 0, *zlen - len );
+	}
+	op->o_tmpfree( raw.mv_data, op->o_tmpmemctx );
+	return zp;
+}
+
 static int mdb_id2entry_put(
 	Operation *op,
 	MDB_txn *txn,
@@ -272,6 +312,8 @@ static int mdb_id2entry_put(
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	Ecount ec;
 	MDB_val key, data;
+	unsigned int *zp = NULL;
+	ber_len_t zlen = 0;
 	int rc, adding = flag, prev_ads = mdb->mi_numads;
 
 	/* We only store rdns, and they go in the dn2id database. */
@@ -295,16 +337,25 @@ static int mdb_id2entry_put(
 		goto fail;
 	}
 
+	/* Until the dictionary is trained, entries are stored as is */
+	if (mdb->mi_compress && mdb->mi_zdict.bv_len &&
+		ec.dlen >= MDB_ENTRY_ZMIN)
+		zp = mdb_entry_zip( op, e, &ec, &zlen );
+
 again:
-	data.mv_size = ec.dlen;
+	data.mv_size = zp ? zlen : ec.dlen;
 	if ( mc )
 		rc = mdb_cursor_put( mc, &key, &data, flag );
 	else
 		rc = mdb_put( txn, mdb->mi_id2entry, &key, &data, flag );
 	if (rc == MDB_SUCCESS) {
-		rc = mdb_entry_encode( op, e, &data, &ec );
-		if( rc != LDAP_SUCCESS )
-			goto fail;
+		if ( zp ) {
+			memcpy( data.mv_data, zp, zlen );
+		} else {
+			rc = mdb_entry_encode( op, e, &data, &ec );
+			if( rc != LDAP_SUCCESS )
+				goto fail;
+		}
 		/* Handle adds of large multi-valued attrs here.
 		 * Modifies handle them directly.
 		 */
@@ -346,6 +397,8 @@ again:
 			rc = LDAP_OTHER;
 	}
 fail:
+	if (zp)
+		op->o_tmpfree( zp, op->o_tmpmemctx );
 	if (rc) {
 		mdb_ad_unwind( mdb, prev_ads );
 	}
@@ -413,7 +466,7 @@ int mdb_id2entry(
 		/* Looking for root entry on an empty-dn suffix? */
 		if ( !id && BER_BVISEMPTY( &op->o_bd->be_nsuffix[0] )) {
 			struct berval gluebv = BER_BVC("glue");
-			Entry *r = mdb_entry_alloc(op, 2, 4);
+			Entry *r = mdb_entry_alloc(op, 2, 4, 0);
 			Attribute *a = r->e_attrs;
 			struct berval *bptr;
 
@@ -502,14 +555,18 @@ int mdb_id2entry_delete(
 	return rc;
 }
 
+/* extra bytes are left after the attribute values, for a
+ * decompressed record the values can point into
+ */
 static Entry * mdb_entry_alloc(
 	Operation *op,
 	int nattrs,
-	int nvals )
+	int nvals,
+	ber_len_t extra )
 {
 	Entry *e = op->o_tmpalloc( sizeof(Entry) +
 		nattrs * sizeof(Attribute) +
-		nvals * sizeof(struct berval), op->o_tmpmemctx );
+		nvals * sizeof(struct berval) + extra, op->o_tmpmemctx );
 	BER_BVZERO(&e->e_bv);
 	e->e_private = e;
 	if (nattrs) {
@@ -740,6 +797,7 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 		moi->moi_oe.oe_key = mdb;
 		moi->moi_ref = 0;
 		moi->moi_txn = NULL;
+		moi->moi_batch = NULL;
 	}
 
 	if ( !rdonly ) {
@@ -761,7 +819,13 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 				if ( get_lazyCommit( op ))
 					flag |= MDB_NOMETASYNC;
 #endif
-				rc = mdb_txn_begin( mdb->mi_dbenv, NULL, flag, &moi->moi_txn );
+				/* Nested txns are not supported with writemap */
+				if ( mdb->mi_batch_max && !flag &&
+					( slapMode & SLAP_SERVER_MODE ) &&
+					!( mdb->mi_dbenv_flags & MDB_WRITEMAP ))
+					rc = mdb_batch_begin( mdb, moi );
+				else
+					rc = mdb_txn_begin( mdb->mi_dbenv, NULL, flag, &moi->moi_txn );
 				if (rc) {
 					Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: err %s(%d)\n",
 						mdb_strerror(rc), rc );
@@ -849,14 +913,14 @@ int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 		}
 		return rc;
 	case SLAP_TXN_COMMIT:
-		rc = mdb_txn_commit( moi->moi_txn );
+		rc = mdb_batch_commit( mdb, moi );
 		if ( rc )
 			mdb->mi_numads = 0;
 		op->o_tmpfree( moi, op->o_tmpmemctx );
 		return rc;
 	case SLAP_TXN_ABORT:
 		mdb->mi_numads = 0;
-		mdb_txn_abort( moi->moi_txn );
+		mdb_batch_abort( mdb, moi );
 		op->o_tmpfree( moi, op->o_tmpmemctx );
 		return 0;
 	}
@@ -957,6 +1021,9 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
  * with a NUL terminator after each value.
  * The buffer is padded to the sizeof(ID). The entire buffer size is
  * precomputed so that a single malloc can be performed.
+ *
+ * If compression is enabled, mdb_entry_zip may store the buffer in
+ * compressed form instead.
  */
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 {
@@ -1025,6 +1092,66 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 	return 0;
 }
 
+/* Point the values of a at the lengths and data of an inline
+ * attribute, and sort them if needed.
+ */
+static void mdb_attr_decode(Attribute *a, unsigned int **lpp,
+	unsigned char **ptrp, int have_nval)
+{
+	unsigned int *lp = *lpp;
+	unsigned char *ptr = *ptrp;
+	BerVarray bptr = a->a_vals;
+	int i;
+
+	for (i=0; i<a->a_numvals; i++) {
+		bptr->bv_len = *lp++;
+		bptr->bv_val = (char *)ptr;
+		ptr += bptr->bv_len+1;
+		bptr++;
+	}
+	bptr->bv_val = NULL;
+	bptr->bv_len = 0;
+	bptr++;
+
+	if (have_nval) {
+		a->a_nvals = bptr;
+		for (i=0; i<a->a_numvals; i++) {
+			bptr->bv_len = *lp++;
+			bptr->bv_val = (char *)ptr;
+			ptr += bptr->bv_len+1;
+			bptr++;
+		}
+		bptr->bv_val = NULL;
+		bptr->bv_len = 0;
+	} else {
+		a->a_nvals = a->a_vals;
+	}
+	*lpp = lp;
+	*ptrp = ptr;
+}
+
+static int mdb_attr_sort(Attribute *a)
+{
+	const char *text;
+	int rc, j;
+
+	/* FIXME: This is redundant once a sorted entry is saved into the DB */
+	if (( a->a_desc->ad_type->sat_flags & SLAP_AT_SORTED_VAL )
+		&& !(a->a_flags & SLAP_ATTR_SORTED_VALS)) {
+		rc = slap_sort_vals( (Modifications *)a, &text, &j, NULL );
+		if ( rc == LDAP_SUCCESS ) {
+			a->a_flags |= SLAP_ATTR_SORTED_VALS;
+		} else if ( rc == LDAP_TYPE_OR_VALUE_EXISTS ) {
+			/* should never happen */
+			Debug( LDAP_DEBUG_ANY,
+				"mdb_entry_decode: attributeType %s value #%d provided more than once\n",
+				a->a_desc->ad_cname.bv_val, j );
+			return rc;
+		}
+	}
+	return 0;
+}
+
 /* Retrieve an Entry that was stored using entry_encode above.
  *
  * Note: everything is stored in a single contiguous block, so
@@ -1033,13 +1160,27 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
  */
 
 int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e)
+{
+	return mdb_entry_decode_lazy(op, txn, data, id, NULL, e);
+}
+
+/* Like mdb_entry_decode, but only the values of the attributes in want
+ * (and objectClass) are decoded. The others keep their descriptions and
+ * value counts but have a NULL a_nvals until mdb_entry_expand is called
+ * on the entry, which must happen in the same txn. Their value slots
+ * remember where the undecoded values are:
+ *   a_vals[0].bv_len: the values have separate normalized values
+ *   a_vals[1]: lengths of an inline attribute, and offset to its data
+ * A NULL want decodes everything.
+ */
+int mdb_entry_decode_lazy(Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	AttributeName *want, Entry **e)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
-	int i, j, nattrs, nvals;
+	int i, nattrs, nvals;
 	int rc;
 	Attribute *a;
 	Entry *x;
-	const char *text;
 	unsigned int *lp = (unsigned int *)data->mv_data;
 	unsigned char *ptr;
 	BerVarray bptr;
@@ -1050,8 +1191,27 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 
 	nattrs = *lp++;
 	nvals = *lp++;
-	x = mdb_entry_alloc(op, nattrs, nvals);
-	x->e_ocflags = *lp++;
+	if (nattrs & MDB_ENTRY_ZIP) {
+		ber_len_t len = lp[1];
+		unsigned int *buf;
+
+		nattrs ^= MDB_ENTRY_ZIP;
+		x = mdb_entry_alloc(op, nattrs, nvals, len);
+		x->e_ocflags = *lp++;
+		lp++;
+		buf = (unsigned int *)((char *)(x+1) + nattrs * sizeof(Attribute) +
+			nvals * sizeof(struct berval));
+		rc = mdb_entry_inflate(op, lp,
+			data->mv_size - ((char *)lp - (char *)data->mv_data), buf, len);
+		if (rc) {
+			op->o_tmpfree(x, op->o_tmpmemctx);
+			goto leave;
+		}
+		lp = buf;
+	} else {
+		x = mdb_entry_alloc(op, nattrs, nvals, 0);
+		x->e_ocflags = *lp++;
+	}
 	if (!nvals) {
 		goto done;
 	}
@@ -1092,57 +1252,37 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 			have_nval = 1;
 		}
 		a->a_vals = bptr;
-		if (multi) {
-			if (!mvc) {
-				rc = mdb_cursor_open(txn, mdb->mi_dbis[MDB_ID2VAL], &mvc);
-				if (rc)
-					goto leave;
-			}
-			i = a->a_numvals;
-			mdb_mval_get(op, mvc, id, a, have_nval);
+		i = a->a_numvals;
+		bptr += i + 1;
+		if (have_nval)
 			bptr += i + 1;
-			if (have_nval)
-				bptr += i + 1;
-		} else {
-			for (i=0; i<a->a_numvals; i++) {
-				bptr->bv_len = *lp++;
-				bptr->bv_val = (char *)ptr;
-				ptr += bptr->bv_len+1;
-				bptr++;
+		if (want && i && a->a_desc != slap_schema.si_ad_objectClass &&
+			!ad_inlist(a->a_desc, want)) {
+			a->a_nvals = NULL;
+			a->a_vals[0].bv_val = NULL;
+			a->a_vals[0].bv_len = have_nval;
+			if (!multi) {
+				a->a_vals[1].bv_val = (char *)lp;
+				a->a_vals[1].bv_len = ptr - (unsigned char *)lp;
+				if (have_nval)
+					i += i;
+				while (i--)
+					ptr += *lp++ + 1;
 			}
-			bptr->bv_val = NULL;
-			bptr->bv_len = 0;
-			bptr++;
-
-			if (have_nval) {
-				a->a_nvals = bptr;
-				for (i=0; i<a->a_numvals; i++) {
-					bptr->bv_len = *lp++;
-					bptr->bv_val = (char *)ptr;
-					ptr += bptr->bv_len+1;
-					bptr++;
+		} else {
+			if (multi) {
+				if (!mvc) {
+					rc = mdb_cursor_open(txn, mdb->mi_dbis[MDB_ID2VAL], &mvc);
+					if (rc)
+						goto leave;
 				}
-				bptr->bv_val = NULL;
-				bptr->bv_len = 0;
-				bptr++;
+				mdb_mval_get(op, mvc, id, a, have_nval);
 			} else {
-				a->a_nvals = a->a_vals;
+				mdb_attr_decode(a, &lp, &ptr, have_nval);
 			}
-		}
-
-		/* FIXME: This is redundant once a sorted entry is saved into the DB */
-		if (( a->a_desc->ad_type->sat_flags & SLAP_AT_SORTED_VAL )
-			&& !(a->a_flags & SLAP_ATTR_SORTED_VALS)) {
-			rc = slap_sort_vals( (Modifications *)a, &text, &j, NULL );
-			if ( rc == LDAP_SUCCESS ) {
-				a->a_flags |= SLAP_ATTR_SORTED_VALS;
-			} else if ( rc == LDAP_TYPE_OR_VALUE_EXISTS ) {
-				/* should never happen */
-				Debug( LDAP_DEBUG_ANY,
-					"mdb_entry_decode: attributeType %s value #%d provided more than once\n",
-					a->a_desc->ad_cname.bv_val, j );
+			rc = mdb_attr_sort(a);
+			if (rc)
 				goto leave;
-			}
 		}
 		a->a_next = a+1;
 		a = a->a_next;
@@ -1158,3 +1298,42 @@ leave:
 		mdb_cursor_close(mvc);
 	return rc;
 }
+
+/* Decode the values mdb_entry_decode_lazy left out, for the attributes
+ * in want, or for all of them if want is NULL.
+ */
+int mdb_entry_expand(Operation *op, MDB_txn *txn, Entry *e, AttributeName *want)
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	Attribute *a;
+	MDB_cursor *mvc = NULL;
+	unsigned int *lp;
+	unsigned char *ptr;
+	int have_nval, rc = 0;
+
+	for (a = e->e_attrs; a; a = a->a_next) {
+		if (a->a_nvals)
+			continue;
+		if (want && !ad_inlist(a->a_desc, want))
+			continue;
+		have_nval = a->a_vals[0].bv_len;
+		if (a->a_flags & SLAP_ATTR_BIG_MULTI) {
+			if (!mvc) {
+				rc = mdb_cursor_open(txn, mdb->mi_dbis[MDB_ID2VAL], &mvc);
+				if (rc)
+					break;
+			}
+			mdb_mval_get(op, mvc, e->e_id, a, have_nval);
+		} else {
+			lp = (unsigned int *)a->a_vals[1].bv_val;
+			ptr = (unsigned char *)lp + a->a_vals[1].bv_len;
+			mdb_attr_decode(a, &lp, &ptr, have_nval);
+		}
+		rc = mdb_attr_sort(a);
+		if (rc)
+			break;
+	}
+	if (mvc)
+		mdb_cursor_close(mvc);
+	return rc;
+}
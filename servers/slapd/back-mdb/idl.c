@@ -32,6 +32,58 @@ unsigned int MDB_idl_um_max = (1 << (MDB_IDL_LOGN+1)) - 1;
 #define IDL_MIN(x,y)	( (x) < (y) ? (x) : (y) )
 #define IDL_CMP(x,y)	( (x) < (y) ? -1 : (x) > (y) )
 
+/* Bitmap IDLs
+ *
+ * IDs are grouped by their upper bits into containers of 64K IDs.
+ * Each container is stored in whichever form is smallest: a sorted
+ * array of 16 bit offsets, a plain bitmap, or a list of runs. The
+ * containers are packed in ascending key order after the IDL header,
+ * so a bitmap IDL fits in the same buffers as any other IDL.
+ *
+ * Container layout, in ID-sized words:
+ *	[0]	key (ID >> BM_SHIFT)
+ *	[1]	type | (number of runs << 8)
+ *	[2]	number of IDs in the container
+ *	[3..]	payload
+ */
+
+#define BM_SHIFT	16
+#define BM_SPAN		(1U << BM_SHIFT)
+#define BM_LOW(id)	((unsigned)((id) & (BM_SPAN-1)))
+#define BM_BITS		(sizeof(ID) * CHAR_BIT)
+#define BM_WORDS	(BM_SPAN / BM_BITS)
+#define BM_BIT(w,x)	((w)[(x) / BM_BITS] & ((ID)1 << ((x) % BM_BITS)))
+#define BM_SET(w,x)	((w)[(x) / BM_BITS] |= ((ID)1 << ((x) % BM_BITS)))
+#define BM_ARRAY_MAX	4096	/* beyond this an array is bigger than a bitmap */
+
+#define BMC_ARRAY	1
+#define BMC_BITMAP	2
+#define BMC_RUN		3
+
+#define BMC_HDR		3
+#define BMC_KEY(c)	((c)[0])
+#define BMC_TYPE(c)	((int)((c)[1] & 0xff))
+#define BMC_NRUNS(c)	((unsigned)((c)[1] >> 8))
+#define BMC_CARD(c)	((c)[2])
+#define BMC_SHORTS(c)	((unsigned short *)((c)+BMC_HDR))
+#define BMC_WORDS(c)	((c)+BMC_HDR)
+
+#define BM_SHORTS2WORDS(n)	(((n) * sizeof(unsigned short) + sizeof(ID)-1) / sizeof(ID))
+
+#define BM_FIRSTC(ids)	((ids)+MDB_IDL_BITMAP_HDR)
+#define BM_END(ids)		((ids)+MDB_IDL_BITMAP_LEN(ids))
+#define BMC_NEXT(c)		((c)+bmc_size(c))
+
+/* As many IDs as dense bitmap containers can hold in one IDL */
+#define BM_IDL_MAX(um_size)	(((um_size) - MDB_IDL_BITMAP_HDR) / \
+	(BMC_HDR + BM_WORDS) << BM_SHIFT)
+
+int MDB_idl_bitmap = 0;
+unsigned int MDB_idl_bm_max = BM_IDL_MAX( 1 << (MDB_IDL_LOGN+1) );
+
+/* Max number of IDs stored per index key before converting to a range */
+#define IDL_DISK_MAX	( MDB_idl_bitmap ? MDB_idl_bm_max : MDB_idl_db_max )
+
 #if IDL_DEBUG > 0
 static void idl_check( ID *ids )
 {
@@ -82,6 +134,10 @@ void mdb_idl_reset()
 	MDB_idl_um_size = 1 << (MDB_idl_logn+1);
 	MDB_idl_db_max = MDB_idl_db_size - 1;
 	MDB_idl_um_max = MDB_idl_um_size - 1;
+
+	MDB_idl_bm_max = BM_IDL_MAX( MDB_idl_um_size );
+	if ( MDB_idl_bm_max < MDB_idl_db_max )
+		MDB_idl_bm_max = MDB_idl_db_max;
 }
 
 unsigned mdb_idl_search( ID *ids, ID id )
@@ -260,6 +316,743 @@ static int mdb_idl_delete( ID *ids, ID id )
 	return 0;
 }
 
+#ifdef __GNUC__
+#define BM_POPCNT(w)	__builtin_popcountl(w)
+#define BM_CTZ(w)		__builtin_ctzl(w)
+#else
+static int
+bm_popcnt( ID w )
+{
+	int n = 0;
+	while ( w ) {
+		w &= w-1;
+		n++;
+	}
+	return n;
+}
+#define BM_POPCNT(w)	bm_popcnt(w)
+
+static int
+bm_ctz( ID w )
+{
+	int n = 0;
+	while ( !( w & 1 )) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+}
+#define BM_CTZ(w)		bm_ctz(w)
+#endif
+
+
+typedef struct bm_build {
+	ID *bb_ids;
+	ID bb_max;		/* words available in bb_ids */
+	int bb_over;	/* set if the result didn't fit */
+} bm_build;
+
+/* Accumulates sorted IDs belonging to one container */
+typedef struct bm_acc {
+	ID ba_key;
+	unsigned ba_n;
+	int ba_isbits;
+	unsigned short ba_arr[BM_ARRAY_MAX];
+	ID ba_bits[BM_WORDS];
+} bm_acc;
+
+static ID
+bmc_size( ID *c )
+{
+	switch ( BMC_TYPE( c )) {
+	case BMC_ARRAY:
+		return BMC_HDR + BM_SHORTS2WORDS( BMC_CARD( c ));
+	case BMC_BITMAP:
+		return BMC_HDR + BM_WORDS;
+	default:
+		return BMC_HDR + BM_SHORTS2WORDS( 2 * BMC_NRUNS( c ));
+	}
+}
+
+/* Find the first bit at or after x that is set (or clear) */
+static unsigned
+bm_scan( ID *w, unsigned x, int set )
+{
+	while ( x < BM_SPAN ) {
+		ID word = w[x / BM_BITS];
+		if ( !set )
+			word = ~word;
+		word >>= x % BM_BITS;
+		if ( word )
+			return x + BM_CTZ( word );
+		x = ( x / BM_BITS + 1 ) * BM_BITS;
+	}
+	return BM_SPAN;
+}
+
+static void
+bm_setrange( ID *w, unsigned lo, unsigned hi )
+{
+	for ( ; lo <= hi && lo % BM_BITS; lo++ )
+		BM_SET( w, lo );
+	for ( ; lo + BM_BITS - 1 <= hi; lo += BM_BITS )
+		w[lo / BM_BITS] = ~(ID)0;
+	for ( ; lo <= hi; lo++ )
+		BM_SET( w, lo );
+}
+
+/* Return the lowest offset >= x present in the container, or BM_SPAN */
+static unsigned
+bmc_next( ID *c, unsigned x )
+{
+	unsigned short *s = BMC_SHORTS( c );
+	unsigned i, n;
+
+	switch ( BMC_TYPE( c )) {
+	case BMC_ARRAY:
+		n = BMC_CARD( c );
+		i = 0;
+		while ( n ) {
+			unsigned pivot = n >> 1;
+			if ( s[i + pivot] < x ) {
+				i += pivot + 1;
+				n -= pivot + 1;
+			} else {
+				n = pivot;
+			}
+		}
+		if ( i < BMC_CARD( c ))
+			return s[i];
+		break;
+	case BMC_BITMAP:
+		return bm_scan( BMC_WORDS( c ), x, 1 );
+	default:
+		n = BMC_NRUNS( c );
+		for ( i = 0; i < n; i++ ) {
+			if ( s[2*i+1] >= x )
+				return s[2*i] > x ? s[2*i] : x;
+		}
+		break;
+	}
+	return BM_SPAN;
+}
+
+static unsigned
+bmc_last( ID *c )
+{
+	unsigned short *s = BMC_SHORTS( c );
+	ID *w;
+	int i;
+
+	switch ( BMC_TYPE( c )) {
+	case BMC_ARRAY:
+		return s[BMC_CARD( c ) - 1];
+	case BMC_BITMAP:
+		w = BMC_WORDS( c );
+		for ( i = BM_SPAN-1; i > 0 && !BM_BIT( w, i ); i-- ) ;
+		return i;
+	default:
+		return s[2 * BMC_NRUNS( c ) - 1];
+	}
+}
+
+static int
+bmc_has( ID *c, unsigned x )
+{
+	unsigned short *s = BMC_SHORTS( c );
+	unsigned base = 0, n, pivot;
+
+	switch ( BMC_TYPE( c )) {
+	case BMC_ARRAY:
+		n = BMC_CARD( c );
+		while ( n ) {
+			pivot = n >> 1;
+			if ( s[base + pivot] == x )
+				return 1;
+			if ( s[base + pivot] < x ) {
+				base += pivot + 1;
+				n -= pivot + 1;
+			} else {
+				n = pivot;
+			}
+		}
+		return 0;
+	case BMC_BITMAP:
+		return BM_BIT( BMC_WORDS( c ), x ) != 0;
+	default:
+		n = BMC_NRUNS( c );
+		while ( n ) {
+			pivot = n >> 1;
+			if ( s[2*(base + pivot)+1] < x ) {
+				base += pivot + 1;
+				n -= pivot + 1;
+			} else {
+				n = pivot;
+			}
+		}
+		return base < BMC_NRUNS( c ) && s[2*base] <= x;
+	}
+}
+
+/* Expand a container into a bitmap. Bitmap containers are returned
+ * as-is, without copying.
+ */
+static ID *
+bmc_bits( ID *c, ID *buf )
+{
+	unsigned short *s = BMC_SHORTS( c );
+	unsigned i;
+
+	if ( BMC_TYPE( c ) == BMC_BITMAP )
+		return BMC_WORDS( c );
+
+	memset( buf, 0, BM_WORDS * sizeof(ID) );
+	if ( BMC_TYPE( c ) == BMC_ARRAY ) {
+		for ( i = 0; i < BMC_CARD( c ); i++ )
+			BM_SET( buf, s[i] );
+	} else {
+		for ( i = 0; i < BMC_NRUNS( c ); i++ )
+			bm_setrange( buf, s[2*i], s[2*i+1] );
+	}
+	return buf;
+}
+
+static void
+bm_init( bm_build *bb, ID *ids, ID max )
+{
+	bb->bb_ids = ids;
+	bb->bb_max = max;
+	bb->bb_over = 0;
+	ids[0] = MDB_IDL_BITMAP_TAG;
+	ids[1] = NOID;
+	ids[2] = 0;
+	MDB_IDL_BITMAP_N( ids ) = 0;
+	MDB_IDL_BITMAP_LEN( ids ) = MDB_IDL_BITMAP_HDR;
+}
+
+static ID *
+bm_alloc( bm_build *bb, ID key, int type, unsigned nruns, ID card, ID size )
+{
+	ID *ids = bb->bb_ids, *c;
+
+	if ( bb->bb_over || MDB_IDL_BITMAP_LEN( ids ) + size > bb->bb_max ) {
+		bb->bb_over = 1;
+		return NULL;
+	}
+	c = BM_END( ids );
+	BMC_KEY( c ) = key;
+	c[1] = type | ((ID)nruns << 8);
+	BMC_CARD( c ) = card;
+	MDB_IDL_BITMAP_LEN( ids ) += size;
+	return c;
+}
+
+/* Record a container that was just appended */
+static void
+bm_note( bm_build *bb, ID *c )
+{
+	ID *ids = bb->bb_ids;
+	ID key = BMC_KEY( c ) << BM_SHIFT;
+
+	if ( ids[1] == NOID )
+		ids[1] = key | bmc_next( c, 0 );
+	ids[2] = key | bmc_last( c );
+	MDB_IDL_BITMAP_N( ids ) += BMC_CARD( c );
+}
+
+static void
+bm_emit_array( bm_build *bb, ID key, unsigned short *s, unsigned n )
+{
+	ID *c;
+
+	if ( !n )
+		return;
+	c = bm_alloc( bb, key, BMC_ARRAY, 0, n, BMC_HDR + BM_SHORTS2WORDS( n ));
+	if ( !c )
+		return;
+	AC_MEMCPY( BMC_SHORTS( c ), s, n * sizeof(unsigned short) );
+	bm_note( bb, c );
+}
+
+/* Store a container given as a bitmap, in its most compact form */
+static void
+bm_emit_bits( bm_build *bb, ID key, ID *w, ID card )
+{
+	unsigned short *s;
+	unsigned i, x, nruns = 0;
+	ID *c, prev = 0;
+
+	if ( !card )
+		return;
+
+	if ( card <= BM_ARRAY_MAX ) {
+		c = bm_alloc( bb, key, BMC_ARRAY, 0, card, BMC_HDR + BM_SHORTS2WORDS( card ));
+		if ( !c )
+			return;
+		s = BMC_SHORTS( c );
+		for ( x = bm_scan( w, 0, 1 ), i = 0; x < BM_SPAN; x = bm_scan( w, x+1, 1 ))
+			s[i++] = x;
+		bm_note( bb, c );
+		return;
+	}
+
+	/* count the runs: a run starts at a set bit whose predecessor is clear */
+	for ( i = 0; i < BM_WORDS; i++ ) {
+		nruns += BM_POPCNT( w[i] & ~(( w[i] << 1 ) | prev ));
+		prev = w[i] >> ( BM_BITS - 1 );
+	}
+
+	if ( BM_SHORTS2WORDS( 2 * nruns ) < BM_WORDS ) {
+		c = bm_alloc( bb, key, BMC_RUN, nruns, card, BMC_HDR + BM_SHORTS2WORDS( 2 * nruns ));
+		if ( !c )
+			return;
+		s = BMC_SHORTS( c );
+		for ( x = bm_scan( w, 0, 1 ); x < BM_SPAN; x = bm_scan( w, x, 1 )) {
+			*s++ = x;
+			x = bm_scan( w, x, 0 );
+			*s++ = x - 1;
+		}
+	} else {
+		c = bm_alloc( bb, key, BMC_BITMAP, 0, card, BMC_HDR + BM_WORDS );
+		if ( !c )
+			return;
+		AC_MEMCPY( BMC_WORDS( c ), w, BM_WORDS * sizeof(ID) );
+	}
+	bm_note( bb, c );
+}
+
+static void
+bm_copy( bm_build *bb, ID *src )
+{
+	ID size = bmc_size( src ), *c;
+
+	c = bm_alloc( bb, BMC_KEY( src ), BMC_TYPE( src ), BMC_NRUNS( src ),
+		BMC_CARD( src ), size );
+	if ( !c )
+		return;
+	AC_MEMCPY( BMC_WORDS( c ), BMC_WORDS( src ), ( size - BMC_HDR ) * sizeof(ID) );
+	bm_note( bb, c );
+}
+
+static void
+bm_acc_flush( bm_build *bb, bm_acc *ac )
+{
+	if ( ac->ba_isbits )
+		bm_emit_bits( bb, ac->ba_key, ac->ba_bits, ac->ba_n );
+	else
+		bm_emit_array( bb, ac->ba_key, ac->ba_arr, ac->ba_n );
+	ac->ba_n = 0;
+	ac->ba_isbits = 0;
+}
+
+/* IDs must be added in ascending order */
+static void
+bm_acc_add( bm_build *bb, bm_acc *ac, ID id )
+{
+	ID key = id >> BM_SHIFT;
+	unsigned x = BM_LOW( id ), i;
+
+	if ( ac->ba_n && key != ac->ba_key )
+		bm_acc_flush( bb, ac );
+	ac->ba_key = key;
+	if ( !ac->ba_isbits ) {
+		if ( ac->ba_n < BM_ARRAY_MAX ) {
+			ac->ba_arr[ac->ba_n++] = x;
+			return;
+		}
+		memset( ac->ba_bits, 0, sizeof( ac->ba_bits ));
+		for ( i = 0; i < ac->ba_n; i++ )
+			BM_SET( ac->ba_bits, ac->ba_arr[i] );
+		ac->ba_isbits = 1;
+	}
+	if ( !BM_BIT( ac->ba_bits, x )) {
+		BM_SET( ac->ba_bits, x );
+		ac->ba_n++;
+	}
+}
+
+/* Convert a sorted list into a bitmap */
+static void
+bm_from_list( bm_build *bb, ID *ids )
+{
+	bm_acc ac;
+	ID i;
+
+	ac.ba_n = 0;
+	ac.ba_isbits = 0;
+	for ( i = 1; i <= ids[0] && !bb->bb_over; i++ )
+		bm_acc_add( bb, &ac, ids[i] );
+	if ( !bb->bb_over )
+		bm_acc_flush( bb, &ac );
+}
+
+static void
+bmc_and( bm_build *bb, ID *ca, ID *cb )
+{
+	ID abuf[BM_WORDS], bbuf[BM_WORDS], *wa, *wb, card = 0, *tmp;
+	unsigned short out[BM_ARRAY_MAX], *sa, *sb;
+	unsigned i, j, k = 0, na, nb;
+
+	if ( BMC_TYPE( ca ) != BMC_ARRAY && BMC_TYPE( cb ) == BMC_ARRAY ) {
+		tmp = ca; ca = cb; cb = tmp;
+	}
+
+	if ( BMC_TYPE( ca ) == BMC_ARRAY ) {
+		sa = BMC_SHORTS( ca );
+		na = BMC_CARD( ca );
+		if ( BMC_TYPE( cb ) == BMC_ARRAY ) {
+			sb = BMC_SHORTS( cb );
+			nb = BMC_CARD( cb );
+			for ( i = j = 0; i < na && j < nb; ) {
+				if ( sa[i] == sb[j] ) {
+					out[k++] = sa[i++];
+					j++;
+				} else if ( sa[i] < sb[j] ) {
+					i++;
+				} else {
+					j++;
+				}
+			}
+		} else {
+			for ( i = 0; i < na; i++ )
+				if ( bmc_has( cb, sa[i] ))
+					out[k++] = sa[i];
+		}
+		bm_emit_array( bb, BMC_KEY( ca ), out, k );
+		return;
+	}
+
+	wa = bmc_bits( ca, abuf );
+	wb = bmc_bits( cb, bbuf );
+	for ( i = 0; i < BM_WORDS; i++ ) {
+		abuf[i] = wa[i] & wb[i];
+		card += BM_POPCNT( abuf[i] );
+	}
+	bm_emit_bits( bb, BMC_KEY( ca ), abuf, card );
+}
+
+static void
+bmc_or( bm_build *bb, ID *ca, ID *cb )
+{
+	ID abuf[BM_WORDS], bbuf[BM_WORDS], *wa, *wb, card = 0;
+	unsigned short out[BM_ARRAY_MAX], *sa, *sb;
+	unsigned i, j, k = 0, na, nb;
+
+	if ( BMC_TYPE( ca ) == BMC_ARRAY && BMC_TYPE( cb ) == BMC_ARRAY &&
+		BMC_CARD( ca ) + BMC_CARD( cb ) <= BM_ARRAY_MAX ) {
+		sa = BMC_SHORTS( ca );
+		na = BMC_CARD( ca );
+		sb = BMC_SHORTS( cb );
+		nb = BMC_CARD( cb );
+		for ( i = j = 0; i < na || j < nb; ) {
+			if ( j >= nb || ( i < na && sa[i] < sb[j] )) {
+				out[k++] = sa[i++];
+			} else {
+				if ( i < na && sa[i] == sb[j] )
+					i++;
+				out[k++] = sb[j++];
+			}
+		}
+		bm_emit_array( bb, BMC_KEY( ca ), out, k );
+		return;
+	}
+
+	wa = bmc_bits( ca, abuf );
+	if ( wa != abuf )
+		AC_MEMCPY( abuf, wa, sizeof( abuf ));
+	wb = bmc_bits( cb, bbuf );
+	for ( i = 0; i < BM_WORDS; i++ ) {
+		abuf[i] |= wb[i];
+		card += BM_POPCNT( abuf[i] );
+	}
+	bm_emit_bits( bb, BMC_KEY( ca ), abuf, card );
+}
+
+static void
+bm_and( bm_build *bb, ID *a, ID *b )
+{
+	ID *ca = BM_FIRSTC( a ), *ea = BM_END( a );
+	ID *cb = BM_FIRSTC( b ), *eb = BM_END( b );
+
+	while ( ca < ea && cb < eb && !bb->bb_over ) {
+		if ( BMC_KEY( ca ) < BMC_KEY( cb )) {
+			ca = BMC_NEXT( ca );
+		} else if ( BMC_KEY( ca ) > BMC_KEY( cb )) {
+			cb = BMC_NEXT( cb );
+		} else {
+			bmc_and( bb, ca, cb );
+			ca = BMC_NEXT( ca );
+			cb = BMC_NEXT( cb );
+		}
+	}
+}
+
+static void
+bm_or( bm_build *bb, ID *a, ID *b )
+{
+	ID *ca = BM_FIRSTC( a ), *ea = BM_END( a );
+	ID *cb = BM_FIRSTC( b ), *eb = BM_END( b );
+
+	while (( ca < ea || cb < eb ) && !bb->bb_over ) {
+		if ( cb >= eb || ( ca < ea && BMC_KEY( ca ) < BMC_KEY( cb ))) {
+			bm_copy( bb, ca );
+			ca = BMC_NEXT( ca );
+		} else if ( ca >= ea || BMC_KEY( ca ) > BMC_KEY( cb )) {
+			bm_copy( bb, cb );
+			cb = BMC_NEXT( cb );
+		} else {
+			bmc_or( bb, ca, cb );
+			ca = BMC_NEXT( ca );
+			cb = BMC_NEXT( cb );
+		}
+	}
+}
+
+/* Restrict a bitmap to the IDs in [lo,hi] */
+static void
+bm_clip( bm_build *bb, ID *a, ID lo, ID hi )
+{
+	ID *c, *e = BM_END( a );
+	ID run[BMC_HDR + 1];
+	unsigned short *s = (unsigned short *)( run + BMC_HDR );
+
+	for ( c = BM_FIRSTC( a ); c < e && !bb->bb_over; c = BMC_NEXT( c )) {
+		if ( BMC_KEY( c ) < ( lo >> BM_SHIFT ) || BMC_KEY( c ) > ( hi >> BM_SHIFT ))
+			continue;
+		if ( BMC_KEY( c ) > ( lo >> BM_SHIFT ) && BMC_KEY( c ) < ( hi >> BM_SHIFT )) {
+			bm_copy( bb, c );
+			continue;
+		}
+		s[0] = BMC_KEY( c ) == ( lo >> BM_SHIFT ) ? BM_LOW( lo ) : 0;
+		s[1] = BMC_KEY( c ) == ( hi >> BM_SHIFT ) ? BM_LOW( hi ) : BM_SPAN-1;
+		BMC_KEY( run ) = BMC_KEY( c );
+		run[1] = BMC_RUN | ( 1 << 8 );
+		BMC_CARD( run ) = s[1] - s[0] + 1;
+		bmc_and( bb, c, run );
+	}
+}
+
+/* Drop the IDs of list l that are not in bitmap a */
+static void
+bm_filter_list( ID *a, ID *l )
+{
+	ID *c = BM_FIRSTC( a ), *e = BM_END( a );
+	ID i, n = 0;
+
+	for ( i = 1; i <= l[0]; i++ ) {
+		while ( c < e && BMC_KEY( c ) < ( l[i] >> BM_SHIFT ))
+			c = BMC_NEXT( c );
+		if ( c >= e )
+			break;
+		if ( BMC_KEY( c ) == ( l[i] >> BM_SHIFT ) && bmc_has( c, BM_LOW( l[i] )))
+			l[++n] = l[i];
+	}
+	l[0] = n;
+}
+
+/* Return the lowest ID >= id in the bitmap, or NOID */
+static ID
+bm_next( ID *ids, ID id )
+{
+	ID *c, *e = BM_END( ids );
+	ID key = id >> BM_SHIFT;
+	unsigned x;
+
+	for ( c = BM_FIRSTC( ids ); c < e; c = BMC_NEXT( c )) {
+		if ( BMC_KEY( c ) < key )
+			continue;
+		x = bmc_next( c, BMC_KEY( c ) == key ? BM_LOW( id ) : 0 );
+		if ( x < BM_SPAN )
+			return ( BMC_KEY( c ) << BM_SHIFT ) | x;
+	}
+	return NOID;
+}
+
+/* Turn a bitmap IDL into a plain list if it fits, else into a range */
+void
+mdb_idl_flatten( ID *ids )
+{
+	ID *tmp, *c, *e, n = 0, key;
+	unsigned short *s;
+	unsigned i, x;
+
+	if ( !MDB_IDL_IS_BITMAP( ids ))
+		return;
+
+	if ( MDB_IDL_BITMAP_N( ids ) > MDB_idl_um_max ) {
+		MDB_IDL_RANGE( ids, ids[1], ids[2] );
+		return;
+	}
+
+	tmp = ch_malloc( MDB_IDL_SIZEOF( ids ));
+	MDB_IDL_CPY( tmp, ids );
+	e = BM_END( tmp );
+	for ( c = BM_FIRSTC( tmp ); c < e; c = BMC_NEXT( c )) {
+		key = BMC_KEY( c ) << BM_SHIFT;
+		s = BMC_SHORTS( c );
+		switch ( BMC_TYPE( c )) {
+		case BMC_ARRAY:
+			for ( i = 0; i < BMC_CARD( c ); i++ )
+				ids[++n] = key | s[i];
+			break;
+		case BMC_BITMAP:
+			for ( x = bm_scan( BMC_WORDS( c ), 0, 1 ); x < BM_SPAN;
+				x = bm_scan( BMC_WORDS( c ), x+1, 1 ))
+				ids[++n] = key | x;
+			break;
+		default:
+			for ( i = 0; i < BMC_NRUNS( c ); i++ )
+				for ( x = s[2*i]; x <= s[2*i+1]; x++ )
+					ids[++n] = key | x;
+			break;
+		}
+	}
+	ids[0] = n;
+	ch_free( tmp );
+}
+
+/* Bitmap results small enough to be a list are converted back */
+static void
+bm_result( ID *ids, bm_build *bb )
+{
+	if ( !MDB_IDL_BITMAP_N( bb->bb_ids )) {
+		MDB_IDL_ZERO( ids );
+		return;
+	}
+	MDB_IDL_CPY( ids, bb->bb_ids );
+	if ( MDB_IDL_BITMAP_N( ids ) <= MDB_idl_um_max )
+		mdb_idl_flatten( ids );
+}
+
+static int
+mdb_idl_bm_intersection( ID *a, ID *b )
+{
+	bm_build bb;
+	ID *out;
+
+	if ( MDB_IDL_IS_BITMAP( a ) && MDB_IDL_IS_BITMAP( b )) {
+		out = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+		bm_init( &bb, out, MDB_idl_um_size );
+		bm_and( &bb, a, b );
+		bm_result( a, &bb );
+		ch_free( out );
+
+	} else if ( MDB_IDL_IS_RANGE( a ) || MDB_IDL_IS_RANGE( b )) {
+		ID lo, hi;
+		if ( MDB_IDL_IS_RANGE( a )) {
+			lo = a[1];
+			hi = a[2];
+			MDB_IDL_CPY( a, b );
+		} else {
+			lo = b[1];
+			hi = b[2];
+		}
+		out = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+		bm_init( &bb, out, MDB_idl_um_size );
+		bm_clip( &bb, a, lo, hi );
+		bm_result( a, &bb );
+		ch_free( out );
+
+	} else if ( MDB_IDL_IS_BITMAP( a )) {
+		bm_filter_list( a, b );
+		MDB_IDL_CPY( a, b );
+
+	} else {
+		bm_filter_list( b, a );
+	}
+	return 0;
+}
+
+static int
+mdb_idl_bm_union( ID *a, ID *b )
+{
+	bm_build bb;
+	ID *dst = a, *out, *ta = NULL, *tb = NULL;
+	ID lo = IDL_MIN( MDB_IDL_FIRST( a ), MDB_IDL_FIRST( b ));
+	ID hi = IDL_MAX( MDB_IDL_LAST( a ), MDB_IDL_LAST( b ));
+
+	out = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+	if ( !MDB_IDL_IS_BITMAP( a )) {
+		ta = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+		bm_init( &bb, ta, MDB_idl_um_size );
+		bm_from_list( &bb, a );
+		if ( bb.bb_over )
+			goto done;
+		a = ta;
+	}
+	if ( !MDB_IDL_IS_BITMAP( b )) {
+		tb = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+		bm_init( &bb, tb, MDB_idl_um_size );
+		bm_from_list( &bb, b );
+		if ( bb.bb_over )
+			goto done;
+		b = tb;
+	}
+	bm_init( &bb, out, MDB_idl_um_size );
+	bm_or( &bb, a, b );
+
+done:
+	/* Too big even as a bitmap, fall back to a range */
+	if ( bb.bb_over ) {
+		MDB_IDL_RANGE( dst, lo, hi );
+	} else {
+		MDB_IDL_CPY( dst, out );
+	}
+	ch_free( tb );
+	ch_free( ta );
+	ch_free( out );
+	return 0;
+}
+
+/* Read a key with more IDs than fit in a plain list. The cursor
+ * is positioned on the first ID of the key.
+ */
+static int
+mdb_idl_fetch_big(
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	MDB_val		*data,
+	ID			*ids )
+{
+	bm_build bb;
+	bm_acc ac;
+	ID lo, hi;
+	char *ptr;
+	size_t n;
+	int rc;
+
+	memcpy( &lo, data->mv_data, sizeof(ID) );
+
+	if ( MDB_idl_bitmap ) {
+		ac.ba_n = 0;
+		ac.ba_isbits = 0;
+		bm_init( &bb, ids, MDB_idl_um_size );
+		rc = mdb_cursor_get( cursor, key, data, MDB_GET_MULTIPLE );
+		while ( rc == 0 && !bb.bb_over ) {
+			ptr = data->mv_data;
+			for ( n = data->mv_size / sizeof(ID); n; n--, ptr += sizeof(ID) ) {
+				memcpy( &hi, ptr, sizeof(ID) );
+				bm_acc_add( &bb, &ac, hi );
+			}
+			rc = mdb_cursor_get( cursor, key, data, MDB_NEXT_MULTIPLE );
+		}
+		if ( rc == MDB_NOTFOUND ) {
+			rc = 0;
+			bm_acc_flush( &bb, &ac );
+		}
+		if ( rc || !bb.bb_over )
+			return rc;
+	}
+
+	/* Doesn't fit, fall back to a range */
+	rc = mdb_cursor_get( cursor, key, data, MDB_LAST_DUP );
+	if ( rc == 0 ) {
+		memcpy( &hi, data->mv_data, sizeof(ID) );
+		MDB_IDL_RANGE( ids, lo, hi );
+	}
+	return rc;
+}
+
 static char *
 mdb_show_key(
 	char		*buf,
@@ -275,6 +1068,48 @@ mdb_show_key(
 	}
 }
 
+/* Read all the IDs under the key the cursor is positioned on */
+static int
+idl_read_dups(
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	MDB_val		*data,
+	ID			*ids )
+{
+	ID *i;
+	size_t count;
+	int rc;
+
+	rc = mdb_cursor_count( cursor, &count );
+	if ( rc == 0 && count > MDB_idl_um_max ) {
+		/* Too many for a plain list */
+		rc = mdb_idl_fetch_big( cursor, key, data, ids );
+		goto done;
+	}
+	i = ids+1;
+	rc = mdb_cursor_get( cursor, key, data, MDB_GET_MULTIPLE );
+	while (rc == 0) {
+		memcpy( i, data->mv_data, data->mv_size );
+		i += data->mv_size / sizeof(ID);
+		rc = mdb_cursor_get( cursor, key, data, MDB_NEXT_MULTIPLE );
+	}
+	if ( rc == MDB_NOTFOUND ) rc = 0;
+	ids[0] = i - &ids[1];
+	/* On disk, a range is denoted by 0 in the first element */
+	if (ids[1] == 0) {
+		if (ids[0] != MDB_IDL_RANGE_SIZE) {
+			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+				"range size mismatch: expected %d, got %ld\n",
+				MDB_IDL_RANGE_SIZE, ids[0] );
+			return -1;
+		}
+		MDB_IDL_RANGE( ids, ids[2], ids[3] );
+	}
+done:
+	data->mv_size = MDB_IDL_SIZEOF(ids);
+	return rc;
+}
+
 int
 mdb_idl_fetch_key(
 	BackendDB	*be,
@@ -287,7 +1122,6 @@ mdb_idl_fetch_key(
 {
 	MDB_val data, key2, *kptr;
 	MDB_cursor *cursor;
-	ID *i;
 	size_t len;
 	int rc;
 	MDB_cursor_op opflag;
@@ -348,29 +1182,8 @@ mdb_idl_fetch_key(
 		key->mv_data, key->mv_size ) > 0 ) {
 		rc = MDB_NOTFOUND;
 	}
-	if (rc == 0) {
-		i = ids+1;
-		rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
-		while (rc == 0) {
-			memcpy( i, data.mv_data, data.mv_size );
-			i += data.mv_size / sizeof(ID);
-			rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_MULTIPLE );
-		}
-		if ( rc == MDB_NOTFOUND ) rc = 0;
-		ids[0] = i - &ids[1];
-		/* On disk, a range is denoted by 0 in the first element */
-		if (ids[1] == 0) {
-			if (ids[0] != MDB_IDL_RANGE_SIZE) {
-				Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
-					"range size mismatch: expected %d, got %ld\n",
-					MDB_IDL_RANGE_SIZE, ids[0] );
-				mdb_cursor_close( cursor );
-				return -1;
-			}
-			MDB_IDL_RANGE( ids, ids[2], ids[3] );
-		}
-		data.mv_size = MDB_IDL_SIZEOF(ids);
-	}
+	if (rc == 0)
+		rc = idl_read_dups( cursor, key, &data, ids );
 
 	if ( saved_cursor && rc == 0 ) {
 		if ( !*saved_cursor )
@@ -406,6 +1219,141 @@ mdb_idl_fetch_key(
 	return rc;
 }
 
+/* Look up one exact key with a cursor the caller keeps open across
+ * several lookups. LMDB starts the search from the cursor's current
+ * page when it can, so a batch of keys in index order mostly avoids
+ * descending the tree again.
+ */
+int
+mdb_idl_fetch_cursor(
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*ids )
+{
+	MDB_val data;
+	int rc;
+
+	rc = mdb_cursor_get( cursor, key, &data, MDB_SET );
+	if ( rc == 0 )
+		rc = idl_read_dups( cursor, key, &data, ids );
+	return rc;
+}
+
+static void idl_union_lists( ID *a, ID *b );
+
+/* Below this many lists, pairwise unions with galloping beat the heap */
+#define IDL_MERGE_MIN	16
+
+typedef struct idl_head {
+	ID ih_id;	/* current head, kept here to spare a dereference */
+	ID *ih_cur, *ih_end;
+} idl_head;
+
+/* Merge n sorted lists into out, dropping duplicates. The lists may
+ * hold at most MDB_idl_um_max IDs between them. Each step takes the
+ * list with the smallest head off a binary heap, so this costs
+ * O(total * log n) instead of the O(total * n) of pairwise unions.
+ * A handful of lists is still cheaper to union pairwise.
+ */
+void
+mdb_idl_merge( ID **lists, int n, ID *out )
+{
+	idl_head *heap, t;
+	ID k = 0;
+	int i, j, c, nh = 0;
+
+	if ( n < IDL_MERGE_MIN ) {
+		MDB_IDL_ZERO( out );
+		for ( i = 0; i < n; i++ )
+			idl_union_lists( out, lists[i] );
+		return;
+	}
+
+	heap = ch_malloc( n * sizeof(idl_head) );
+	for ( i = 0; i < n; i++ ) {
+		if ( !lists[i][0] )
+			continue;
+		t.ih_cur = lists[i] + 1;
+		t.ih_end = lists[i] + lists[i][0];
+		t.ih_id = *t.ih_cur;
+		/* sift up */
+		for ( j = nh++; j > 0 && heap[(j-1)/2].ih_id > t.ih_id; j = (j-1)/2 )
+			heap[j] = heap[(j-1)/2];
+		heap[j] = t;
+	}
+
+	while ( nh ) {
+		t = heap[0];
+		if ( !k || out[k] != t.ih_id )
+			out[++k] = t.ih_id;
+		if ( t.ih_cur == t.ih_end ) {
+			t = heap[--nh];
+		} else {
+			t.ih_id = *++t.ih_cur;
+			/* still the smallest, drain this run without touching the heap */
+			if ( nh == 1 || ( t.ih_id <= heap[1].ih_id &&
+				( nh == 2 || t.ih_id <= heap[2].ih_id ))) {
+				heap[0] = t;
+				continue;
+			}
+		}
+		/* sift down */
+		for ( j = 0; ( c = 2*j+1 ) < nh; j = c ) {
+			if ( c+1 < nh )
+				c += heap[c+1].ih_id < heap[c].ih_id;
+			if ( heap[c].ih_id >= t.ih_id )
+				break;
+			heap[j] = heap[c];
+		}
+		if ( nh )
+			heap[j] = t;
+	}
+	out[0] = k;
+	ch_free( heap );
+}
+
+/* Count the IDs stored under a key without reading them */
+int
+mdb_idl_count_key(
+	BackendDB	*be,
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*count )
+{
+	MDB_cursor *cursor;
+	MDB_val data;
+	ID lo;
+	size_t n;
+	int rc;
+
+	rc = mdb_cursor_open( txn, dbi, &cursor );
+	if ( rc )
+		return rc;
+
+	rc = mdb_cursor_get( cursor, key, &data, MDB_SET );
+	if ( rc == 0 )
+		rc = mdb_cursor_count( cursor, &n );
+	if ( rc == 0 ) {
+		*count = n;
+		/* On disk, a range is denoted by 0 in the first element */
+		memcpy( &lo, data.mv_data, sizeof(ID) );
+		if ( lo == 0 ) {
+			rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+			if ( rc == 0 ) {
+				memcpy( &lo, data.mv_data, sizeof(ID) );
+				rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+			}
+			if ( rc == 0 ) {
+				memcpy( count, data.mv_data, sizeof(ID) );
+				*count -= lo - 1;
+			}
+		}
+	}
+	mdb_cursor_close( cursor );
+	return rc;
+}
+
 int
 mdb_idl_insert_keys(
 	BackendDB	*be,
@@ -464,7 +1412,7 @@ mdb_idl_insert_keys(
 				err = "c_count";
 				goto fail;
 			}
-			if ( count >= MDB_idl_db_max ) {
+			if ( count >= IDL_DISK_MAX ) {
 			/* No room, convert to a range */
 				lo = *i;
 				rc = mdb_cursor_get( cursor, &key, &data, MDB_LAST_DUP );
@@ -704,6 +1652,249 @@ fail:
 }
 
 
+/* Kernels for intersecting and merging plain lists.
+ *
+ * When one list is much shorter than the other, the longer one is
+ * searched by galloping: probing exponentially from the last match
+ * and then bisecting. Lists of similar size are merged linearly,
+ * comparing blocks of IDs with SIMD instructions when the CPU has them.
+ */
+#define IDL_GALLOP_RATIO	32
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(IDL_NO_SIMD)
+#define IDL_SIMD	1
+#include <immintrin.h>
+#endif
+
+/* Return the position of the first element >= id in ids[lo..ids[0]],
+ * or ids[0]+1 if there is none.
+ */
+static ID
+idl_gallop( ID *ids, ID lo, ID id )
+{
+	ID n = ids[0], hi = lo, step = 1, mid;
+
+	if ( lo > n || ids[lo] >= id )
+		return lo;
+
+	while ( hi + step <= n && ids[hi + step] < id ) {
+		hi += step;
+		step <<= 1;
+	}
+	lo = hi + 1;
+	hi = hi + step > n ? n + 1 : hi + step;
+	while ( lo < hi ) {
+		mid = lo + (( hi - lo ) >> 1);
+		if ( ids[mid] < id )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Return the position of the first element > id in ids[1..hi],
+ * searching backward from hi. ids[hi] must be > id.
+ */
+static ID
+idl_gallop_back( ID *ids, ID hi, ID id )
+{
+	ID lo = hi, step = 1, mid;
+
+	while ( lo > step && ids[lo - step] > id ) {
+		lo -= step;
+		step <<= 1;
+	}
+	hi = lo;
+	lo = lo > step ? lo - step + 1 : 1;
+	while ( lo < hi ) {
+		mid = lo + (( hi - lo ) >> 1);
+		if ( ids[mid] > id )
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/* The intersection kernels store the result in out, which may be
+ * either of the inputs, and return the number of IDs stored.
+ */
+static ID
+idl_isect_gallop( ID *small, ID *large, ID *out )
+{
+	ID i, j = 1, k = 0;
+
+	for ( i = 1; i <= small[0]; i++ ) {
+		j = idl_gallop( large, j, small[i] );
+		if ( j > large[0] )
+			break;
+		if ( large[j] == small[i] )
+			out[++k] = small[i];
+	}
+	return k;
+}
+
+static ID
+idl_isect_tail( ID *a, ID *b, ID *out, ID i, ID j, ID k )
+{
+	ID na = a[0], nb = b[0];
+
+	while ( i <= na && j <= nb ) {
+		if ( a[i] < b[j] ) {
+			i++;
+		} else if ( a[i] > b[j] ) {
+			j++;
+		} else {
+			out[++k] = a[i];
+			i++;
+			j++;
+		}
+	}
+	return k;
+}
+
+static ID
+idl_isect_merge( ID *a, ID *b, ID *out )
+{
+	return idl_isect_tail( a, b, out, 1, 1, 0 );
+}
+
+#ifdef IDL_SIMD
+/* Compare blocks of 4 IDs from each list against each other,
+ * then advance whichever block has the smaller maximum.
+ */
+__attribute__((target("avx2")))
+static ID
+idl_isect_avx2( ID *a, ID *b, ID *out )
+{
+	ID i = 1, j = 1, k = 0, amax, bmax;
+	__m256i va, vb, m;
+	int mask;
+
+	while ( i + 3 <= a[0] && j + 3 <= b[0] ) {
+		va = _mm256_loadu_si256( (__m256i *)( a + i ));
+		vb = _mm256_loadu_si256( (__m256i *)( b + j ));
+		m = _mm256_cmpeq_epi64( va, vb );
+		vb = _mm256_permute4x64_epi64( vb, _MM_SHUFFLE( 0, 3, 2, 1 ));
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		vb = _mm256_permute4x64_epi64( vb, _MM_SHUFFLE( 0, 3, 2, 1 ));
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		vb = _mm256_permute4x64_epi64( vb, _MM_SHUFFLE( 0, 3, 2, 1 ));
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		mask = _mm256_movemask_pd( _mm256_castsi256_pd( m ));
+
+		/* out may be a, read the maxima before storing */
+		amax = a[i+3];
+		bmax = b[j+3];
+		while ( mask ) {
+			out[++k] = a[i + __builtin_ctz( mask )];
+			mask &= mask - 1;
+		}
+		if ( amax <= bmax )
+			i += 4;
+		if ( bmax <= amax )
+			j += 4;
+	}
+	return idl_isect_tail( a, b, out, i, j, k );
+}
+
+__attribute__((target("sse4.2")))
+static ID
+idl_isect_sse42( ID *a, ID *b, ID *out )
+{
+	ID i = 1, j = 1, k = 0, amax, bmax;
+	__m128i va, vb, m;
+	int mask;
+
+	while ( i + 1 <= a[0] && j + 1 <= b[0] ) {
+		va = _mm_loadu_si128( (__m128i *)( a + i ));
+		vb = _mm_loadu_si128( (__m128i *)( b + j ));
+		m = _mm_cmpeq_epi64( va, vb );
+		vb = _mm_shuffle_epi32( vb, _MM_SHUFFLE( 1, 0, 3, 2 ));
+		m = _mm_or_si128( m, _mm_cmpeq_epi64( va, vb ));
+		mask = _mm_movemask_pd( _mm_castsi128_pd( m ));
+
+		amax = a[i+1];
+		bmax = b[j+1];
+		while ( mask ) {
+			out[++k] = a[i + __builtin_ctz( mask )];
+			mask &= mask - 1;
+		}
+		if ( amax <= bmax )
+			i += 2;
+		if ( bmax <= amax )
+			j += 2;
+	}
+	return idl_isect_tail( a, b, out, i, j, k );
+}
+#endif /* IDL_SIMD */
+
+static ID
+idl_isect_lists( ID *a, ID *b, ID *out )
+{
+	if ( a[0] * IDL_GALLOP_RATIO < b[0] )
+		return idl_isect_gallop( a, b, out );
+	if ( b[0] * IDL_GALLOP_RATIO < a[0] )
+		return idl_isect_gallop( b, a, out );
+#ifdef IDL_SIMD
+	if ( __builtin_cpu_supports( "avx2" ))
+		return idl_isect_avx2( a, b, out );
+	if ( __builtin_cpu_supports( "sse4.2" ))
+		return idl_isect_sse42( a, b, out );
+#endif
+	return idl_isect_merge( a, b, out );
+}
+
+/* Merge sorted list b into sorted list a, working backward from the
+ * end of a. When the lists differ a lot in size, runs of either list
+ * that fall between two elements of the other are found by galloping
+ * and moved as blocks. a must have room for a[0]+b[0] IDs.
+ */
+static void
+idl_union_lists( ID *a, ID *b )
+{
+	ID total = a[0] + b[0], i = a[0], j = b[0], k = total, n;
+	int gallop = a[0] * IDL_GALLOP_RATIO < b[0] ||
+		b[0] * IDL_GALLOP_RATIO < a[0];
+
+	while ( i && j ) {
+		if ( a[i] > b[j] ) {
+			if ( !gallop ) {
+				a[k--] = a[i--];
+				continue;
+			}
+			n = i + 1 - idl_gallop_back( a, i, b[j] );
+			i -= n;
+			k -= n;
+			AC_MEMCPY( a+k+1, a+i+1, n * sizeof(ID) );
+		} else if ( a[i] < b[j] ) {
+			if ( !gallop ) {
+				a[k--] = b[j--];
+				continue;
+			}
+			n = j + 1 - idl_gallop_back( b, j, a[i] );
+			j -= n;
+			k -= n;
+			AC_MEMCPY( a+k+1, b+j+1, n * sizeof(ID) );
+		} else {
+			a[k--] = a[i--];
+			j--;
+		}
+	}
+	if ( j ) {
+		k -= j;
+		AC_MEMCPY( a+k+1, b+1, j * sizeof(ID) );
+	}
+	/* Duplicates leave a gap between the untouched head of a
+	 * and the merged tail.
+	 */
+	if ( k > i ) {
+		AC_MEMCPY( a+i+1, a+k+1, ( total - k ) * sizeof(ID) );
+	}
+	a[0] = total - ( k - i );
+}
+
 /*
  * idl_intersection - return a = a intersection b
  */
@@ -735,6 +1926,10 @@ mdb_idl_intersection(
 		return 0;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( a ) || MDB_IDL_IS_BITMAP( b ) ) {
+		return mdb_idl_bm_intersection( a, b );
+	}
+
 	if ( MDB_IDL_IS_RANGE( a ) ) {
 		if ( MDB_IDL_IS_RANGE(b) ) {
 		/* If both are ranges, just shrink the boundaries */
@@ -759,6 +1954,11 @@ mdb_idl_intersection(
 		goto done;
 	}
 
+	if ( !MDB_IDL_IS_RANGE( b ) ) {
+		a[0] = idl_isect_lists( a, b, a );
+		goto done;
+	}
+
 	/* Fine, do the intersection one element at a time.
 	 * First advance to idmin in both IDLs.
 	 */
@@ -816,6 +2016,15 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		return 0;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( a ) || MDB_IDL_IS_BITMAP( b ) ) {
+		return mdb_idl_bm_union( a, b );
+	}
+
+	if ( a[0] + b[0] <= MDB_idl_um_max ) {
+		idl_union_lists( a, b );
+		return 0;
+	}
+
 	ida = mdb_idl_first( a, &cursora );
 	idb = mdb_idl_first( b, &cursorb );
 
@@ -825,6 +2034,9 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 	while( ida != NOID || idb != NOID ) {
 		if ( ida < idb ) {
 			if( ++cursorc > MDB_idl_um_max ) {
+				/* b's tail was only used as scratch, both are intact */
+				if ( MDB_idl_bitmap )
+					return mdb_idl_bm_union( a, b );
 				goto over;
 			}
 			b[cursorc] = ida;
@@ -859,7 +2071,6 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 }
 
 
-#if 0
 /*
  * mdb_idl_notin - return a intersection ~b (or a minus b)
  */
@@ -869,49 +2080,46 @@ mdb_idl_notin(
 	ID	*b,
 	ID *ids )
 {
-	ID ida, idb;
-	ID cursora = 0, cursorb = 0;
+	ID i = 1, j, n;
 
 	if( MDB_IDL_IS_ZERO( a ) ||
 		MDB_IDL_IS_ZERO( b ) ||
-		MDB_IDL_IS_RANGE( b ) )
+		MDB_IDL_IS_RANGE( b ) ||
+		MDB_IDL_IS_BITMAP( b ) )
 	{
 		MDB_IDL_CPY( ids, a );
 		return 0;
 	}
 
-	if( MDB_IDL_IS_RANGE( a ) ) {
+	if( MDB_IDL_IS_RANGE( a ) || MDB_IDL_IS_BITMAP( a ) ) {
 		MDB_IDL_CPY( ids, a );
 		return 0;
 	}
 
-	ida = mdb_idl_first( a, &cursora ),
-	idb = mdb_idl_first( b, &cursorb );
-
 	ids[0] = 0;
 
-	while( ida != NOID ) {
-		if ( idb == NOID ) {
-			/* we could shortcut this */
-			ids[++ids[0]] = ida;
-			ida = mdb_idl_next( a, &cursora );
-
-		} else if ( ida < idb ) {
-			ids[++ids[0]] = ida;
-			ida = mdb_idl_next( a, &cursora );
-
-		} else if ( ida > idb ) {
-			idb = mdb_idl_next( b, &cursorb );
-
-		} else {
-			ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
+	if ( b[0] * IDL_GALLOP_RATIO < a[0] ) {
+		/* Few IDs to remove, copy the runs of a between them */
+		for ( j = 1; j <= b[0]; j++ ) {
+			n = idl_gallop( a, i, b[j] );
+			AC_MEMCPY( ids+ids[0]+1, a+i, ( n - i ) * sizeof(ID) );
+			ids[0] += n - i;
+			i = n;
+			if ( i <= a[0] && a[i] == b[j] )
+				i++;
+		}
+		AC_MEMCPY( ids+ids[0]+1, a+i, ( a[0] + 1 - i ) * sizeof(ID) );
+		ids[0] += a[0] + 1 - i;
+	} else {
+		for ( i = 1, j = 1; i <= a[0]; i++ ) {
+			j = idl_gallop( b, j, a[i] );
+			if ( j > b[0] || b[j] != a[i] )
+				ids[++ids[0]] = a[i];
 		}
 	}
 
 	return 0;
 }
-#endif
 
 ID mdb_idl_first( ID *ids, ID *cursor )
 {
@@ -929,6 +2137,11 @@ ID mdb_idl_first( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( ids ) ) {
+		*cursor = bm_next( ids, *cursor );
+		return *cursor;
+	}
+
 	if ( *cursor == 0 )
 		pos = 1;
 	else
@@ -951,6 +2164,14 @@ ID mdb_idl_next( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( ids ) ) {
+		if ( *cursor >= ids[2] ) {
+			return NOID;
+		}
+		*cursor = bm_next( ids, *cursor + 1 );
+		return *cursor;
+	}
+
 	if ( ++(*cursor) <= ids[0] ) {
 		return ids[*cursor];
 	}
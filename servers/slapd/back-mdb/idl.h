@@ -27,11 +27,25 @@ extern unsigned int MDB_idl_um_size;
 extern unsigned int MDB_idl_db_max;
 extern unsigned int MDB_idl_um_max;
 
+extern int MDB_idl_bitmap;
+extern unsigned int MDB_idl_bm_max;
+
 #define MDB_IDL_IS_RANGE(ids)	((ids)[0] == NOID)
 #define MDB_IDL_RANGE_SIZE		(3)
 #define MDB_IDL_RANGE_SIZEOF	(MDB_IDL_RANGE_SIZE * sizeof(ID))
 #define MDB_IDL_SIZEOF(ids)		((MDB_IDL_IS_RANGE(ids) \
-	? MDB_IDL_RANGE_SIZE : ((ids)[0]+1)) * sizeof(ID))
+	? MDB_IDL_RANGE_SIZE : MDB_IDL_IS_BITMAP(ids) \
+	? MDB_IDL_BITMAP_LEN(ids) : ((ids)[0]+1)) * sizeof(ID))
+
+/* A bitmap IDL holds a set that is too large for a plain list in the
+ * same buffer. The header is followed by packed containers, each
+ * covering 64K consecutive IDs.
+ */
+#define MDB_IDL_BITMAP_TAG		(NOID-1)
+#define MDB_IDL_IS_BITMAP(ids)	((ids)[0] == MDB_IDL_BITMAP_TAG)
+#define MDB_IDL_BITMAP_HDR		(5)	/* tag, first, last, count, length */
+#define MDB_IDL_BITMAP_N(ids)	((ids)[3])
+#define MDB_IDL_BITMAP_LEN(ids)	((ids)[4])
 
 #define MDB_IDL_RANGE_FIRST(ids)	((ids)[1])
 #define MDB_IDL_RANGE_LAST(ids)		((ids)[2])
@@ -61,11 +75,12 @@ extern unsigned int MDB_idl_um_max;
 
 #define MDB_IDL_FIRST( ids )	( (ids)[1] )
 #define MDB_IDL_LLAST( ids )	( (ids)[(ids)[0]] )
-#define MDB_IDL_LAST( ids )		( MDB_IDL_IS_RANGE(ids) \
+#define MDB_IDL_LAST( ids )		( (ids)[0] >= MDB_IDL_BITMAP_TAG \
 	? (ids)[2] : (ids)[(ids)[0]] )
 
 #define MDB_IDL_N( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? ((ids)[2]-(ids)[1])+1 : (ids)[0] )
+	? ((ids)[2]-(ids)[1])+1 : MDB_IDL_IS_BITMAP(ids) \
+	? MDB_IDL_BITMAP_N(ids) : (ids)[0] )
 
 	/** An ID2 is an ID/value pair.
 	 */
@@ -0,0 +1,330 @@
+/* idlbench.c - micro-benchmark for the back-mdb IDL kernels */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2024 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Times the list intersection, union, difference and k-way merge
+ * kernels over synthetic IDLs of various sizes and densities, and
+ * checks that all strategies agree with a plain element-at-a-time merge.
+ *
+ * Build with "make idlbench" in the back-mdb build directory.
+ */
+
+#include "idl.c"
+
+#include <ac/stdlib.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+/* Minimal stand-ins for the slapd symbols idl.c depends on */
+int slap_debug;
+int ldap_syslog;
+int ldap_syslog_level;
+
+void *
+ch_malloc( ber_len_t size )
+{
+	void *p = ber_memalloc( size );
+	if ( !p ) {
+		perror( "ch_malloc" );
+		exit( EXIT_FAILURE );
+	}
+	return p;
+}
+
+void
+ch_free( void *p )
+{
+	ber_memfree( p );
+}
+
+typedef ID (isect_func)( ID *a, ID *b, ID *out );
+
+static struct {
+	const char *name;
+	isect_func *func;
+	const char *cpu;
+} kernels[] = {
+	{ "merge", idl_isect_merge, NULL },
+	{ "gallop", NULL, NULL },
+#ifdef IDL_SIMD
+	{ "sse4.2", idl_isect_sse42, "sse4.2" },
+	{ "avx2", idl_isect_avx2, "avx2" },
+#endif
+	{ "auto", idl_isect_lists, NULL },
+	{ NULL }
+};
+
+static struct {
+	ID na, nb;
+	ID span;	/* IDs are drawn from [1, span] */
+} cases[] = {
+	{ 10, 100000, 1000000 },
+	{ 100, 100000, 1000000 },
+	{ 1000, 100000, 1000000 },
+	{ 10000, 100000, 1000000 },
+	{ 100000, 100000, 1000000 },
+	{ 100000, 100000, 200000 },
+	{ 50000, 120000, 10000000 },
+	{ 0 }
+};
+
+static int
+cpu_has( const char *cpu )
+{
+#ifdef IDL_SIMD
+	if ( !strcmp( cpu, "avx2" ))
+		return __builtin_cpu_supports( "avx2" );
+	if ( !strcmp( cpu, "sse4.2" ))
+		return __builtin_cpu_supports( "sse4.2" );
+#endif
+	return 0;
+}
+
+static double
+now( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fill ids with n distinct sorted IDs from [1, span] */
+static void
+gen( ID *ids, ID n, ID span )
+{
+	ID i, k = 0;
+	double p = (double)n / span;
+
+	for ( i = 1; i <= span && k < n; i++ ) {
+		if ( (double)rand() / RAND_MAX < p || span - i < n - k )
+			ids[++k] = i;
+	}
+	ids[0] = k;
+}
+
+/* The original element-at-a-time intersection */
+static ID
+isect_legacy( ID *a, ID *b, ID *out )
+{
+	ID ida, idb, cursora = 0, cursorb = 0, k = 0;
+
+	ida = mdb_idl_first( a, &cursora );
+	idb = mdb_idl_first( b, &cursorb );
+	while ( ida != NOID && idb != NOID ) {
+		if ( ida == idb ) {
+			out[++k] = ida;
+			ida = mdb_idl_next( a, &cursora );
+			idb = mdb_idl_next( b, &cursorb );
+		} else if ( ida < idb ) {
+			ida = mdb_idl_next( a, &cursora );
+		} else {
+			idb = mdb_idl_next( b, &cursorb );
+		}
+	}
+	return k;
+}
+
+static ID
+isect_gallop( ID *a, ID *b, ID *out )
+{
+	return a[0] <= b[0] ? idl_isect_gallop( a, b, out ) :
+		idl_isect_gallop( b, a, out );
+}
+
+/* A plain forward merge into a separate list */
+static void
+union_merge( ID *a, ID *b, ID *out )
+{
+	ID i = 1, j = 1, k = 0;
+
+	while ( i <= a[0] || j <= b[0] ) {
+		if ( j > b[0] || ( i <= a[0] && a[i] < b[j] )) {
+			out[++k] = a[i++];
+		} else {
+			if ( i <= a[0] && a[i] == b[j] )
+				i++;
+			out[++k] = b[j++];
+		}
+	}
+	out[0] = k;
+}
+
+#define MERGE_LISTS	1000
+
+static struct {
+	int n;
+	ID len, span;
+} merges[] = {
+	{ 4, 10000, 1000000 },
+	{ 16, 2000, 1000000 },
+	{ 64, 1000, 100000 },
+	{ 200, 20, 1000000 },
+	{ 1000, 1, 1000000 },
+	{ 0 }
+};
+
+static void
+usage( const char *name )
+{
+	fprintf( stderr, "usage: %s [-i iterations] [-s seed]\n", name );
+	exit( EXIT_FAILURE );
+}
+
+int
+main( int argc, char **argv )
+{
+	ID *a, *b, *out, *ref, n, *lists[MERGE_LISTS];
+	int i, c, k, iters = 20, rc = EXIT_SUCCESS;
+	unsigned seed = 42;
+	double t0, t;
+
+	while (( c = getopt( argc, argv, "i:s:" )) != EOF ) {
+		switch ( c ) {
+		case 'i':
+			iters = atoi( optarg );
+			break;
+		case 's':
+			seed = strtoul( optarg, NULL, 0 );
+			break;
+		default:
+			usage( argv[0] );
+		}
+	}
+	if ( iters < 1 )
+		usage( argv[0] );
+	srand( seed );
+
+	a = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+	b = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+	out = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+	ref = ch_malloc( MDB_idl_um_size * sizeof(ID) );
+
+	printf( "%-24s %-8s %12s %8s\n", "case", "kernel", "usec/op", "speedup" );
+	for ( c = 0; cases[c].na; c++ ) {
+		char label[64];
+		double base;
+
+		gen( a, cases[c].na, cases[c].span );
+		gen( b, cases[c].nb, cases[c].span );
+		snprintf( label, sizeof(label), "and %lu/%lu/%lu",
+			a[0], b[0], cases[c].span );
+
+		t0 = now();
+		for ( i = 0; i < iters; i++ )
+			ref[0] = isect_legacy( a, b, ref );
+		base = ( now() - t0 ) / iters;
+		printf( "%-24s %-8s %12.1f %8s\n", label, "legacy", base * 1e6, "1.0" );
+
+		for ( k = 0; kernels[k].name; k++ ) {
+			isect_func *f = kernels[k].func ? kernels[k].func : isect_gallop;
+			if ( kernels[k].cpu && !cpu_has( kernels[k].cpu ))
+				continue;
+			t0 = now();
+			for ( i = 0; i < iters; i++ )
+				out[0] = f( a, b, out );
+			t = ( now() - t0 ) / iters;
+			if ( out[0] != ref[0] || memcmp( out, ref, ( ref[0]+1 ) * sizeof(ID) )) {
+				printf( "%-24s %-8s MISMATCH\n", label, kernels[k].name );
+				rc = EXIT_FAILURE;
+				continue;
+			}
+			printf( "%-24s %-8s %12.1f %8.1f\n", label, kernels[k].name,
+				t * 1e6, base / t );
+		}
+
+		if ( a[0] + b[0] <= MDB_idl_um_max ) {
+			snprintf( label, sizeof(label), "or  %lu/%lu/%lu",
+				a[0], b[0], cases[c].span );
+			t0 = now();
+			for ( i = 0; i < iters; i++ )
+				union_merge( a, b, ref );
+			base = ( now() - t0 ) / iters;
+			printf( "%-24s %-8s %12.1f %8s\n", label, "merge", base * 1e6, "1.0" );
+
+			t = 0;
+			for ( i = 0; i < iters; i++ ) {
+				MDB_IDL_CPY( out, a );
+				t0 = now();
+				idl_union_lists( out, b );
+				t += now() - t0;
+			}
+			t /= iters;
+			if ( out[0] != ref[0] || memcmp( out, ref, ( ref[0]+1 ) * sizeof(ID) )) {
+				printf( "%-24s %-8s MISMATCH\n", label, "auto" );
+				rc = EXIT_FAILURE;
+			} else {
+				printf( "%-24s %-8s %12.1f %8.1f\n", label, "auto",
+					t * 1e6, base / t );
+			}
+		}
+
+		snprintf( label, sizeof(label), "not %lu/%lu/%lu",
+			a[0], b[0], cases[c].span );
+		for ( n = 1, ref[0] = 0; n <= a[0]; n++ )
+			if ( mdb_idl_search( b, a[n] ) > b[0] || b[mdb_idl_search( b, a[n] )] != a[n] )
+				ref[++ref[0]] = a[n];
+		t0 = now();
+		for ( i = 0; i < iters; i++ )
+			mdb_idl_notin( a, b, out );
+		t = ( now() - t0 ) / iters;
+		if ( out[0] != ref[0] || memcmp( out, ref, ( ref[0]+1 ) * sizeof(ID) )) {
+			printf( "%-24s %-8s MISMATCH\n", label, "auto" );
+			rc = EXIT_FAILURE;
+		} else {
+			printf( "%-24s %-8s %12.1f\n", label, "auto", t * 1e6 );
+		}
+	}
+
+	for ( c = 0; merges[c].n; c++ ) {
+		char label[64];
+		double base;
+
+		for ( k = 0; k < merges[c].n; k++ ) {
+			lists[k] = ch_malloc( ( merges[c].len + 1 ) * sizeof(ID) );
+			gen( lists[k], merges[c].len, merges[c].span );
+		}
+		snprintf( label, sizeof(label), "merge %dx%lu/%lu",
+			merges[c].n, merges[c].len, merges[c].span );
+
+		t0 = now();
+		for ( i = 0; i < iters; i++ ) {
+			MDB_IDL_ZERO( ref );
+			for ( k = 0; k < merges[c].n; k++ )
+				idl_union_lists( ref, lists[k] );
+		}
+		base = ( now() - t0 ) / iters;
+		printf( "%-24s %-8s %12.1f %8s\n", label, "pairwise", base * 1e6, "1.0" );
+
+		t0 = now();
+		for ( i = 0; i < iters; i++ )
+			mdb_idl_merge( lists, merges[c].n, out );
+		t = ( now() - t0 ) / iters;
+		if ( out[0] != ref[0] || memcmp( out, ref, ( ref[0]+1 ) * sizeof(ID) )) {
+			printf( "%-24s %-8s MISMATCH\n", label, "kway" );
+			rc = EXIT_FAILURE;
+		} else {
+			printf( "%-24s %-8s %12.1f %8.1f\n", label, "kway",
+				t * 1e6, base / t );
+		}
+		for ( k = 0; k < merges[c].n; k++ )
+			ch_free( lists[k] );
+	}
+
+	ch_free( ref );
+	ch_free( out );
+	ch_free( b );
+	ch_free( a );
+	return rc;
+}
@@ -282,6 +282,38 @@ done:
 	return rc;
 }
 
+/* The index types an online reindex has to add. Substring keys are
+ * rebuilt in full when their lengths or layout changed.
+ */
+static slap_mask_t
+index_update_mask( AttrInfo *ai )
+{
+	slap_mask_t mask;
+
+	mask = ai->ai_newmask & ~ai->ai_indexmask & ~SLAP_INDEX_SUBSTR_LENS;
+	if (( ai->ai_newmask ^ ai->ai_indexmask ) &
+		( SLAP_INDEX_SUBSTR_LENS | SLAP_INDEX_SUBSTR_POS ))
+		mask |= ai->ai_newmask &
+			( SLAP_INDEX_SUBSTR_DEFAULT | SLAP_INDEX_SUBSTR_POS );
+	if ( mask )
+		mask |= ai->ai_newmask & SLAP_INDEX_SUBSTR_LENS;
+	return mask;
+}
+
+/* The substring keys an online reindex has to remove before adding
+ * the new ones, because their lengths or layout changed.
+ */
+static slap_mask_t
+index_stale_mask( AttrInfo *ai )
+{
+	if ( !ai->ai_newmask || !IS_SLAP_INDEX( ai->ai_indexmask, SLAP_INDEX_SUBSTR ) ||
+		!(( ai->ai_newmask ^ ai->ai_indexmask ) &
+		( SLAP_INDEX_SUBSTR_LENS | SLAP_INDEX_SUBSTR_POS )))
+		return 0;
+	return ai->ai_indexmask & ( SLAP_INDEX_SUBSTR_DEFAULT |
+		SLAP_INDEX_SUBSTR_POS | SLAP_INDEX_SUBSTR_LENS );
+}
+
 static int index_at_values(
 	Operation *op,
 	MDB_txn *txn,
@@ -299,6 +331,8 @@ static int index_at_values(
 
 	if ( opid == MDB_INDEX_UPDATE_OP )
 		ixop = SLAP_INDEX_ADD_OP;
+	else if ( opid == MDB_INDEX_STALE_OP )
+		ixop = SLAP_INDEX_DELETE_OP;
 
 	if( type->sat_sup ) {
 		/* recurse */
@@ -329,7 +363,9 @@ static int index_at_values(
 			 * already in the old mask.
 			 */
 			if ( opid == MDB_INDEX_UPDATE_OP )
-				mask = ai->ai_newmask & ~ai->ai_indexmask;
+				mask = index_update_mask( ai );
+			else if ( opid == MDB_INDEX_STALE_OP )
+				mask = index_stale_mask( ai );
 			else
 			/* For regular updates, if there is a newmask use it. Otherwise
 			 * just use the old mask.
@@ -353,7 +389,9 @@ static int index_at_values(
 
 			if( ai && ( ai->ai_indexmask || ai->ai_newmask )) {
 				if ( opid == MDB_INDEX_UPDATE_OP )
-					mask = ai->ai_newmask & ~ai->ai_indexmask;
+					mask = index_update_mask( ai );
+				else if ( opid == MDB_INDEX_STALE_OP )
+					mask = index_stale_mask( ai );
 				else
 					mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
 				if ( mask ) {
@@ -500,6 +538,19 @@ mdb_index_entry(
 		opid == SLAP_INDEX_DELETE_OP ? "del" : "add",
 		(long) e->e_id, e->e_dn ? e->e_dn : "" );
 
+	/* An index update first removes the substring keys it replaces,
+	 * for all attributes, since other attributes may share them
+	 */
+	if ( opid == MDB_INDEX_UPDATE_OP ) {
+		for ( ; ap != NULL; ap = ap->a_next ) {
+			rc = mdb_index_values( op, txn, ap->a_desc,
+				ap->a_nvals, e->e_id, MDB_INDEX_STALE_OP );
+			if ( rc != LDAP_SUCCESS )
+				return rc;
+		}
+		ap = e->e_attrs;
+	}
+
 	/* add each attribute to the indexes */
 	for ( ; ap != NULL; ap = ap->a_next ) {
 #if 0 /* ifdef LDAP_COMP_MATCH */
@@ -67,6 +67,9 @@ mdb_db_init( BackendDB *be, ConfigReply *cr )
 	mdb->mi_multi_hi = UINT_MAX;
 	mdb->mi_multi_lo = UINT_MAX;
 
+	ldap_pvt_thread_mutex_init( &mdb->mi_batch_mutex );
+	ldap_pvt_thread_cond_init( &mdb->mi_batch_cond );
+
 	be->be_private = mdb;
 	be->be_cf_ocs = be->bd_info->bi_cf_ocs+1;
 
@@ -176,6 +179,14 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 	if ( slapMode & SLAP_TOOL_READONLY)
 		flags |= MDB_RDONLY;
 
+	if ( mdb->mi_batch_max && ( flags & MDB_WRITEMAP ) &&
+		( slapMode & SLAP_SERVER_MODE )) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_db_open) ": database \"%s\": "
+			"groupcommit is not supported with writemap, ignored.\n",
+			be->be_suffix[0].bv_val );
+	}
+
 	rc = mdb_env_open( mdb->mi_dbenv, dbhome,
 			flags, mdb->mi_dbenv_mode );
 
@@ -277,6 +288,15 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	rc = mdb_zdict_read( mdb, txn );
+	if ( rc == 0 && mdb->mi_compress && !mdb->mi_zdict.bv_len &&
+		!(slapMode & SLAP_TOOL_READONLY) )
+		rc = mdb_zdict_train( be, txn );
+	if ( rc ) {
+		mdb_txn_abort( txn );
+		goto fail;
+	}
+
 	/* slapcat doesn't need indexes. avoid a failure if
 	 * a configured index wasn't created yet.
 	 */
@@ -373,6 +393,8 @@ mdb_db_close( BackendDB *be, ConfigReply *cr )
 		mdb->mi_dbenv = NULL;
 	}
 
+	mdb_zdict_free( mdb );
+
 	return 0;
 }
 
@@ -399,6 +421,9 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 
 	mdb_attr_index_destroy( mdb );
 
+	ldap_pvt_thread_cond_destroy( &mdb->mi_batch_cond );
+	ldap_pvt_thread_mutex_destroy( &mdb->mi_batch_mutex );
+
 	ch_free( mdb );
 	be->be_private = NULL;
 
@@ -70,3 +70,181 @@ mdb_key_read(
 
 	return rc;
 }
+
+/* count the IDs under a key */
+int
+mdb_key_count(
+	Backend	*be,
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *k,
+	ID *count
+)
+{
+	int rc;
+	MDB_val key;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+#endif
+
+#ifndef MISALIGNED_OK
+	if (k->bv_len & ALIGNER) {
+		key.mv_size = sizeof(kbuf);
+		key.mv_data = kbuf;
+		kbuf[1] = 0;
+		memcpy(kbuf, k->bv_val, k->bv_len);
+	} else
+#endif
+	{
+		key.mv_size = k->bv_len;
+		key.mv_data = k->bv_val;
+	}
+
+	rc = mdb_idl_count_key( be, txn, dbi, &key, count );
+
+	Debug( LDAP_DEBUG_TRACE, "<= mdb_key_count: rc=%d count=%ld\n",
+		rc, rc ? 0L : (long) *count );
+
+	return rc;
+}
+
+static int
+key_cmp( const void *v1, const void *v2 )
+{
+	const struct berval *k1 = v1, *k2 = v2;
+	int rc;
+
+	/* same order as the index DB: bytes first, then length */
+	rc = memcmp( k1->bv_val, k2->bv_val,
+		k1->bv_len < k2->bv_len ? k1->bv_len : k2->bv_len );
+	if ( !rc )
+		rc = ( k1->bv_len > k2->bv_len ) - ( k1->bv_len < k2->bv_len );
+	return rc;
+}
+
+/* Read several keys of one index and combine their IDLs, intersected
+ * for LDAP_FILTER_AND or merged for LDAP_FILTER_OR. The keys are read
+ * in index order with a single cursor. Plain lists of an OR are
+ * gathered and merged in one pass, as many at a time as fit in a list.
+ */
+int
+mdb_keys_read(
+	Operation *op,
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *keys,
+	int ftype,
+	ID *ids,
+	ID *tmp
+)
+{
+	struct berval *sorted;
+	MDB_cursor *mc;
+	MDB_val key;
+	ID **lists = NULL, total = 0;
+	int i, n, nlists = 0, rc;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+#endif
+
+	for ( n = 0; keys[n].bv_val; n++ );
+
+	Debug( LDAP_DEBUG_TRACE, "=> mdb_keys_read: %d keys\n", n );
+
+	rc = mdb_cursor_open( txn, dbi, &mc );
+	if ( rc )
+		return rc;
+
+	sorted = op->o_tmpalloc( n * sizeof(struct berval), op->o_tmpmemctx );
+	AC_MEMCPY( sorted, keys, n * sizeof(struct berval) );
+	qsort( sorted, n, sizeof(struct berval), key_cmp );
+	if ( ftype == LDAP_FILTER_OR ) {
+		lists = op->o_tmpalloc( n * sizeof(ID *), op->o_tmpmemctx );
+		MDB_IDL_ZERO( ids );
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		/* skip duplicate keys */
+		if ( i && !key_cmp( &sorted[i-1], &sorted[i] ))
+			continue;
+#ifndef MISALIGNED_OK
+		if ( sorted[i].bv_len & ALIGNER ) {
+			key.mv_size = sizeof(kbuf);
+			key.mv_data = kbuf;
+			kbuf[1] = 0;
+			memcpy( kbuf, sorted[i].bv_val, sorted[i].bv_len );
+		} else
+#endif
+		{
+			key.mv_size = sorted[i].bv_len;
+			key.mv_data = sorted[i].bv_val;
+		}
+
+		rc = mdb_idl_fetch_cursor( mc, &key, tmp );
+
+		if ( ftype == LDAP_FILTER_AND ) {
+			if ( rc == MDB_NOTFOUND ) {
+				MDB_IDL_ZERO( ids );
+				rc = 0;
+				break;
+			}
+			if ( rc )
+				break;
+			if ( i == 0 ) {
+				MDB_IDL_CPY( ids, tmp );
+			} else {
+				mdb_idl_intersection( ids, tmp );
+			}
+			if ( MDB_IDL_IS_ZERO( ids ))
+				break;
+			continue;
+		}
+
+		if ( rc == MDB_NOTFOUND ) {
+			rc = 0;
+			continue;
+		}
+		if ( rc )
+			break;
+		if ( MDB_IDL_IS_RANGE( tmp ) || MDB_IDL_IS_BITMAP( tmp )) {
+			mdb_idl_union( ids, tmp );
+			continue;
+		}
+		if ( total + tmp[0] > MDB_idl_um_max ) {
+			/* merge what we have so far to make room */
+			ID *cur = op->o_tmpalloc( ( tmp[0] + 1 ) * sizeof(ID),
+				op->o_tmpmemctx );
+			AC_MEMCPY( cur, tmp, ( tmp[0] + 1 ) * sizeof(ID) );
+			mdb_idl_merge( lists, nlists, tmp );
+			mdb_idl_union( ids, tmp );
+			while ( nlists )
+				op->o_tmpfree( lists[--nlists], op->o_tmpmemctx );
+			lists[nlists++] = cur;
+			total = cur[0];
+			continue;
+		}
+		lists[nlists] = op->o_tmpalloc( ( tmp[0] + 1 ) * sizeof(ID),
+			op->o_tmpmemctx );
+		AC_MEMCPY( lists[nlists], tmp, ( tmp[0] + 1 ) * sizeof(ID) );
+		total += tmp[0];
+		nlists++;
+	}
+
+	if ( nlists ) {
+		if ( rc == 0 ) {
+			mdb_idl_merge( lists, nlists, tmp );
+			mdb_idl_union( ids, tmp );
+		}
+		while ( nlists )
+			op->o_tmpfree( lists[--nlists], op->o_tmpmemctx );
+	}
+	if ( lists )
+		op->o_tmpfree( lists, op->o_tmpmemctx );
+	op->o_tmpfree( sorted, op->o_tmpmemctx );
+	mdb_cursor_close( mc );
+
+	Debug( LDAP_DEBUG_TRACE, "<= mdb_keys_read: rc=%d %ld candidates\n",
+		rc, (long) MDB_IDL_N(ids) );
+
+	return rc;
+}
@@ -764,12 +764,12 @@ mdb_modify( Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_batch_abort( mdb, moi );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		} else {
-			rs->sr_err = mdb_txn_commit( txn );
+			rs->sr_err = mdb_batch_commit( mdb, moi );
 			if ( rs->sr_err )
 				mdb->mi_numads = numads;
 			txn = NULL;
@@ -815,7 +815,7 @@ done:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_batch_abort( mdb, moi );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
@@ -59,6 +59,27 @@ int mdb_ad_read( struct mdb_info *mdb, MDB_txn *txn );
 int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad );
 void mdb_ad_unwind( struct mdb_info *mdb, int prev_ads );
 
+/*
+ * batch.c
+ */
+
+int mdb_batch_begin( struct mdb_info *mdb, mdb_op_info *moi );
+int mdb_batch_commit( struct mdb_info *mdb, mdb_op_info *moi );
+void mdb_batch_abort( struct mdb_info *mdb, mdb_op_info *moi );
+
+/*
+ * compress.c
+ */
+
+int mdb_entry_deflate( Operation *op, void *src, size_t len,
+	void *dst, size_t *dlen );
+int mdb_entry_inflate( Operation *op, void *src, size_t slen,
+	void *dst, size_t len );
+int mdb_zdict_read( struct mdb_info *mdb, MDB_txn *txn );
+int mdb_zdict_train( BackendDB *be, MDB_txn *txn );
+int mdb_zdict_setup( BackendDB *be );
+void mdb_zdict_free( struct mdb_info *mdb );
+
 /*
  * config.c
  */
@@ -218,6 +239,9 @@ BI_entry_get_rw mdb_entry_get;
 BI_op_txn mdb_txn;
 
 int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e );
+int mdb_entry_decode_lazy( Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	AttributeName *want, Entry **e );
+int mdb_entry_expand( Operation *op, MDB_txn *txn, Entry *e, AttributeName *want );
 
 void mdb_reader_flush( MDB_env *env );
 int mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **moi );
@@ -240,6 +264,20 @@ int mdb_idl_fetch_key(
 	MDB_cursor	**saved_cursor,
 	int                     get_flag );
 
+int mdb_idl_fetch_cursor(
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*ids );
+
+void mdb_idl_merge( ID **lists, int n, ID *out );
+
+int mdb_idl_count_key(
+	BackendDB	*be,
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*count );
+
 int mdb_idl_insert( ID *ids, ID id );
 
 typedef int (mdb_idl_keyfunc)(
@@ -261,6 +299,14 @@ mdb_idl_union(
 	ID *a,
 	ID *b );
 
+int
+mdb_idl_notin(
+	ID *a,
+	ID *b,
+	ID *ids );
+
+void mdb_idl_flatten( ID *ids );
+
 ID mdb_idl_first( ID *ids, ID *cursor );
 ID mdb_idl_next( ID *ids, ID *cursor );
 
@@ -335,6 +381,24 @@ mdb_key_read(
     MDB_cursor **saved_cursor,
         int get_flags );
 
+extern int
+mdb_keys_read(
+	Operation *op,
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *keys,
+	int ftype,
+	ID *ids,
+	ID *tmp );
+
+extern int
+mdb_key_count(
+	Backend	*be,
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *k,
+	ID *count );
+
 /*
  * nextid.c
  */
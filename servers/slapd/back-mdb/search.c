@@ -122,9 +122,9 @@ static Entry * deref_base (
 }
 
 /* Look for and dereference all aliases within the search scope.
- * Requires "stack" to be able to hold 6 levels of DB_SIZE IDLs.
- * Of course we're hardcoded to require a minimum of 8 UM_SIZE
- * IDLs so this is never a problem.
+ * Requires "stack" to be able to hold 6 levels of UM_SIZE IDLs,
+ * since index reads may return bitmap IDLs. We're hardcoded to
+ * require a minimum of 8 UM_SIZE IDLs so this is never a problem.
  */
 static int search_aliases(
 	Operation *op,
@@ -142,11 +142,11 @@ static int search_aliases(
 	Filter	af;
 
 	aliases = stack;	/* IDL of all aliases in the database */
-	curscop = aliases + MDB_idl_db_size;	/* Aliases in the current scope */
-	visited = curscop + MDB_idl_db_size;	/* IDs we've seen in this search */
-	newsubs = visited + MDB_idl_db_size;	/* New subtrees we've added */
-	oldsubs = newsubs + MDB_idl_db_size;	/* Subtrees added previously */
-	tmp = oldsubs + MDB_idl_db_size;	/* Scratch space for deref_base() */
+	curscop = aliases + MDB_idl_um_size;	/* Aliases in the current scope */
+	visited = curscop + MDB_idl_um_size;	/* IDs we've seen in this search */
+	newsubs = visited + MDB_idl_um_size;	/* New subtrees we've added */
+	oldsubs = newsubs + MDB_idl_um_size;	/* Subtrees added previously */
+	tmp = oldsubs + MDB_idl_um_size;	/* Scratch space for deref_base() */
 
 	af.f_choice = LDAP_FILTER_EQUALITY;
 	af.f_ava = &aa_alias;
@@ -158,6 +158,7 @@ static int search_aliases(
 	MDB_IDL_ZERO( aliases );
 	rs->sr_err = mdb_filter_candidates( op, isc->mt, &af, aliases,
 		curscop, visited );
+	mdb_idl_flatten( aliases );
 	if (rs->sr_err != LDAP_SUCCESS || MDB_IDL_IS_ZERO( aliases )) {
 		return rs->sr_err;
 	}
@@ -416,6 +417,117 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	return rc;
 }
 
+/* Lazy entry decoding: candidates are decoded with only the values
+ * test_filter() can look at, directly or through the ACLs it checks.
+ * Everything else is left for mdb_entry_expand() once the entry matched,
+ * so candidates that fail the filter never pay for their big attributes.
+ */
+static void
+lazy_add( Operation *op, AttributeName **anp, int *nump, AttributeDescription *ad )
+{
+	AttributeName *an = *anp;
+	int i;
+
+	if ( !ad )
+		return;
+	for ( i = 0; i < *nump; i++ ) {
+		if ( an[i].an_desc == ad )
+			return;
+	}
+	an = op->o_tmprealloc( an, ( *nump + 2 ) * sizeof(AttributeName),
+		op->o_tmpmemctx );
+	memset( &an[*nump], 0, 2 * sizeof(AttributeName) );
+	an[*nump].an_name = ad->ad_cname;
+	an[*nump].an_desc = ad;
+	(*nump)++;
+	*anp = an;
+}
+
+static int
+lazy_filter_attrs( Operation *op, Filter *f, AttributeName **anp, int *nump )
+{
+	for ( ; f; f = f->f_next ) {
+		switch ( f->f_choice & SLAPD_FILTER_MASK ) {
+		case SLAPD_FILTER_COMPUTED:
+			break;
+		case LDAP_FILTER_EQUALITY:
+		case LDAP_FILTER_GE:
+		case LDAP_FILTER_LE:
+		case LDAP_FILTER_APPROX:
+			lazy_add( op, anp, nump, f->f_av_desc );
+			break;
+		case LDAP_FILTER_SUBSTRINGS:
+			lazy_add( op, anp, nump, f->f_sub_desc );
+			break;
+		case LDAP_FILTER_PRESENT:
+			lazy_add( op, anp, nump, f->f_desc );
+			break;
+		case LDAP_FILTER_EXT:
+			/* without a type, every attribute is tested */
+			if ( !f->f_mr_desc )
+				return -1;
+			lazy_add( op, anp, nump, f->f_mr_desc );
+			break;
+		case LDAP_FILTER_AND:
+		case LDAP_FILTER_OR:
+		case LDAP_FILTER_NOT:
+			if ( lazy_filter_attrs( op, f->f_list, anp, nump ))
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+lazy_acl_attrs( Operation *op, AccessControl *acl, AttributeName **anp, int *nump )
+{
+	Access *b;
+
+	for ( ; acl; acl = acl->acl_next ) {
+		if ( acl->acl_filter &&
+			lazy_filter_attrs( op, acl->acl_filter, anp, nump ))
+			return -1;
+		for ( b = acl->acl_access; b; b = b->a_next ) {
+			/* sets may look at any attribute of the entry */
+			if ( !BER_BVISEMPTY( &b->a_set_pat ))
+				return -1;
+#ifdef SLAP_DYNACL
+			if ( b->a_dynacl )
+				return -1;
+#endif
+			lazy_add( op, anp, nump, b->a_dn_at );
+			lazy_add( op, anp, nump, b->a_realdn_at );
+			/* the entry may be the group itself */
+			if ( !BER_BVISEMPTY( &b->a_group_pat ))
+				lazy_add( op, anp, nump, b->a_group_at );
+		}
+	}
+	return 0;
+}
+
+/* Returns the attributes to decode up front, or NULL to decode
+ * candidates in full.
+ */
+static AttributeName *
+lazy_attrs( Operation *op )
+{
+	AttributeName *an = NULL;
+	int num = 0;
+
+	if ( lazy_filter_attrs( op, op->ors_filter, &an, &num ) ||
+		lazy_acl_attrs( op, op->o_bd->be_acl, &an, &num ) ||
+		lazy_acl_attrs( op, frontendDB->be_acl, &an, &num )) {
+		op->o_tmpfree( an, op->o_tmpmemctx );
+		return NULL;
+	}
+	if ( !an )
+		an = op->o_tmpcalloc( 1, sizeof(AttributeName), op->o_tmpmemctx );
+	return an;
+}
+
 int
 mdb_search( Operation *op, SlapReply *rs )
 {
@@ -427,7 +539,7 @@ mdb_search( Operation *op, SlapReply *rs )
 	void	*stack;
 	Entry		*e = NULL, *base = NULL;
 	Entry		*matched = NULL;
-	AttributeName	*attrs;
+	AttributeName	*lazy = NULL, *sendattrs = NULL;
 	slap_mask_t	mask;
 	time_t		stoptime;
 	int		manageDSAit;
@@ -442,7 +554,6 @@ mdb_search( Operation *op, SlapReply *rs )
 	MDB_txn			*ltid = NULL;
 
 	Debug( LDAP_DEBUG_TRACE, "=> " LDAP_XSTRING(mdb_search) "\n" );
-	attrs = op->oq_search.rs_attrs;
 
 	manageDSAit = get_manageDSAit( op );
 
@@ -736,6 +847,27 @@ adminlimit:
 		op->o_callback = &cb;
 	}
 
+	lazy = lazy_attrs( op );
+	if ( lazy ) {
+		slap_callback *sc;
+
+		/* Matching entries get the values send_search_entry() will
+		 * look at. Anyone else seeing the entry gets all of them.
+		 */
+		sendattrs = op->ors_attrs;
+		/* internal ops may have no o_controls at all */
+		if ( op->o_valuesreturnfilter && op->o_vrFilter )
+			sendattrs = NULL;
+		for ( sc = op->o_callback; sc; sc = sc->sc_next ) {
+			if ( sc->sc_response )
+				sendattrs = NULL;
+		}
+#ifdef LDAP_SLAPI
+		if ( op->o_pb )
+			sendattrs = NULL;
+#endif
+	}
+
 	if ( get_pagedresults( op ) > SLAP_CONTROL_IGNORED ) {
 		PagedResultsState *ps = op->o_pagedresults_state;
 		/* deferred cookie parsing */
@@ -849,6 +981,10 @@ loop_begin:
 				if ( id >= MDB_IDL_RANGE_FIRST( candidates ) &&
 					id <= MDB_IDL_RANGE_LAST( candidates ))
 					scopeok = 1;
+			} else if (MDB_IDL_IS_BITMAP( candidates )) {
+				ID bid = id;
+				if ( mdb_idl_first( candidates, &bid ) == id )
+					scopeok = 1;
 			} else {
 				i = mdb_idl_search( candidates, id );
 				if (i <= candidates[0] && candidates[i] == id )
@@ -946,7 +1082,7 @@ notfound:
 				goto done;
 			}
 
-			rs->sr_err = mdb_entry_decode( op, ltid, &edata, id, &e );
+			rs->sr_err = mdb_entry_decode_lazy( op, ltid, &edata, id, lazy, &e );
 			if ( rs->sr_err ) {
 				rs->sr_err = LDAP_OTHER;
 				rs->sr_text = "internal error in mdb_entry_decode";
@@ -1060,7 +1196,11 @@ notfound:
 		if ( !manageDSAit && op->oq_search.rs_scope != LDAP_SCOPE_BASE
 			&& is_entry_referral( e ) )
 		{
-			BerVarray erefs = get_entry_referrals( op, e );
+			BerVarray erefs;
+
+			if ( lazy && e != base )
+				mdb_entry_expand( op, ltid, e, NULL );
+			erefs = get_entry_referrals( op, e );
 			rs->sr_ref = referral_rewrite( erefs, &e->e_name, NULL,
 				op->oq_search.rs_scope == LDAP_SCOPE_ONELEVEL
 					? LDAP_SCOPE_BASE : LDAP_SCOPE_SUBTREE );
@@ -1098,6 +1238,18 @@ notfound:
 				lastid = id;
 			}
 
+			if ( lazy && e != base ) {
+				rs->sr_err = mdb_entry_expand( op, ltid, e, sendattrs );
+				if ( rs->sr_err ) {
+					mdb_entry_return( op, e );
+					e = NULL;
+					rs->sr_err = LDAP_OTHER;
+					rs->sr_text = "internal error in mdb_entry_expand";
+					send_ldap_result( op, rs );
+					goto done;
+				}
+			}
+
 			if (e) {
 				/* safe default */
 				rs->sr_attrs = op->oq_search.rs_attrs;
@@ -1214,6 +1366,8 @@ nochange:
 	}
 
 done:
+	if ( lazy )
+		op->o_tmpfree( lazy, op->o_tmpmemctx );
 	if ( cb.sc_private ) {
 		/* remove our writewait callback */
 		slap_callback **scp = &op->o_callback;
@@ -1418,6 +1572,9 @@ static int search_candidates(
 	if ( rc == LDAP_SUCCESS ) {
 		rc = mdb_filter_candidates( op, isc->mt, f, ids,
 			stack, stack+MDB_idl_um_size );
+		/* Bitmaps too large for a list are iterated as they are */
+		if ( MDB_IDL_IS_BITMAP( ids ) && MDB_IDL_N( ids ) <= MDB_idl_um_max )
+			mdb_idl_flatten( ids );
 	}
 
 	if ( depth+1 > mdb->mi_search_stack_depth ) {
@@ -45,6 +45,11 @@ typedef struct mdb_tool_idl_cache {
 #define WAS_FOUND	0x01
 #define WAS_RANGE	0x02
 
+/* Keys with more IDs are stored as a range. With idlbitmap, keys
+ * stay exact up to what a bitmap IDL can hold.
+ */
+#define IDL_TOOL_MAX	( MDB_idl_bitmap ? MDB_idl_bm_max : MDB_idl_db_size )
+
 #define MDB_TOOL_IDL_FLUSH(be, txn)	mdb_tool_idl_flush(be, txn)
 #else
 #define MDB_TOOL_IDL_FLUSH(be, txn)
@@ -88,6 +93,7 @@ static ldap_pvt_thread_cond_t mdb_tool_index_cond_work;
 static void * mdb_tool_index_task( void *ctx, void *ptr );
 
 static int	mdb_writes, mdb_writes_per_commit;
+static int	mdb_tool_ztried;
 
 /* Number of ops per commit in Quick mode.
  * Batching speeds writes overall, but too large a
@@ -251,6 +257,9 @@ int mdb_tool_entry_close(
 		txi = NULL;
 	}
 
+	if ( !(slapMode & SLAP_TOOL_READONLY) )
+		mdb_zdict_setup( be );
+
 	if( nholes ) {
 		unsigned i;
 		fprintf( stderr, "Error, entries missing!\n");
@@ -436,6 +445,10 @@ mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 		}
 	}
 	rc = mdb_entry_decode( &op, mdb_tool_txn, &data, id, &e );
+	if ( rc ) {
+		rc = LDAP_OTHER;
+		goto done;
+	}
 	e->e_id = id;
 	if ( !BER_BVISNULL( &dn )) {
 		e->e_name = dn;
@@ -800,6 +813,13 @@ done:
 					"=> " LDAP_XSTRING(mdb_tool_entry_put) ": %s\n",
 					text->bv_val );
 				e->e_id = NOID;
+			} else if ( mdb->mi_compress && !mdb_tool_ztried &&
+				mdb->mi_nextid > MDB_ZDICT_SAMPLE ) {
+				/* Compress the rest of the load with a dictionary
+				 * trained on its first entries
+				 */
+				mdb_tool_ztried = 1;
+				mdb_zdict_setup( be );
 			}
 		}
 
@@ -836,6 +856,7 @@ int mdb_tool_entry_reindex(
 	Entry *e;
 	Operation op = {0};
 	Opheader ohdr = {0};
+	int recompress;
 
 	Debug( LDAP_DEBUG_ARGS,
 		"=> " LDAP_XSTRING(mdb_tool_entry_reindex) "( %ld )\n",
@@ -850,10 +871,15 @@ int mdb_tool_entry_reindex(
 		return mdb_dn2id_upgrade( be );
 	}
 
+	/* A full reindex also compresses the entries that were
+	 * stored before compression was enabled.
+	 */
+	recompress = !adv && mi->mi_compress && mi->mi_zdict.bv_len;
+
 	/* No indexes configured, nothing to do. Could return an
 	 * error here to shortcut things.
 	 */
-	if (!mi->mi_attrs) {
+	if (!mi->mi_attrs && !recompress) {
 		return 0;
 	}
 
@@ -951,7 +977,12 @@ int mdb_tool_entry_reindex(
 	op.o_tmpmemctx = NULL;
 	op.o_tmpmfuncs = &ch_mfuncs;
 
-	rc = mdb_tool_index_add( &op, txi, e );
+	rc = 0;
+	if ( mi->mi_attrs )
+		rc = mdb_tool_index_add( &op, txi, e );
+	if ( rc == 0 && recompress &&
+		!(*(unsigned int *)data.mv_data & MDB_ENTRY_ZIP) )
+		rc = mdb_id2entry_update( &op, txi, NULL, e );
 
 done:
 	if( rc == 0 ) {
@@ -1310,14 +1341,14 @@ mdb_tool_idl_flush_one( MDB_cursor *mc, AttrIxInfo *ai, mdb_tool_idl_cache *ic )
 	ID id, nid;
 
 	/* Freshly allocated, ignore it */
-	if ( !ic->head && ic->count <= MDB_idl_db_size ) {
+	if ( !ic->head && ic->count <= IDL_TOOL_MAX ) {
 		return 0;
 	}
 
 	key.mv_data = ic->kstr.bv_val;
 	key.mv_size = ic->kstr.bv_len;
 
-	if ( ic->count > MDB_idl_db_size ) {
+	if ( ic->count > IDL_TOOL_MAX ) {
 		while ( ic->flags & WAS_FOUND ) {
 			rc = mdb_cursor_get( mc, &key, data, MDB_SET );
 			if ( rc ) {
@@ -1480,7 +1511,7 @@ int mdb_tool_idl_add(
 			ic->flags |= WAS_FOUND;
 			nid = *(ID *)data.mv_data;
 			if ( nid == 0 ) {
-				ic->count = MDB_idl_db_size+1;
+				ic->count = IDL_TOOL_MAX+1;
 				ic->flags |= WAS_RANGE;
 			} else {
 				size_t count;
@@ -1493,11 +1524,11 @@ int mdb_tool_idl_add(
 		}
 	}
 	/* are we a range already? */
-	if ( ic->count > MDB_idl_db_size ) {
+	if ( ic->count > IDL_TOOL_MAX ) {
 		ic->last = id;
 		continue;
 	/* Are we at the limit, and converting to a range? */
-	} else if ( ic->count == MDB_idl_db_size ) {
+	} else if ( ic->count == IDL_TOOL_MAX ) {
 		if ( ic->head ) {
 			ic->tail->next = ax->ai_flist;
 			ax->ai_flist = ic->head;
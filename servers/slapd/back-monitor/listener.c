@@ -27,6 +27,63 @@
 #include "slap.h"
 #include "back-monitor.h"
 
+static struct berval accepted_bv = BER_BVC( "cn=Accepted" ),
+	accept_rate_bv = BER_BVC( "cn=Accept Rate" );
+
+static int
+monitor_subsys_listener_update(
+	Operation		*op,
+	SlapReply		*rs,
+	Entry                   *e );
+
+/*
+ * Adds a counter below the entry of a listener
+ */
+static int
+monitor_listener_counter(
+	monitor_info_t		*mi,
+	monitor_subsys_t	*ms,
+	Entry			*e_listener,
+	Listener		*l,
+	struct berval		*rdn )
+{
+	Entry		*e;
+	monitor_entry_t	*mp;
+	struct berval	bv = BER_BVC( "0" );
+
+	e = monitor_entry_stub( &e_listener->e_name, &e_listener->e_nname,
+		rdn, mi->mi_oc_monitorCounterObject, NULL, NULL );
+	if ( e == NULL ) {
+		Debug( LDAP_DEBUG_ANY,
+			"monitor_subsys_listener_init: "
+			"unable to create entry \"%s,%s\"\n",
+			rdn->bv_val, e_listener->e_name.bv_val );
+		return( -1 );
+	}
+
+	attr_merge_one( e, mi->mi_ad_monitorCounter, &bv, NULL );
+
+	mp = monitor_entrypriv_create();
+	if ( mp == NULL ) {
+		return -1;
+	}
+	e->e_private = ( void * )mp;
+	mp->mp_info = ms;
+	mp->mp_private = l;
+	mp->mp_flags = ms->mss_flags
+		| MONITOR_F_SUB | MONITOR_F_PERSISTENT;
+
+	if ( monitor_cache_add( mi, e, NULL ) ) {
+		Debug( LDAP_DEBUG_ANY,
+			"monitor_subsys_listener_init: "
+			"unable to add entry \"%s,%s\"\n",
+			rdn->bv_val, e_listener->e_name.bv_val );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
 int
 monitor_subsys_listener_init(
 	BackendDB		*be,
@@ -41,6 +98,8 @@ monitor_subsys_listener_init(
 
 	assert( be != NULL );
 
+	ms->mss_update = monitor_subsys_listener_update;
+
 	if ( ( l = slapd_get_listeners() ) == NULL ) {
 		if ( slapMode & SLAP_TOOL_MODE ) {
 			return 0;
@@ -105,6 +164,13 @@ monitor_subsys_listener_init(
 					&bv, NULL );
 		}
 #endif /* HAVE_TLS */
+		if ( l[ i ]->sl_shard >= 0 ) {
+			struct berval bv;
+
+			BER_BVSTR( &bv, "SO_REUSEPORT" );
+			attr_merge_normalize_one( e, mi->mi_ad_monitoredInfo,
+					&bv, NULL );
+		}
 
 		mp = monitor_entrypriv_create();
 		if ( mp == NULL ) {
@@ -122,6 +188,12 @@ monitor_subsys_listener_init(
 				i, ms->mss_ndn.bv_val );
 			return( -1 );
 		}
+
+		if ( monitor_listener_counter( mi, ms, e, l[ i ], &accepted_bv ) ||
+			monitor_listener_counter( mi, ms, e, l[ i ], &accept_rate_bv ) )
+		{
+			return( -1 );
+		}
 	}
 	
 	monitor_cache_release( mi, e_listener );
@@ -129,3 +201,48 @@ monitor_subsys_listener_init(
 	return( 0 );
 }
 
+static int
+monitor_subsys_listener_update(
+	Operation		*op,
+	SlapReply		*rs,
+	Entry                   *e )
+{
+	monitor_info_t	*mi = ( monitor_info_t * )op->o_bd->be_private;
+	monitor_entry_t	*mp = ( monitor_entry_t * )e->e_private;
+	Listener	*l = ( Listener * )mp->mp_private;
+	unsigned long	n;
+	struct berval	rdn;
+	Attribute	*a;
+	char		buf[LDAP_PVT_INTTYPE_CHARS(unsigned long)];
+	ber_len_t	len;
+
+	assert( mi != NULL );
+
+	if ( l == NULL ) {
+		return SLAP_CB_CONTINUE;
+	}
+
+	dnRdn( &e->e_name, &rdn );
+
+	if ( dn_match( &rdn, &accept_rate_bv ) ) {
+		n = slapd_listener_rate( l );
+	} else {
+		n = l->sl_accepts;
+	}
+
+	a = attr_find( e->e_attrs, mi->mi_ad_monitorCounter );
+	if ( a == NULL ) {
+		return( -1 );
+	}
+
+	snprintf( buf, sizeof( buf ), "%lu", n );
+	len = strlen( buf );
+	if ( len > a->a_vals[ 0 ].bv_len ) {
+		a->a_vals[ 0 ].bv_val = ber_memrealloc( a->a_vals[ 0 ].bv_val, len + 1 );
+	}
+	a->a_vals[ 0 ].bv_len = len;
+	AC_MEMCPY( a->a_vals[ 0 ].bv_val, buf, len + 1 );
+
+	return SLAP_CB_CONTINUE;
+}
+
@@ -169,7 +169,7 @@ monitor_subsys_ops_update(
 	struct berval		rdn;
 	int 			i;
 	Attribute		*a;
-	slap_counters_t *sc;
+	slap_counters_t sc;
 	static struct berval	bv_ops = BER_BVC( "cn=operations" );
 
 	assert( mi != NULL );
@@ -181,31 +181,21 @@ monitor_subsys_ops_update(
 		ldap_pvt_mp_init( nInitiated );
 		ldap_pvt_mp_init( nCompleted );
 
-		ldap_pvt_thread_mutex_lock( &slap_counters.sc_mutex );
-		ldap_pvt_mp_add( nInitiated, slap_counters.sc_ops_initiated );
-		ldap_pvt_mp_add( nCompleted, slap_counters.sc_ops_completed );
-		for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
-			ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
-			ldap_pvt_mp_add( nInitiated, sc->sc_ops_initiated );
-			ldap_pvt_mp_add( nCompleted, sc->sc_ops_completed );
-			ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
-		}
-		ldap_pvt_thread_mutex_unlock( &slap_counters.sc_mutex );
+		slap_counters_sum( &sc );
+		ldap_pvt_mp_add_ulong( nInitiated, sc.sc_ops_initiated );
+		ldap_pvt_mp_add_ulong( nCompleted, sc.sc_ops_completed );
+		slap_counters_destroy( &sc );
 		
 	} else {
 		for ( i = 0; i < SLAP_OP_LAST; i++ ) {
 			if ( dn_match( &rdn, &monitor_op[ i ].nrdn ) )
 			{
-				ldap_pvt_thread_mutex_lock( &slap_counters.sc_mutex );
-				ldap_pvt_mp_init_set( nInitiated, slap_counters.sc_ops_initiated_[ i ] );
-				ldap_pvt_mp_init_set( nCompleted, slap_counters.sc_ops_completed_[ i ] );
-				for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
-					ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
-					ldap_pvt_mp_add( nInitiated, sc->sc_ops_initiated_[ i ] );
-					ldap_pvt_mp_add( nCompleted, sc->sc_ops_completed_[ i ] );
-					ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
-				}
-				ldap_pvt_thread_mutex_unlock( &slap_counters.sc_mutex );
+				slap_counters_sum( &sc );
+				ldap_pvt_mp_init( nInitiated );
+				ldap_pvt_mp_init( nCompleted );
+				ldap_pvt_mp_add_ulong( nInitiated, sc.sc_ops_initiated_[ i ] );
+				ldap_pvt_mp_add_ulong( nCompleted, sc.sc_ops_completed_[ i ] );
+				slap_counters_destroy( &sc );
 				break;
 			}
 		}
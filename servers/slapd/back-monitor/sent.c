@@ -43,6 +43,7 @@ enum {
 	MONITOR_SENT_PDU,
 	MONITOR_SENT_ENTRIES,
 	MONITOR_SENT_REFERRALS,
+	MONITOR_SENT_WRITES,
 
 	MONITOR_SENT_LAST
 };
@@ -55,6 +56,7 @@ struct monitor_sent_t {
 	{ BER_BVC("cn=PDU"),		BER_BVNULL },
 	{ BER_BVC("cn=Entries"),	BER_BVNULL },
 	{ BER_BVC("cn=Referrals"),	BER_BVNULL },
+	{ BER_BVC("cn=Writes"),		BER_BVNULL },
 	{ BER_BVNULL,			BER_BVNULL }
 };
 
@@ -159,7 +161,7 @@ monitor_subsys_sent_update(
 	struct berval		nrdn;
 	ldap_pvt_mp_t		n;
 	Attribute		*a;
-	slap_counters_t *sc;
+	slap_counters_t sc;
 	int			i;
 
 	assert( mi != NULL );
@@ -177,48 +179,33 @@ monitor_subsys_sent_update(
 		return SLAP_CB_CONTINUE;
 	}
 
-	ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
+	slap_counters_sum( &sc );
+	ldap_pvt_mp_init( n );
 	switch ( i ) {
 	case MONITOR_SENT_ENTRIES:
-		ldap_pvt_mp_init_set( n, slap_counters.sc_entries );
-		for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
-			ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
-			ldap_pvt_mp_add( n, sc->sc_entries );
-			ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
-		}
+		ldap_pvt_mp_add_ulong( n, sc.sc_entries );
 		break;
 
 	case MONITOR_SENT_REFERRALS:
-		ldap_pvt_mp_init_set( n, slap_counters.sc_refs );
-		for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
-			ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
-			ldap_pvt_mp_add( n, sc->sc_refs );
-			ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
-		}
+		ldap_pvt_mp_add_ulong( n, sc.sc_refs );
 		break;
 
 	case MONITOR_SENT_PDU:
-		ldap_pvt_mp_init_set( n, slap_counters.sc_pdu );
-		for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
-			ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
-			ldap_pvt_mp_add( n, sc->sc_pdu );
-			ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
-		}
+		ldap_pvt_mp_add_ulong( n, sc.sc_pdu );
+		break;
+
+	case MONITOR_SENT_WRITES:
+		ldap_pvt_mp_add_ulong( n, sc.sc_writes );
 		break;
 
 	case MONITOR_SENT_BYTES:
-		ldap_pvt_mp_init_set( n, slap_counters.sc_bytes );
-		for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next ) {
-			ldap_pvt_thread_mutex_lock( &sc->sc_mutex );
-			ldap_pvt_mp_add( n, sc->sc_bytes );
-			ldap_pvt_thread_mutex_unlock( &sc->sc_mutex );
-		}
+		ldap_pvt_mp_add_ulong( n, sc.sc_bytes );
 		break;
 
 	default:
 		assert(0);
 	}
-	ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
+	slap_counters_destroy( &sc );
 	
 	a = attr_find( e->e_attrs, mi->mi_ad_monitorCounter );
 	assert( a != NULL );
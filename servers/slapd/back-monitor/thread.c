@@ -65,6 +65,12 @@ static struct {
 	{ BER_BVC( "cn=Backload" ),	
 		BER_BVC("Number of active plus pending threads"),
 		BER_BVNULL,	LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD,	MT_UNKNOWN },
+	{ BER_BVC( "cn=Steals" ),
+		BER_BVC("Number of pending tasks taken over from another work queue"),
+		BER_BVNULL,	LDAP_PVT_THREAD_POOL_PARAM_STEALS,	MT_UNKNOWN },
+	{ BER_BVC( "cn=Queue Wait" ),
+		BER_BVC("Recent average time in microseconds tasks stayed pending"),
+		BER_BVNULL,	LDAP_PVT_THREAD_POOL_PARAM_WAIT,	MT_UNKNOWN },
 #if 0	/* not meaningful right now */
 	{ BER_BVC( "cn=Active Max" ),
 		BER_BVNULL,
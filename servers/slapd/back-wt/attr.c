@@ -148,6 +148,19 @@ wt_attr_index_config(
 		}
 	}
 
+	/* the candidate code doesn't know about positional keys */
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_SUBSTR_POS ) ) {
+		if ( c_reply )
+		{
+			snprintf(c_reply->msg, sizeof(c_reply->msg),
+				"index type \"subpos\" not supported" );
+			fprintf( stderr, "%s: line %d: %s\n",
+				fname, lineno, c_reply->msg );
+		}
+		rc = LDAP_PARAM_ERROR;
+		goto done;
+	}
+
 	if( !mask ) {
 		if ( c_reply )
 		{
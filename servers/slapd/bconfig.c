@@ -197,6 +197,7 @@ enum {
 	CFG_IX_HASH64,
 	CFG_DISABLED,
 	CFG_THREADQS,
+	CFG_CPUAFFINITY,
 	CFG_TLS_ECNAME,
 	CFG_TLS_CACERT,
 	CFG_TLS_CERT,
@@ -365,6 +366,10 @@ static ConfigTable config_back_cf_table[] = {
 		&slap_conn_max_pending_auth, "( OLcfgGlAt:12 NAME 'olcConnMaxPendingAuth' "
 			"EQUALITY integerMatch "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "cpuaffinity", "on|off|cpulist", 2, 0, 0, ARG_MAGIC|CFG_CPUAFFINITY,
+		&config_generic, "( OLcfgGlAt:107 NAME 'olcCpuAffinity' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "database", "type", 2, 2, 0, ARG_MAGIC|CFG_DATABASE,
 		&config_generic, "( OLcfgGlAt:13 NAME 'olcDatabase' "
 			"DESC 'The backend type for a database instance' "
@@ -936,6 +941,18 @@ static ConfigTable config_back_cf_table[] = {
 		&config_updateref, "( OLcfgDbAt:0.13 NAME 'olcUpdateRef' "
 			"EQUALITY caseIgnoreMatch "
 			"SUP labeledURI )", NULL, NULL },
+	{ "writebatch", "bytes", 2, 2, 0, ARG_UINT,
+		&global_writebatch, "( OLcfgGlAt:105 NAME 'olcWriteBatch' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL,
+			{ .v_uint = SLAP_WRITEBATCH_DEFAULT }
+	},
+	{ "writebatchtime", "usec", 2, 2, 0, ARG_UINT,
+		&global_writebatchtime, "( OLcfgGlAt:106 NAME 'olcWriteBatchTime' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL,
+			{ .v_uint = SLAP_WRITEBATCHTIME_DEFAULT }
+	},
 	{ "writetimeout", "timeout", 2, 2, 0, ARG_INT,
 		&global_writetimeout, "( OLcfgGlAt:88 NAME 'olcWriteTimeout' "
 			"EQUALITY integerMatch "
@@ -985,7 +1002,7 @@ static ConfigOCs cf_ocs[] = {
 		"MAY ( cn $ olcConfigFile $ olcConfigDir $ olcAllows $ olcArgsFile $ "
 		 "olcAttributeOptions $ olcAuthIDRewrite $ "
 		 "olcAuthzPolicy $ olcAuthzRegexp $ olcConcurrency $ "
-		 "olcConnMaxPending $ olcConnMaxPendingAuth $ "
+		 "olcConnMaxPending $ olcConnMaxPendingAuth $ olcCpuAffinity $ "
 		 "olcDisallows $ olcGentleHUP $ olcIdleTimeout $ "
 		 "olcIndexSubstrIfMaxLen $ olcIndexSubstrIfMinLen $ "
 		 "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexHash64 $ "
@@ -1007,7 +1024,8 @@ static ConfigOCs cf_ocs[] = {
 		 "olcTLSCertificateKeyFile $ olcTLSCipherSuite $ olcTLSCRLCheck $ "
 		 "olcTLSCACertificate $ olcTLSCertificate $ olcTLSCertificateKey $ "
 		 "olcTLSRandFile $ olcTLSVerifyClient $ olcTLSDHParamFile $ olcTLSECName $ "
-		 "olcTLSCRLFile $ olcTLSProtocolMin $ olcToolThreads $ olcWriteTimeout $ "
+		 "olcTLSCRLFile $ olcTLSProtocolMin $ olcToolThreads $ "
+		 "olcWriteBatch $ olcWriteBatchTime $ olcWriteTimeout $ "
 		 "olcObjectIdentifier $ olcAttributeTypes $ olcObjectClasses $ "
 		 "olcDitContentRules $ olcLdapSyntaxes ) )", Cft_Global },
 	{ "( OLcfgGlOc:2 "
@@ -1133,6 +1151,14 @@ config_generic(ConfigArgs *c) {
 		case CFG_THREADQS:
 			c->value_int = connection_pool_queues;
 			break;
+		case CFG_CPUAFFINITY:
+			if ( !connection_pool_cpus )
+				rc = 1;
+			else if ( !connection_pool_cpus[0] )
+				c->value_string = ch_strdup( "on" );
+			else
+				c->value_string = ldap_charray2str( connection_pool_cpus, " " );
+			break;
 		case CFG_TTHREADS:
 			c->value_int = slap_tool_thread_max;
 			break;
@@ -1491,6 +1517,17 @@ config_generic(ConfigArgs *c) {
 			connection_pool_queues = 1;	/* save for reference */
 			break;
 
+		case CFG_CPUAFFINITY:
+			if ( slapMode & SLAP_SERVER_MODE ) {
+				ldap_pvt_thread_pool_affinity(&connection_pool, NULL);
+				slapd_daemon_rebind();
+			}
+			if ( connection_pool_cpus ) {
+				ldap_charray_free( connection_pool_cpus );
+				connection_pool_cpus = NULL;
+			}
+			break;
+
 		case CFG_TTHREADS:
 			slap_tool_thread_max = 1;
 			break;
@@ -1951,6 +1988,36 @@ config_generic(ConfigArgs *c) {
 			connection_pool_queues = c->value_int;	/* save for reference */
 			break;
 
+		case CFG_CPUAFFINITY: {
+			char **cpus = NULL;
+
+			if ( c->argc == 2 && !strcasecmp( c->argv[1], "on" )) {
+				cpus = ch_calloc( 1, sizeof( char * ));
+			} else if ( c->argc > 2 || strcasecmp( c->argv[1], "off" )) {
+				for ( i = 1; i < c->argc; i++ )
+					ldap_charray_add( &cpus, c->argv[i] );
+			}
+			if ( cpus && ( slapMode & SLAP_SERVER_MODE ) &&
+				ldap_pvt_thread_pool_affinity( &connection_pool, cpus ))
+			{
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"<%s> invalid CPU list, or binding threads to CPUs "
+					"is not supported on this platform", c->argv[0] );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg );
+				ldap_charray_free( cpus );
+				return 1;
+			}
+			if ( !cpus && ( slapMode & SLAP_SERVER_MODE ))
+				ldap_pvt_thread_pool_affinity( &connection_pool, NULL );
+			if ( connection_pool_cpus )
+				ldap_charray_free( connection_pool_cpus );
+			connection_pool_cpus = cpus;
+			if ( slapMode & SLAP_SERVER_MODE )
+				slapd_daemon_rebind();
+			}
+			break;
+
 		case CFG_TTHREADS:
 			if ( slapMode & SLAP_TOOL_MODE )
 				ldap_pvt_thread_pool_maxthreads(&connection_pool, c->value_int);
@@ -69,6 +69,8 @@ slap_mask_t		global_disallows = 0;
 int		global_gentlehup = 0;
 int		global_idletimeout = 0;
 int		global_writetimeout = 0;
+unsigned int	global_writebatch = SLAP_WRITEBATCH_DEFAULT;
+unsigned int	global_writebatchtime = SLAP_WRITEBATCHTIME_DEFAULT;
 char	*global_host = NULL;
 struct berval global_host_bv = BER_BVNULL;
 char	*global_realm = NULL;
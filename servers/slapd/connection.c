@@ -54,6 +54,13 @@ static unsigned long conn_nextid = SLAPD_SYNC_SYNCCONN_OFFSET;
 
 static const char conn_lost_str[] = "connection lost";
 
+/* cheap requests pipelined on one connection run inline, this many
+ * at a time, instead of one pool task each
+ */
+#ifndef SLAPD_CONN_BATCH
+#define SLAPD_CONN_BATCH	16
+#endif /* ! SLAPD_CONN_BATCH */
+
 const char *
 connection_state2str( int state )
 {
@@ -77,6 +84,8 @@ typedef struct conn_readinfo {
 	void *arg;
 	void *ctx;
 	int nullop;
+	int nbatch;
+	Operation *batch[SLAPD_CONN_BATCH];
 } conn_readinfo;
 
 static int connection_input( Connection *c, conn_readinfo *cri );
@@ -378,6 +387,7 @@ Connection * connection_init(
 		}
 
 		c->c_currentber = NULL;
+		c->c_wbatch = NULL;
 
 #ifdef LDAP_SLAPI
 		if ( slapi_plugins_used ) {
@@ -405,6 +415,7 @@ Connection * connection_init(
 	assert( c->c_sasl_bindop == NULL );
 	assert( c->c_sasl_cbind == NULL );
 	assert( c->c_currentber == NULL );
+	assert( c->c_wbatch == NULL );
 	assert( c->c_writewaiter == 0);
 	assert( c->c_writers == 0);
 
@@ -476,6 +487,19 @@ Connection * connection_init(
 			LBER_SBIOD_LEVEL_PROVIDER, (void *)&sfd );
 	}
 
+#ifdef LDAP_CONNECTIONLESS
+	if ( !c->c_is_udp )
+#endif
+	{
+		/* Let most PDUs arrive in a single read, without
+		 * holding a buffer for idle connections */
+		ber_len_t max = SLAP_SB_MAX_READAHEAD;
+
+		ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_readahead,
+			LBER_SBIOD_LEVEL_PROVIDER, NULL );
+		ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_SET_READAHEAD_MAX, &max );
+	}
+
 #ifdef LDAP_DEBUG
 	ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_debug,
 		INT_MAX, (void*)"ldap_" );
@@ -635,6 +659,11 @@ connection_destroy( Connection *c )
 		c->c_currentber = NULL;
 	}
 
+	if ( c->c_wbatch != NULL ) {
+		slap_send_batch_drop( c );
+		ber_free( c->c_wbatch, 1 );
+		c->c_wbatch = NULL;
+	}
 
 #ifdef LDAP_SLAPI
 	/* call destructors, then constructors; avoids unnecessary allocation */
@@ -900,19 +929,12 @@ void connection_done( Connection *c )
  * calls the appropriate stub to handle it.
  */
 
-/* FIXME: returns 0 in case of failure */
 #define INCR_OP_INITIATED(index) \
-	do { \
-		ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex ); \
-		ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_initiated_[(index)], 1); \
-		ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex ); \
-	} while (0)
+	SLAP_COUNTER_ADD( op->o_counters, sc_ops_initiated_[(index)], 1 )
 #define INCR_OP_COMPLETED(index) \
 	do { \
-		ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex ); \
-		ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_completed, 1); \
-		ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_completed_[(index)], 1); \
-		ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex ); \
+		SLAP_COUNTER_ADD( op->o_counters, sc_ops_completed, 1 ); \
+		SLAP_COUNTER_ADD( op->o_counters, sc_ops_completed_[(index)], 1 ); \
 	} while (0)
 
 /*
@@ -939,30 +961,19 @@ conn_counter_destroy( void *key, void *data )
 {
 	slap_counters_t **prev, *sc;
 
-	ldap_pvt_thread_mutex_lock( &slap_counters.sc_mutex );
+	ldap_pvt_thread_mutex_lock( &slap_counters_mutex );
 	for ( prev = &slap_counters.sc_next, sc = slap_counters.sc_next; sc;
 		prev = &sc->sc_next, sc = sc->sc_next ) {
 		if ( sc == data ) {
-			int i;
-
 			*prev = sc->sc_next;
 			/* Copy data to main counter */
-			ldap_pvt_mp_add( slap_counters.sc_bytes, sc->sc_bytes );
-			ldap_pvt_mp_add( slap_counters.sc_pdu, sc->sc_pdu );
-			ldap_pvt_mp_add( slap_counters.sc_entries, sc->sc_entries );
-			ldap_pvt_mp_add( slap_counters.sc_refs, sc->sc_refs );
-			ldap_pvt_mp_add( slap_counters.sc_ops_initiated, sc->sc_ops_initiated );
-			ldap_pvt_mp_add( slap_counters.sc_ops_completed, sc->sc_ops_completed );
-			for ( i = 0; i < SLAP_OP_LAST; i++ ) {
-				ldap_pvt_mp_add( slap_counters.sc_ops_initiated_[ i ], sc->sc_ops_initiated_[ i ] );
-				ldap_pvt_mp_add( slap_counters.sc_ops_initiated_[ i ], sc->sc_ops_completed_[ i ] );
-			}
+			slap_counters_add( &slap_counters, sc );
 			slap_counters_destroy( sc );
 			ber_memfree_x( data, NULL );
 			break;
 		}
 	}
-	ldap_pvt_thread_mutex_unlock( &slap_counters.sc_mutex );
+	ldap_pvt_thread_mutex_unlock( &slap_counters_mutex );
 }
 
 void
@@ -979,10 +990,10 @@ operation_counter_init( Operation *op, void *ctx )
 		ldap_pvt_thread_pool_setkey( ctx, (void*)operation_counter_init, vsc,
 			conn_counter_destroy, NULL, NULL );
 
-		ldap_pvt_thread_mutex_lock( &slap_counters.sc_mutex );
+		ldap_pvt_thread_mutex_lock( &slap_counters_mutex );
 		sc->sc_next = slap_counters.sc_next;
 		slap_counters.sc_next = sc;
-		ldap_pvt_thread_mutex_unlock( &slap_counters.sc_mutex );
+		ldap_pvt_thread_mutex_unlock( &slap_counters_mutex );
 	}
 	op->o_counters = vsc;
 }
@@ -1035,10 +1046,7 @@ connection_operation( void *ctx, void *arg_v )
 	}
 	op->o_qtime.tv_sec -= op->o_time;
 	operation_counter_init( op, ctx );
-	ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
-	/* FIXME: returns 0 in case of failure */
-	ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_initiated, 1);
-	ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+	SLAP_COUNTER_ADD( op->o_counters, sc_ops_initiated, 1 );
 
 	op->o_threadctx = ctx;
 	op->o_tid = ldap_pvt_thread_pool_tid( ctx );
@@ -1248,8 +1256,8 @@ static int connection_read( ber_socket_t s, conn_readinfo *cri );
 
 static void* connection_read_thread( void* ctx, void* argv )
 {
-	int rc ;
-	conn_readinfo cri = { NULL, NULL, NULL, NULL, 0 };
+	int rc, i;
+	conn_readinfo cri = { NULL, NULL, NULL, NULL, 0, 0 };
 	ber_socket_t s = (long)argv;
 
 	/*
@@ -1269,6 +1277,11 @@ static void* connection_read_thread( void* ctx, void* argv )
 		rc = (long)cri.func( ctx, cri.arg );
 	}
 
+	/* followed by any cheap requests pipelined behind it */
+	for ( i = 0; i < cri.nbatch; i++ ) {
+		rc = (long)connection_operation( ctx, cri.batch[i] );
+	}
+
 	return (void*)(long)rc;
 }
 
@@ -1285,8 +1298,9 @@ int connection_read_activate( ber_socket_t s )
 	if ( rc )
 		return rc;
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		connection_read_thread, (void *)(long)s );
+	rc = ldap_pvt_thread_pool_submit_q( &connection_pool,
+		connection_read_thread, (void *)(long)s, NULL,
+		slapd_daemon_queue( s ) );
 
 	if( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -1466,6 +1480,34 @@ connection_read( ber_socket_t s, conn_readinfo *cri )
 	return 0;
 }
 
+/* Base-scope searches and compares are cheap enough to run back to
+ * back on the thread that read them.
+ */
+static int
+connection_op_batchable( Operation *op )
+{
+	BerElementBuffer berbuf;
+	BerElement *ber = (BerElement *)&berbuf;
+	struct berval bv;
+	ber_int_t scope;
+
+	switch ( op->o_tag ) {
+	case LDAP_REQ_COMPARE:
+		return 1;
+
+	case LDAP_REQ_SEARCH:
+		/* peek at the scope without disturbing o_ber */
+		if ( ber_peek_element( op->o_ber, &bv ) == LBER_ERROR )
+			return 0;
+		ber_init2( ber, &bv, 0 );
+		if ( ber_scanf( ber, "xe", &scope ) == LBER_ERROR )
+			return 0;
+		return scope == LDAP_SCOPE_BASE;
+	}
+
+	return 0;
+}
+
 static int
 connection_input( Connection *conn , conn_readinfo *cri )
 {
@@ -1697,7 +1739,8 @@ connection_input( Connection *conn , conn_readinfo *cri )
 
 		/*
 		 * The first op will be processed in the same thread context,
-		 * as long as there is only one op total.
+		 * as long as there is only one op total, or it and the ops
+		 * following it are all cheap enough to batch.
 		 * Subsequent ops will be submitted to the pool by
 		 * calling connection_op_activate()
 		 */
@@ -1705,11 +1748,18 @@ connection_input( Connection *conn , conn_readinfo *cri )
 			/* the first incoming request */
 			connection_op_queue( op );
 			cri->op = op;
+		} else if ( !cri->nullop && cri->nbatch < SLAPD_CONN_BATCH &&
+			connection_op_batchable( cri->op ) &&
+			connection_op_batchable( op ))
+		{
+			connection_op_queue( op );
+			cri->batch[cri->nbatch++] = op;
 		} else {
 			if ( !cri->nullop ) {
 				cri->nullop = 1;
-				rc = ldap_pvt_thread_pool_submit( &connection_pool,
-					connection_operation, (void *) cri->op );
+				rc = ldap_pvt_thread_pool_submit_q( &connection_pool,
+					connection_operation, (void *) cri->op, NULL,
+					slapd_daemon_queue( conn->c_sd ) );
 			}
 			connection_op_activate( op );
 		}
@@ -1891,8 +1941,9 @@ static int connection_op_activate( Operation *op )
 
 	connection_op_queue( op );
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		connection_operation, (void *) op );
+	rc = ldap_pvt_thread_pool_submit_q( &connection_pool,
+		connection_operation, (void *) op, NULL,
+		slapd_daemon_queue( op->o_conn->c_sd ) );
 
 	if ( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
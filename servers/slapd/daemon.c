@@ -92,6 +92,9 @@ struct runqueue_s slapd_rq = {
 int slapd_daemon_threads = 1;
 int slapd_daemon_mask;
 
+/* bumped when the CPU binding of the pool queues changes */
+static volatile int slapd_cpugen;
+
 #ifdef LDAP_TCP_BUFFER
 int slapd_tcp_rmem;
 int slapd_tcp_wmem;
@@ -106,6 +109,18 @@ static volatile sig_atomic_t listening = 1; /* 0 when slap_listeners closed */
 
 #define	DAEMON_ID(fd)	(fd & slapd_daemon_mask)
 
+/* SO_REUSEPORT sockets are spread over the listener threads by index */
+#define	LISTENER_ID(sl)	((sl)->sl_shard >= 0 ? \
+	(sl)->sl_shard & slapd_daemon_mask : DAEMON_ID((sl)->sl_sd))
+
+#ifdef SO_REUSEPORT
+# define SLAPD_REUSEPORT_URLEXT	"x-reuseport"
+#endif /* SO_REUSEPORT */
+
+#ifndef SLAPD_ACCEPT_BATCH
+#define SLAPD_ACCEPT_BATCH 64
+#endif /* ! SLAPD_ACCEPT_BATCH */
+
 typedef ber_socket_t sdpair[2];
 
 static sdpair *wake_sds;
@@ -1133,17 +1148,17 @@ slapd_add( ber_socket_t s, int isactive, Listener *sl, int id )
 /*
  * Remove the descriptor from daemon control
  */
-void
-slapd_remove(
+static void
+slapd_remove_id(
 	ber_socket_t s,
 	Sockbuf *sb,
 	int wasactive,
 	int wake,
-	int locked )
+	int locked,
+	int id )
 {
 	int waswriter;
 	int wasreader;
-	int id = DAEMON_ID(s);
 
 	if ( !locked )
 		ldap_pvt_thread_mutex_lock( &slap_daemon[id].sd_mutex );
@@ -1183,8 +1198,8 @@ slapd_remove(
 			if ( lr->sl_mute ) {
 				lr->sl_mute = 0;
 				emfile--;
-				if ( DAEMON_ID(lr->sl_sd) != id )
-					WAKE_LISTENER(DAEMON_ID(lr->sl_sd), wake);
+				if ( LISTENER_ID(lr) != id )
+					WAKE_LISTENER(LISTENER_ID(lr), wake);
 				break;
 			}
 		}
@@ -1198,6 +1213,17 @@ slapd_remove(
 	WAKE_LISTENER(id, wake || slapd_gentle_shutdown == 2);
 }
 
+void
+slapd_remove(
+	ber_socket_t s,
+	Sockbuf *sb,
+	int wasactive,
+	int wake,
+	int locked )
+{
+	slapd_remove_id( s, sb, wasactive, wake, locked, DAEMON_ID(s) );
+}
+
 void
 slapd_clr_write( ber_socket_t s, int wake )
 {
@@ -1302,7 +1328,7 @@ get_url_perms(
 	mode_t	*perms,
 	int	*crit )
 {
-	int	i;
+	int	i, skipped = 0;
 
 	assert( exts != NULL );
 	assert( perms != NULL );
@@ -1318,6 +1344,16 @@ get_url_perms(
 			type++;
 		}
 
+#ifdef SLAPD_REUSEPORT_URLEXT
+		/* handled by get_url_shards() */
+		if ( strncasecmp( type, SLAPD_REUSEPORT_URLEXT,
+			STRLENOF(SLAPD_REUSEPORT_URLEXT) ) == 0 )
+		{
+			skipped++;
+			continue;
+		}
+#endif /* SLAPD_REUSEPORT_URLEXT */
+
 		if ( strncasecmp( type, LDAPI_MOD_URLEXT "=",
 			sizeof(LDAPI_MOD_URLEXT "=") - 1 ) == 0 )
 		{
@@ -1372,10 +1408,61 @@ get_url_perms(
 		}
 	}
 
+	if ( skipped == i ) {
+		*perms = S_IRWXU | S_IRWXO;
+		return LDAP_SUCCESS;
+	}
+
 	return LDAP_OTHER;
 }
 #endif /* LDAP_PF_LOCAL || SLAP_X_LISTENER_MOD */
 
+#ifdef SLAPD_REUSEPORT_URLEXT
+/* Number of SO_REUSEPORT sockets to open as requested by
+ * x-reuseport[=<n>], one per online CPU if <n> is omitted.
+ * Returns 0 without the extension, -1 if <n> is invalid.
+ */
+static int
+get_url_shards(
+	char	**exts )
+{
+	int	i, n;
+
+	for ( i = 0; exts[ i ]; i++ ) {
+		char	*type = exts[ i ];
+
+		if ( type[ 0 ] == '!' ) {
+			type++;
+		}
+
+		if ( strncasecmp( type, SLAPD_REUSEPORT_URLEXT,
+			STRLENOF(SLAPD_REUSEPORT_URLEXT) ) != 0 )
+		{
+			continue;
+		}
+
+		type += STRLENOF(SLAPD_REUSEPORT_URLEXT);
+		if ( *type == '\0' ) {
+#ifdef _SC_NPROCESSORS_ONLN
+			n = sysconf( _SC_NPROCESSORS_ONLN );
+			return n > 0 ? n : 1;
+#else
+			return 1;
+#endif
+		}
+
+		if ( *type++ != '=' || lutil_atoi( &n, type ) != 0 ||
+			n < 1 || n > 1024 )
+		{
+			return -1;
+		}
+		return n;
+	}
+
+	return 0;
+}
+#endif /* SLAPD_REUSEPORT_URLEXT */
+
 /* port = 0 indicates AF_LOCAL */
 static int
 slap_get_listener_addresses(
@@ -1513,6 +1600,7 @@ slap_open_listener(
 	int *cur )
 {
 	int	num, proto, tmp, rc;
+	int	nshards = 0, shard = 0;
 	Listener l;
 	Listener *li;
 	LDAPURLDesc *lud;
@@ -1542,6 +1630,11 @@ slap_open_listener(
 	l.sl_url.bv_val = NULL;
 	l.sl_mute = 0;
 	l.sl_busy = 0;
+	l.sl_shard = -1;
+	l.sl_accepts = 0;
+	l.sl_rate = 0;
+	l.sl_rate_cnt = 0;
+	l.sl_rate_time = 0;
 
 #ifndef HAVE_TLS
 	if( ldap_pvt_url_scheme2tls( lud->lud_scheme ) ) {
@@ -1601,6 +1694,24 @@ slap_open_listener(
 	}
 #endif /* LDAP_PF_LOCAL || SLAP_X_LISTENER_MOD */
 
+#ifdef SLAPD_REUSEPORT_URLEXT
+	if ( lud->lud_exts ) {
+		nshards = get_url_shards( lud->lud_exts );
+		if ( nshards < 0 || ( nshards && ( proto == LDAP_PROTO_IPC
+#ifdef LDAP_CONNECTIONLESS
+			|| l.sl_is_udp
+#endif /* LDAP_CONNECTIONLESS */
+			)))
+		{
+			Debug( LDAP_DEBUG_ANY, "daemon: listener URL %s: "
+				"invalid " SLAPD_REUSEPORT_URLEXT " extension\n", url );
+			ldap_free_urldesc( lud );
+			slap_free_listener_addresses( sal );
+			return -1;
+		}
+	}
+#endif /* SLAPD_REUSEPORT_URLEXT */
+
 	if ( lud->lud_dn && lud->lud_dn[0] ) {
 		sprintf( (char *)url, "%s://%s/", lud->lud_scheme, lud->lud_host );
 		Debug( LDAP_DEBUG_ANY, "daemon: listener URL %s<junk> DN must be absent (%s)\n",
@@ -1615,10 +1726,12 @@ slap_open_listener(
 		return -1;
 	}
 
-	/* If we got more than one address returned, we need to make space
-	 * for it in the slap_listeners array.
+	/* If we got more than one address returned, or open several
+	 * SO_REUSEPORT sockets per address, we need to make space
+	 * for them in the slap_listeners array.
 	 */
 	for ( num=0; sal[num]; num++ ) /* empty */;
+	if ( nshards > 1 ) num *= nshards;
 	if ( num > 1 ) {
 		*listeners += num-1;
 		slap_listeners = ch_realloc( slap_listeners,
@@ -1657,6 +1770,7 @@ slap_open_listener(
 			Debug( LDAP_DEBUG_ANY,
 				"daemon: %s socket() failed errno=%d (%s)\n",
 				af, err, sock_errstr(err, ebuf, sizeof(ebuf)) );
+			shard = 0;
 			sal++;
 			continue;
 		}
@@ -1667,6 +1781,7 @@ slap_open_listener(
 				"daemon: listener descriptor %ld is too great %ld\n",
 				(long) l.sl_sd, (long) dtblsize );
 			tcp_close( s );
+			shard = 0;
 			sal++;
 			continue;
 		}
@@ -1689,6 +1804,24 @@ slap_open_listener(
 					(long) l.sl_sd, err, sock_errstr(err, ebuf, sizeof(ebuf)) );
 			}
 #endif /* SO_REUSEADDR */
+#ifdef SLAPD_REUSEPORT_URLEXT
+			/* let each listener thread accept on a socket of its own */
+			if ( nshards ) {
+				tmp = 1;
+				rc = setsockopt( s, SOL_SOCKET, SO_REUSEPORT,
+					(char *) &tmp, sizeof(tmp) );
+				if ( rc == AC_SOCKET_ERROR ) {
+					int err = sock_errno();
+					Debug( LDAP_DEBUG_ANY, "slapd(%ld): "
+						"setsockopt(SO_REUSEPORT) failed errno=%d (%s)\n",
+						(long) l.sl_sd, err, sock_errstr(err, ebuf, sizeof(ebuf)) );
+					tcp_close( s );
+					shard = 0;
+					sal++;
+					continue;
+				}
+			}
+#endif /* SLAPD_REUSEPORT_URLEXT */
 		}
 
 		switch( (*sal)->sa_family ) {
@@ -1755,6 +1888,7 @@ slap_open_listener(
 				"daemon: bind(%ld) failed errno=%d (%s)\n",
 				(long)l.sl_sd, err, sock_errstr( err, ebuf, sizeof(ebuf) ) );
 			tcp_close( s );
+			shard = 0;
 			sal++;
 			continue;
 		}
@@ -1822,10 +1956,14 @@ slap_open_listener(
 
 		AC_MEMCPY(&l.sl_sa, *sal, addrlen);
 		ber_str2bv( url, 0, 1, &l.sl_url);
+		l.sl_shard = nshards ? shard : -1;
 		li = ch_malloc( sizeof( Listener ) );
 		*li = l;
 		slap_listeners[*cur] = li;
 		(*cur)++;
+		/* the next SO_REUSEPORT socket binds the same address */
+		if ( ++shard < nshards ) continue;
+		shard = 0;
 		sal++;
 	}
 
@@ -1973,10 +2111,6 @@ slapd_socket_realloc( int newnum )
 		}
 		if ( skip ) continue;
 
-		oldid = DAEMON_ID(i);
-		newid = i & newmask;
-		if ( oldid == newid ) continue;
-		if ( !SLAP_SOCK_IS_ACTIVE( oldid, i )) continue;
 		sl = NULL;
 		if ( num_listeners ) {
 			for ( j=0; slap_listeners[j] != NULL; j++ ) {
@@ -1987,6 +2121,15 @@ slapd_socket_realloc( int newnum )
 				}
 			}
 		}
+		if ( sl && sl->sl_shard >= 0 ) {
+			oldid = LISTENER_ID(sl);
+			newid = sl->sl_shard & newmask;
+		} else {
+			oldid = DAEMON_ID(i);
+			newid = i & newmask;
+		}
+		if ( oldid == newid ) continue;
+		if ( !SLAP_SOCK_IS_ACTIVE( oldid, i )) continue;
 		SLAP_SOCK_ADD( newid, i, sl );
 		if ( SLAP_SOCK_IS_READ( oldid, i )) {
 			SLAP_SOCK_SET_READ( newid, i );
@@ -2059,8 +2202,9 @@ close_listeners(
 
 		if ( lr->sl_sd != AC_SOCKET_INVALID ) {
 			int s = lr->sl_sd;
+			int id = LISTENER_ID( lr );
 			lr->sl_sd = AC_SOCKET_INVALID;
-			if ( remove ) slapd_remove( s, NULL, 0, 0, 0 );
+			if ( remove ) slapd_remove_id( s, NULL, 0, 0, 0, id );
 
 #ifdef LDAP_PF_LOCAL
 			if ( lr->sl_sa.sa_addr.sa_family == AF_LOCAL ) {
@@ -2097,6 +2241,38 @@ destroy_listeners( void )
 	slap_listeners = NULL;
 }
 
+/* Update the accept statistics of sl, only called by the one thread
+ * accepting on it at a time.
+ */
+static void
+slap_listener_count(
+	Listener *sl )
+{
+	time_t now = slap_get_time();
+
+	sl->sl_accepts++;
+	if ( now != sl->sl_rate_time ) {
+		sl->sl_rate = now == sl->sl_rate_time + 1 ? sl->sl_rate_cnt : 0;
+		sl->sl_rate_cnt = 0;
+		sl->sl_rate_time = now;
+	}
+	sl->sl_rate_cnt++;
+}
+
+/* Connections accepted on sl during the last full second */
+unsigned long
+slapd_listener_rate(
+	Listener *sl )
+{
+	time_t now = slap_get_time();
+
+	if ( now == sl->sl_rate_time )
+		return sl->sl_rate;
+	if ( now == sl->sl_rate_time + 1 )
+		return sl->sl_rate_cnt;
+	return 0;
+}
+
 static int
 slap_listener(
 	Listener *sl )
@@ -2142,19 +2318,30 @@ slap_listener(
 	s = accept( SLAP_FD2SOCK( sl->sl_sd ), (struct sockaddr *) &from, &len );
 	if ( s != AC_SOCKET_INVALID ) {
 		SET_CLOSE(s);
+		slap_listener_count( sl );
 	}
 	Debug( LDAP_DEBUG_CONNS,
 		"daemon: accept() = %d\n", s );
 
 	/* Resume the listener FD to allow concurrent-processing of
-	 * additional incoming connections.
+	 * additional incoming connections. SO_REUSEPORT sockets are
+	 * resumed once their whole batch was accepted.
 	 */
-	sl->sl_busy = 0;
-	WAKE_LISTENER(DAEMON_ID(sl->sl_sd),1);
+	if ( sl->sl_shard < 0 ) {
+		sl->sl_busy = 0;
+		WAKE_LISTENER(DAEMON_ID(sl->sl_sd),1);
+	}
 
 	if ( s == AC_SOCKET_INVALID ) {
 		int err = sock_errno();
 
+		/* the backlog of a SO_REUSEPORT socket was drained */
+		if ( sl->sl_shard >= 0 &&
+			( err == EWOULDBLOCK || err == EAGAIN ))
+		{
+			return -1;
+		}
+
 		if(
 #ifdef EMFILE
 		    err == EMFILE ||
@@ -2175,7 +2362,7 @@ slap_listener(
 			"daemon: accept(%ld) failed errno=%d (%s)\n",
 			(long) sl->sl_sd, err, sock_errstr(err, ebuf, sizeof(ebuf)) );
 		ldap_pvt_thread_yield();
-		return 0;
+		return -1;
 	}
 	sfd = SLAP_SOCKNEW( s );
 
@@ -2379,6 +2566,21 @@ slap_listener(
 	return 0;
 }
 
+/* Accept connections on a SO_REUSEPORT socket until its backlog
+ * is empty, or SLAPD_ACCEPT_BATCH were accepted.
+ */
+static void
+slap_listener_batch(
+	Listener *sl )
+{
+	int n;
+
+	for ( n = 0; n < SLAPD_ACCEPT_BATCH; n++ ) {
+		if ( slap_listener( sl ) < 0 )
+			break;
+	}
+}
+
 static void*
 slap_listener_thread(
 	void* ctx,
@@ -2387,9 +2589,16 @@ slap_listener_thread(
 	int		rc;
 	Listener	*sl = (Listener *)ptr;
 
+	if ( sl->sl_shard >= 0 ) {
+		slap_listener_batch( sl );
+		sl->sl_busy = 0;
+		WAKE_LISTENER(LISTENER_ID(sl),1);
+		return (void*)NULL;
+	}
+
 	rc = slap_listener( sl );
 
-	if( rc != LDAP_SUCCESS ) {
+	if( rc > 0 ) {
 		Debug( LDAP_DEBUG_ANY,
 			"slap_listener_thread(%s): failed err=%d",
 			sl->sl_url.bv_val, rc );
@@ -2398,6 +2607,27 @@ slap_listener_thread(
 	return (void*)NULL;
 }
 
+/* Whether the listener thread can accept on sl by itself. Reverse
+ * lookups, TCP wrappers and PROXY headers may block, so connections
+ * needing them are set up by the thread pool instead.
+ */
+static int
+slap_listener_inline(
+	Listener *sl )
+{
+	if ( sl->sl_shard < 0 || sl->sl_is_proxied )
+		return 0;
+#ifdef HAVE_TCPD
+	return 0;
+#else /* ! HAVE_TCPD */
+#ifdef SLAPD_RLOOKUPS
+	if ( use_reverse_lookup )
+		return 0;
+#endif /* SLAPD_RLOOKUPS */
+	return 1;
+#endif /* ! HAVE_TCPD */
+}
+
 static int
 slap_listener_activate(
 	Listener* sl )
@@ -2407,10 +2637,16 @@ slap_listener_activate(
 	Debug( LDAP_DEBUG_TRACE, "slap_listener_activate(%d): %s\n",
 		sl->sl_sd, sl->sl_busy ? "busy" : "" );
 
+	if ( slap_listener_inline( sl )) {
+		slap_listener_batch( sl );
+		return 0;
+	}
+
 	sl->sl_busy = 1;
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		slap_listener_thread, (void *) sl );
+	rc = ldap_pvt_thread_pool_submit_q( &connection_pool,
+		slap_listener_thread, (void *) sl, NULL,
+		sl->sl_shard >= 0 && connection_pool_cpus ? LISTENER_ID( sl ) : -1 );
 
 	if( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -2440,6 +2676,7 @@ slapd_daemon_task(
 	time_t last_idle_check = 0;
 	int ebadf = 0;
 	int tid = (slap_daemon_st *) ptr - slap_daemon;
+	int cpugen = 0;
 	char ebuf[128];
 
 #define SLAPD_IDLE_CHECK_LIMIT 4
@@ -2643,7 +2880,8 @@ slapd_daemon_task(
 			return (void*)-1;
 		}
 
-		slapd_add( slap_listeners[l]->sl_sd, 0, slap_listeners[l], -1 );
+		slapd_add( slap_listeners[l]->sl_sd, 0, slap_listeners[l],
+			LISTENER_ID( slap_listeners[l] ));
 	}
 
 	ldap_pvt_thread_mutex_lock( &slapd_init_mutex );
@@ -2684,6 +2922,12 @@ loop:
 
 		now = slap_get_time();
 
+		if ( cpugen != slapd_cpugen ) {
+			/* share the CPUs of the queue our connections use */
+			cpugen = slapd_cpugen;
+			ldap_pvt_thread_pool_bind( &connection_pool, tid );
+		}
+
 		if ( !tid && ( global_idletimeout > 0 )) {
 			int check = 0;
 			/* Set the select timeout.
@@ -2753,7 +2997,7 @@ loop:
 			Listener *lr = slap_listeners[l];
 
 			if ( lr->sl_sd == AC_SOCKET_INVALID ) continue;
-			if ( DAEMON_ID( lr->sl_sd ) != tid ) continue;
+			if ( LISTENER_ID( lr ) != tid ) continue;
 			if ( !SLAP_SOCK_IS_ACTIVE( tid, lr->sl_sd )) continue;
 
 			if ( lr->sl_mute || lr->sl_busy )
@@ -2819,6 +3063,14 @@ loop:
 					tvp = &tv;
 				}
 			}
+
+			/* Write out search results held back too long */
+			if ( slap_send_batch_timeout( &cat ) && ( tvp == NULL ||
+				cat.tv_sec < tv.tv_sec || ( cat.tv_sec == tv.tv_sec &&
+				cat.tv_usec < tv.tv_usec ))) {
+				tv = cat;
+				tvp = &tv;
+			}
 		}
 
 		for ( l = 0; slap_listeners[l] != NULL; l++ ) {
@@ -2828,7 +3080,7 @@ loop:
 				continue;
 			}
 
-			if ( DAEMON_ID( lr->sl_sd ) != tid ) continue;
+			if ( LISTENER_ID( lr ) != tid ) continue;
 
 			if ( lr->sl_mute ) {
 				Debug( LDAP_DEBUG_CONNS,
@@ -2917,7 +3169,7 @@ loop:
 
 			if ( ns <= 0 ) break;
 			if ( slap_listeners[l]->sl_sd == AC_SOCKET_INVALID ) continue;
-			if ( DAEMON_ID( slap_listeners[l]->sl_sd ) != tid ) continue;
+			if ( LISTENER_ID( slap_listeners[l] ) != tid ) continue;
 #ifdef LDAP_CONNECTIONLESS
 			if ( slap_listeners[l]->sl_is_udp ) continue;
 #endif /* LDAP_CONNECTIONLESS */
@@ -3210,6 +3462,25 @@ slapd_daemon_tid_cleanup(
 	return NULL;
 }
 
+/* The pool queue that handles the connection on s, -1 if any */
+int
+slapd_daemon_queue( ber_socket_t s )
+{
+	return connection_pool_cpus ? DAEMON_ID( s ) : -1;
+}
+
+void
+slapd_daemon_rebind( void )
+{
+	int i;
+
+	slapd_cpugen++;
+
+	/* let the listener threads rebind now, not on their next event */
+	for ( i=0; i<slapd_daemon_threads; i++ )
+		WAKE_LISTENER(i,1);
+}
+
 int
 slapd_daemon_resize( int newnum )
 {
@@ -30,6 +30,7 @@ static slap_verbmasks idxstr[] = {
 	{ BER_BVC("subany"), SLAP_INDEX_SUBSTR_ANY },
 	{ BER_BVC("subfinal"), SLAP_INDEX_SUBSTR_FINAL },
 	{ BER_BVC("sub"), SLAP_INDEX_SUBSTR_DEFAULT },
+	{ BER_BVC("subpos"), SLAP_INDEX_SUBSTR_POS },
 	{ BER_BVC("substr"), 0 },
 	{ BER_BVC("notags"), SLAP_INDEX_NOTAGS },
 	{ BER_BVC("nolang"), 0 },	/* backwards compat */
@@ -38,9 +39,35 @@ static slap_verbmasks idxstr[] = {
 };
 
 
+/* per-attribute overrides of the index_substr_* settings */
+static struct {
+	struct berval word;
+	int shift;
+} idxlens[] = {
+	{ BER_BVC("substr_if_minlen"), SLAP_INDEX_SUBSTR_IF_MINLEN_SHIFT },
+	{ BER_BVC("substr_if_maxlen"), SLAP_INDEX_SUBSTR_IF_MAXLEN_SHIFT },
+	{ BER_BVC("substr_any_len"), SLAP_INDEX_SUBSTR_ANY_LEN_SHIFT },
+	{ BER_BVC("substr_any_step"), SLAP_INDEX_SUBSTR_ANY_STEP_SHIFT },
+	{ BER_BVNULL, 0 }
+};
+
 int slap_str2index( const char *str, slap_mask_t *idx )
 {
 	int i;
+	char *next;
+	unsigned long len;
+
+	for ( i=0; !BER_BVISNULL( &idxlens[i].word ); i++ ) {
+		if ( strncasecmp( str, idxlens[i].word.bv_val, idxlens[i].word.bv_len ) ||
+			str[idxlens[i].word.bv_len] != '=' )
+			continue;
+		str += idxlens[i].word.bv_len + 1;
+		len = strtoul( str, &next, 10 );
+		if ( next == str || *next || !len || len > SLAP_INDEX_SUBSTR_LEN_MAX )
+			return LDAP_OTHER;
+		*idx = len << idxlens[i].shift;
+		return LDAP_SUCCESS;
+	}
 
 	i = verb_to_mask( str, idxstr );
 	if ( BER_BVISNULL(&idxstr[i].word) ) return LDAP_OTHER;
@@ -51,22 +78,75 @@ int slap_str2index( const char *str, slap_mask_t *idx )
 	return LDAP_SUCCESS;
 }
 
+/* Check that the substring key lengths of an index mask make sense */
+int slap_index_substr_check( slap_mask_t idx, const char **text )
+{
+	unsigned if_minlen, if_maxlen, any_len, any_step;
+
+	if ( !( idx & SLAP_INDEX_SUBSTR_LENS ))
+		return LDAP_SUCCESS;
+
+	if ( !IS_SLAP_INDEX( idx, SLAP_INDEX_SUBSTR )) {
+		*text = "substring key lengths without a substring index";
+		return LDAP_OTHER;
+	}
+	slap_index_substr_lens( idx, &if_minlen, &if_maxlen, &any_len, &any_step );
+	if ( if_maxlen < if_minlen ) {
+		*text = "substr_if_maxlen is smaller than substr_if_minlen";
+		return LDAP_OTHER;
+	}
+	return LDAP_SUCCESS;
+}
+
+/* The substring key lengths to use for an index mask */
+void slap_index_substr_lens( slap_mask_t idx, unsigned *if_minlen,
+	unsigned *if_maxlen, unsigned *any_len, unsigned *any_step )
+{
+	*if_minlen = SLAP_INDEX_SUBSTR_LEN( idx, SLAP_INDEX_SUBSTR_IF_MINLEN_SHIFT );
+	if ( !*if_minlen ) *if_minlen = index_substr_if_minlen;
+	*if_maxlen = SLAP_INDEX_SUBSTR_LEN( idx, SLAP_INDEX_SUBSTR_IF_MAXLEN_SHIFT );
+	if ( !*if_maxlen ) *if_maxlen = index_substr_if_maxlen;
+	*any_len = SLAP_INDEX_SUBSTR_LEN( idx, SLAP_INDEX_SUBSTR_ANY_LEN_SHIFT );
+	if ( !*any_len ) *any_len = index_substr_any_len;
+	*any_step = SLAP_INDEX_SUBSTR_LEN( idx, SLAP_INDEX_SUBSTR_ANY_STEP_SHIFT );
+	if ( !*any_step ) *any_step = index_substr_any_step;
+}
+
+/* Whether idxstr entry i is part of the textual form of idx */
+static int
+index2str_match( slap_mask_t idx, int i )
+{
+	if ( !idxstr[i].mask || !IS_SLAP_INDEX( idx, idxstr[i].mask ))
+		return 0;
+	if ( idxstr[i].mask == SLAP_INDEX_SUBSTR_POS )
+		return 1;
+	if ( (idxstr[i].mask & SLAP_INDEX_SUBSTR) &&
+		((idx & SLAP_INDEX_SUBSTR_DEFAULT) != idxstr[i].mask))
+		return 0;
+	return 1;
+}
+
 void slap_index2bvlen( slap_mask_t idx, struct berval *bv )
 {
+	char buf[sizeof("=15")];
 	int i;
 
 	bv->bv_len = 0;
 
 	for ( i=0; !BER_BVISNULL( &idxstr[i].word ); i++ ) {
-		if ( !idxstr[i].mask ) continue;
-		if ( IS_SLAP_INDEX( idx, idxstr[i].mask )) {
-			if ( (idxstr[i].mask & SLAP_INDEX_SUBSTR) &&
-				((idx & SLAP_INDEX_SUBSTR_DEFAULT) != idxstr[i].mask))
-				continue;
+		if ( index2str_match( idx, i )) {
 			if ( bv->bv_len ) bv->bv_len++;
 			bv->bv_len += idxstr[i].word.bv_len;
 		}
 	}
+	for ( i=0; !BER_BVISNULL( &idxlens[i].word ); i++ ) {
+		unsigned len = SLAP_INDEX_SUBSTR_LEN( idx, idxlens[i].shift );
+		if ( len ) {
+			if ( bv->bv_len ) bv->bv_len++;
+			bv->bv_len += idxlens[i].word.bv_len +
+				snprintf( buf, sizeof(buf), "=%u", len );
+		}
+	}
 }
 
 /* caller must provide buffer space, after calling index2bvlen */
@@ -79,13 +159,17 @@ void slap_index2bv( slap_mask_t idx, struct berval *bv )
 
 	ptr = bv->bv_val;
 	for ( i=0; !BER_BVISNULL( &idxstr[i].word ); i++ ) {
-		if ( !idxstr[i].mask ) continue;
-		if ( IS_SLAP_INDEX( idx, idxstr[i].mask )) {
-			if ( (idxstr[i].mask & SLAP_INDEX_SUBSTR) &&
-				((idx & SLAP_INDEX_SUBSTR_DEFAULT) != idxstr[i].mask))
-				continue;
+		if ( index2str_match( idx, i )) {
 			if ( ptr != bv->bv_val ) *ptr++ = ',';
 			ptr = lutil_strcopy( ptr, idxstr[i].word.bv_val );
 		}
 	}
+	for ( i=0; !BER_BVISNULL( &idxlens[i].word ); i++ ) {
+		unsigned len = SLAP_INDEX_SUBSTR_LEN( idx, idxlens[i].shift );
+		if ( len ) {
+			if ( ptr != bv->bv_val ) *ptr++ = ',';
+			ptr = lutil_strcopy( ptr, idxlens[i].word.bv_val );
+			ptr += sprintf( ptr, "=%u", len );
+		}
+	}
 }
@@ -61,9 +61,11 @@ BerVarray default_referral = NULL;
 ldap_pvt_thread_pool_t	connection_pool;
 int		connection_pool_max = SLAP_MAX_WORKER_THREADS;
 int		connection_pool_queues = 1;
+char		**connection_pool_cpus = NULL;
 int		slap_tool_thread_max = 1;
 
-slap_counters_t			slap_counters, *slap_counters_list;
+slap_counters_t			slap_counters;
+ldap_pvt_thread_mutex_t	slap_counters_mutex;
 
 static const char* slap_name = NULL;
 int slapMode = SLAP_UNDEFINED_MODE;
@@ -142,6 +144,8 @@ slap_init( int mode, const char *name )
 				connection_pool_max, 0, connection_pool_queues);
 
 		slap_counters_init( &slap_counters );
+		ldap_pvt_thread_mutex_init( &slap_counters_mutex );
+		ldap_pvt_thread_mutex_init( &slap_wbatch_mutex );
 
 		ldap_pvt_thread_mutex_init( &slapd_rq.rq_mutex );
 		LDAP_STAILQ_INIT( &slapd_rq.task_list );
@@ -268,6 +272,8 @@ int slap_destroy(void)
 	case SLAP_SERVER_MODE:
 	case SLAP_TOOL_MODE:
 		slap_counters_destroy( &slap_counters );
+		ldap_pvt_thread_mutex_destroy( &slap_counters_mutex );
+		ldap_pvt_thread_mutex_destroy( &slap_wbatch_mutex );
 		break;
 
 	default:
@@ -292,39 +298,51 @@ int slap_destroy(void)
 
 void slap_counters_init( slap_counters_t *sc )
 {
-	int i;
-
+	memset( sc, 0, sizeof( *sc ));
 	ldap_pvt_thread_mutex_init( &sc->sc_mutex );
-	ldap_pvt_mp_init( sc->sc_bytes );
-	ldap_pvt_mp_init( sc->sc_pdu );
-	ldap_pvt_mp_init( sc->sc_entries );
-	ldap_pvt_mp_init( sc->sc_refs );
-
-	ldap_pvt_mp_init( sc->sc_ops_initiated );
-	ldap_pvt_mp_init( sc->sc_ops_completed );
-
-	for ( i = 0; i < SLAP_OP_LAST; i++ ) {
-		ldap_pvt_mp_init( sc->sc_ops_initiated_[ i ] );
-		ldap_pvt_mp_init( sc->sc_ops_completed_[ i ] );
-	}
 }
 
 void slap_counters_destroy( slap_counters_t *sc )
+{
+	ldap_pvt_thread_mutex_destroy( &sc->sc_mutex );
+}
+
+/* Fold src into dst */
+void slap_counters_add( slap_counters_t *dst, slap_counters_t *src )
 {
 	int i;
 
-	ldap_pvt_thread_mutex_destroy( &sc->sc_mutex );
-	ldap_pvt_mp_clear( sc->sc_bytes );
-	ldap_pvt_mp_clear( sc->sc_pdu );
-	ldap_pvt_mp_clear( sc->sc_entries );
-	ldap_pvt_mp_clear( sc->sc_refs );
+	SLAP_COUNTER_ADD( dst, sc_bytes, SLAP_COUNTER_GET( src, sc_bytes ));
+	SLAP_COUNTER_ADD( dst, sc_pdu, SLAP_COUNTER_GET( src, sc_pdu ));
+	SLAP_COUNTER_ADD( dst, sc_entries, SLAP_COUNTER_GET( src, sc_entries ));
+	SLAP_COUNTER_ADD( dst, sc_refs, SLAP_COUNTER_GET( src, sc_refs ));
+	SLAP_COUNTER_ADD( dst, sc_writes, SLAP_COUNTER_GET( src, sc_writes ));
 
-	ldap_pvt_mp_clear( sc->sc_ops_initiated );
-	ldap_pvt_mp_clear( sc->sc_ops_completed );
+	SLAP_COUNTER_ADD( dst, sc_ops_initiated,
+		SLAP_COUNTER_GET( src, sc_ops_initiated ));
+	SLAP_COUNTER_ADD( dst, sc_ops_completed,
+		SLAP_COUNTER_GET( src, sc_ops_completed ));
 
 	for ( i = 0; i < SLAP_OP_LAST; i++ ) {
-		ldap_pvt_mp_clear( sc->sc_ops_initiated_[ i ] );
-		ldap_pvt_mp_clear( sc->sc_ops_completed_[ i ] );
+		SLAP_COUNTER_ADD( dst, sc_ops_initiated_[ i ],
+			SLAP_COUNTER_GET( src, sc_ops_initiated_[ i ] ));
+		SLAP_COUNTER_ADD( dst, sc_ops_completed_[ i ],
+			SLAP_COUNTER_GET( src, sc_ops_completed_[ i ] ));
 	}
 }
 
+/* Snapshot the global counters plus those of every live thread.
+ * The caller must slap_counters_destroy() the result.
+ */
+void slap_counters_sum( slap_counters_t *sum )
+{
+	slap_counters_t *sc;
+
+	slap_counters_init( sum );
+	ldap_pvt_thread_mutex_lock( &slap_counters_mutex );
+	slap_counters_add( sum, &slap_counters );
+	for ( sc = slap_counters.sc_next; sc; sc = sc->sc_next )
+		slap_counters_add( sum, sc );
+	ldap_pvt_thread_mutex_unlock( &slap_counters_mutex );
+}
+
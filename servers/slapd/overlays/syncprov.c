@@ -148,9 +148,32 @@ typedef struct syncprov_accesslog_deletes {
 	char *uuid_buf;
 } syncprov_accesslog_deletes;
 
+/* An index of the active persistent searches, rebuilt whenever the
+ * list changes, used to find the ones that could match a given entry.
+ * Each psearch is keyed by its search base, and by one equality
+ * assertion that its filter requires, if it has one.
+ */
+typedef struct psidx_key {
+	AttributeType	*pk_at;		/* NULL for a search base */
+	struct berval	pk_val;		/* base ndn, or normalized value */
+	int		*pk_slots;	/* psearches using this key */
+	int		pk_nslots;
+} psidx_key;
+
+typedef struct psindex {
+	unsigned long	pi_gen;		/* si_opsgen this was built for */
+	int		pi_nops;
+	syncops		**pi_ops;	/* psearch in each slot */
+	char		*pi_keyed;	/* slot has an equality key */
+	int		pi_nkeyed;
+	Avlnode		*pi_keys;
+} psindex;
+
 /* The main state for this overlay */
 typedef struct syncprov_info_t {
 	syncops		*si_ops;
+	unsigned long	si_opsgen;	/* bumped when si_ops changes */
+	psindex		si_psidx;
 	struct berval	si_contextdn;
 	struct berval	si_logbase;
 	BerVarray	si_ctxcsn;	/* ldapsync context */
@@ -905,6 +928,7 @@ syncprov_free_syncop( syncops *so, int flags )
 		for ( sop = &so->s_si->si_ops; *sop; sop = &(*sop)->s_next ) {
 			if ( *sop == so ) {
 				*sop = so->s_next;
+				so->s_si->si_opsgen++;
 				break;
 			}
 		}
@@ -1282,6 +1306,7 @@ syncprov_op_abandon( Operation *op, SlapReply *rs )
 			so->s_op->o_msgid == op->orn_msgid ) {
 				so->s_op->o_abandon = 1;
 				*sop = so->s_next;
+				si->si_opsgen++;
 				break;
 		}
 	}
@@ -1309,6 +1334,217 @@ syncprov_op_abandon( Operation *op, SlapReply *rs )
 	return SLAP_CB_CONTINUE;
 }
 
+static int
+psidx_cmp( const void *v1, const void *v2 )
+{
+	const psidx_key *k1 = v1, *k2 = v2;
+	int rc;
+
+	if ( k1->pk_at != k2->pk_at )
+		return k1->pk_at < k2->pk_at ? -1 : 1;
+	rc = k1->pk_val.bv_len - k2->pk_val.bv_len;
+	if ( rc == 0 )
+		rc = memcmp( k1->pk_val.bv_val, k2->pk_val.bv_val, k1->pk_val.bv_len );
+	return rc;
+}
+
+static void
+psidx_key_free( void *v )
+{
+	psidx_key *pk = v;
+
+	ch_free( pk->pk_slots );
+	ch_free( pk );
+}
+
+/* Find an equality assertion that an entry must satisfy to match
+ * the filter, and whose normalized value can be compared directly
+ * with the entry's normalized values.
+ */
+static Filter *
+psidx_eqfilter( Filter *f )
+{
+	AttributeDescription *ad;
+	MatchingRule *mr;
+	Filter *f2;
+
+	switch ( f->f_choice ) {
+	case LDAP_FILTER_EQUALITY:
+		ad = f->f_av_desc;
+		mr = ad->ad_type->sat_equality;
+		if ( ad == slap_schema.si_ad_objectClass ||
+			ad == slap_schema.si_ad_entryDN ||
+			ad == slap_schema.si_ad_hasSubordinates ||
+			!mr || mr->smr_syntax != ad->ad_type->sat_syntax )
+			break;
+#ifdef LDAP_COMP_MATCH
+		if ( f->f_ava->aa_cf )
+			break;
+#endif
+		return f;
+
+	case LDAP_FILTER_AND:
+		for ( f2 = f->f_and; f2; f2 = f2->f_next ) {
+			Filter *fe = psidx_eqfilter( f2 );
+			if ( fe )
+				return fe;
+		}
+		break;
+	}
+	return NULL;
+}
+
+static void
+psidx_add( psindex *pi, AttributeType *at, struct berval *val, int slot )
+{
+	psidx_key pk, *pp;
+
+	pk.pk_at = at;
+	pk.pk_val = *val;
+	pp = ldap_avl_find( pi->pi_keys, &pk, psidx_cmp );
+	if ( !pp ) {
+		pp = ch_malloc( sizeof( psidx_key ) + val->bv_len + 1 );
+		pp->pk_at = at;
+		pp->pk_val.bv_len = val->bv_len;
+		pp->pk_val.bv_val = (char *)(pp+1);
+		AC_MEMCPY( pp->pk_val.bv_val, val->bv_val, val->bv_len );
+		pp->pk_val.bv_val[val->bv_len] = '\0';
+		pp->pk_slots = NULL;
+		pp->pk_nslots = 0;
+		ldap_avl_insert( &pi->pi_keys, pp, psidx_cmp, ldap_avl_dup_error );
+	}
+	pp->pk_slots = ch_realloc( pp->pk_slots,
+		( pp->pk_nslots + 1 ) * sizeof( int ));
+	pp->pk_slots[pp->pk_nslots++] = slot;
+}
+
+/* Rebuild the psearch index. Must hold si_ops_mutex. */
+static void
+psidx_build( syncprov_info_t *si )
+{
+	psindex *pi = &si->si_psidx;
+	syncops *ss;
+	Filter *f;
+	int n;
+
+	ldap_avl_free( pi->pi_keys, psidx_key_free );
+	pi->pi_keys = NULL;
+
+	for ( n = 0, ss = si->si_ops; ss; ss = ss->s_next )
+		n++;
+	pi->pi_ops = ch_realloc( pi->pi_ops, ( n + 1 ) * sizeof( syncops * ));
+	pi->pi_keyed = ch_realloc( pi->pi_keyed, n + 1 );
+	pi->pi_nops = n;
+	pi->pi_nkeyed = 0;
+
+	for ( n = 0, ss = si->si_ops; ss; ss = ss->s_next, n++ ) {
+		pi->pi_ops[n] = ss;
+		psidx_add( pi, NULL, &ss->s_base, n );
+
+		ldap_pvt_thread_mutex_lock( &ss->s_mutex );
+		f = ss->s_op->ors_filter;
+		if ( ss->s_flags & PS_FIX_FILTER )
+			f = f->f_and->f_next;
+		f = psidx_eqfilter( f );
+		if ( f ) {
+			psidx_add( pi, f->f_av_desc->ad_type, &f->f_av_value, n );
+			pi->pi_nkeyed++;
+		}
+		pi->pi_keyed[n] = ( f != NULL );
+		ldap_pvt_thread_mutex_unlock( &ss->s_mutex );
+	}
+	pi->pi_gen = si->si_opsgen;
+}
+
+static void
+psidx_free( psindex *pi )
+{
+	ldap_avl_free( pi->pi_keys, psidx_key_free );
+	pi->pi_keys = NULL;
+	ch_free( pi->pi_ops );
+	pi->pi_ops = NULL;
+	ch_free( pi->pi_keyed );
+	pi->pi_keyed = NULL;
+	pi->pi_nops = 0;
+}
+
+#define	PSIDX_EQ	1	/* entry has the psearch's equality value */
+#define	PSIDX_BASE	2	/* entry is below the psearch's base */
+
+static void
+psidx_mark( psindex *pi, AttributeType *at, struct berval *val,
+	int flag, char *hits )
+{
+	psidx_key pk, *pp;
+	int i;
+
+	pk.pk_at = at;
+	pk.pk_val = *val;
+	pp = ldap_avl_find( pi->pi_keys, &pk, psidx_cmp );
+	if ( pp ) {
+		for ( i = 0; i < pp->pk_nslots; i++ )
+			hits[pp->pk_slots[i]] |= flag;
+	}
+}
+
+/* Flag the psearches whose base and equality key fit the entry.
+ * Only those need their filter tested. Must hold si_ops_mutex.
+ */
+static void
+psidx_match( psindex *pi, Entry *e, struct berval *ndn, char *hits )
+{
+	struct berval dn;
+	Attribute *a;
+	AttributeType *at;
+	int i;
+
+	for ( i = 0; i < pi->pi_nops; i++ )
+		hits[i] = pi->pi_keyed[i] ? 0 : PSIDX_EQ;
+
+	if ( pi->pi_nkeyed ) {
+		for ( a = e->e_attrs; a; a = a->a_next ) {
+			for ( at = a->a_desc->ad_type; at; at = at->sat_sup ) {
+				/* Values normalized by a different rule can't be
+				 * compared, so any keyed psearch may match.
+				 */
+				if ( at->sat_equality != a->a_desc->ad_type->sat_equality ) {
+					for ( i = 0; i < pi->pi_nops; i++ )
+						hits[i] |= PSIDX_EQ;
+					goto base;
+				}
+				for ( i = 0; i < a->a_numvals; i++ )
+					psidx_mark( pi, at, &a->a_nvals[i], PSIDX_EQ, hits );
+			}
+		}
+	}
+
+base:
+	/* The base of a matching psearch is the DN or one of its ancestors */
+	dn = *ndn;
+	for (;;) {
+		psidx_mark( pi, NULL, &dn, PSIDX_BASE, hits );
+		if ( BER_BVISEMPTY( &dn ))
+			break;
+		dnParent( &dn, &dn );
+	}
+}
+
+typedef struct pscand {
+	syncops	*pc_op;
+	int	pc_rc;		/* result of test_filter */
+	int	pc_done;	/* reference dropped */
+} pscand;
+
+static int
+pscand_cmp( const void *v1, const void *v2 )
+{
+	const pscand *c1 = v1, *c2 = v2;
+
+	if ( c1->pc_op == c2->pc_op )
+		return 0;
+	return c1->pc_op < c2->pc_op ? -1 : 1;
+}
+
 /* Find which persistent searches are affected by this operation */
 static void
 syncprov_matchops( Operation *op, opcookie *opc, int saveit )
@@ -1322,6 +1558,8 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 	Attribute *a;
 	int rc, gonext;
 	BackendDB *b0 = op->o_bd, db;
+	pscand *cands = NULL;
+	int i, ncands = 0;
 
 	fc.fdn = saveit ? &op->o_req_ndn : &opc->sndn;
 	if ( !saveit && op->o_tag == LDAP_REQ_DELETE ) {
@@ -1373,15 +1611,94 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 	}
 
 	ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
+
+	/* Use the index to pick the psearches whose filter needs testing,
+	 * and test them without holding si_ops_mutex.
+	 */
+	if ( e && !is_entry_glue( e ) && si->si_ops ) {
+		psindex *pi = &si->si_psidx;
+		char *hits;
+
+		if ( pi->pi_gen != si->si_opsgen )
+			psidx_build( si );
+		hits = op->o_tmpalloc( pi->pi_nops, op->o_tmpmemctx );
+		psidx_match( pi, e, fc.fdn, hits );
+		cands = op->o_tmpalloc( pi->pi_nops * sizeof( pscand ), op->o_tmpmemctx );
+		for ( i = 0; i < pi->pi_nops; i++ ) {
+			syncops *ss = pi->pi_ops[i];
+
+			if ( hits[i] != ( PSIDX_EQ|PSIDX_BASE ) || ss->s_op->o_abandon ||
+				( opc->osid > 0 && opc->osid == ss->s_sid ) ||
+				( opc->rsid > 0 && opc->rsid == ss->s_sid ))
+				continue;
+			ldap_pvt_thread_mutex_lock( &ss->s_mutex );
+			ss->s_inuse++;
+			ldap_pvt_thread_mutex_unlock( &ss->s_mutex );
+			cands[ncands].pc_op = ss;
+			cands[ncands].pc_rc = LDAP_COMPARE_FALSE;
+			cands[ncands].pc_done = 0;
+			ncands++;
+		}
+		op->o_tmpfree( hits, op->o_tmpmemctx );
+		Debug( LDAP_DEBUG_TRACE, "%s syncprov_matchops: "
+			"testing %d of %d psearches\n",
+			op->o_log_prefix, ncands, pi->pi_nops );
+		ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
+
+		for ( i = 0; i < ncands; i++ ) {
+			syncops *ss = cands[i].pc_op;
+			Operation op2;
+			Opheader oh;
+
+			ldap_pvt_thread_mutex_lock( &ss->s_mutex );
+			op2 = *ss->s_op;
+			oh = *op->o_hdr;
+			oh.oh_conn = ss->s_op->o_conn;
+			oh.oh_connid = ss->s_op->o_connid;
+			op2.o_bd = op->o_bd->bd_self;
+			op2.o_hdr = &oh;
+			op2.o_extra = op->o_extra;
+			op2.o_callback = NULL;
+			if (ss->s_flags & PS_FIX_FILTER) {
+				/* Skip the AND/GE clause that we stuck on in front. We
+				   would lose deletes/mods that happen during the refresh
+				   phase otherwise (ITS#6555) */
+				op2.ors_filter = ss->s_op->ors_filter->f_and->f_next;
+			}
+			cands[i].pc_rc = test_filter( &op2, e, op2.ors_filter );
+			ldap_pvt_thread_mutex_unlock( &ss->s_mutex );
+		}
+		qsort( cands, ncands, sizeof( pscand ), pscand_cmp );
+
+		ldap_pvt_thread_mutex_lock( &si->si_ops_mutex );
+	}
+
 	for (pss = &si->si_ops; *pss; pss = gonext ? &(*pss)->s_next : pss)
 	{
-		Operation op2;
-		Opheader oh;
 		syncmatches *sm;
 		int found = 0;
 		syncops *snext, *ss = *pss;
+		pscand *pc = NULL;
 
 		gonext = 1;
+		if ( ncands ) {
+			pscand key;
+
+			key.pc_op = ss;
+			pc = bsearch( &key, cands, ncands, sizeof( pscand ), pscand_cmp );
+		}
+		/* Drop the reference taken for testing */
+		if ( pc ) {
+			pc->pc_done = 1;
+			snext = ss->s_next;
+			if ( syncprov_free_syncop( ss, FS_LOCK ) == FSR_DIDFREE ) {
+				*pss = snext;
+				si->si_opsgen++;
+				gonext = 0;
+				continue;
+			}
+		}
+
 		if ( ss->s_op->o_abandon )
 			continue;
 
@@ -1413,8 +1730,10 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			send_ldap_error( ss->s_op, &rs, LDAP_SYNC_REFRESH_REQUIRED,
 				"search base has changed" );
 			snext = ss->s_next;
-			if ( syncprov_drop_psearch( ss, 1 ) )
+			if ( syncprov_drop_psearch( ss, 1 ) ) {
 				*pss = snext;
+				si->si_opsgen++;
+			}
 			gonext = 0;
 			continue;
 		}
@@ -1441,26 +1760,7 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			}
 		}
 
-		rc = LDAP_COMPARE_FALSE;
-		if ( e && !is_entry_glue( e ) && fc.fscope ) {
-			ldap_pvt_thread_mutex_lock( &ss->s_mutex );
-			op2 = *ss->s_op;
-			oh = *op->o_hdr;
-			oh.oh_conn = ss->s_op->o_conn;
-			oh.oh_connid = ss->s_op->o_connid;
-			op2.o_bd = op->o_bd->bd_self;
-			op2.o_hdr = &oh;
-			op2.o_extra = op->o_extra;
-			op2.o_callback = NULL;
-			if (ss->s_flags & PS_FIX_FILTER) {
-				/* Skip the AND/GE clause that we stuck on in front. We
-				   would lose deletes/mods that happen during the refresh
-				   phase otherwise (ITS#6555) */
-				op2.ors_filter = ss->s_op->ors_filter->f_and->f_next;
-			}
-			rc = test_filter( &op2, e, op2.ors_filter );
-			ldap_pvt_thread_mutex_unlock( &ss->s_mutex );
-		}
+		rc = pc ? pc->pc_rc : LDAP_COMPARE_FALSE;
 
 		Debug( LDAP_DEBUG_TRACE, "%s syncprov_matchops: "
 			"sid %03x fscope %d rc %d\n",
@@ -1494,12 +1794,23 @@ syncprov_matchops( Operation *op, opcookie *opc, int saveit )
 			snext = ss->s_next;
 			if ( syncprov_free_syncop( ss, FS_LOCK ) ) {
 				*pss = snext;
+				si->si_opsgen++;
 				gonext = 0;
 			}
 		}
 	}
 	ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 
+	/* Drop the references on any psearches that left the list
+	 * while they were being tested
+	 */
+	for ( i = 0; i < ncands; i++ ) {
+		if ( !cands[i].pc_done )
+			syncprov_free_syncop( cands[i].pc_op, FS_LOCK|FS_UNLINK );
+	}
+	if ( cands )
+		op->o_tmpfree( cands, op->o_tmpmemctx );
+
 	if ( op->o_tag != LDAP_REQ_ADD && e ) {
 		if ( !SLAP_ISOVERLAY( op->o_bd )) {
 			op->o_bd = &db;
@@ -3228,6 +3539,7 @@ aband:
 		sop->s_next = si->si_ops;
 		sop->s_si = si;
 		si->si_ops = sop;
+		si->si_opsgen++;
 		ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 		Debug( LDAP_DEBUG_SYNC, "%s syncprov_op_search: "
 			"registered persistent search\n", op->o_log_prefix );
@@ -3344,6 +3656,7 @@ bailout:
 					while ( *sp != sop )
 						sp = &(*sp)->s_next;
 					*sp = sop->s_next;
+					si->si_opsgen++;
 					ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 					ch_free( sop->s_base.bv_val );
 					ch_free( sop );
@@ -4166,6 +4479,7 @@ syncprov_db_close(
 				so->s_si = NULL;
 		}
 		si->si_ops=NULL;
+		si->si_opsgen++;
 		ldap_pvt_thread_mutex_unlock( &si->si_ops_mutex );
 	}
 	overlay_unregister_control( be, LDAP_CONTROL_SYNC );
@@ -4235,6 +4549,7 @@ syncprov_db_destroy(
 			ch_free( si->si_sids );
 		if ( si->si_logbase.bv_val )
 			ch_free( si->si_logbase.bv_val );
+		psidx_free( &si->si_psidx );
 		ldap_pvt_thread_mutex_destroy( &si->si_resp_mutex );
 		ldap_pvt_thread_mutex_destroy( &si->si_mods_mutex );
 		ldap_pvt_thread_mutex_destroy( &si->si_ops_mutex );
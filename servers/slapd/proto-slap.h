@@ -864,6 +864,7 @@ LDAP_SLAPD_F (int) slapd_daemon_resize( int newnum );
 LDAP_SLAPD_F (int) slapd_daemon_destroy(void);
 LDAP_SLAPD_F (int) slapd_daemon(void);
 LDAP_SLAPD_F (Listener **)	slapd_get_listeners LDAP_P((void));
+LDAP_SLAPD_F (unsigned long) slapd_listener_rate LDAP_P((Listener *sl));
 LDAP_SLAPD_F (void) slapd_remove LDAP_P((ber_socket_t s, Sockbuf *sb,
 	int wasactive, int wake, int locked ));
 
@@ -892,6 +893,8 @@ LDAP_SLAPD_V (slap_ssf_t) local_ssf;
 LDAP_SLAPD_V (struct runqueue_s) slapd_rq;
 LDAP_SLAPD_V (int) slapd_daemon_threads;
 LDAP_SLAPD_V (int) slapd_daemon_mask;
+LDAP_SLAPD_F (int) slapd_daemon_queue LDAP_P(( ber_socket_t s ));
+LDAP_SLAPD_F (void) slapd_daemon_rebind LDAP_P(( void ));
 #ifdef LDAP_TCP_BUFFER
 LDAP_SLAPD_V (int) slapd_tcp_rmem;
 LDAP_SLAPD_V (int) slapd_tcp_wmem;
@@ -1160,6 +1163,11 @@ LDAP_SLAPD_V( LDAP * ) slap_tls_ld;
 LDAP_SLAPD_F (int) slap_str2index LDAP_P(( const char *str, slap_mask_t *idx ));
 LDAP_SLAPD_F (void) slap_index2bvlen LDAP_P(( slap_mask_t idx, struct berval *bv ));
 LDAP_SLAPD_F (void) slap_index2bv LDAP_P(( slap_mask_t idx, struct berval *bv ));
+LDAP_SLAPD_F (int) slap_index_substr_check LDAP_P(( slap_mask_t idx,
+	const char **text ));
+LDAP_SLAPD_F (void) slap_index_substr_lens LDAP_P(( slap_mask_t idx,
+	unsigned *if_minlen, unsigned *if_maxlen,
+	unsigned *any_len, unsigned *any_step ));
 
 /*
  * init.c
@@ -1170,6 +1178,8 @@ LDAP_SLAPD_F (int)	slap_shutdown LDAP_P(( Backend *be ));
 LDAP_SLAPD_F (int)	slap_destroy LDAP_P((void));
 LDAP_SLAPD_F (void) slap_counters_init LDAP_P((slap_counters_t *sc));
 LDAP_SLAPD_F (void) slap_counters_destroy LDAP_P((slap_counters_t *sc));
+LDAP_SLAPD_F (void) slap_counters_add LDAP_P((slap_counters_t *dst, slap_counters_t *src));
+LDAP_SLAPD_F (void) slap_counters_sum LDAP_P((slap_counters_t *sum));
 
 LDAP_SLAPD_V (char *)	slap_known_controls[];
 
@@ -1642,6 +1652,9 @@ LDAP_SLAPD_F (void) slap_send_ldap_intermediate LDAP_P(( Operation *op, SlapRepl
 LDAP_SLAPD_F (void) slap_send_search_result LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_send_search_reference LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_send_search_entry LDAP_P(( Operation *op, SlapReply *rs ));
+LDAP_SLAPD_F (void) slap_send_flush LDAP_P(( Operation *op ));
+LDAP_SLAPD_F (void) slap_send_batch_drop LDAP_P(( Connection *conn ));
+LDAP_SLAPD_F (int) slap_send_batch_timeout LDAP_P(( struct timeval *tv ));
 LDAP_SLAPD_F (int) slap_null_cb LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_freeself_cb LDAP_P(( Operation *op, SlapReply *rs ));
 
@@ -2116,6 +2129,8 @@ LDAP_SLAPD_V (const char) 	Versionstr[];
 LDAP_SLAPD_V (int)		global_gentlehup;
 LDAP_SLAPD_V (int)		global_idletimeout;
 LDAP_SLAPD_V (int)		global_writetimeout;
+LDAP_SLAPD_V (unsigned int)	global_writebatch;
+LDAP_SLAPD_V (unsigned int)	global_writebatchtime;
 LDAP_SLAPD_V (char *)	global_host;
 LDAP_SLAPD_V (struct berval)	global_host_bv;
 LDAP_SLAPD_V (char *)	global_realm;
@@ -2133,6 +2148,8 @@ LDAP_SLAPD_V (struct berval)	default_search_base;
 LDAP_SLAPD_V (struct berval)	default_search_nbase;
 
 LDAP_SLAPD_V (slap_counters_t)	slap_counters;
+LDAP_SLAPD_V (ldap_pvt_thread_mutex_t)	slap_counters_mutex;
+LDAP_SLAPD_V (ldap_pvt_thread_mutex_t)	slap_wbatch_mutex;
 
 LDAP_SLAPD_V (char *)		slapd_pid_file;
 LDAP_SLAPD_V (char *)		slapd_args_file;
@@ -2144,6 +2161,7 @@ LDAP_SLAPD_V (time_t)		starttime;
 LDAP_SLAPD_V (ldap_pvt_thread_pool_t)	connection_pool;
 LDAP_SLAPD_V (int)			connection_pool_max;
 LDAP_SLAPD_V (int)			connection_pool_queues;
+LDAP_SLAPD_V (char **)			connection_pool_cpus;
 LDAP_SLAPD_V (int)			slap_tool_thread_max;
 
 LDAP_SLAPD_V (ldap_pvt_thread_mutex_t)	entry2str_mutex;
@@ -331,22 +331,147 @@ slap_writewait_play(
 	}
 }
 
+/* Connections with queued PDUs, oldest batch first. Every batch waits
+ * the same writebatchtime, so this is also the order they are due in.
+ */
+static LDAP_TAILQ_HEAD(wbatch_list, Connection) slap_wbatch_list =
+	LDAP_TAILQ_HEAD_INITIALIZER( slap_wbatch_list );
+ldap_pvt_thread_mutex_t slap_wbatch_mutex;
+
+/* Have the daemon write out a batch just started if it is still
+ * waiting when writebatchtime is up. Called with c_write1_mutex.
+ */
+static void
+send_batch_arm( Connection *conn )
+{
+	int first;
+
+	ldap_pvt_thread_mutex_lock( &slap_wbatch_mutex );
+	first = LDAP_TAILQ_EMPTY( &slap_wbatch_list );
+	LDAP_TAILQ_INSERT_TAIL( &slap_wbatch_list, conn, c_wbatch_next );
+	conn->c_wbatch_queued = 1;
+	ldap_pvt_thread_mutex_unlock( &slap_wbatch_mutex );
+
+	/* later batches are due later, the daemon already waits for an
+	 * earlier one
+	 */
+	if ( first )
+		slap_wake_listener();
+}
+
+/* The batch of conn is being written or discarded */
+void
+slap_send_batch_drop( Connection *conn )
+{
+	ldap_pvt_thread_mutex_lock( &slap_wbatch_mutex );
+	if ( conn->c_wbatch_queued ) {
+		LDAP_TAILQ_REMOVE( &slap_wbatch_list, conn, c_wbatch_next );
+		conn->c_wbatch_queued = 0;
+	}
+	ldap_pvt_thread_mutex_unlock( &slap_wbatch_mutex );
+}
+
 static long send_ldap_ber(
+	Connection *conn,
 	Operation *op,
-	BerElement *ber )
+	BerElement *ber,
+	int batch );
+
+static void *
+send_batch_task( void *ctx, void *arg )
+{
+	send_ldap_ber( arg, NULL, NULL, 0 );
+	return NULL;
+}
+
+/* Called by the daemon: hand the batches whose writebatchtime is up
+ * to the thread pool. Returns nonzero if more are waiting, with the
+ * time until the next one is due in tv, rounded up to a millisecond.
+ */
+int
+slap_send_batch_timeout( struct timeval *tv )
+{
+	Connection *c;
+	struct timeval now;
+	long usec;
+	int rc = 0;
+
+	gettimeofday( &now, NULL );
+	ldap_pvt_thread_mutex_lock( &slap_wbatch_mutex );
+	while (( c = LDAP_TAILQ_FIRST( &slap_wbatch_list )) != NULL ) {
+		usec = ( c->c_wbatch_start.tv_sec - now.tv_sec ) * 1000000L +
+			c->c_wbatch_start.tv_usec - now.tv_usec +
+			(long)global_writebatchtime;
+		if ( usec > 0 ) {
+			usec = ( usec + 999 ) / 1000 * 1000;
+			tv->tv_sec = usec / 1000000;
+			tv->tv_usec = usec % 1000000;
+			rc = 1;
+			break;
+		}
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+				send_batch_task, c ))
+			break;
+		LDAP_TAILQ_REMOVE( &slap_wbatch_list, c, c_wbatch_next );
+		c->c_wbatch_queued = 0;
+	}
+	ldap_pvt_thread_mutex_unlock( &slap_wbatch_mutex );
+	return rc;
+}
+
+/* Should the queued PDUs be written now? */
+static int
+send_batch_full( Connection *conn )
 {
-	Connection *conn = op->o_conn;
 	ber_len_t bytes;
+	struct timeval now;
+	long usec;
+
+	ber_get_option( conn->c_wbatch, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
+	if ( bytes >= global_writebatch )
+		return 1;
+
+	gettimeofday( &now, NULL );
+	usec = ( now.tv_sec - conn->c_wbatch_start.tv_sec ) * 1000000L +
+		now.tv_usec - conn->c_wbatch_start.tv_usec;
+	return usec >= (long)global_writebatchtime;
+}
+
+/* Write a PDU to the client. With batch set, the PDU may instead be
+ * queued on the connection and written later together with others,
+ * so that a stream of search results costs fewer syscalls. Any PDU
+ * that is not queued flushes the queue ahead of itself. A NULL ber
+ * just flushes the queue; op may then be NULL too, when the daemon
+ * flushes a batch whose writebatchtime is up.
+ */
+static long send_ldap_ber(
+	Connection *conn,
+	Operation *op,
+	BerElement *ber,
+	int batch )
+{
+	ber_len_t bytes = 0;
+	unsigned long connid;
 	long ret = 0;
 	char *close_reason;
-	int do_resume = 0;
+	int do_resume = 0, started = 0;
 
-	ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
+	if ( ber ) {
+		ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
+	}
+
+	batch = batch && op->o_batch_writes && global_writebatch;
+#ifdef LDAP_CONNECTIONLESS
+	if ( conn->c_is_udp )
+		batch = 0;
+#endif
 
 	/* write only one pdu at a time - wait til it's our turn */
 	ldap_pvt_thread_mutex_lock( &conn->c_write1_mutex );
-	if (( op->o_abandon && !op->o_cancel ) || !connection_valid( conn ) ||
-		conn->c_writers < 0 ) {
+	connid = op ? op->o_connid : conn->c_connid;
+	if (( ber && op->o_abandon && !op->o_cancel ) ||
+		!connection_valid( conn ) || conn->c_writers < 0 ||
+		( !ber && !conn->c_wbatch )) {
 		ldap_pvt_thread_mutex_unlock( &conn->c_write1_mutex );
 		return 0;
 	}
@@ -367,6 +492,33 @@ static long send_ldap_ber(
 		return 0;
 	}
 
+	/* Queue the pdu behind any others already waiting */
+	if ( ber && ( batch || conn->c_wbatch )) {
+		struct berval bv;
+
+		if ( !conn->c_wbatch ) {
+			conn->c_wbatch = ber_alloc_t( 0 );
+			gettimeofday( &conn->c_wbatch_start, NULL );
+			started = 1;
+		}
+		ber_flatten2( ber, &bv, 0 );
+		if ( ber_write( conn->c_wbatch, bv.bv_val, bv.bv_len, 0 ) < 0 ) {
+			close_reason = "out of memory queueing pdu";
+			goto fail;
+		}
+		if ( batch && !send_batch_full( conn )) {
+			if ( started )
+				send_batch_arm( conn );
+			conn->c_writers--;
+			ldap_pvt_thread_cond_signal( &conn->c_write1_cv );
+			ldap_pvt_thread_mutex_unlock( &conn->c_write1_mutex );
+			return bytes;
+		}
+	}
+	if ( conn->c_wbatch ) {
+		ber = conn->c_wbatch;
+	}
+
 	/* Our turn */
 	conn->c_writing = 1;
 
@@ -376,6 +528,13 @@ static long send_ldap_ber(
 		char ebuf[128];
 
 		if ( ber_flush2( conn->c_sb, ber, LBER_FLUSH_FREE_NEVER ) == 0 ) {
+			if ( ber == conn->c_wbatch ) {
+				slap_send_batch_drop( conn );
+				ber_free( ber, 1 );
+				conn->c_wbatch = NULL;
+			}
+			SLAP_COUNTER_ADD( op ? op->o_counters : &slap_counters,
+				sc_writes, 1 );
 			ret = bytes;
 			break;
 		}
@@ -399,7 +558,7 @@ fail:
 			ldap_pvt_thread_mutex_unlock( &conn->c_write1_mutex );
 			ldap_pvt_thread_mutex_lock( &conn->c_mutex );
 			/* conn may have been reused by the time we get the mutex */
-			if ( op->o_connid == conn->c_connid )
+			if ( connid == conn->c_connid )
 				connection_closing( conn, close_reason );
 			ldap_pvt_thread_mutex_unlock( &conn->c_mutex );
 			return -1;
@@ -417,7 +576,8 @@ fail:
 		do_resume = 1;
 		conn->c_writewaiter = 1;
 		ldap_pvt_thread_mutex_unlock( &conn->c_write1_mutex );
-		slap_writewait_play( op );
+		if ( op )
+			slap_writewait_play( op );
 		err = slapd_wait_writer( conn->c_sd );
 		conn->c_writewaiter = 0;
 		ldap_pvt_thread_mutex_lock( &conn->c_write1_mutex );
@@ -461,6 +621,14 @@ fail:
 	return ret;
 }
 
+/* Write out any PDUs still queued on the connection */
+void
+slap_send_flush( Operation *op )
+{
+	if ( op->o_conn && op->o_conn->c_wbatch )
+		send_ldap_ber( op->o_conn, op, NULL, 0 );
+}
+
 static int
 send_ldap_control( BerElement *ber, LDAPControl *c )
 {
@@ -766,7 +934,7 @@ send_ldap_response(
 	}
 
 	/* send BER */
-	bytes = send_ldap_ber( op, ber );
+	bytes = send_ldap_ber( op->o_conn, op, ber, 0 );
 #ifdef LDAP_CONNECTIONLESS
 	if (!op->o_conn || op->o_conn->c_is_udp == 0)
 #endif
@@ -781,10 +949,8 @@ send_ldap_response(
 		goto cleanup;
 	}
 
-	ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
-	ldap_pvt_mp_add_ulong( op->o_counters->sc_pdu, 1 );
-	ldap_pvt_mp_add_ulong( op->o_counters->sc_bytes, (unsigned long)bytes );
-	ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+	SLAP_COUNTER_ADD( op->o_counters, sc_pdu, 1 );
+	SLAP_COUNTER_ADD( op->o_counters, sc_bytes, bytes );
 
 cleanup:;
 	/* Tell caller that we did this for real, as opposed to being
@@ -1493,7 +1659,7 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 	rs_flush_entry( op, rs, NULL );
 
 	if ( op->o_res_ber == NULL ) {
-		bytes = send_ldap_ber( op, ber );
+		bytes = send_ldap_ber( op->o_conn, op, ber, 1 );
 		ber_free_buf( ber );
 
 		if ( bytes < 0 ) {
@@ -1506,11 +1672,9 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 		}
 		rs->sr_nentries++;
 
-		ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_bytes, (unsigned long)bytes );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_entries, 1 );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_pdu, 1 );
-		ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+		SLAP_COUNTER_ADD( op->o_counters, sc_bytes, bytes );
+		SLAP_COUNTER_ADD( op->o_counters, sc_entries, 1 );
+		SLAP_COUNTER_ADD( op->o_counters, sc_pdu, 1 );
 	}
 
 	Debug( LDAP_DEBUG_TRACE,
@@ -1659,17 +1823,15 @@ slap_send_search_reference( Operation *op, SlapReply *rs )
 #ifdef LDAP_CONNECTIONLESS
 	if (!op->o_conn || op->o_conn->c_is_udp == 0) {
 #endif
-	bytes = send_ldap_ber( op, ber );
+	bytes = send_ldap_ber( op->o_conn, op, ber, 1 );
 	ber_free_buf( ber );
 
 	if ( bytes < 0 ) {
 		rc = LDAP_UNAVAILABLE;
 	} else {
-		ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_bytes, (unsigned long)bytes );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_refs, 1 );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_pdu, 1 );
-		ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+		SLAP_COUNTER_ADD( op->o_counters, sc_bytes, bytes );
+		SLAP_COUNTER_ADD( op->o_counters, sc_refs, 1 );
+		SLAP_COUNTER_ADD( op->o_counters, sc_pdu, 1 );
 	}
 #ifdef LDAP_CONNECTIONLESS
 	}
@@ -934,38 +934,43 @@ octetStringSubstringsIndexer(
 {
 	ber_len_t i, nkeys;
 	BerVarray keys;
+	unsigned if_minlen, if_maxlen, any_len, any_step;
+	int pos = IS_SLAP_INDEX( flags, SLAP_INDEX_SUBSTR_POS );
 
 	HASH_CONTEXT HCany, HCini, HCfin;
+	HASH_CONTEXT HCpos[SLAP_INDEX_SUBSTR_POS_BUCKETS];
 	unsigned char HASHdigest[HASH_BYTES];
 	struct berval digest;
 	digest.bv_val = (char *)HASHdigest;
 	digest.bv_len = HASH_LEN;
 
+	slap_index_substr_lens( flags, &if_minlen, &if_maxlen, &any_len, &any_step );
+
 	nkeys = 0;
 
 	for ( i = 0; !BER_BVISNULL( &values[i] ); i++ ) {
 		/* count number of indices to generate */
 		if( flags & SLAP_INDEX_SUBSTR_INITIAL ) {
-			if( values[i].bv_len >= index_substr_if_maxlen ) {
-				nkeys += index_substr_if_maxlen -
-					(index_substr_if_minlen - 1);
-			} else if( values[i].bv_len >= index_substr_if_minlen ) {
-				nkeys += values[i].bv_len - (index_substr_if_minlen - 1);
+			if( values[i].bv_len >= if_maxlen ) {
+				nkeys += if_maxlen -
+					(if_minlen - 1);
+			} else if( values[i].bv_len >= if_minlen ) {
+				nkeys += values[i].bv_len - (if_minlen - 1);
 			}
 		}
 
 		if( flags & SLAP_INDEX_SUBSTR_ANY ) {
-			if( values[i].bv_len >= index_substr_any_len ) {
-				nkeys += values[i].bv_len - (index_substr_any_len - 1);
+			if( values[i].bv_len >= any_len ) {
+				nkeys += values[i].bv_len - (any_len - 1);
 			}
 		}
 
 		if( flags & SLAP_INDEX_SUBSTR_FINAL ) {
-			if( values[i].bv_len >= index_substr_if_maxlen ) {
-				nkeys += index_substr_if_maxlen -
-					(index_substr_if_minlen - 1);
-			} else if( values[i].bv_len >= index_substr_if_minlen ) {
-				nkeys += values[i].bv_len - (index_substr_if_minlen - 1);
+			if( values[i].bv_len >= if_maxlen ) {
+				nkeys += if_maxlen -
+					(if_minlen - 1);
+			} else if( values[i].bv_len >= if_minlen ) {
+				nkeys += values[i].bv_len - (if_minlen - 1);
 			}
 		}
 	}
@@ -978,7 +983,11 @@ octetStringSubstringsIndexer(
 
 	keys = slap_sl_malloc( sizeof( struct berval ) * (nkeys+1), ctx );
 
-	if ( flags & SLAP_INDEX_SUBSTR_ANY )
+	if ( pos ) {
+		for ( i = 0; i < SLAP_INDEX_SUBSTR_POS_BUCKETS; i++ )
+			hashPreset( &HCpos[i], prefix,
+				SLAP_INDEX_SUBSTR_POS_PREFIX + i, syntax, mr );
+	} else if ( flags & SLAP_INDEX_SUBSTR_ANY )
 		hashPreset( &HCany, prefix, SLAP_INDEX_SUBSTR_PREFIX, syntax, mr );
 	if( flags & SLAP_INDEX_SUBSTR_INITIAL )
 		hashPreset( &HCini, prefix, SLAP_INDEX_SUBSTR_INITIAL_PREFIX, syntax, mr );
@@ -990,25 +999,25 @@ octetStringSubstringsIndexer(
 		ber_len_t j,max;
 
 		if( ( flags & SLAP_INDEX_SUBSTR_ANY ) &&
-			( values[i].bv_len >= index_substr_any_len ) )
+			( values[i].bv_len >= any_len ) )
 		{
-			max = values[i].bv_len - (index_substr_any_len - 1);
+			max = values[i].bv_len - (any_len - 1);
 
 			for( j=0; j<max; j++ ) {
-				hashIter( &HCany, HASHdigest,
-					(unsigned char *)&values[i].bv_val[j],
-					index_substr_any_len );
+				hashIter( pos ? &HCpos[j % SLAP_INDEX_SUBSTR_POS_BUCKETS] : &HCany,
+					HASHdigest, (unsigned char *)&values[i].bv_val[j],
+					any_len );
 				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
 			}
 		}
 
 		/* skip if too short */ 
-		if( values[i].bv_len < index_substr_if_minlen ) continue;
+		if( values[i].bv_len < if_minlen ) continue;
 
-		max = index_substr_if_maxlen < values[i].bv_len
-			? index_substr_if_maxlen : values[i].bv_len;
+		max = if_maxlen < values[i].bv_len
+			? if_maxlen : values[i].bv_len;
 
-		for( j=index_substr_if_minlen; j<=max; j++ ) {
+		for( j=if_minlen; j<=max; j++ ) {
 
 			if( flags & SLAP_INDEX_SUBSTR_INITIAL ) {
 				hashIter( &HCini, HASHdigest,
@@ -1036,7 +1045,45 @@ octetStringSubstringsIndexer(
 	return LDAP_SUCCESS;
 }
 
-/* Substring index generation function: Assertion value -> index hash keys */
+/* Positional keys of a substring whose position in the value is not
+ * known: one alternative for each bucket its start may fall in, each
+ * introduced by an empty key. A value matches if it has all the keys
+ * of one alternative.
+ */
+static void
+octetStringSubstringsPosKeys(
+	HASH_CONTEXT *HCpos,
+	struct berval *value,
+	unsigned any_len,
+	unsigned any_step,
+	BerVarray keys,
+	ber_len_t *nkeys,
+	void *ctx )
+{
+	unsigned char HASHdigest[HASH_BYTES];
+	struct berval digest;
+	ber_len_t j;
+	int s;
+
+	digest.bv_val = (char *)HASHdigest;
+	digest.bv_len = HASH_LEN;
+
+	for ( s = 0; s < SLAP_INDEX_SUBSTR_POS_BUCKETS; s++ ) {
+		ber_str2bv_x( "", 0, 1, &keys[(*nkeys)++], ctx );
+		for ( j = 0; j <= value->bv_len - any_len; j += any_step ) {
+			hashIter( &HCpos[(s + j) % SLAP_INDEX_SUBSTR_POS_BUCKETS],
+				HASHdigest, (unsigned char *)&value->bv_val[j], any_len );
+			ber_dupbv_x( &keys[(*nkeys)++], &digest, ctx );
+		}
+	}
+}
+
+/* Substring index generation function: Assertion value -> index hash keys
+ *
+ * With SLAP_INDEX_SUBSTR_POS the keys every match must have come first,
+ * followed by the alternatives of each unanchored substring, see
+ * octetStringSubstringsPosKeys().
+ */
 static int
 octetStringSubstringsFilter (
 	slap_mask_t use,
@@ -1054,44 +1101,55 @@ octetStringSubstringsFilter (
 	size_t klen;
 	BerVarray keys;
 	HASH_CONTEXT HASHcontext;
+	HASH_CONTEXT HCpos[SLAP_INDEX_SUBSTR_POS_BUCKETS];
 	unsigned char HASHdigest[HASH_BYTES];
 	struct berval *value;
 	struct berval digest;
+	unsigned if_minlen, if_maxlen, any_len, any_step;
+	int pos = IS_SLAP_INDEX( flags, SLAP_INDEX_SUBSTR_POS );
 
 	sa = (SubstringsAssertion *) assertedValue;
 
+	slap_index_substr_lens( flags, &if_minlen, &if_maxlen, &any_len, &any_step );
+
 	if( flags & SLAP_INDEX_SUBSTR_INITIAL &&
 		!BER_BVISNULL( &sa->sa_initial ) &&
-		sa->sa_initial.bv_len >= index_substr_if_minlen )
+		sa->sa_initial.bv_len >= if_minlen )
 	{
 		nkeys++;
-		if ( sa->sa_initial.bv_len > index_substr_if_maxlen &&
+		if ( sa->sa_initial.bv_len > if_maxlen &&
 			( flags & SLAP_INDEX_SUBSTR_ANY ))
 		{
-			nkeys += 1 + (sa->sa_initial.bv_len - index_substr_if_maxlen) / index_substr_any_step;
+			nkeys += 1 + (sa->sa_initial.bv_len - if_maxlen) / any_step;
 		}
 	}
 
 	if ( flags & SLAP_INDEX_SUBSTR_ANY && sa->sa_any != NULL ) {
 		ber_len_t i;
 		for( i=0; !BER_BVISNULL( &sa->sa_any[i] ); i++ ) {
-			if( sa->sa_any[i].bv_len >= index_substr_any_len ) {
+			if( sa->sa_any[i].bv_len >= any_len ) {
 				/* don't bother accounting with stepping */
-				nkeys += sa->sa_any[i].bv_len -
-					( index_substr_any_len - 1 );
+				klen = sa->sa_any[i].bv_len - ( any_len - 1 );
+				if ( pos )
+					klen = ( klen + 1 ) * SLAP_INDEX_SUBSTR_POS_BUCKETS;
+				nkeys += klen;
 			}
 		}
 	}
 
 	if( flags & SLAP_INDEX_SUBSTR_FINAL &&
 		!BER_BVISNULL( &sa->sa_final ) &&
-		sa->sa_final.bv_len >= index_substr_if_minlen )
+		sa->sa_final.bv_len >= if_minlen )
 	{
 		nkeys++;
-		if ( sa->sa_final.bv_len > index_substr_if_maxlen &&
+		if ( sa->sa_final.bv_len > if_maxlen &&
 			( flags & SLAP_INDEX_SUBSTR_ANY ))
 		{
-			nkeys += 1 + (sa->sa_final.bv_len - index_substr_if_maxlen) / index_substr_any_step;
+			klen = 1 + (sa->sa_final.bv_len - if_maxlen) / any_step;
+			if ( pos && sa->sa_final.bv_len >= any_len )
+				klen = ( sa->sa_final.bv_len - ( any_len - 1 ) + 1 ) *
+					SLAP_INDEX_SUBSTR_POS_BUCKETS;
+			nkeys += klen;
 		}
 	}
 
@@ -1106,15 +1164,22 @@ octetStringSubstringsFilter (
 	keys = slap_sl_malloc( sizeof( struct berval ) * (nkeys+1), ctx );
 	nkeys = 0;
 
+	if ( pos ) {
+		int b;
+		for ( b = 0; b < SLAP_INDEX_SUBSTR_POS_BUCKETS; b++ )
+			hashPreset( &HCpos[b], prefix,
+				SLAP_INDEX_SUBSTR_POS_PREFIX + b, syntax, mr );
+	}
+
 	if( flags & SLAP_INDEX_SUBSTR_INITIAL &&
 		!BER_BVISNULL( &sa->sa_initial ) &&
-		sa->sa_initial.bv_len >= index_substr_if_minlen )
+		sa->sa_initial.bv_len >= if_minlen )
 	{
 		pre = SLAP_INDEX_SUBSTR_INITIAL_PREFIX;
 		value = &sa->sa_initial;
 
-		klen = index_substr_if_maxlen < value->bv_len
-			? index_substr_if_maxlen : value->bv_len;
+		klen = if_maxlen < value->bv_len
+			? if_maxlen : value->bv_len;
 
 		hashPreset( &HASHcontext, prefix, pre, syntax, mr );
 		hashIter( &HASHcontext, HASHdigest,
@@ -1124,39 +1189,18 @@ octetStringSubstringsFilter (
 		/* If initial is too long and we have subany indexed, use it
 		 * to match the excess...
 		 */
-		if (value->bv_len > index_substr_if_maxlen && (flags & SLAP_INDEX_SUBSTR_ANY))
+		if (value->bv_len > if_maxlen && (flags & SLAP_INDEX_SUBSTR_ANY) &&
+			value->bv_len >= any_len )
 		{
 			ber_len_t j;
 			pre = SLAP_INDEX_SUBSTR_PREFIX;
 			hashPreset( &HASHcontext, prefix, pre, syntax, mr);
-			for ( j=index_substr_if_maxlen-1; j <= value->bv_len - index_substr_any_len; j+=index_substr_any_step )
+			for ( j=if_maxlen-1; j <= value->bv_len - any_len; j+=any_step )
 			{
-				hashIter( &HASHcontext, HASHdigest,
-					(unsigned char *)&value->bv_val[j], index_substr_any_len );
-				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
-			}
-		}
-	}
-
-	if( flags & SLAP_INDEX_SUBSTR_ANY && sa->sa_any != NULL ) {
-		ber_len_t i, j;
-		pre = SLAP_INDEX_SUBSTR_PREFIX;
-		klen = index_substr_any_len;
-
-		for( i=0; !BER_BVISNULL( &sa->sa_any[i] ); i++ ) {
-			if( sa->sa_any[i].bv_len < index_substr_any_len ) {
-				continue;
-			}
-
-			value = &sa->sa_any[i];
-
-			hashPreset( &HASHcontext, prefix, pre, syntax, mr);
-			for(j=0;
-				j <= value->bv_len - index_substr_any_len;
-				j += index_substr_any_step )
-			{
-				hashIter( &HASHcontext, HASHdigest,
-					(unsigned char *)&value->bv_val[j], klen ); 
+				/* the position of the excess is known */
+				hashIter( pos ? &HCpos[j % SLAP_INDEX_SUBSTR_POS_BUCKETS] :
+					&HASHcontext, HASHdigest,
+					(unsigned char *)&value->bv_val[j], any_len );
 				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
 			}
 		}
@@ -1164,13 +1208,13 @@ octetStringSubstringsFilter (
 
 	if( flags & SLAP_INDEX_SUBSTR_FINAL &&
 		!BER_BVISNULL( &sa->sa_final ) &&
-		sa->sa_final.bv_len >= index_substr_if_minlen )
+		sa->sa_final.bv_len >= if_minlen )
 	{
 		pre = SLAP_INDEX_SUBSTR_FINAL_PREFIX;
 		value = &sa->sa_final;
 
-		klen = index_substr_if_maxlen < value->bv_len
-			? index_substr_if_maxlen : value->bv_len;
+		klen = if_maxlen < value->bv_len
+			? if_maxlen : value->bv_len;
 
 		hashPreset( &HASHcontext, prefix, pre, syntax, mr );
 		hashIter( &HASHcontext, HASHdigest,
@@ -1180,20 +1224,61 @@ octetStringSubstringsFilter (
 		/* If final is too long and we have subany indexed, use it
 		 * to match the excess...
 		 */
-		if (value->bv_len > index_substr_if_maxlen && (flags & SLAP_INDEX_SUBSTR_ANY))
+		if (value->bv_len > if_maxlen && (flags & SLAP_INDEX_SUBSTR_ANY) && !pos)
 		{
 			ber_len_t j;
 			pre = SLAP_INDEX_SUBSTR_PREFIX;
 			hashPreset( &HASHcontext, prefix, pre, syntax, mr);
-			for ( j=0; j <= value->bv_len - index_substr_if_maxlen; j+=index_substr_any_step )
+			for ( j=0; j <= value->bv_len - if_maxlen &&
+				j + any_len <= value->bv_len; j+=any_step )
+			{
+				hashIter( &HASHcontext, HASHdigest,
+					(unsigned char *)&value->bv_val[j], any_len );
+				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
+			}
+		}
+	}
+
+	if( flags & SLAP_INDEX_SUBSTR_ANY && sa->sa_any != NULL ) {
+		ber_len_t i, j;
+		pre = SLAP_INDEX_SUBSTR_PREFIX;
+		klen = any_len;
+
+		for( i=0; !BER_BVISNULL( &sa->sa_any[i] ); i++ ) {
+			if( sa->sa_any[i].bv_len < any_len ) {
+				continue;
+			}
+
+			value = &sa->sa_any[i];
+
+			if ( pos ) {
+				octetStringSubstringsPosKeys( HCpos, value,
+					any_len, any_step, keys, &nkeys, ctx );
+				continue;
+			}
+
+			hashPreset( &HASHcontext, prefix, pre, syntax, mr);
+			for(j=0;
+				j <= value->bv_len - any_len;
+				j += any_step )
 			{
 				hashIter( &HASHcontext, HASHdigest,
-					(unsigned char *)&value->bv_val[j], index_substr_any_len );
+					(unsigned char *)&value->bv_val[j], klen ); 
 				ber_dupbv_x( &keys[nkeys++], &digest, ctx );
 			}
 		}
 	}
 
+	/* The position of the final excess isn't known either */
+	if( pos && flags & SLAP_INDEX_SUBSTR_FINAL &&
+		!BER_BVISNULL( &sa->sa_final ) &&
+		sa->sa_final.bv_len > if_maxlen &&
+		sa->sa_final.bv_len >= any_len )
+	{
+		octetStringSubstringsPosKeys( HCpos, &sa->sa_final,
+			any_len, any_step, keys, &nkeys, ctx );
+	}
+
 	if( nkeys > 0 ) {
 		BER_BVZERO( &keys[nkeys] );
 		*keysp = keys;
@@ -264,7 +264,11 @@ do_search(
 	}
 
 	op->o_bd = frontendDB;
+	op->o_batch_writes = 1;
 	rs->sr_err = frontendDB->be_search( op, rs );
+	op->o_batch_writes = 0;
+	/* write out any results still queued */
+	slap_send_flush( op );
 	if ( rs->sr_err == SLAPD_ASYNCOP ) {
 		/* skip cleanup */
 		return rs->sr_err;
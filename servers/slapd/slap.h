@@ -141,11 +141,18 @@ LDAP_BEGIN_DECL
 
 #define SLAP_SB_MAX_INCOMING_DEFAULT ((1<<18) - 1)
 #define SLAP_SB_MAX_INCOMING_AUTH ((1<<24) - 1)
+#define SLAP_SB_MAX_READAHEAD (1<<16)
 
 #define SLAP_CONN_MAX_PENDING_DEFAULT	100
 #define SLAP_CONN_MAX_PENDING_AUTH	1000
 #define SLAP_MAX_FILTER_DEPTH_DEFAULT	1000
 
+/* search results are queued and written together up to this many
+ * bytes, or until the oldest queued one has waited this many usecs
+ */
+#define SLAP_WRITEBATCH_DEFAULT	16384
+#define SLAP_WRITEBATCHTIME_DEFAULT	1000
+
 #define SLAP_TEXT_BUFLEN (256)
 
 /* pseudo error code indicating abandoned operation */
@@ -272,6 +279,12 @@ typedef struct slap_ssf_set {
 	| SLAP_INDEX_SUBSTR_INITIAL \
 	| SLAP_INDEX_SUBSTR_ANY \
 	| SLAP_INDEX_SUBSTR_FINAL )
+/* any keys also carry the position of the substring, modulo
+ * SLAP_INDEX_SUBSTR_POS_BUCKETS, so that adjacent keys of an
+ * unanchored assertion can be told apart from scattered ones
+ */
+#define SLAP_INDEX_SUBSTR_POS     ( SLAP_INDEX_SUBSTR_ANY | 0x0800UL )
+#define SLAP_INDEX_SUBSTR_POS_BUCKETS	4
 
 /* defaults for initial/final substring indices */
 #define SLAP_INDEX_SUBSTR_IF_MINLEN_DEFAULT	2
@@ -281,6 +294,16 @@ typedef struct slap_ssf_set {
 #define SLAP_INDEX_SUBSTR_ANY_LEN_DEFAULT		4
 #define SLAP_INDEX_SUBSTR_ANY_STEP_DEFAULT		2
 
+/* per-attribute substring key lengths, 4 bits each, 0 for the global setting */
+#define SLAP_INDEX_SUBSTR_LENS		0xFFFF0000UL
+#define SLAP_INDEX_SUBSTR_IF_MINLEN_SHIFT	16
+#define SLAP_INDEX_SUBSTR_IF_MAXLEN_SHIFT	20
+#define SLAP_INDEX_SUBSTR_ANY_LEN_SHIFT	24
+#define SLAP_INDEX_SUBSTR_ANY_STEP_SHIFT	28
+#define SLAP_INDEX_SUBSTR_LEN_MAX	15
+#define SLAP_INDEX_SUBSTR_LEN(mask, shift) \
+	(((mask) >> (shift)) & SLAP_INDEX_SUBSTR_LEN_MAX)
+
 /* default for ordered integer index keys */
 #define SLAP_INDEX_INTLEN_DEFAULT	4
 
@@ -297,6 +320,7 @@ typedef struct slap_ssf_set {
 #define SLAP_INDEX_SUBSTR_PREFIX	'*'		/* prefix for substring keys    */
 #define SLAP_INDEX_SUBSTR_INITIAL_PREFIX '^'
 #define SLAP_INDEX_SUBSTR_FINAL_PREFIX '$'
+#define SLAP_INDEX_SUBSTR_POS_PREFIX	'0'	/* '0' + position bucket */
 #define SLAP_INDEX_CONT_PREFIX		'.'		/* prefix for continuation keys */
 
 #define SLAP_SYNTAX_MATCHINGRULES_OID	 "1.3.6.1.4.1.1466.115.121.1.30"
@@ -2571,20 +2595,59 @@ typedef enum {
 	SLAP_OP_LAST
 } slap_op_t;
 
+#ifdef HAVE_LONG_LONG
+typedef unsigned long long	slap_counter_t;
+#else
+typedef unsigned long	slap_counter_t;
+#endif
+
+#ifndef SLAP_CACHELINE
+#define SLAP_CACHELINE	64
+#endif
+
+/* Each pool thread owns one set of counters and is the only one bumping
+ * it, so updates need no lock. The sets are only summed up when someone
+ * reads them, see slap_counters_sum(). The global set is also used by
+ * internal operations on any thread, so every update is an atomic add.
+ */
 typedef struct slap_counters_t {
+	/* protected by slap_counters_mutex */
 	struct slap_counters_t	*sc_next;
+	/* only used when the compiler has no atomics */
 	ldap_pvt_thread_mutex_t	sc_mutex;
-	ldap_pvt_mp_t		sc_bytes;
-	ldap_pvt_mp_t		sc_pdu;
-	ldap_pvt_mp_t		sc_entries;
-	ldap_pvt_mp_t		sc_refs;
-
-	ldap_pvt_mp_t		sc_ops_completed;
-	ldap_pvt_mp_t		sc_ops_initiated;
-	ldap_pvt_mp_t		sc_ops_completed_[SLAP_OP_LAST];
-	ldap_pvt_mp_t		sc_ops_initiated_[SLAP_OP_LAST];
+
+	/* keep other threads' sets out of the counters' cache lines */
+	char			sc_pad0[SLAP_CACHELINE];
+
+	slap_counter_t		sc_bytes;
+	slap_counter_t		sc_pdu;
+	slap_counter_t		sc_entries;
+	slap_counter_t		sc_refs;
+	slap_counter_t		sc_writes;
+
+	slap_counter_t		sc_ops_completed;
+	slap_counter_t		sc_ops_initiated;
+	slap_counter_t		sc_ops_completed_[SLAP_OP_LAST];
+	slap_counter_t		sc_ops_initiated_[SLAP_OP_LAST];
+
+	char			sc_pad1[SLAP_CACHELINE];
 } slap_counters_t;
 
+#ifdef __ATOMIC_RELAXED
+#define SLAP_COUNTER_ADD(sc,c,n) \
+	((void)__atomic_fetch_add( &(sc)->c, (n), __ATOMIC_RELAXED ))
+#define SLAP_COUNTER_GET(sc,c) \
+	__atomic_load_n( &(sc)->c, __ATOMIC_RELAXED )
+#else
+#define SLAP_COUNTER_ADD(sc,c,n) \
+	do { \
+		ldap_pvt_thread_mutex_lock( &(sc)->sc_mutex ); \
+		(sc)->c += (n); \
+		ldap_pvt_thread_mutex_unlock( &(sc)->sc_mutex ); \
+	} while (0)
+#define SLAP_COUNTER_GET(sc,c)	((sc)->c)
+#endif
+
 /*
  * represents an operation pending from an ldap client
  */
@@ -2743,6 +2806,7 @@ struct Operation {
 #define get_no_schema_check(op)			((op)->o_no_schema_check)
 	char o_no_subordinate_glue;
 #define get_no_subordinate_glue(op)		((op)->o_no_subordinate_glue)
+	char o_batch_writes;	/* search results may be queued and written together */
 
 #define SLAP_CONTROL_NONE	0
 #define SLAP_CONTROL_IGNORED	1
@@ -2953,6 +3017,11 @@ struct Connection {
 	char		c_sasl_bind_in_progress;	/* multi-op bind in progress */
 	char		c_writewaiter;	/* true if blocked on write */
 
+	BerElement	*c_wbatch;		/* PDUs waiting to be written together */
+	struct timeval	c_wbatch_start;	/* when the first of them was queued */
+	LDAP_TAILQ_ENTRY(Connection) c_wbatch_next;	/* waiting for writebatchtime */
+	char		c_wbatch_queued;	/* on that list, under slap_wbatch_mutex */
+
 
 #define	CONN_IS_TLS	1
 #define	CONN_IS_UDP	2
@@ -3038,6 +3107,11 @@ struct Listener {
 	int	sl_is_proxied;
 	int	sl_mute;	/* Listener is temporarily disabled due to emfile */
 	int	sl_busy;	/* Listener is busy (accept thread activated) */
+	int	sl_shard;	/* SO_REUSEPORT socket index, or -1 */
+	unsigned long	sl_accepts;	/* connections accepted */
+	unsigned long	sl_rate;	/* accepted during the last full second */
+	unsigned long	sl_rate_cnt;	/* accepted during sl_rate_time */
+	time_t	sl_rate_time;
 	ber_socket_t sl_sd;
 	Sockaddr sl_sa;
 #define sl_addr	sl_sa.sa_in_addr
@@ -0,0 +1,838 @@
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1999-2024 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * This tool is a multi-threaded benchmark driver.  Each thread owns
+ * its own connection and replays a weighted mix of searches, base
+ * reads, simple binds and modifies for a fixed amount of time, either
+ * as fast as the server answers or at a fixed aggregate rate.  Latencies
+ * are kept in log-linear histograms (HDR-style, < 1% relative error)
+ * and summarized per operation type, optionally as JSON so that runs
+ * of different builds against the same data can be compared.
+ *
+ * Filters and DNs may contain a "[lo-hi]" range, as with slapd-mtread,
+ * which is replaced by a random integer in that range for each request.
+ *
+ * With -q the aggregate rate is split evenly between the threads.  By
+ * default a thread that falls behind simply continues from "now", and
+ * latency is measured from when each request was sent.  With -o the
+ * schedule is kept (open loop) and latency is measured from when each
+ * request was due, so that time spent waiting behind a slow response
+ * is charged to the requests that were delayed by it.
+ */
+
+#include "portable.h"
+
+/* Requires libldap with threads */
+#ifndef NO_THREADS
+
+#include <stdio.h>
+#include "ldap_pvt_thread.h"
+
+#include "ac/stdlib.h"
+
+#include "ac/ctype.h"
+#include "ac/param.h"
+#include "ac/socket.h"
+#include "ac/string.h"
+#include "ac/time.h"
+#include "ac/unistd.h"
+
+#include "ldap.h"
+#include "lutil.h"
+
+#include "ldap_pvt.h"
+
+#include "slapd-common.h"
+
+#define MAX_THREAD	1024
+#define DEFAULT_BASE	"ou=people,dc=example,dc=com"
+#define DEFAULT_ATTR	"description"
+#define DEFAULT_SECS	10
+
+enum {
+	BENCH_SEARCH = 0,
+	BENCH_READ,
+	BENCH_BIND,
+	BENCH_MODIFY,
+	BENCH_LAST
+};
+
+static const char *bench_ops[] = {
+	"search", "read", "bind", "modify", NULL
+};
+
+/*
+ * Log-linear histogram of latencies in nanoseconds.  Values below
+ * HIST_SUB_COUNT are counted exactly; above that each power of two
+ * is split into HIST_HALF equal buckets, bounding the relative error
+ * to 1/HIST_HALF.  The last bucket absorbs everything beyond ~36 minutes.
+ */
+#define HIST_SUB_BITS	7
+#define HIST_SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HIST_HALF	(HIST_SUB_COUNT >> 1)
+#define HIST_MAX_SHIFT	35
+#define HIST_BUCKETS	(HIST_SUB_COUNT + HIST_MAX_SHIFT * HIST_HALF)
+
+typedef unsigned long long bench_ns;
+
+typedef struct bench_hist {
+	bench_ns	bh_count;
+	bench_ns	bh_errors;
+	bench_ns	bh_sum;
+	bench_ns	bh_min;
+	bench_ns	bh_max;
+	bench_ns	bh_buckets[HIST_BUCKETS];
+} bench_hist;
+
+typedef struct bench_thread {
+	ldap_pvt_thread_t	bt_tid;
+	int		bt_idx;
+	LDAP		*bt_ld;
+	LDAP		*bt_bindld;
+	bench_ns	bt_rng;
+	int		bt_fatal;
+	bench_hist	bt_hist[BENCH_LAST];
+} bench_thread;
+
+static void *
+do_onethread( void *arg );
+
+/*
+ * Shared globals (command line args)
+ */
+struct tester_conn_args	*config;
+char		*base = DEFAULT_BASE;
+char		*filter = NULL;
+char		*entry = NULL;
+char		*binddn = NULL;
+char		*modattr = DEFAULT_ATTR;
+struct berval	bindpw = BER_BVNULL;
+char		**attrs = NULL;
+int		weights[BENCH_LAST];
+int		wtotal;
+int		threads = 1;
+int		seconds = DEFAULT_SECS;
+int		warmup = 0;
+int		rate = 0;
+int		openloop = 0;
+int		force = 0;
+int		verbose = 0;
+unsigned long	seed;
+
+bench_ns	bench_start, bench_measure, bench_end;
+bench_ns	bench_interval;
+
+bench_thread	**bts;
+
+static bench_ns
+bench_now( void )
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec	ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (bench_ns)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	struct timeval	tv;
+
+	gettimeofday( &tv, NULL );
+	return (bench_ns)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+static void
+bench_sleep( bench_ns ns )
+{
+	struct timeval	tv;
+
+	tv.tv_sec = ns / 1000000000ULL;
+	tv.tv_usec = ( ns % 1000000000ULL ) / 1000;
+	select( 0, NULL, NULL, NULL, &tv );
+}
+
+/* xorshift64*, one generator per thread */
+static unsigned long
+bench_rand( bench_thread *bt )
+{
+	bench_ns	x = bt->bt_rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	bt->bt_rng = x;
+	return (unsigned long)(( x * 2685821657736338717ULL ) >> 33 );
+}
+
+static int
+hist_index( bench_ns v )
+{
+	int		shift = 0;
+
+	if ( v < HIST_SUB_COUNT )
+		return (int)v;
+	while ( ( v >> shift ) >= HIST_SUB_COUNT )
+		shift++;
+	if ( shift > HIST_MAX_SHIFT )
+		return HIST_BUCKETS - 1;
+	return HIST_SUB_COUNT + ( shift - 1 ) * HIST_HALF +
+		(int)( v >> shift ) - HIST_HALF;
+}
+
+/* highest value that maps to the given bucket */
+static bench_ns
+hist_value( int idx )
+{
+	int		shift, sub;
+
+	if ( idx < HIST_SUB_COUNT )
+		return idx;
+	shift = ( idx - HIST_SUB_COUNT ) / HIST_HALF + 1;
+	sub = ( idx - HIST_SUB_COUNT ) % HIST_HALF + HIST_HALF;
+	return ( (bench_ns)( sub + 1 ) << shift ) - 1;
+}
+
+static void
+hist_record( bench_hist *bh, bench_ns v )
+{
+	if ( bh->bh_count == 0 || v < bh->bh_min )
+		bh->bh_min = v;
+	if ( v > bh->bh_max )
+		bh->bh_max = v;
+	bh->bh_count++;
+	bh->bh_sum += v;
+	bh->bh_buckets[ hist_index( v ) ]++;
+}
+
+static void
+hist_merge( bench_hist *dst, bench_hist *src )
+{
+	int		i;
+
+	if ( src->bh_count ) {
+		if ( dst->bh_count == 0 || src->bh_min < dst->bh_min )
+			dst->bh_min = src->bh_min;
+		if ( src->bh_max > dst->bh_max )
+			dst->bh_max = src->bh_max;
+		for ( i = 0; i < HIST_BUCKETS; i++ )
+			dst->bh_buckets[i] += src->bh_buckets[i];
+	}
+	dst->bh_count += src->bh_count;
+	dst->bh_errors += src->bh_errors;
+	dst->bh_sum += src->bh_sum;
+}
+
+static bench_ns
+hist_percentile( bench_hist *bh, double pct )
+{
+	bench_ns	want, seen = 0, v;
+	int		i;
+
+	if ( bh->bh_count == 0 )
+		return 0;
+	want = (bench_ns)( pct / 100.0 * bh->bh_count + 0.5 );
+	if ( want < 1 )
+		want = 1;
+	for ( i = 0; i < HIST_BUCKETS; i++ ) {
+		seen += bh->bh_buckets[i];
+		if ( seen >= want ) {
+			v = hist_value( i );
+			return v < bh->bh_max ? v : bh->bh_max;
+		}
+	}
+	return bh->bh_max;
+}
+
+/*
+ * Expand the first "[lo-hi]" in tmpl with a random value in range.
+ */
+static char *
+bench_expand( bench_thread *bt, const char *tmpl, char *buf, size_t len )
+{
+	const char	*ptr, *tail;
+	int		lo, hi;
+
+	ptr = strchr( tmpl, '[' );
+	if ( ptr == NULL || ( tail = strchr( ptr, ']' ) ) == NULL ||
+		sscanf( ptr, "[%d-%d]", &lo, &hi ) != 2 || hi < lo )
+	{
+		return (char *)tmpl;
+	}
+
+	snprintf( buf, len, "%.*s%lu%s", (int)( ptr - tmpl ), tmpl,
+		lo + bench_rand( bt ) % (unsigned long)( hi - lo + 1 ), tail + 1 );
+	return buf;
+}
+
+static int
+parse_mix( char *mix )
+{
+	char		**list;
+	int		i, j, rc = -1;
+
+	list = ldap_str2charray( mix, "," );
+	if ( list == NULL )
+		return -1;
+
+	memset( weights, 0, sizeof( weights ) );
+	wtotal = 0;
+	for ( i = 0; list[i] != NULL; i++ ) {
+		char	*val = strchr( list[i], '=' );
+		int	w = 1;
+
+		if ( val != NULL ) {
+			*val++ = '\0';
+			if ( lutil_atoi( &w, val ) != 0 || w < 0 )
+				goto done;
+		}
+		for ( j = 0; bench_ops[j] != NULL; j++ ) {
+			if ( strcasecmp( list[i], bench_ops[j] ) == 0 )
+				break;
+		}
+		if ( bench_ops[j] == NULL )
+			goto done;
+		weights[j] += w;
+		wtotal += w;
+	}
+	if ( wtotal > 0 )
+		rc = 0;
+
+done:;
+	ldap_charray_free( list );
+	return rc;
+}
+
+static void
+usage( char *name, char opt )
+{
+	if ( opt ) {
+		fprintf( stderr, "%s: unable to handle option \'%c\'\n\n",
+			name, opt );
+	}
+
+	fprintf( stderr, "usage: %s " TESTER_COMMON_HELP
+		"[-F] "
+		"[-v] "
+		"[-a <modify attr>] "
+		"[-B <bind dn>] "
+		"[-b <searchbase>] "
+		"[-e <entry>] "
+		"[-f <filter>] "
+		"[-J <json file>] "
+		"[-M search=<n>,read=<n>,bind=<n>,modify=<n>] "
+		"[-m threads] "
+		"[-o] "
+		"[-p <bind passwd>] "
+		"[-q <ops/sec>] "
+		"[-s <seed>] "
+		"[-T <seconds>] "
+		"[-W <warmup seconds>] "
+		"[<attrs>] "
+		"\n",
+		name );
+	exit( EXIT_FAILURE );
+}
+
+static void
+json_string( FILE *fp, const char *s )
+{
+	putc( '"', fp );
+	for ( ; s && *s; s++ ) {
+		unsigned char	c = *s;
+
+		if ( c == '"' || c == '\\' ) {
+			fprintf( fp, "\\%c", c );
+		} else if ( c < 0x20 ) {
+			fprintf( fp, "\\u%04x", c );
+		} else {
+			putc( c, fp );
+		}
+	}
+	putc( '"', fp );
+}
+
+static const double bench_pcts[] = { 50.0, 90.0, 99.0, 99.9 };
+static const char *bench_pctnames[] = { "p50", "p90", "p99", "p999" };
+#define BENCH_NPCTS	( sizeof( bench_pcts ) / sizeof( bench_pcts[0] ) )
+
+static void
+print_hist( FILE *fp, const char *name, bench_hist *bh, double secs )
+{
+	int		i;
+
+	fprintf( fp, "%-8s %10llu %7llu %10.1f %9.1f",
+		name, bh->bh_count, bh->bh_errors,
+		secs > 0 ? bh->bh_count / secs : 0.0,
+		bh->bh_count ? bh->bh_sum / 1000.0 / bh->bh_count : 0.0 );
+	for ( i = 0; i < BENCH_NPCTS; i++ )
+		fprintf( fp, " %9.1f", hist_percentile( bh, bench_pcts[i] ) / 1000.0 );
+	fprintf( fp, " %9.1f\n", bh->bh_max / 1000.0 );
+}
+
+static void
+json_hist( FILE *fp, const char *name, bench_hist *bh, double secs )
+{
+	int		i;
+
+	fprintf( fp, "    " );
+	json_string( fp, name );
+	fprintf( fp, ": {\"count\": %llu, \"errors\": %llu, "
+		"\"ops_per_sec\": %.1f, \"latency_us\": {",
+		bh->bh_count, bh->bh_errors,
+		secs > 0 ? bh->bh_count / secs : 0.0 );
+	fprintf( fp, "\"min\": %.1f, \"mean\": %.1f",
+		bh->bh_min / 1000.0,
+		bh->bh_count ? bh->bh_sum / 1000.0 / bh->bh_count : 0.0 );
+	for ( i = 0; i < BENCH_NPCTS; i++ )
+		fprintf( fp, ", \"%s\": %.1f", bench_pctnames[i],
+			hist_percentile( bh, bench_pcts[i] ) / 1000.0 );
+	fprintf( fp, ", \"max\": %.1f}}", bh->bh_max / 1000.0 );
+}
+
+static int
+write_json( const char *fname, bench_hist *ops, bench_hist *total, double secs )
+{
+	FILE		*fp;
+	int		i, first = 1;
+
+	if ( strcmp( fname, "-" ) == 0 ) {
+		fp = stdout;
+	} else if ( ( fp = fopen( fname, "w" ) ) == NULL ) {
+		tester_perror( "fopen", fname );
+		return -1;
+	}
+
+	fprintf( fp, "{\n  \"tool\": \"slapd-bench\",\n  \"uri\": " );
+	json_string( fp, config->uri );
+	fprintf( fp, ",\n  \"threads\": %d,\n  \"seconds\": %.3f,\n"
+		"  \"warmup\": %d,\n  \"rate\": %d,\n  \"open_loop\": %s,\n"
+		"  \"seed\": %lu,\n  \"mix\": {",
+		threads, secs, warmup, rate, openloop ? "true" : "false", seed );
+	for ( i = 0; i < BENCH_LAST; i++ ) {
+		if ( !weights[i] )
+			continue;
+		fprintf( fp, "%s\"%s\": %d", first ? "" : ", ",
+			bench_ops[i], weights[i] );
+		first = 0;
+	}
+	fprintf( fp, "},\n  \"ops\": {\n" );
+	first = 1;
+	for ( i = 0; i < BENCH_LAST; i++ ) {
+		if ( !weights[i] )
+			continue;
+		if ( !first )
+			fprintf( fp, ",\n" );
+		json_hist( fp, bench_ops[i], &ops[i], secs );
+		first = 0;
+	}
+	fprintf( fp, "\n  },\n  \"total\": {\n" );
+	json_hist( fp, "all", total, secs );
+	fprintf( fp, "\n  }\n}\n" );
+
+	if ( fp != stdout )
+		fclose( fp );
+	else
+		fflush( fp );
+	return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+	int		i, j;
+	char		*mix = NULL;
+	char		*json = NULL;
+	char		outstr[BUFSIZ];
+	bench_hist	*ops, *total;
+	FILE		*out;
+	double		secs;
+	int		testfail = 0;
+
+	config = tester_init( "slapd-bench", TESTER_TESTER );
+
+	/* by default, tolerate referrals and no such object */
+	tester_ignore_str2errlist( "REFERRAL,NO_SUCH_OBJECT" );
+
+	seed = (unsigned long)getpid();
+
+	while ( (i = getopt( argc, argv, TESTER_COMMON_OPTS "a:B:b:e:Ff:J:M:m:op:q:s:T:vW:" )) != EOF ) {
+		switch ( i ) {
+		case 'a':		/* attribute replaced by modify */
+			modattr = optarg;
+			break;
+
+		case 'B':		/* DN (template) to bind as */
+			binddn = optarg;
+			break;
+
+		case 'b':		/* base DN of searches */
+			base = optarg;
+			break;
+
+		case 'e':		/* DN (template) to read/bind/modify */
+			entry = optarg;
+			break;
+
+		case 'F':
+			force++;
+			break;
+
+		case 'f':		/* the search filter (template) */
+			filter = optarg;
+			break;
+
+		case 'J':		/* JSON summary, "-" for stdout */
+			json = optarg;
+			break;
+
+		case 'M':		/* operation mix */
+			mix = optarg;
+			break;
+
+		case 'm':		/* the number of threads */
+			if ( lutil_atoi( &threads, optarg ) != 0 || threads < 1 ) {
+				usage( argv[0], i );
+			}
+			if ( threads > MAX_THREAD )
+				threads = MAX_THREAD;
+			break;
+
+		case 'o':
+			openloop++;
+			break;
+
+		case 'p':		/* password of bind operations */
+			ber_str2bv( optarg, 0, 1, &bindpw );
+			memset( optarg, '*', bindpw.bv_len );
+			break;
+
+		case 'q':		/* aggregate rate, ops/sec */
+			if ( lutil_atoi( &rate, optarg ) != 0 || rate < 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 's':
+			if ( lutil_atoul( &seed, optarg ) != 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'T':		/* measured duration */
+			if ( lutil_atoi( &seconds, optarg ) != 0 || seconds < 1 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		case 'v':
+			verbose++;
+			break;
+
+		case 'W':		/* unmeasured warmup */
+			if ( lutil_atoi( &warmup, optarg ) != 0 || warmup < 0 ) {
+				usage( argv[0], i );
+			}
+			break;
+
+		default:
+			if ( tester_config_opt( config, i, optarg ) == LDAP_SUCCESS ) {
+				break;
+			}
+			usage( argv[0], i );
+			break;
+		}
+	}
+
+	if ( mix != NULL ) {
+		if ( parse_mix( mix ) != 0 ) {
+			fprintf( stderr, "%s: invalid operation mix \"%s\".\n",
+				argv[0], mix );
+			exit( EXIT_FAILURE );
+		}
+	} else {
+		weights[ filter ? BENCH_SEARCH : BENCH_READ ] = wtotal = 1;
+	}
+
+	if ( weights[BENCH_SEARCH] && filter == NULL ) {
+		fprintf( stderr, "%s: searches require a filter (-f).\n",
+			argv[0] );
+		exit( EXIT_FAILURE );
+	}
+
+	if ( weights[BENCH_BIND] && binddn == NULL ) {
+		binddn = entry;
+	}
+
+	if ( ( weights[BENCH_READ] || weights[BENCH_MODIFY] ||
+		( weights[BENCH_BIND] && binddn == NULL ) ) &&
+		( entry == NULL || *entry == '\0' ) )
+	{
+		fprintf( stderr, "%s: reads, binds and modifies require "
+			"an entry DN (-e).\n", argv[0] );
+		exit( EXIT_FAILURE );
+	}
+
+	if ( argv[optind] != NULL ) {
+		attrs = &argv[optind];
+	}
+
+	tester_config_finish( config );
+	ldap_pvt_thread_initialize();
+
+	if ( weights[BENCH_BIND] && BER_BVISNULL( &bindpw ) ) {
+		bindpw = config->pass;
+	}
+
+	bts = (bench_thread **) calloc( sizeof(bench_thread *), threads );
+	if ( bts == NULL ) {
+		fprintf( stderr, "%s: Memory error: calloc threads.\n",
+			argv[0] );
+		exit( EXIT_FAILURE );
+	}
+
+	for ( i = 0; i < threads; i++ ) {
+		bts[i] = (bench_thread *) calloc( 1, sizeof(bench_thread) );
+		if ( bts[i] == NULL ) {
+			fprintf( stderr, "%s: Memory error: calloc thread.\n",
+				argv[0] );
+			exit( EXIT_FAILURE );
+		}
+		bts[i]->bt_idx = i;
+		bts[i]->bt_rng = ( (bench_ns)seed << 16 ) ^ ( i + 1 ) *
+			0x9E3779B97F4A7C15ULL;
+		if ( bts[i]->bt_rng == 0 )
+			bts[i]->bt_rng = 1;
+		tester_init_ld( &bts[i]->bt_ld, config, 0 );
+		if ( weights[BENCH_BIND] )
+			tester_init_ld( &bts[i]->bt_bindld, config, TESTER_INIT_ONLY );
+	}
+
+	if ( rate > 0 ) {
+		bench_interval = 1000000000ULL * threads / rate;
+		if ( bench_interval == 0 )
+			bench_interval = 1;
+	}
+
+	snprintf( outstr, BUFSIZ, "Bench Start: threads: %d seconds: %d "
+		"warmup: %d rate: %d%s (%s)", threads, seconds, warmup, rate,
+		openloop ? " open loop" : "", config->uri );
+	tester_error( outstr );
+
+	bench_start = bench_now();
+	bench_measure = bench_start + warmup * 1000000000ULL;
+	bench_end = bench_measure + seconds * 1000000000ULL;
+
+	for ( i = 0; i < threads; i++ ) {
+		ldap_pvt_thread_create( &bts[i]->bt_tid, 0, do_onethread, bts[i] );
+	}
+
+	for ( i = 0; i < threads; i++ ) {
+		ldap_pvt_thread_join( bts[i]->bt_tid, NULL );
+	}
+
+	secs = ( bench_now() - bench_measure ) / 1e9;
+	if ( secs <= 0 )
+		secs = seconds;
+
+	ops = (bench_hist *) calloc( BENCH_LAST + 1, sizeof(bench_hist) );
+	if ( ops == NULL ) {
+		fprintf( stderr, "%s: Memory error: calloc histograms.\n",
+			argv[0] );
+		exit( EXIT_FAILURE );
+	}
+	total = &ops[BENCH_LAST];
+
+	for ( i = 0; i < threads; i++ ) {
+		for ( j = 0; j < BENCH_LAST; j++ ) {
+			hist_merge( &ops[j], &bts[i]->bt_hist[j] );
+			hist_merge( total, &bts[i]->bt_hist[j] );
+		}
+		if ( bts[i]->bt_fatal ) {
+			snprintf( outstr, BUFSIZ, "FAIL thread %d", i );
+			tester_error( outstr );
+			testfail++;
+		}
+		if ( bts[i]->bt_ld != NULL )
+			ldap_unbind_ext( bts[i]->bt_ld, NULL, NULL );
+		if ( bts[i]->bt_bindld != NULL )
+			ldap_unbind_ext( bts[i]->bt_bindld, NULL, NULL );
+		free( bts[i] );
+	}
+	free( bts );
+
+	/* keep stdout clean when the JSON summary goes there */
+	out = ( json != NULL && strcmp( json, "-" ) == 0 ) ? stderr : stdout;
+	fprintf( out, "%-8s %10s %7s %10s %9s %9s %9s %9s %9s %9s\n",
+		"op", "count", "errors", "ops/sec", "mean(us)",
+		"p50", "p90", "p99", "p99.9", "max" );
+	for ( j = 0; j < BENCH_LAST; j++ ) {
+		if ( weights[j] )
+			print_hist( out, bench_ops[j], &ops[j], secs );
+	}
+	print_hist( out, "all", total, secs );
+	fflush( out );
+
+	if ( json != NULL && write_json( json, ops, total, secs ) != 0 )
+		testfail++;
+
+	free( ops );
+
+	snprintf( outstr, BUFSIZ, "Bench complete" );
+	tester_error( outstr );
+
+	if ( testfail )
+		exit( EXIT_FAILURE );
+	exit( EXIT_SUCCESS );
+}
+
+static int
+bench_op( bench_thread *bt, int op, unsigned long n )
+{
+	char		buf[BUFSIZ], val[64];
+	char		*dn, *vals[2];
+	LDAPMod		mod, *mods[2];
+	LDAPMessage	*res = NULL;
+	int		rc = LDAP_OTHER;
+
+	switch ( op ) {
+	case BENCH_SEARCH:
+		rc = ldap_search_ext_s( bt->bt_ld, base, LDAP_SCOPE_SUBTREE,
+			bench_expand( bt, filter, buf, sizeof( buf ) ),
+			attrs, 0, NULL, NULL, NULL, LDAP_NO_LIMIT, &res );
+		break;
+
+	case BENCH_READ:
+		rc = ldap_search_ext_s( bt->bt_ld,
+			bench_expand( bt, entry, buf, sizeof( buf ) ),
+			LDAP_SCOPE_BASE, NULL, attrs, 0, NULL, NULL, NULL,
+			LDAP_NO_LIMIT, &res );
+		break;
+
+	case BENCH_BIND:
+		rc = ldap_sasl_bind_s( bt->bt_bindld,
+			bench_expand( bt, binddn, buf, sizeof( buf ) ),
+			LDAP_SASL_SIMPLE, &bindpw, NULL, NULL, NULL );
+		break;
+
+	case BENCH_MODIFY:
+		dn = bench_expand( bt, entry, buf, sizeof( buf ) );
+		snprintf( val, sizeof( val ), "slapd-bench %d %lu",
+			bt->bt_idx, n );
+		vals[0] = val;
+		vals[1] = NULL;
+		mod.mod_op = LDAP_MOD_REPLACE;
+		mod.mod_type = modattr;
+		mod.mod_values = vals;
+		mods[0] = &mod;
+		mods[1] = NULL;
+		rc = ldap_modify_ext_s( bt->bt_ld, dn, mods, NULL, NULL );
+		break;
+	}
+
+	if ( res != NULL )
+		ldap_msgfree( res );
+	return rc;
+}
+
+static void *
+do_onethread( void *arg )
+{
+	bench_thread	*bt = arg;
+	bench_ns	next, sched, begin, done;
+	unsigned long	n;
+	char		thrstr[BUFSIZ];
+	int		op, rc, w;
+
+	/* spread the first request of each thread over one interval */
+	next = bench_start + bench_interval * bt->bt_idx / threads;
+
+	for ( n = 0; !bt->bt_fatal; n++ ) {
+		begin = bench_now();
+		if ( bench_interval ) {
+			if ( begin < next ) {
+				bench_sleep( next - begin );
+				begin = bench_now();
+			} else if ( !openloop ) {
+				next = begin;
+			}
+			sched = next;
+			next += bench_interval;
+		} else {
+			sched = begin;
+		}
+		if ( sched >= bench_end )
+			break;
+
+		w = bench_rand( bt ) % wtotal;
+		for ( op = 0; w >= weights[op]; op++ )
+			w -= weights[op];
+
+		rc = bench_op( bt, op, n );
+		done = bench_now();
+
+		if ( sched >= bench_measure ) {
+			if ( rc == LDAP_SUCCESS )
+				hist_record( &bt->bt_hist[op],
+					done - ( openloop ? sched : begin ) );
+			else
+				bt->bt_hist[op].bh_errors++;
+		}
+
+		if ( rc != LDAP_SUCCESS ) {
+			int	first = tester_ignore_err( rc );
+
+			snprintf( thrstr, BUFSIZ, "tidx: %d %s", bt->bt_idx,
+				bench_ops[op] );
+			if ( first ) {
+				/* only log if first occurrence */
+				if ( ( force < 2 && first > 0 ) || abs( first ) == 1 ) {
+					tester_ldap_error( op == BENCH_BIND ?
+						bt->bt_bindld : bt->bt_ld, thrstr, NULL );
+				}
+				continue;
+			}
+
+			tester_ldap_error( op == BENCH_BIND ?
+				bt->bt_bindld : bt->bt_ld, thrstr, NULL );
+			if ( rc == LDAP_SERVER_DOWN || !force )
+				bt->bt_fatal = 1;
+		} else if ( verbose > 1 ) {
+			snprintf( thrstr, BUFSIZ, "tidx: %d %s #%lu done",
+				bt->bt_idx, bench_ops[op], n );
+			tester_error( thrstr );
+		}
+	}
+
+	if ( verbose ) {
+		snprintf( thrstr, BUFSIZ, "tidx: %d done after %lu requests",
+			bt->bt_idx, n );
+		tester_error( thrstr );
+	}
+	return( NULL );
+}
+
+#else /* NO_THREADS */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main( int argc, char **argv )
+{
+	fprintf( stderr, "%s: not available when configured --without-threads\n", argv[0] );
+	exit( EXIT_FAILURE );
+}
+
+#endif /* NO_THREADS */
@@ -188,6 +188,7 @@ LLOADDANONCONF=$DATADIR/lloadd-anon.conf
 LLOADDUNREACHABLECONF=$DATADIR/lloadd-backend-issues.conf
 LLOADDTLSCONF=$DATADIR/lloadd-tls.conf
 LLOADDSASLCONF=$DATADIR/lloadd-sasl.conf
+LLOADDCACHECONF=$DATADIR/lloadd-cache.conf
 
 # generated files
 CONF1=$TESTDIR/slapd.1.conf
@@ -269,6 +270,7 @@ LDAPEXOP="$CLIENTDIR/ldapexop $TOOLARGS"
 SLAPDTESTER=$PROGDIR/slapd-tester
 LDIFFILTER=$PROGDIR/ldif-filter
 SLAPDMTREAD=$PROGDIR/slapd-mtread
+SLAPDBENCH=$PROGDIR/slapd-bench
 LVL=${SLAPD_DEBUG-0x4105}
 LOCALHOST=localhost
 LOCALIP=127.0.0.1